@@ -3,6 +3,10 @@
 #include "src/Utils.h"
 #include "src/Stack.tcc"
 #include "src/TCPClient.h"
+#include "src/TraceRecorder.h"
+#ifdef __linux__
+#include "src/TCPServer.h"
+#endif
 #include <math.h>
 #include <iostream>
 #include <list>
@@ -56,9 +60,41 @@ int main(int, char**) {
 	Test("Matrix transpose", tMatrix, "0 1 2");
 
 	printf("%s\n", TCPClient::ResolveIP("127.0.0.1").c_str());
-	TCPClient client = TCPClient("127.0.0.1", 1337, true);
+#ifdef __linux__
+	TCPServer::Options echoOptions;
+	echoOptions.threads = 1;
+	TCPServer::Handlers echoHandlers;
+	echoHandlers.onMessage = [](FramedConnection& connection, string&& payload) { connection.Send(payload); };
+	TCPServer echo(echoOptions, echoHandlers);
+	echo.Start();
+#endif
+	TCPClient client = TCPClient("127.0.0.1", 1337, TCPClient::RetryPolicy::THROW);
 	client.SendData("Welcome to the club, buddy!");
-	std::cout << client.ReceiveData() << endl;
+	Test("TCPServer echo", client.ReceiveData(), "Welcome to the club, buddy!");
+	string large(3 * 1024 * 1024, 'x');
+	client.SendData(large);
+	Test("TCPServer echo, 3 MiB", client.ReceiveData() == large ? "equal" : "differs", "equal");
+
+	printf("Trace tests\n");
+	{
+		TraceRecorder recorder("test.mrtr", true, 4);
+		client.SetRecorder(&recorder);
+		client.SendData(string("\x05{}", 3));
+		client.ReceiveData();
+		client.SendData(large);
+		client.ReceiveData();
+		client.SetRecorder(nullptr);
+		Test("Trace records", to_string(recorder.GetRecordCount()), "4");
+	}
+	TraceReader reader;
+	Trace::Record record;
+	string records;
+	bool opened = reader.Open("test.mrtr");
+	while (opened && reader.Next(record))
+		records += to_string(record.direction) + ":" + to_string(record.action) + ":" + to_string(record.size) + ":" + to_string(record.payload.size()) + " ";
+	Test("Trace read back", records, "0:5:3:3 1:255:3:3 0:120:3145728:4 1:255:3145728:4 ");
+	Test("Trace payload", record.payload, "xxxx");
+	remove("test.mrtr");
 
 	printf("%sTests completed\u001b[0m. %i of %i passed.\n", passed == total ? "\u001b[32m" : "\u001b[33m", passed, total);
 
@@ -0,0 +1,121 @@
+#include "DatagramChannel.h"
+#include <cstring>
+#include <openssl/evp.h>
+using namespace std;
+
+#ifdef _WIN32
+void WSInit(); // TCPClient.cpp
+#else
+#include <arpa/inet.h>
+#endif
+
+#ifndef INVALID_SOCKET
+#define INVALID_SOCKET -1
+#endif
+
+static constexpr size_t NONCE_SIZE = 12;
+
+static void PutLE(unsigned char* out, uint64_t value, size_t size) {
+  for (size_t i = 0; i < size; i++)
+    out[i] = (unsigned char)(value >> (8 * i));
+}
+
+DatagramChannel::DatagramChannel(const std::string& host, uint16_t port, const unsigned char* keyingMaterial, uint8_t groupSize)
+    : _groupSize(groupSize) {
+  memcpy(_key, keyingMaterial, key_size);
+  memcpy(_sessionId, keyingMaterial + key_size, session_id_size);
+  _packet.resize(header_size + fragment_size + tag_size);
+#ifdef _WIN32
+  WSInit();
+#endif
+  _socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  _address.sin_family = AF_INET;
+  _address.sin_port = htons(port);
+  if (inet_pton(AF_INET, TCPClient::ResolveIP(host).c_str(), &_address.sin_addr) != 1) {
+#ifdef _WIN32
+    closesocket(_socket);
+#else
+    close(_socket);
+#endif
+    _socket = INVALID_SOCKET;
+  }
+  _cipher = EVP_CIPHER_CTX_new();
+}
+DatagramChannel::~DatagramChannel() {
+  if (_socket != INVALID_SOCKET)
+#ifdef _WIN32
+    closesocket(_socket);
+#else
+    close(_socket);
+#endif
+  EVP_CIPHER_CTX_free(_cipher);
+  OPENSSL_cleanse(_key, key_size);
+}
+
+DatagramChannel* DatagramChannel::FromTLS(const TCPClient& tls, uint16_t port, uint8_t groupSize) {
+  unsigned char material[key_size + session_id_size];
+  if (!tls.ExportKeyingMaterial(material, sizeof(material), exporter_label))
+    return nullptr;
+  auto channel = new DatagramChannel(tls.GetHost(), port, material, groupSize);
+  OPENSSL_cleanse(material, sizeof(material));
+  if (!channel->IsOpen()) {
+    delete channel;
+    return nullptr;
+  }
+  return channel;
+}
+
+bool DatagramChannel::IsOpen() const { return _socket != INVALID_SOCKET && _cipher; }
+
+bool DatagramChannel::SendFragment(uint16_t index, uint16_t count, uint32_t frameSize, const unsigned char* fragment) {
+  unsigned char* header = _packet.data();
+  memcpy(header, _sessionId, session_id_size);
+  PutLE(header + 8, _frameSeq, 4);
+  PutLE(header + 12, index, 2);
+  PutLE(header + 14, count, 2);
+  header[16] = _groupSize;
+  PutLE(header + 17, frameSize, 4);
+
+  // (frameSeq, fragIndex) never repeats under one key: the key lives as long as the TLS session
+  unsigned char nonce[NONCE_SIZE] = {};
+  memcpy(nonce, header + 8, 6);
+
+  int len = 0;
+  unsigned char* body = header + header_size;
+  if (EVP_EncryptInit_ex(_cipher, EVP_aes_256_gcm(), nullptr, _key, nonce) != 1 ||
+      EVP_EncryptUpdate(_cipher, nullptr, &len, header, (int)header_size) != 1 ||
+      EVP_EncryptUpdate(_cipher, body, &len, fragment, (int)fragment_size) != 1 || EVP_EncryptFinal_ex(_cipher, body + len, &len) != 1 ||
+      EVP_CIPHER_CTX_ctrl(_cipher, EVP_CTRL_GCM_GET_TAG, (int)tag_size, body + fragment_size) != 1)
+    return false;
+  return sendto(_socket, (const char*)_packet.data(), (int)_packet.size(), 0, (const sockaddr*)&_address, sizeof(_address)) == (int)_packet.size();
+}
+
+bool DatagramChannel::SendFrame(const char* data, size_t size) {
+  if (!IsOpen())
+    return false;
+  size_t count = (size + fragment_size - 1) / fragment_size;
+  if (!count || count > UINT16_MAX / 2 || size > UINT32_MAX)
+    return false;
+
+  bool result = true;
+  unsigned char fragment[fragment_size];
+  unsigned char parity[fragment_size] = {};
+  for (size_t i = 0; i < count; i++) {
+    size_t piece = std::min(fragment_size, size - i * fragment_size);
+    memcpy(fragment, data + i * fragment_size, piece);
+    memset(fragment + piece, 0, fragment_size - piece);
+    result &= SendFragment((uint16_t)i, (uint16_t)count, (uint32_t)size, fragment);
+
+    if (!_groupSize)
+      continue;
+    for (size_t b = 0; b < fragment_size; b++)
+      parity[b] ^= fragment[b];
+    // parity of group g goes out as fragment count + g, right after its last member
+    if ((i + 1) % _groupSize == 0 || i + 1 == count) {
+      result &= SendFragment((uint16_t)(count + i / _groupSize), (uint16_t)count, (uint32_t)size, parity);
+      memset(parity, 0, fragment_size);
+    }
+  }
+  _frameSeq++;
+  return result;
+}
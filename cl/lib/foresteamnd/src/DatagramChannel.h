@@ -0,0 +1,48 @@
+#pragma once
+#include "TCPClient.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// @brief One-way, loss-tolerant datagram channel for large, latency-sensitive messages (screencast frames). Each frame is split into
+/// fragments, every `groupSize` fragments get an XOR parity fragment (recovers one loss per group), and every packet is sealed with
+/// AES-256-GCM. Key and session id come from the TLS session of the control connection (RFC 5705 exporter), so nothing extra has to
+/// be negotiated and the receiver can tell which agent a datagram belongs to.
+///
+/// Packet: [sessionId 8][frameSeq u32][fragIndex u16][fragCount u16][groupSize u8][frameSize u32] (all LE, authenticated as AAD)
+///         [ciphertext fragment_size][GCM tag 16]. Fragments with fragIndex >= fragCount are parity.
+class DatagramChannel {
+public:
+  static constexpr size_t fragment_size = 1152; // stays below the 1280-byte IPv6 minimum MTU with all headers
+  static constexpr size_t key_size = 32;
+  static constexpr size_t session_id_size = 8;
+  static constexpr size_t header_size = session_id_size + 4 + 2 + 2 + 1 + 4;
+  static constexpr size_t tag_size = 16;
+  static constexpr const char* exporter_label = "EXPORTER-mrut-screencast";
+
+  /// @param groupSize Data fragments per parity fragment. 0 disables FEC
+  DatagramChannel(const std::string& host, uint16_t port, const unsigned char* keyingMaterial, uint8_t groupSize = 8);
+  ~DatagramChannel();
+  DatagramChannel(const DatagramChannel&) = delete;
+  DatagramChannel& operator=(const DatagramChannel&) = delete;
+
+  /// @brief Derives key and session id from `tls` and opens the channel
+  /// @returns nullptr if the connection has no TLS session to derive from
+  static DatagramChannel* FromTLS(const TCPClient& tls, uint16_t port, uint8_t groupSize = 8);
+
+  bool IsOpen() const;
+  /// @returns false if the frame could not be handed to the network stack (nothing is retransmitted either way)
+  bool SendFrame(const char* data, size_t size);
+
+private:
+  PLATFORM_SOCKET _socket;
+  sockaddr_in _address {};
+  unsigned char _key[key_size];
+  unsigned char _sessionId[session_id_size];
+  uint8_t _groupSize;
+  uint32_t _frameSeq = 0;
+  EVP_CIPHER_CTX* _cipher = nullptr;
+  std::vector<unsigned char> _packet;
+
+  bool SendFragment(uint16_t index, uint16_t count, uint32_t frameSize, const unsigned char* fragment);
+};
@@ -0,0 +1,124 @@
+#include "EventLoop.h"
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+EventLoop::EventLoop() {
+  _epoll = epoll_create1(EPOLL_CLOEXEC);
+  _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_epoll < 0 || _wakeFd < 0)
+    throw std::runtime_error("EventLoop: epoll/eventfd creation failed");
+  epoll_event event {};
+  event.events = EPOLLIN;
+  event.data.fd = _wakeFd;
+  epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeFd, &event);
+}
+EventLoop::~EventLoop() {
+  // callbacks may own connections whose destructors touch the loop: drop them while it still exists
+  _handlers.clear();
+  _timers.clear();
+  close(_wakeFd);
+  close(_epoll);
+}
+
+bool EventLoop::Add(int fd, uint32_t events, IoCallback callback) {
+  epoll_event event {};
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+    return false;
+  _handlers[fd] = std::make_shared<IoCallback>(std::move(callback));
+  return true;
+}
+bool EventLoop::Modify(int fd, uint32_t events) {
+  epoll_event event {};
+  event.events = events;
+  event.data.fd = fd;
+  return epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+void EventLoop::Remove(int fd) {
+  if (!_handlers.erase(fd))
+    return;
+  epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+}
+size_t EventLoop::GetHandlerCount() const { return _handlers.size(); }
+
+uint64_t EventLoop::AddTimer(Clock::duration delay, Task task) {
+  uint64_t id = _nextTimerId++;
+  _timers.emplace(id, std::move(task));
+  _timerQueue.push({ Clock::now() + delay, id });
+  return id;
+}
+void EventLoop::CancelTimer(uint64_t id) {
+  // the heap entry stays and is skipped when it comes up
+  _timers.erase(id);
+}
+
+void EventLoop::Post(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(_postMutex);
+    _posted.push_back(std::move(task));
+  }
+  uint64_t one = 1;
+  (void)!write(_wakeFd, &one, sizeof(one));
+}
+void EventLoop::Stop() {
+  _running = false;
+  uint64_t one = 1;
+  (void)!write(_wakeFd, &one, sizeof(one));
+}
+
+int EventLoop::NextTimeout() {
+  while (!_timerQueue.empty() && !_timers.count(_timerQueue.top().id))
+    _timerQueue.pop();
+  if (_timerQueue.empty())
+    return -1;
+  auto left = std::chrono::ceil<std::chrono::milliseconds>(_timerQueue.top().at - Clock::now()).count();
+  return left > 0 ? (int)left : 0;
+}
+void EventLoop::RunTimers() {
+  auto now = Clock::now();
+  while (!_timerQueue.empty() && _timerQueue.top().at <= now) {
+    uint64_t id = _timerQueue.top().id;
+    _timerQueue.pop();
+    auto it = _timers.find(id);
+    if (it == _timers.end())
+      continue;
+    Task task = std::move(it->second);
+    _timers.erase(it);
+    task();
+  }
+}
+void EventLoop::RunPosted() {
+  std::vector<Task> posted;
+  {
+    std::lock_guard<std::mutex> lock(_postMutex);
+    posted.swap(_posted);
+  }
+  for (auto& task : posted)
+    task();
+}
+
+void EventLoop::Run() {
+  _running = true;
+  epoll_event events[max_events];
+  while (_running) {
+    int count = epoll_wait(_epoll, events, max_events, NextTimeout());
+    for (int i = 0; i < count && _running; i++) {
+      int fd = events[i].data.fd;
+      if (fd == _wakeFd) {
+        uint64_t value;
+        (void)!read(_wakeFd, &value, sizeof(value));
+        continue;
+      }
+      auto it = _handlers.find(fd);
+      if (it == _handlers.end())
+        continue;
+      auto callback = it->second;
+      (*callback)(events[i].events);
+    }
+    RunTimers();
+    RunPosted();
+  }
+}
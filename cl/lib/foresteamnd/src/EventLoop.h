@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Single-threaded reactor: readiness callbacks for file descriptors (epoll, level-triggered), one-shot timers on a heap and
+/// tasks posted from other threads. Everything but Post() and Stop() must be called from the thread running Run(). Linux only
+class EventLoop {
+public:
+  using Clock = std::chrono::steady_clock;
+  /// @param events EPOLLIN/EPOLLOUT/EPOLLERR/EPOLLHUP mask
+  using IoCallback = std::function<void(uint32_t events)>;
+  using Task = std::function<void()>;
+  static constexpr int max_events = 256;
+
+  EventLoop();
+  ~EventLoop();
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  /// @returns false if epoll refused the descriptor
+  bool Add(int fd, uint32_t events, IoCallback callback);
+  bool Modify(int fd, uint32_t events);
+  /// @brief Safe to call from within the descriptor's own callback. Does not close `fd`
+  void Remove(int fd);
+  size_t GetHandlerCount() const;
+
+  /// @returns Timer id for CancelTimer()
+  uint64_t AddTimer(Clock::duration delay, Task task);
+  void CancelTimer(uint64_t id);
+
+  /// @brief Runs `task` on the loop thread. Thread-safe
+  void Post(Task task);
+  /// @brief Blocks until Stop()
+  void Run();
+  /// @brief Thread-safe
+  void Stop();
+
+private:
+  struct Timer {
+    Clock::time_point at;
+    uint64_t id;
+    bool operator>(const Timer& other) const { return at > other.at; }
+  };
+
+  int _epoll;
+  int _wakeFd;
+  std::atomic<bool> _running { false };
+  // shared_ptr: a callback may Remove() itself (or others) while it runs
+  std::unordered_map<int, std::shared_ptr<IoCallback>> _handlers;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timerQueue;
+  std::unordered_map<uint64_t, Task> _timers;
+  uint64_t _nextTimerId = 1;
+  std::mutex _postMutex;
+  std::vector<Task> _posted;
+
+  /// @returns epoll_wait timeout until the nearest timer, -1 if none
+  int NextTimeout();
+  void RunTimers();
+  void RunPosted();
+};
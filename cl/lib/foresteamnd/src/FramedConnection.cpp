@@ -0,0 +1,287 @@
+#include "FramedConnection.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Reads per readiness event before yielding to other connections (level-triggered epoll comes back for the rest)
+static constexpr int MAX_READS_PER_EVENT = 16;
+static constexpr size_t SSL_WRITE_CHUNK_SIZE = 256 * 1024;
+static constexpr size_t COMPACT_THRESHOLD = 1024 * 1024;
+
+FramedConnection::FramedConnection(EventLoop& loop, int fd, SSL* ssl) : _loop(loop), _fd(fd), _ssl(ssl), _handshaking(ssl != nullptr) {
+  if (_ssl)
+    SSL_set_mode(_ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+}
+FramedConnection::~FramedConnection() {
+  // never touches the loop: it may be the loop's destructor dropping us
+  if (_ssl)
+    SSL_free(_ssl);
+  if (_fd >= 0)
+    close(_fd);
+}
+
+std::shared_ptr<FramedConnection> FramedConnection::Connect(EventLoop& loop, const std::string& ip, uint16_t port, SSL_CTX* tls) {
+  sockaddr_in address {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  if (inet_pton(AF_INET, ip.c_str(), &address.sin_addr) != 1)
+    return nullptr;
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+  if (fd < 0)
+    return nullptr;
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0 && errno != EINPROGRESS) {
+    close(fd);
+    return nullptr;
+  }
+  SSL* ssl = nullptr;
+  if (tls) {
+    ssl = SSL_new(tls);
+    if (!ssl) {
+      close(fd);
+      return nullptr;
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_connect_state(ssl);
+  }
+  // until the connect completes, writes hit EAGAIN and wait for EPOLLOUT like any other full socket buffer
+  return std::make_shared<FramedConnection>(loop, fd, ssl);
+}
+
+bool FramedConnection::Start(MessageHandler onMessage, CloseHandler onClose) {
+  _onMessage = std::move(onMessage);
+  _onClose = std::move(onClose);
+  _interest = EPOLLIN;
+  if (!_loop.Add(_fd, _interest, [self = shared_from_this()](uint32_t events) { self->OnEvents(events); })) {
+    Close();
+    return false;
+  }
+  _registered = true;
+  // the client side of TLS speaks first
+  if (_handshaking && !DoHandshake())
+    return false;
+  if (!_handshaking && !DoWrite())
+    return false;
+  UpdateInterest();
+  return true;
+}
+
+void FramedConnection::Send(const char* data, size_t size) {
+  if (!_open)
+    return;
+  uint64_t length = size;
+  _out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+  _out.append(data, size);
+  if (!_registered || _handshaking)
+    return;
+  if (DoWrite())
+    UpdateInterest();
+}
+void FramedConnection::Send(const std::string& payload) { Send(payload.data(), payload.size()); }
+void FramedConnection::Send(uint8_t action, const char* body, size_t size) {
+  if (!_open)
+    return;
+  uint64_t length = size + 1;
+  _out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+  _out.push_back((char)action);
+  _out.append(body, size);
+  if (!_registered || _handshaking)
+    return;
+  if (DoWrite())
+    UpdateInterest();
+}
+
+void FramedConnection::Close() {
+  if (!_open)
+    return;
+  _open = false;
+  if (_registered)
+    _loop.Remove(_fd);
+  _registered = false;
+  if (_ssl) {
+    SSL_free(_ssl);
+    _ssl = nullptr;
+  }
+  close(_fd);
+  _fd = -1;
+  auto onClose = std::move(_onClose);
+  _onClose = nullptr;
+  if (onClose)
+    onClose(*this);
+}
+
+EventLoop& FramedConnection::GetLoop() const { return _loop; }
+bool FramedConnection::IsOpen() const { return _open; }
+bool FramedConnection::IsHandshaking() const { return _handshaking; }
+int FramedConnection::GetFd() const { return _fd; }
+size_t FramedConnection::GetPendingOutput() const { return _out.size() - _outOffset; }
+uint64_t FramedConnection::GetBytesReceived() const { return _bytesReceived; }
+uint64_t FramedConnection::GetBytesSent() const { return _bytesSent; }
+
+void FramedConnection::OnEvents(uint32_t events) {
+  auto self = shared_from_this(); // handlers may drop the last outside reference
+  if (events & EPOLLERR) {
+    Close();
+    return;
+  }
+  if (_handshaking) {
+    if (!DoHandshake())
+      return;
+    if (_handshaking) {
+      UpdateInterest();
+      return;
+    }
+  }
+  if ((events & (EPOLLIN | EPOLLHUP)) && !DoRead())
+    return;
+  if ((GetPendingOutput() || _sslWantsWrite) && !DoWrite())
+    return;
+  UpdateInterest();
+}
+
+bool FramedConnection::SslWouldBlock(int result) {
+  switch (SSL_get_error(_ssl, result)) {
+  case SSL_ERROR_WANT_READ:
+    _sslWantsWrite = false;
+    return true;
+  case SSL_ERROR_WANT_WRITE:
+    _sslWantsWrite = true;
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool FramedConnection::DoHandshake() {
+  int result = SSL_do_handshake(_ssl);
+  if (result == 1) {
+    _handshaking = false;
+    _sslWantsWrite = false;
+    // whatever was queued meanwhile, and records that arrived along with the handshake
+    return DoWrite() && DoRead();
+  }
+  if (SslWouldBlock(result))
+    return true;
+  Close();
+  return false;
+}
+
+bool FramedConnection::DoRead() {
+  static thread_local char buffer[read_chunk_size];
+  for (int i = 0; _open; i++) {
+    if (i >= MAX_READS_PER_EVENT && !(_ssl && SSL_pending(_ssl)))
+      break;
+    ssize_t got;
+    if (_ssl) {
+      got = SSL_read(_ssl, buffer, (int)sizeof(buffer));
+      if (got <= 0) {
+        if (SslWouldBlock((int)got))
+          break;
+        Close();
+        return false;
+      }
+    }
+    else {
+      got = recv(_fd, buffer, sizeof(buffer), 0);
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      if (got <= 0) {
+        Close();
+        return false;
+      }
+    }
+    _bytesReceived += got;
+    _in.append(buffer, got);
+    if (!ParseFrames())
+      return false;
+  }
+  return _open;
+}
+
+bool FramedConnection::ParseFrames() {
+  while (_open && _in.size() - _inOffset >= sizeof(uint64_t)) {
+    uint64_t length;
+    memcpy(&length, _in.data() + _inOffset, sizeof(length));
+    if (length > max_message_size) {
+      Close();
+      return false;
+    }
+    if (_in.size() - _inOffset - sizeof(length) < length)
+      break;
+    std::string payload = _in.substr(_inOffset + sizeof(length), length);
+    _inOffset += sizeof(length) + length;
+    _onMessage(*this, std::move(payload));
+  }
+  if (_inOffset == _in.size()) {
+    _in.clear();
+    _inOffset = 0;
+  }
+  else if (_inOffset > COMPACT_THRESHOLD) {
+    _in.erase(0, _inOffset);
+    _inOffset = 0;
+  }
+  return _open;
+}
+
+bool FramedConnection::DoWrite() {
+  while (_open && _outOffset < _out.size()) {
+    size_t left = _out.size() - _outOffset;
+    ssize_t sent;
+    if (_ssl) {
+      int length = _sslRetryWrite ? _sslRetryWrite : (int)std::min(left, SSL_WRITE_CHUNK_SIZE);
+      sent = SSL_write(_ssl, _out.data() + _outOffset, length);
+      if (sent <= 0) {
+        if (SslWouldBlock((int)sent)) {
+          _sslRetryWrite = length;
+          break;
+        }
+        Close();
+        return false;
+      }
+      _sslRetryWrite = 0;
+      _sslWantsWrite = false;
+    }
+    else {
+      sent = send(_fd, _out.data() + _outOffset, left, MSG_NOSIGNAL);
+      if (sent < 0 && errno == EINTR)
+        continue;
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      if (sent < 0) {
+        Close();
+        return false;
+      }
+    }
+    _outOffset += sent;
+    _bytesSent += sent;
+  }
+  if (_outOffset == _out.size()) {
+    _out.clear();
+    _outOffset = 0;
+  }
+  else if (_outOffset > COMPACT_THRESHOLD) {
+    _out.erase(0, _outOffset);
+    _outOffset = 0;
+  }
+  return _open;
+}
+
+void FramedConnection::UpdateInterest() {
+  if (!_open || !_registered)
+    return;
+  uint32_t interest = EPOLLIN;
+  if (_sslWantsWrite || (!_handshaking && GetPendingOutput()))
+    interest |= EPOLLOUT;
+  if (interest != _interest && _loop.Modify(_fd, interest))
+    _interest = interest;
+}
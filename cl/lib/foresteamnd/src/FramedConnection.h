@@ -0,0 +1,86 @@
+#pragma once
+#include "EventLoop.h"
+#include <any>
+#include <functional>
+#include <memory>
+#include <openssl/ssl.h>
+#include <string>
+
+/// @brief Non-blocking, optionally TLS, connection on an EventLoop speaking the `[u64 length][payload]` framing of TCPClient. The
+/// action byte of agent messages is just the first payload byte here, so the same class serves both ends. Lives as long as it is
+/// registered in the loop (or referenced elsewhere); callbacks run on the loop thread
+class FramedConnection : public std::enable_shared_from_this<FramedConnection> {
+public:
+  using MessageHandler = std::function<void(FramedConnection& connection, std::string&& payload)>;
+  using CloseHandler = std::function<void(FramedConnection& connection)>;
+  /// @brief Frames above this are treated as a protocol error (the peer is confused or hostile)
+  static constexpr uint64_t max_message_size = 1ull << 30;
+  static constexpr size_t read_chunk_size = 64 * 1024;
+
+  /// @param fd Connected, non-blocking socket. Owned from now on
+  /// @param ssl Set up with SSL_set_fd() and SSL_set_accept_state()/SSL_set_connect_state(), or nullptr for plain TCP. Owned
+  FramedConnection(EventLoop& loop, int fd, SSL* ssl = nullptr);
+  /// @brief Starts a non-blocking connect. Messages sent before it completes are queued; a failed connect ends in the close handler
+  /// @param ip IPv4 address (no resolving here, it would block the loop)
+  /// @param tls Client context for TLS, nullptr for plain TCP. Not owned
+  /// @returns nullptr if no socket could be created
+  static std::shared_ptr<FramedConnection> Connect(EventLoop& loop, const std::string& ip, uint16_t port, SSL_CTX* tls = nullptr);
+  ~FramedConnection();
+  FramedConnection(const FramedConnection&) = delete;
+  FramedConnection& operator=(const FramedConnection&) = delete;
+
+  /// @brief Registers in the loop. Handlers are not called before this
+  /// @returns false if the loop refused the descriptor (the connection is closed then)
+  bool Start(MessageHandler onMessage, CloseHandler onClose);
+  /// @brief Queues one frame. Goes out as soon as the socket (and the TLS handshake) allows
+  void Send(const char* data, size_t size);
+  void Send(const std::string& payload);
+  /// @brief Queues one frame made of `action` followed by `body` (agent-side messages)
+  void Send(uint8_t action, const char* body, size_t size);
+  /// @brief Closes immediately, dropping unsent data. Calls the close handler once
+  void Close();
+
+  /// @brief The loop this connection runs on, for timers of whoever drives it
+  EventLoop& GetLoop() const;
+  bool IsOpen() const;
+  bool IsHandshaking() const;
+  int GetFd() const;
+  size_t GetPendingOutput() const;
+  uint64_t GetBytesReceived() const;
+  uint64_t GetBytesSent() const;
+
+  /// @brief Per-connection state of whoever drives the connection
+  std::any context;
+
+private:
+  EventLoop& _loop;
+  int _fd;
+  SSL* _ssl;
+  bool _open = true;
+  bool _registered = false;
+  bool _handshaking;
+  uint32_t _interest = 0;
+  MessageHandler _onMessage;
+  CloseHandler _onClose;
+
+  std::string _in;
+  size_t _inOffset = 0;
+  std::string _out;
+  size_t _outOffset = 0;
+  /// @brief SSL_write must be retried with the same length after WANT_WRITE
+  int _sslRetryWrite = 0;
+  bool _sslWantsWrite = false;
+  uint64_t _bytesReceived = 0;
+  uint64_t _bytesSent = 0;
+
+  void OnEvents(uint32_t events);
+  /// @returns false if the connection was closed
+  bool DoHandshake();
+  bool DoRead();
+  bool DoWrite();
+  /// @brief Dispatches complete frames from `_in`
+  bool ParseFrames();
+  void UpdateInterest();
+  /// @returns true if `result` of an SSL call means "try again later" (and records which direction it waits for)
+  bool SslWouldBlock(int result);
+};
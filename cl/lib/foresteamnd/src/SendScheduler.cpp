@@ -0,0 +1,115 @@
+#include "SendScheduler.h"
+#include <algorithm>
+#include <thread>
+
+SendScheduler::Lease::Lease(SendScheduler& scheduler, TrafficClass cls, bool preemptible)
+    : _scheduler(scheduler), _cls(cls), _preemptible(preemptible) {
+  _scheduler.Acquire(cls);
+}
+SendScheduler::Lease::~Lease() { _scheduler.Release(); }
+void SendScheduler::Lease::Pace(size_t bytes) { _scheduler.Pace(_cls, bytes, _preemptible); }
+bool SendScheduler::Lease::IsPreemptible() const { return _preemptible; }
+
+void SendScheduler::Bucket::Configure(double bytesPerSec, double burstBytes) {
+  rate = bytesPerSec > 0 ? bytesPerSec : 0;
+  burst = burstBytes > 0 ? burstBytes : rate / 4;
+  tokens = burst;
+  refilledAt = Clock::now();
+}
+void SendScheduler::Bucket::Refill(Clock::time_point now) {
+  if (!rate)
+    return;
+  tokens = std::min(burst, tokens + rate * std::chrono::duration<double>(now - refilledAt).count());
+  refilledAt = now;
+}
+SendScheduler::Clock::duration SendScheduler::Bucket::Deficit(double bytes) const {
+  if (!rate)
+    return Clock::duration::zero();
+  // a piece bigger than the bucket would never fit: let it through on a full bucket and go into debt instead
+  double needed = std::min(bytes, burst) - tokens;
+  if (needed <= 0)
+    return Clock::duration::zero();
+  return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(needed / rate));
+}
+
+void SendScheduler::SetRateLimit(TrafficClass cls, double bytesPerSec, double burstBytes) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _buckets[cls].Configure(bytesPerSec, burstBytes);
+}
+void SendScheduler::SetLinkRateLimit(double bytesPerSec, double burstBytes) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _link.Configure(bytesPerSec, burstBytes);
+}
+double SendScheduler::GetRateLimit(TrafficClass cls) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _buckets[cls].rate;
+}
+double SendScheduler::GetLinkRateLimit() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _link.rate;
+}
+
+bool SendScheduler::HigherPriorityWaiting(TrafficClass cls) const {
+  for (uint8_t i = 0; i < cls; i++)
+    if (_waiting[i])
+      return true;
+  return false;
+}
+bool SendScheduler::Interrupted(TrafficClass cls) const {
+  for (uint8_t i = 0; i <= cls; i++)
+    if (_suspended[i])
+      return true;
+  return false;
+}
+void SendScheduler::Acquire(TrafficClass cls) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _waiting[cls]++;
+  _cv.wait(lock, [this, cls] { return !_busy && !HigherPriorityWaiting(cls) && !Interrupted(cls); });
+  _waiting[cls]--;
+  _busy = true;
+}
+void SendScheduler::Release() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _busy = false;
+  }
+  _cv.notify_all();
+}
+void SendScheduler::Pace(TrafficClass cls, size_t bytes, bool preemptible) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  Bucket& bucket = _buckets[cls];
+  while (true) {
+    auto now = Clock::now();
+    bucket.Refill(now);
+    _link.Refill(now);
+    auto wait = std::max(bucket.Deficit((double)bytes), _link.Deficit((double)bytes));
+    bool yield = preemptible && HigherPriorityWaiting(cls);
+    if (wait == Clock::duration::zero() && !yield)
+      break;
+    if (!preemptible) {
+      // the wire stays ours while we sleep: a message that isn't sliced can't be preempted halfway
+      lock.unlock();
+      std::this_thread::sleep_for(wait);
+      lock.lock();
+      continue;
+    }
+    // between two slices: higher classes have the wire until the tokens are there, and until they're done
+    _busy = false;
+    _suspended[cls]++;
+    _cv.notify_all();
+    if (wait != Clock::duration::zero()) {
+      lock.unlock();
+      std::this_thread::sleep_for(wait);
+      lock.lock();
+    }
+    _waiting[cls]++;
+    _cv.wait(lock, [this, cls] { return !_busy && !HigherPriorityWaiting(cls); });
+    _waiting[cls]--;
+    _suspended[cls]--;
+    _busy = true;
+  }
+  if (bucket.rate)
+    bucket.tokens -= (double)bytes;
+  if (_link.rate)
+    _link.tokens -= (double)bytes;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+/// @brief Arbitrates concurrent senders on a single connection. Whoever holds a Lease owns the wire for one whole message, waiting
+/// senders are admitted by traffic class priority, and every class is paced by its own token bucket plus a shared link bucket, so capped
+/// bulk transfers leave the rest of the uplink to interactive traffic. A preemptible lease's message goes in slices the receiver can
+/// tell apart (TCPClient::SetSlicing()): between them it gives the wire up to higher classes, and to no one else
+class SendScheduler {
+public:
+  /// @brief Lower value = higher priority
+  enum TrafficClass : uint8_t { CONTROL = 0, INPUT, SCREENCAST, BULK, CLASS_COUNT };
+
+  /// @brief RAII ownership of the wire
+  class Lease {
+    SendScheduler& _scheduler;
+    TrafficClass _cls;
+    bool _preemptible;
+
+  public:
+    /// @param preemptible The message can be interrupted between its pieces by whole messages of higher classes
+    Lease(SendScheduler& scheduler, TrafficClass cls, bool preemptible = false);
+    ~Lease();
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    /// @brief Blocks until `bytes` may go out for this lease's class. Call before each piece of a large message. A preemptible lease
+    /// lets higher classes have the wire meanwhile: while it waits for tokens, or right away if one of them is waiting
+    void Pace(size_t bytes);
+    bool IsPreemptible() const;
+  };
+
+  /// @param bytesPerSec 0 removes the limit
+  /// @param burstBytes Bucket depth. 0 picks a quarter of a second worth of traffic
+  void SetRateLimit(TrafficClass cls, double bytesPerSec, double burstBytes = 0);
+  /// @brief Cap for all classes together (the site's uplink share). 0 removes the limit
+  void SetLinkRateLimit(double bytesPerSec, double burstBytes = 0);
+  double GetRateLimit(TrafficClass cls) const;
+  double GetLinkRateLimit() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+  struct Bucket {
+    double rate = 0;
+    double burst = 0;
+    double tokens = 0;
+    Clock::time_point refilledAt;
+
+    void Configure(double bytesPerSec, double burstBytes);
+    void Refill(Clock::time_point now);
+    /// @returns How long to wait until `bytes` tokens are there (zero if the bucket is unlimited)
+    Clock::duration Deficit(double bytes) const;
+  };
+
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _busy = false;
+  std::array<uint32_t, CLASS_COUNT> _waiting {};
+  /// @brief Preemptible leases that gave the wire up halfway through their message, per class
+  std::array<uint32_t, CLASS_COUNT> _suspended {};
+  std::array<Bucket, CLASS_COUNT> _buckets;
+  Bucket _link;
+
+  void Acquire(TrafficClass cls);
+  void Release();
+  void Pace(TrafficClass cls, size_t bytes, bool preemptible);
+  bool HigherPriorityWaiting(TrafficClass cls) const;
+  /// @returns true if a message of `cls` or of a higher class is halfway out: `cls` can't start one of its own until it's done
+  bool Interrupted(TrafficClass cls) const;
+};
@@ -1,6 +1,7 @@
 #include "TCPClient.h"
 #include "Utils.h"
 #include <chrono>
+#include <cmath>
 #include <cstring>
 #include <iostream>
 #include <thread>
@@ -12,7 +13,13 @@ using namespace std;
 #pragma comment(lib, "AdvApi32.lib")
 #else
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
 #endif
 
 #ifndef INVALID_SOCKET
@@ -25,9 +32,14 @@ using namespace std;
 #define MSG_NOSIGNAL 0
 #endif
 
-#ifdef _WIN32
 static constexpr size_t TLS_READ_CHUNK_SIZE = 16 * 1024; // 16 KiB per SSL_read()
 
+// EWMA weights: RFC 6298 for RTT, a slower-moving average for throughput
+static constexpr double RTT_ALPHA = 1.0 / 8;
+static constexpr double RTT_BETA = 1.0 / 4;
+static constexpr double THROUGHPUT_ALPHA = 1.0 / 4;
+
+#ifdef _WIN32
 void WSInit() {
   WSADATA data;
   if (WSAStartup(MAKEWORD(1, 1), &data) != 0) {
@@ -36,6 +48,8 @@ void WSInit() {
   }
 }
 namespace PLATFORM {
+  /// @brief Receive and send timeout of the socket
+  constexpr DWORD socket_timeout_ms = 5000;
   void CloseConnection(PLATFORM_SOCKET& socket) {
     WSACleanup();
     if (socket == INVALID_SOCKET)
@@ -53,7 +67,7 @@ namespace PLATFORM {
     }
     return true;
   }
-  void OpenConnection(PLATFORM_SOCKET& _socket, PLATFORM_ADDRESS& hints, std::string ip, uint16_t port, DWORD timeout_ms = 5000) {
+  void OpenConnection(PLATFORM_SOCKET& _socket, PLATFORM_ADDRESS& hints, std::string ip, uint16_t port, DWORD timeout_ms = socket_timeout_ms) {
     WSInit();
     int iResult;
     PLATFORM_ADDRESS* addrinfo = nullptr;
@@ -178,6 +192,11 @@ namespace PLATFORM {
     return total_received;
   }
   int __stdcall Send(PLATFORM_SOCKET socket, char* buf, int buf_sz, int flags) { return send(socket, buf, buf_sz, flags); }
+  bool WaitReadable(PLATFORM_SOCKET socket) {
+    WSAPOLLFD fd = { socket, POLLRDNORM, 0 };
+    // gives up when a blocking recv() would have: SO_RCVTIMEO doesn't apply to the wait
+    return WSAPoll(&fd, 1, socket_timeout_ms) > 0;
+  }
 } // namespace PLATFORM
 #else
 namespace PLATFORM {
@@ -191,10 +210,33 @@ namespace PLATFORM {
     address.sin_family = AF_INET;
     address.sin_port = htons(port);
     inet_pton(AF_INET, ip.c_str(), &address.sin_addr);
+    int nodelay = 1; // header and body go out as separate writes: don't let Nagle hold the body for an ACK
+    setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
     connect(_socket, (struct sockaddr*)&address, sizeof(address));
   }
-  ssize_t Recv(PLATFORM_SOCKET socket, void* buf, size_t buf_sz, int flags) { return recv(socket, buf, buf_sz, flags); }
+  ssize_t Recv(PLATFORM_SOCKET socket, void* buf, size_t buf_sz, int flags) {
+    // callers expect the whole buffer, like the Windows version
+    size_t total_received = 0;
+    while (total_received < buf_sz) {
+      ssize_t rc = recv(socket, (char*)buf + total_received, buf_sz - total_received, flags);
+      if (rc > 0)
+        total_received += rc;
+      else if (rc < 0 && errno == EINTR)
+        continue;
+      else
+        return SOCKET_ERROR;
+    }
+    return total_received;
+  }
   ssize_t Send(PLATFORM_SOCKET socket, void* buf, size_t buf_sz, int flags) { return send(socket, buf, buf_sz, flags); }
+  bool WaitReadable(PLATFORM_SOCKET socket) {
+    pollfd fd = { socket, POLLIN, 0 };
+    int rc;
+    while ((rc = poll(&fd, 1, -1)) < 0 && errno == EINTR) {
+    }
+    // a closed or shut down socket counts: the read that follows finds out
+    return rc > 0;
+  }
 } // namespace PLATFORM
 #endif
 
@@ -212,30 +254,67 @@ void TCPClient::Retry(bool dInitial) {
     InitializeTLS(_host);
 }
 void TCPClient::LostConnection() {
-  PLATFORM::CloseConnection(_socket);
+  {
+    // the reader and a writer may both run into it: closed once, and never under an SSL call
+    std::lock_guard lock(_sslMutex);
+    if (_socket != INVALID_SOCKET)
+      PLATFORM::CloseConnection(_socket);
+  }
   if (_debug)
+#ifdef _WIN32
     printf("Connection lost %x\n", WSAGetLastError());
+#else
+    printf("Connection lost %x\n", errno);
+#endif
   if (_retryPolicy == RetryPolicy::THROW)
     throw runtime_error("Connection lost");
 }
+int TCPClient::ReadTls(void* data, int size) {
+  while (true) {
+    PLATFORM_SOCKET socket;
+    bool buffered;
+    {
+      std::lock_guard lock(_sslMutex);
+      socket = _socket;
+      // what OpenSSL has read already doesn't show on the socket
+      buffered = socket != INVALID_SOCKET && SSL_has_pending(_ssl);
+    }
+    if (socket == INVALID_SOCKET || (!buffered && !PLATFORM::WaitReadable(socket)))
+      return -1;
+    std::lock_guard lock(_sslMutex);
+    if (_socket == INVALID_SOCKET)
+      return -1;
+    int got = SSL_read(_ssl, data, size);
+    // a record without application data (a session ticket): back to waiting without the lock, see InitializeTLS()
+    if (got <= 0 && SSL_get_error(_ssl, got) == SSL_ERROR_WANT_READ)
+      continue;
+    return got;
+  }
+}
+int TCPClient::WriteTls(const void* data, int size) {
+  std::lock_guard lock(_sslMutex);
+  if (_socket == INVALID_SOCKET)
+    return -1;
+  return SSL_write(_ssl, data, size);
+}
 char* TCPClient::ReceiveRawData(size_t* sz) {
   Retry(false);
 
-#ifdef _WIN32
   if (_useTls) {
     // read size prefix first (on TLS)
     size_t msgLen;
-    int n = SSL_read(_ssl, &msgLen, sizeof msgLen);
+    int n = ReadTls(&msgLen, sizeof msgLen);
     if (n <= 0) {
       LostConnection();
       return nullptr;
     }
+    auto headerAt = Clock::now();
 
     auto out = new char[msgLen];
     size_t offset = 0;
     while (offset < msgLen) {
       int chunk = (int)std::min(msgLen - offset, TLS_READ_CHUNK_SIZE);
-      int got = SSL_read(_ssl, out + offset, chunk);
+      int got = ReadTls(out + offset, chunk);
       if (got <= 0) {
         delete[] out;
         LostConnection();
@@ -243,11 +322,13 @@ char* TCPClient::ReceiveRawData(size_t* sz) {
       }
       offset += got;
     }
+    RecordReceived(msgLen, headerAt);
+    if (_recorder)
+      _recorder->Record(Trace::RECEIVED, out, msgLen);
     if (sz)
       *sz = msgLen;
     return out;
   }
-#endif
 
   // fallback to your existing size-prefix logic…
   size_t bufSz;
@@ -255,12 +336,16 @@ char* TCPClient::ReceiveRawData(size_t* sz) {
     LostConnection();
     return nullptr;
   }
+  auto headerAt = Clock::now();
   auto buf = new char[bufSz];
   if (PLATFORM::Recv(_socket, buf, bufSz, 0) == SOCKET_ERROR) {
     delete[] buf;
     LostConnection();
     return nullptr;
   }
+  RecordReceived(bufSz, headerAt);
+  if (_recorder)
+    _recorder->Record(Trace::RECEIVED, buf, bufSz);
   if (sz)
     *sz = bufSz;
   return buf;
@@ -274,12 +359,44 @@ std::string TCPClient::ReceiveData() {
   delete[] buf;
   return rs;
 }
+bool TCPClient::ReceiveData(const std::function<void(const char* data, size_t size)>& sink) {
+  Retry(false);
+  size_t msgLen;
+  if (_useTls ? ReadTls(&msgLen, sizeof msgLen) <= 0 : PLATFORM::Recv(_socket, (char*)&msgLen, sizeof msgLen, 0) == SOCKET_ERROR) {
+    LostConnection();
+    return false;
+  }
+  auto headerAt = Clock::now();
+  std::vector<char> piece(std::min(msgLen, file_chunk_size));
+  size_t offset = 0;
+  while (offset < msgLen) {
+    size_t size = std::min(msgLen - offset, piece.size());
+    if (_useTls) {
+      int got = ReadTls(piece.data(), (int)std::min(size, TLS_READ_CHUNK_SIZE));
+      if (got <= 0) {
+        LostConnection();
+        return false;
+      }
+      size = got;
+    }
+    else if (PLATFORM::Recv(_socket, piece.data(), size, 0) == SOCKET_ERROR) {
+      LostConnection();
+      return false;
+    }
+    sink(piece.data(), size);
+    offset += size;
+  }
+  RecordReceived(msgLen, headerAt);
+  // like SendFile: the size, not the contents
+  if (_recorder)
+    _recorder->Record(Trace::RECEIVED, msgLen, {});
+  return true;
+}
 bool TCPClient::SendDataRaw(const char* data, size_t size) {
-#ifdef _WIN32
   if (_useTls) {
     size_t offset = 0;
     while (offset < size) {
-      int written = SSL_write(_ssl, const_cast<char*>(data + offset), int(size - offset));
+      int written = WriteTls(data + offset, int(size - offset));
       if (written <= 0) {
         LostConnection();
         return false;
@@ -288,7 +405,6 @@ bool TCPClient::SendDataRaw(const char* data, size_t size) {
     }
     return true;
   }
-#endif
 
   // fallback to plain‐TCP
   size_t offset = 0;
@@ -302,22 +418,166 @@ bool TCPClient::SendDataRaw(const char* data, size_t size) {
   }
   return true;
 }
-bool TCPClient::SendData(const char* data, size_t size) {
+bool TCPClient::BeginPiece(SendScheduler::Lease& lease, size_t size) {
+  lease.Pace(size);
+  // an empty slice would end nothing: the receiver counts the message's bytes
+  if (!lease.IsPreemptible() || !size)
+    return true;
+  uint64_t header = size | slice_flag;
+  return SendDataRaw(reinterpret_cast<char*>(&header), sizeof(header));
+}
+bool TCPClient::SendDataPaced(SendScheduler::Lease& lease, const char* data, size_t size) {
+  size_t offset = 0;
+  do {
+    size_t piece = std::min(size - offset, file_chunk_size);
+    if (!BeginPiece(lease, piece) || !SendDataRaw(data + offset, piece))
+      return false;
+    offset += piece;
+  } while (offset < size);
+  return true;
+}
+bool TCPClient::SendData(const char* data, size_t size, SendScheduler::TrafficClass cls) {
+  SendScheduler::Lease lease(_scheduler, cls, _slicing && cls == SendScheduler::BULK);
+  auto start = Clock::now();
   // now sends size as well
-  return SendDataRaw(reinterpret_cast<char*>(&size), sizeof size_t) && SendDataRaw(data, size);
+  uint64_t header = size | (lease.IsPreemptible() ? sliced_message_flag : 0);
+  bool result = SendDataRaw(reinterpret_cast<char*>(&header), sizeof(header)) && SendDataPaced(lease, data, size);
+  if (result)
+    RecordSent(size, start);
+  if (result && _recorder)
+    _recorder->Record(Trace::SENT, data, size);
+  return result;
 }
-bool TCPClient::SendData(const std::vector<std::pair<const char*, size_t>>& data) {
+bool TCPClient::SendData(const std::vector<std::pair<const char*, size_t>>& data, SendScheduler::TrafficClass cls) {
+  SendScheduler::Lease lease(_scheduler, cls, _slicing && cls == SendScheduler::BULK);
+  auto start = Clock::now();
   size_t totalSize = 0;
   for (size_t i = 0; i < data.size(); i++)
     totalSize += data[i].second;
   // now sends size as well
   // std::cout << totalSize << std::endl;
-  bool result = SendDataRaw(reinterpret_cast<char*>(&totalSize), sizeof(size_t));
+  uint64_t header = totalSize | (lease.IsPreemptible() ? sliced_message_flag : 0);
+  bool result = SendDataRaw(reinterpret_cast<char*>(&header), sizeof(header));
   for (size_t i = 0; i < data.size() && result; i++)
-    result &= SendDataRaw(data[i].first, data[i].second);
+    result &= SendDataPaced(lease, data[i].first, data[i].second);
+  if (result)
+    RecordSent(totalSize, start);
+  if (result && _recorder)
+    _recorder->Record(Trace::SENT, totalSize, data);
+  return result;
+}
+bool TCPClient::SendData(const std::string& data, SendScheduler::TrafficClass cls) { return SendData(data.c_str(), data.length(), cls); }
+bool TCPClient::SendFile(const std::filesystem::path& path, const char* prefix, size_t prefixSize, SendScheduler::TrafficClass cls) {
+  return SendFileRange(path, 0, UINT64_MAX, prefix, prefixSize, cls);
+}
+bool TCPClient::SendFileRange(const std::filesystem::path& path, uint64_t offset, uint64_t length, const char* prefix, size_t prefixSize,
+                              SendScheduler::TrafficClass cls) {
+  std::error_code ec;
+  uint64_t fileSize = std::filesystem::file_size(path, ec);
+  if (ec)
+    return false;
+  offset = std::min(offset, fileSize);
+  fileSize = std::min(length, fileSize - offset);
+#ifdef __linux__
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+#else
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open() || !file.seekg((std::streamoff)offset))
+    return false;
+#endif
+
+  SendScheduler::Lease lease(_scheduler, cls, _slicing && cls == SendScheduler::BULK);
+  auto start = Clock::now();
+  size_t totalSize = prefixSize + fileSize;
+  uint64_t header = totalSize | (lease.IsPreemptible() ? sliced_message_flag : 0);
+  bool result = SendDataRaw(reinterpret_cast<char*>(&header), sizeof(header)) &&
+                (!prefixSize || (BeginPiece(lease, prefixSize) && SendDataRaw(prefix, prefixSize)));
+#ifdef __linux__
+  if (result)
+    result = SendFileZeroCopy(lease, fd, offset, fileSize);
+  close(fd);
+#else
+  if (result)
+    result = SendFileBuffered(lease, file, fileSize);
+#endif
+  if (result)
+    RecordSent(totalSize, start);
+  // the file itself is not in memory: only the prefix makes it into the payload
+  if (result && _recorder)
+    _recorder->Record(Trace::SENT, totalSize, { { prefix, prefixSize } });
   return result;
 }
-bool TCPClient::SendData(const std::string& data) { return SendData(data.c_str(), data.length()); }
+bool TCPClient::SendFileBuffered(SendScheduler::Lease& lease, std::ifstream& file, uint64_t size) {
+  std::vector<char> chunk(std::min<uint64_t>(size, file_chunk_size));
+  uint64_t offset = 0;
+  while (offset < size) {
+    size_t toRead = (size_t)std::min<uint64_t>(size - offset, chunk.size());
+    if (!file.read(chunk.data(), toRead)) {
+      // the file shrank under us: the size is already announced, so the stream can't be recovered
+      LostConnection();
+      return false;
+    }
+    if (!BeginPiece(lease, toRead) || !SendDataRaw(chunk.data(), toRead))
+      return false;
+    offset += toRead;
+  }
+  return true;
+}
+#ifdef __linux__
+bool TCPClient::SendFileZeroCopy(SendScheduler::Lease& lease, int fd, uint64_t start, uint64_t size) {
+  size += start;
+  if (_useTls && !IsKtlsSendActive()) {
+    // user-space TLS: records must go through SSL_write anyway
+    std::vector<char> chunk(std::min<uint64_t>(size - start, file_chunk_size));
+    off_t offset = (off_t)start;
+    while ((uint64_t)offset < size) {
+      ssize_t got = pread(fd, chunk.data(), std::min<uint64_t>(size - offset, chunk.size()), offset);
+      if (got <= 0) {
+        LostConnection();
+        return false;
+      }
+      if (!BeginPiece(lease, got) || !SendDataRaw(chunk.data(), got))
+        return false;
+      offset += got;
+    }
+    return true;
+  }
+
+  off_t offset = (off_t)start;
+  while ((uint64_t)offset < size) {
+    size_t piece = std::min<uint64_t>(size - offset, file_chunk_size);
+    if (!BeginPiece(lease, piece))
+      return false;
+    // the piece is announced whole (a slice): what the kernel leaves of it goes before the next one
+    for (off_t end = offset + (off_t)piece; offset < end;) {
+      ssize_t sent;
+      if (_useTls) {
+#ifdef SSL_OP_ENABLE_KTLS
+        {
+          std::lock_guard lock(_sslMutex);
+          sent = _socket == INVALID_SOCKET ? -1 : SSL_sendfile(_ssl, fd, offset, (size_t)(end - offset), 0);
+        }
+        if (sent > 0)
+          offset += sent;
+#else
+        sent = -1;
+#endif
+      }
+      else
+        sent = sendfile(_socket, fd, &offset, (size_t)(end - offset)); // advances `offset` itself
+      if (sent <= 0) {
+        if (sent < 0 && errno == EINTR)
+          continue;
+        LostConnection();
+        return false;
+      }
+    }
+  }
+  return true;
+}
+#endif
 TCPClient::TCPClient(PLATFORM_SOCKET socket, PLATFORM_ADDRESS address) : _socket(socket), _address(address) {}
 TCPClient::TCPClient(const TCPClient& other) : TCPClient(other._host, other._port, other._retryPolicy, other._debug) {}
 TCPClient::TCPClient(std::string host, uint16_t port, RetryPolicy retryPolicy, bool debug) {
@@ -329,31 +589,101 @@ TCPClient::TCPClient(std::string host, uint16_t port, RetryPolicy retryPolicy, b
   _useTls = false;
   Retry(true);
 }
-TCPClient::TCPClient(std::string host, uint16_t port, RetryPolicy retryPolicy, const std::vector<unsigned char>& rootCertificate, bool debug) {
+TCPClient::TCPClient(std::string host, uint16_t port, RetryPolicy retryPolicy, const std::vector<unsigned char>& rootCertificate, bool debug,
+                     bool ktls) {
   this->_retryPolicy = retryPolicy;
   this->_debug = debug;
   _socket = INVALID_SOCKET;
   _host = host;
   _port = port;
   _useTls = true;
+  _useKtls = ktls;
   _rootCertificate = rootCertificate;
   Retry(true);
 }
 
+std::function<TCPClient*()> TCPClient::Sibling() const {
+  return [host = _host, port = _port, tls = _useTls, rootCertificate = _rootCertificate, debug = _debug, ktls = _useKtls]() {
+    return tls ? new TCPClient(host, port, THROW, rootCertificate, debug, ktls) : new TCPClient(host, port, THROW, debug);
+  };
+}
+
 TCPClient::~TCPClient() {
-#ifdef _WIN32
   if (_useTls) {
     SSL_shutdown(_ssl);
     SSL_free(_ssl);
     SSL_CTX_free(_sslCtx);
     EVP_cleanup();
   }
-#endif
   PLATFORM::CloseConnection(_socket);
 }
 
 std::string TCPClient::GetHost() const { return _host; }
 uint16_t TCPClient::GetPort() const { return _port; }
+TCPClient::LinkStats TCPClient::GetLinkStats() const {
+  std::lock_guard lock(_linkStatsMutex);
+  return _linkStats;
+}
+SendScheduler& TCPClient::GetScheduler() { return _scheduler; }
+void TCPClient::SetSlicing(bool slicing) { _slicing = slicing; }
+void TCPClient::ProbeRtt() {
+  std::lock_guard lock(_linkStatsMutex);
+  _rttProbeArmed = true;
+}
+void TCPClient::SetRecorder(TraceRecorder* recorder) { _recorder = recorder; }
+void TCPClient::RecordSent(size_t size, Clock::time_point start) {
+  auto now = Clock::now();
+  std::lock_guard lock(_linkStatsMutex);
+  _linkStats.bytesSent += sizeof(size_t) + size;
+  _linkStats.messagesSent++;
+  if (_rttProbeArmed) {
+    _rttProbeArmed = false;
+    _rttProbeSentAt = now;
+  }
+  double seconds = std::chrono::duration<double>(now - start).count();
+  if (size >= throughput_sample_min_size && seconds > 0) {
+    double sample = size / seconds;
+    _linkStats.sendBytesPerSec = _linkStats.sendBytesPerSec ? _linkStats.sendBytesPerSec + THROUGHPUT_ALPHA * (sample - _linkStats.sendBytesPerSec) : sample;
+  }
+}
+void TCPClient::RecordReceived(size_t size, Clock::time_point headerAt) {
+  auto now = Clock::now();
+  std::lock_guard lock(_linkStatsMutex);
+  _linkStats.bytesReceived += sizeof(size_t) + size;
+  _linkStats.messagesReceived++;
+  if (_rttProbeSentAt != Clock::time_point()) {
+    double sample = std::chrono::duration<double, std::milli>(headerAt - _rttProbeSentAt).count();
+    _rttProbeSentAt = Clock::time_point();
+    if (!_linkStats.rttSamples) {
+      _linkStats.rttMs = sample;
+      _linkStats.rttVarMs = sample / 2;
+    }
+    else {
+      _linkStats.rttVarMs += RTT_BETA * (std::abs(_linkStats.rttMs - sample) - _linkStats.rttVarMs);
+      _linkStats.rttMs += RTT_ALPHA * (sample - _linkStats.rttMs);
+    }
+    _linkStats.rttSamples++;
+  }
+  double seconds = std::chrono::duration<double>(now - headerAt).count();
+  if (size >= throughput_sample_min_size && seconds > 0) {
+    double sample = size / seconds;
+    _linkStats.receiveBytesPerSec =
+        _linkStats.receiveBytesPerSec ? _linkStats.receiveBytesPerSec + THROUGHPUT_ALPHA * (sample - _linkStats.receiveBytesPerSec) : sample;
+  }
+}
+bool TCPClient::IsKtlsSendActive() const {
+#ifdef SSL_OP_ENABLE_KTLS
+  return _ssl && BIO_get_ktls_send(SSL_get_wbio(_ssl));
+#else
+  return false;
+#endif
+}
+bool TCPClient::ExportKeyingMaterial(unsigned char* out, size_t size, const std::string& label) const {
+  if (!_useTls || !_ssl)
+    return false;
+  std::lock_guard lock(_sslMutex);
+  return SSL_export_keying_material(_ssl, out, size, label.c_str(), label.size(), nullptr, 0, 0) == 1;
+}
 
 std::string TCPClient::ResolveIP(std::string host) {
 #ifdef _WIN32
@@ -383,7 +713,6 @@ std::string TCPClient::ResolveIP(std::string host) {
 }
 
 bool TCPClient::InitializeTLS(const std::string& host) {
-#ifdef _WIN32
   if (_sslCtx)
     return true;
 
@@ -399,6 +728,11 @@ bool TCPClient::InitializeTLS(const std::string& host) {
 
   SSL_CTX_set_min_proto_version(_sslCtx, TLS1_3_VERSION);
   SSL_CTX_set_max_proto_version(_sslCtx, TLS1_3_VERSION);
+#ifdef SSL_OP_ENABLE_KTLS
+  // Only takes effect if both the kernel (tls module) and the negotiated cipher support it; otherwise OpenSSL stays in user space
+  if (_useKtls)
+    SSL_CTX_set_options(_sslCtx, SSL_OP_ENABLE_KTLS);
+#endif
 
   // === Load root CA ===
   BIO* bio = BIO_new_mem_buf(_rootCertificate.data(), -1);
@@ -436,6 +770,8 @@ bool TCPClient::InitializeTLS(const std::string& host) {
   }
 
   SSL_set_fd(_ssl, static_cast<int>(_socket));
+  // a record with nothing for the reader must not make SSL_read block for the next one with _sslMutex held
+  SSL_clear_mode(_ssl, SSL_MODE_AUTO_RETRY);
   SSL_set_tlsext_host_name(_ssl, host.c_str());
 
   // === Perform handshake ===
@@ -458,6 +794,7 @@ bool TCPClient::InitializeTLS(const std::string& host) {
     return false;
   }
 
+  if (_debug && _useKtls)
+    printf("kTLS send: %s\n", IsKtlsSendActive() ? "on" : "off");
   return true;
-#endif
 }
\ No newline at end of file
@@ -1,6 +1,14 @@
 #pragma once
 #define NOMINMAX
+#include "SendScheduler.h"
+#include "TraceRecorder.h"
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 #include <string>
@@ -28,6 +36,26 @@ class TCPClient {
 public:
   enum RetryPolicy { SILENT, THROW };
   static constexpr uint16_t buffer_size = 4096;
+  static constexpr size_t file_chunk_size = 64 * 1024;
+  /// @brief Smaller messages only measure the copy into the socket buffer, not the link
+  static constexpr size_t throughput_sample_min_size = 64 * 1024;
+  /// @brief Set in the size of a message whose body comes in slices, each one [u64 size | slice_flag][that many bytes]. Whole messages
+  /// may come between two slices, never another sliced one. See SetSlicing()
+  static constexpr uint64_t sliced_message_flag = 1ull << 63;
+  static constexpr uint64_t slice_flag = 1ull << 62;
+
+  /// @brief Link estimate. RTT is smoothed like TCP's SRTT/RTTVAR (RFC 6298), throughput is an EWMA over large messages
+  struct LinkStats {
+    double rttMs = 0;
+    double rttVarMs = 0;
+    double sendBytesPerSec = 0;
+    double receiveBytesPerSec = 0;
+    uint64_t bytesSent = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t messagesSent = 0;
+    uint64_t messagesReceived = 0;
+    uint64_t rttSamples = 0;
+  };
 
 private:
   char _buffer[buffer_size];
@@ -42,26 +70,79 @@ private:
   PLATFORM_ADDRESS _address;
 
   bool _useTls = false;
+  /// @brief Ask OpenSSL to hand the record layer to the kernel (Linux kTLS). Silently ignored where unsupported
+  bool _useKtls = false;
   std::vector<unsigned char> _rootCertificate;
-#ifdef _WIN32
   SSL_CTX* _sslCtx = nullptr;
   SSL* _ssl = nullptr;
-#endif
+  /// @brief An SSL* can't be read and written from two threads at once, and a file may go from one while another waits for replies:
+  /// every call into it holds this. Also guards closing the socket
+  mutable std::mutex _sslMutex;
+  /// @brief SSL_read that waits for the socket to be readable without the lock, so it doesn't hold up a writer meanwhile
+  int ReadTls(void* data, int size);
+  int WriteTls(const void* data, int size);
+
+  using Clock = std::chrono::steady_clock;
+  /// @brief Guards the stats and the probe: sends can come from several threads
+  mutable std::mutex _linkStatsMutex;
+  LinkStats _linkStats;
+  bool _rttProbeArmed = false;
+  Clock::time_point _rttProbeSentAt;
+  void RecordSent(size_t size, Clock::time_point start);
+  void RecordReceived(size_t size, Clock::time_point headerAt);
+
+  SendScheduler _scheduler;
+  TraceRecorder* _recorder = nullptr;
+  std::atomic<bool> _slicing = false;
 
   bool InitializeTLS(const std::string& host);
+  /// @brief Waits for the lease to admit the next `size` bytes of the message and, if it goes in slices, announces them as one
+  bool BeginPiece(SendScheduler::Lease& lease, size_t size);
+  /// @brief SendDataRaw in `file_chunk_size` pieces, each admitted by the lease's rate limit
+  bool SendDataPaced(SendScheduler::Lease& lease, const char* data, size_t size);
+  /// @brief Streams `size` bytes of an open file (positioned already) through the regular send path, in `file_chunk_size` pieces
+  bool SendFileBuffered(SendScheduler::Lease& lease, std::ifstream& file, uint64_t size);
+#ifdef __linux__
+  /// @brief Streams `size` bytes of `fd` from `offset` with sendfile(2) (plain TCP) or SSL_sendfile (kTLS)
+  bool SendFileZeroCopy(SendScheduler::Lease& lease, int fd, uint64_t offset, uint64_t size);
+#endif
 
 public:
   static std::string ResolveIP(std::string host);
 
-  /// @deprecated used by the useless TCPServer (C++ seems to not be the best in this)
+  /// @deprecated Wraps an already accepted socket. TCPServer hands out FramedConnection instead
   TCPClient(PLATFORM_SOCKET socket, PLATFORM_ADDRESS address);
   /// @param host Either domain or IP
   TCPClient(std::string host, uint16_t port, RetryPolicy retryPolicy, bool debug = false);
-  TCPClient(std::string host, uint16_t port, RetryPolicy retryPolicy, const std::vector<unsigned char>& rootCertificate, bool debug = false);
+  /// @param ktls Enable kernel TLS offload (Linux, OpenSSL 3 built with ktls). Falls back to user-space TLS if the kernel refuses
+  TCPClient(std::string host, uint16_t port, RetryPolicy retryPolicy, const std::vector<unsigned char>& rootCertificate, bool debug = false,
+            bool ktls = false);
   TCPClient(const TCPClient& other);
   ~TCPClient();
   std::string GetHost() const;
   uint16_t GetPort() const;
+  /// @returns true if TLS records are currently written by the kernel, so SendFile goes straight from the page cache
+  bool IsKtlsSendActive() const;
+  /// @brief How to open more connections to the same server, set up the same way (TLS, root certificate, kTLS), for data that goes
+  /// alongside this one. Holds copies of the settings: usable on another thread, and after this client is gone
+  /// @returns A factory of clients the caller owns; it throws if it can't connect
+  std::function<TCPClient*()> Sibling() const;
+  /// @returns A snapshot
+  LinkStats GetLinkStats() const;
+  /// @brief RFC 5705 / TLS 1.3 exporter: secret material both peers can derive from the session without sending it
+  /// @returns false if there is no TLS session (plain TCP or not connected)
+  bool ExportKeyingMaterial(unsigned char* out, size_t size, const std::string& label) const;
+  /// @brief Priorities and rate caps applied to the Send* functions
+  SendScheduler& GetScheduler();
+  /// @brief BULK messages go in slices (`sliced_message_flag`) from now on, so higher classes' messages can go between them instead
+  /// of waiting for all of a file. Only if the peer said it reads them
+  void SetSlicing(bool slicing);
+  /// @brief Takes an RTT sample between the end of the next sent message and the arrival of the next received one. Meant for
+  /// request/response pairs the peer answers immediately (IDLE polls, heartbeats)
+  void ProbeRtt();
+  /// @brief Logs every message sent and received from now on (nullptr stops). Not owned; may be shared with the next client after a
+  /// reconnect, so one trace covers the whole run
+  void SetRecorder(TraceRecorder* recorder);
 
   /// @brief Acquires data through net. Keeps waiting, until the data is received. Automatically deletes the dynamic buffer. Interprets 1-length data with 0
   /// as empty
@@ -70,17 +151,30 @@ public:
   /// @brief Acquires data through net. Keeps waiting, until the data is received
   /// @returns Dynamic char buffer
   char* ReceiveRawData(size_t* sz = nullptr);
+  /// @brief Acquires data through net in pieces of at most `file_chunk_size`, handed to `sink` as they come: a large payload is never
+  /// held whole
+  /// @returns false if the connection was lost before the end
+  bool ReceiveData(const std::function<void(const char* data, size_t size)>& sink);
 
   /// @brief Raw send function, no protocol-specific logic (just sends `data` over the network)
   /// @returns true if data was sent successfully
   bool SendDataRaw(const char* data, size_t size);
   /// @brief "Raw" send function. Sends size of `data`, then `data`
+  /// @param cls Traffic class, see SendScheduler. Safe to call from several threads
   /// @returns true if data was sent successfully
-  bool SendData(const char* data, size_t size);
+  bool SendData(const char* data, size_t size, SendScheduler::TrafficClass cls = SendScheduler::CONTROL);
   /// @brief Sends size of `data`, then `data`
   /// @returns True if data was sent successfully, false otherwise
-  bool SendData(const std::string& data);
+  bool SendData(const std::string& data, SendScheduler::TrafficClass cls = SendScheduler::CONTROL);
   /// @brief Sends multiple buffers as a single message
   /// @returns True if data was sent successfully, false otherwise
-  bool SendData(const std::vector<std::pair<const char*, size_t>>& data);
+  bool SendData(const std::vector<std::pair<const char*, size_t>>& data, SendScheduler::TrafficClass cls = SendScheduler::CONTROL);
+  /// @brief Sends `prefix` followed by the contents of the file at `path` as a single message. Uses sendfile/SSL_sendfile when possible,
+  /// otherwise reads the file in chunks (never buffers it whole)
+  /// @returns True if data was sent successfully, false otherwise (including when the file can't be opened; nothing is sent then)
+  bool SendFile(const std::filesystem::path& path, const char* prefix = nullptr, size_t prefixSize = 0,
+                SendScheduler::TrafficClass cls = SendScheduler::BULK);
+  /// @brief SendFile() of `length` bytes of the file from `offset` (as much as there is of them)
+  bool SendFileRange(const std::filesystem::path& path, uint64_t offset, uint64_t length, const char* prefix = nullptr, size_t prefixSize = 0,
+                     SendScheduler::TrafficClass cls = SendScheduler::BULK);
 };
\ No newline at end of file
@@ -1,173 +1,124 @@
 #include "TCPServer.h"
-#include <chrono>
-
-//Конструктор принимает:
-// port - порт на котором будем запускать сервер
-// handler - callback-функция запускаямая при подключении клиента
-//          объект которого и передают первым аргументом в callback
-//          (пример лямбда-функции: [](TCPClient){...do something...})
-TCPServer::TCPServer(const uint16_t port, handler_function_t handler) : port(port), handler(handler) {}
-
-//Деструктор останавливает сервер если он был запущен
-//и вычищает заданную версию WinSocket
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+TCPServer::TCPServer(Options options, Handlers handlers) : _options(options), _handlers(std::move(handlers)) {
+  if (!_options.threads)
+    _options.threads = std::max(1u, std::thread::hardware_concurrency());
+}
 TCPServer::~TCPServer() {
-	if (_status == status::up)
-		Stop();
-#ifdef _WIN32 // Windows NT
-	WSACleanup();
-#endif
+  Stop();
+  Join();
 }
 
-//Задаёт callback-функцию запускаямую при подключении клиента
-void TCPServer::SetHandler(TCPServer::handler_function_t handler) { this->handler = handler; }
-
-// Getter/Setter порта
-uint16_t TCPServer::GetPort() const { return port; }
-uint16_t TCPServer::SetPort(const uint16_t port) {
-	this->port = port;
-	Restart(); //Перезапустить если сервер был запущен
-	return port;
+int TCPServer::Listen() {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+  if (fd < 0)
+    return -1;
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+  sockaddr_in address {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(_options.port);
+  if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, _options.backlog) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
 }
 
-//Перезапуск сервера
-TCPServer::status TCPServer::Restart() {
-	if (_status == status::up)
-		Stop();
-	return Start();
+bool TCPServer::Start() {
+  for (size_t i = 0; i < _options.threads; i++) {
+    auto worker = std::make_unique<Worker>();
+    worker->listener = Listen();
+    if (worker->listener < 0) {
+      _error = std::string("Listening on port ") + std::to_string(_options.port) + " failed: " + strerror(errno);
+      for (auto& started : _workers)
+        close(started->listener);
+      _workers.clear();
+      return false;
+    }
+    Worker* raw = worker.get();
+    raw->loop.Add(raw->listener, EPOLLIN, [this, raw](uint32_t) { Accept(*raw); });
+    _workers.push_back(std::move(worker));
+  }
+  for (auto& worker : _workers) {
+    Worker* raw = worker.get();
+    raw->thread = std::thread([raw] { raw->loop.Run(); });
+  }
+  return true;
 }
-
-// Вход в поток обработки соединений
-void TCPServer::JoinLoop() {
-	if (handler_thread.joinable())
-		handler_thread.join();
+void TCPServer::Stop() {
+  for (auto& worker : _workers)
+    worker->loop.Stop();
+}
+void TCPServer::Join() {
+  for (auto& worker : _workers) {
+    if (worker->thread.joinable())
+      worker->thread.join();
+    if (worker->listener >= 0) {
+      close(worker->listener);
+      worker->listener = -1;
+    }
+  }
 }
 
-#ifdef _WIN32 // Windows NT
-	//Запуск сервера
-	TCPServer::status TCPServer::Start() {
-		WSAStartup(MAKEWORD(2, 2), &w_data); //Задаём версию WinSocket
-
-		SOCKADDR_IN address;					   //Структура хост/порт/протокол для инициализации сокета
-		address.sin_addr.S_un.S_addr = INADDR_ANY; //Любой IP адресс
-		address.sin_port = htons(port);			   //Задаём порт
-		address.sin_family = AF_INET;			   // AF_INET - Cемейство адресов для IPv4
-
-		//Инициализируем наш сокет и проверяем корректно ли прошла инициализация
-		//в противном случае возвращаем статус с ошибкой
-		if (static_cast<int>(serv_socket = socket(AF_INET, SOCK_STREAM, 0)) == SOCKET_ERROR)
-			return _status = status::err_socket_init;
-		//Присваиваем к сокету адресс и порт и проверяем на коректность сокет
-		//в противном случае возвращаем статус с ошибкой
-		if (bind(serv_socket, (struct sockaddr*)&address, sizeof(address)) == SOCKET_ERROR)
-			return _status = status::err_socket_bind;
-		//Запускаем прослушку и проверяем запустилась ли она
-		//в противном случае возвращаем статус с ошибкой
-		if (listen(serv_socket, SOMAXCONN) == SOCKET_ERROR)
-			return _status = status::err_socket_listening;
-
-		//Меняем статус, запускаем обработчик соединений и возвращаем статус
-		_status = status::up;
-		handler_thread = std::thread([this] { HandlingLoop(); });
-		return _status;
-	}
-
-	//Остановка сервера
-	void TCPServer::Stop() {
-		_status = status::close;						   //Изменение статуса
-		closesocket(serv_socket);						   //Закрытие сокета
-		JoinLoop();										   //Ожидание завершения
-		for (std::thread& cl_thr : client_handler_threads) //Перебор всех клиентских потоков
-			cl_thr.join();								   // Ожидание их завершения
-		client_handler_threads.clear();					   // Очистка списка клиентских потоков
-		client_handling_end.clear();					   // Очистка списка идентификаторов завершённых клиентских потоков
-	}
-
-	// Функиця обработки соединений
-	void TCPServer::HandlingLoop() {
-		while (_status == status::up) {
-			SOCKET client_socket;			   //Сокет клиента
-			SOCKADDR_IN client_addr;		   //Адресс клиента
-			int addrlen = sizeof(client_addr); //Размер адреса клиента
-			//Получение сокета и адреса клиента
-			//(если сокет коректен и сервер зарущен запуск потока обработки)
-			if ((client_socket = accept(serv_socket, (struct sockaddr*)&client_addr, &addrlen)) != 0 && _status == status::up) {
-				client_handler_threads.push_back(std::thread([this, &client_socket, &client_addr] {
-					handler(TCPClient(client_socket, client_addr)); //Запуск callback-обработчика
-					//Добавление идентификатора в список идентификаторов завершённых клиентских потоков
-					client_handling_end.push_back(std::this_thread::get_id());
-				}));
-			}
-			//Очистка отработанных клиентских потоков
-			if (!client_handling_end.empty())
-				for (std::list<std::thread::id>::iterator id_it = client_handling_end.begin(); !client_handling_end.empty(); id_it = client_handling_end.begin())
-					for (std::list<std::thread>::iterator thr_it = client_handler_threads.begin(); thr_it != client_handler_threads.end(); ++thr_it)
-						if (thr_it->get_id() == *id_it) {
-							thr_it->join();
-							client_handler_threads.erase(thr_it);
-							client_handling_end.erase(id_it);
-							break;
-						}
-
-			std::this_thread::sleep_for(std::chrono::milliseconds(50));
-		}
-	}
-#else // *nix
-	//Запуск сервера (по аналогии с реализацией для Windows)
-	TCPServer::status TCPServer::Start() {
-		struct sockaddr_in server;
-		server.sin_addr.s_addr = INADDR_ANY;
-		server.sin_port = htons(port);
-		server.sin_family = AF_INET;
-		serv_socket = socket(AF_INET, SOCK_STREAM, 0);
-
-		if (serv_socket == -1)
-			return _status = status::err_socket_init;
-		if (bind(serv_socket, (struct sockaddr*)&server, sizeof(server)) < 0)
-			return _status = status::err_socket_bind;
-		if (listen(serv_socket, 3) < 0)
-			return _status = status::err_socket_listening;
-
-		_status = status::up;
-		handler_thread = std::thread([this]() { this->HandlingLoop(); });
-		return _status;
-	}
-
-	//Остановка сервера
-	void TCPServer::Stop() {
-		_status = status::close;
-		close(serv_socket);
-		JoinLoop();
-		for (std::thread& cl_thr : client_handler_threads)
-			cl_thr.join();
-		client_handler_threads.clear();
-		client_handling_end.clear();
-		if (handler_thread.joinable())
-			handler_thread.detach();
-	}
-
-	// Функиця обработки соединений (по аналогии с реализацией для Windows)
-	void TCPServer::HandlingLoop() {
-		while (_status == status::up) {
-			int client_socket;
-			struct sockaddr_in client_addr;
-			int addrlen = sizeof(struct sockaddr_in);
-			if ((client_socket = accept(serv_socket, (struct sockaddr*)&client_addr, (socklen_t*)&addrlen)) >= 0 && _status == status::up)
-				client_handler_threads.push_back(std::thread([this, &client_socket, &client_addr] {
-					handler(TCPClient(client_socket, client_addr));
-					client_handling_end.push_back(std::this_thread::get_id());
-				}));
-
-			if (!client_handling_end.empty())
-				for (std::list<std::thread::id>::iterator id_it = client_handling_end.begin(); !client_handling_end.empty(); id_it = client_handling_end.begin())
-					for (std::list<std::thread>::iterator thr_it = client_handler_threads.begin(); thr_it != client_handler_threads.end(); ++thr_it)
-						if (thr_it->get_id() == *id_it) {
-							thr_it->join();
-							client_handler_threads.erase(thr_it);
-							client_handling_end.erase(id_it);
-							break;
-						}
+void TCPServer::Accept(Worker& worker) {
+  // bounded so one worker flooded with connects still serves its existing connections
+  for (int i = 0; i < 64; i++) {
+    int fd = accept4(worker.listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      // EAGAIN: drained; EMFILE/ENFILE: level-triggered epoll retries once descriptors are freed
+      return;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    SSL* ssl = nullptr;
+    if (_options.tls) {
+      ssl = SSL_new(_options.tls);
+      if (!ssl) {
+        close(fd);
+        continue;
+      }
+      SSL_set_fd(ssl, fd);
+      SSL_set_accept_state(ssl);
+    }
+    auto connection = std::make_shared<FramedConnection>(worker.loop, fd, ssl);
+    _connections++;
+    // before Start(): with TLS the handshake (and the first frames) may complete right inside it
+    if (_handlers.onConnect)
+      _handlers.onConnect(connection);
+    connection->Start(_handlers.onMessage, [this](FramedConnection& closed) {
+      _connections--;
+      if (_handlers.onClose)
+        _handlers.onClose(closed);
+    });
+  }
+}
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(50));
-		}
-	}
-#endif
\ No newline at end of file
+const std::string& TCPServer::GetError() const { return _error; }
+size_t TCPServer::GetConnectionCount() const { return _connections; }
+
+SSL_CTX* TCPServer::CreateTlsContext(const std::string& certificatePath, const std::string& keyPath) {
+  SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+  if (!ctx)
+    return nullptr;
+  SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+  if (SSL_CTX_use_certificate_chain_file(ctx, certificatePath.c_str()) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx, keyPath.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1) {
+    SSL_CTX_free(ctx);
+    return nullptr;
+  }
+  return ctx;
+}
@@ -1,56 +1,67 @@
 #pragma once
-#include "TCPClient.h"
+#include "EventLoop.h"
+#include "FramedConnection.h"
+#include <atomic>
+#include <cstdint>
 #include <functional>
-#include <list>
+#include <memory>
+#include <openssl/ssl.h>
+#include <string>
 #include <thread>
+#include <vector>
 
-// Damn fucked up. Seems it doesn't clean the shit up well after it's done, so next time it just won't start
-// I will keep this, but just to be
-// DO NOT USE
+/// @brief Event-driven server for the TCPClient framing. Every worker thread runs its own EventLoop with its own SO_REUSEPORT listener,
+/// so the kernel spreads accepts across workers and a connection never changes threads. Handlers run on the connection's worker:
+/// they must be thread-safe with respect to each other, and must not block. Linux only
 class TCPServer {
-private:
-	//Тип Callback-функции обработчика клиента
-	typedef std::function<void(TCPClient)> handler_function_t;
-	//Статус сервера
-	enum class status : uint8_t {
-		up = 0,
-		err_socket_init = 1,
-		err_socket_bind = 2,
-		err_socket_listening = 3,
-		close = 4
-	};
-
-	uint16_t port; //Порт
-	status _status = status::close;
-	handler_function_t handler;
-
-	std::thread handler_thread;
-	std::list<std::thread> client_handler_threads;
-	std::list<std::thread::id> client_handling_end;
-
-#ifdef _WIN32
-	SOCKET serv_socket = INVALID_SOCKET;
-	WSAData w_data;
-#else
-	int serv_socket;
-#endif
-
-	void HandlingLoop();
 public:
-	TCPServer(const uint16_t port, handler_function_t handler);
-	~TCPServer();
+  struct Handlers {
+    /// @brief Right after accept (the TLS handshake may still be in progress; Send() is queued until it's done)
+    std::function<void(const std::shared_ptr<FramedConnection>& connection)> onConnect;
+    FramedConnection::MessageHandler onMessage;
+    FramedConnection::CloseHandler onClose;
+  };
+  struct Options {
+    uint16_t port = 1337;
+    /// @brief 0 = one per hardware thread
+    size_t threads = 0;
+    /// @brief Server context to terminate TLS with, nullptr for plain TCP. Not owned, must outlive the server
+    SSL_CTX* tls = nullptr;
+    int backlog = 4096;
+  };
+
+  TCPServer(Options options, Handlers handlers);
+  /// @brief Stops and joins
+  ~TCPServer();
+  TCPServer(const TCPServer&) = delete;
+  TCPServer& operator=(const TCPServer&) = delete;
 
-	//! Set client handler
-	void SetHandler(handler_function_t handler);
+  /// @brief Binds the listeners and starts the workers
+  /// @returns false (and an error in `GetError()`) if a listener could not be set up
+  bool Start();
+  /// @brief Asks the workers to finish. Thread-safe, doesn't wait
+  void Stop();
+  /// @brief Waits for the workers to finish
+  void Join();
 
-	uint16_t GetPort() const;
-	uint16_t SetPort(const uint16_t port);
+  const std::string& GetError() const;
+  size_t GetConnectionCount() const;
+  /// @brief TLS 1.3 server context from PEM files. nullptr if they can't be loaded
+  static SSL_CTX* CreateTlsContext(const std::string& certificatePath, const std::string& keyPath);
 
-	status GetStatus() const { return _status; }
+private:
+  struct Worker {
+    EventLoop loop;
+    int listener = -1;
+    std::thread thread;
+  };
 
-	status Restart();
-	status Start();
-	void Stop();
+  Options _options;
+  Handlers _handlers;
+  std::vector<std::unique_ptr<Worker>> _workers;
+  std::atomic<size_t> _connections { 0 };
+  std::string _error;
 
-	void JoinLoop();
-};
\ No newline at end of file
+  int Listen();
+  void Accept(Worker& worker);
+};
@@ -0,0 +1,129 @@
+#include "TraceRecorder.h"
+#include <algorithm>
+#include <cstring>
+
+// Endianness is assumed little (x86/ARM), like the rest of the wire format
+template <typename T>
+static void WritePod(std::ofstream& file, T value) {
+  file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+template <typename T>
+static bool ReadPod(std::ifstream& file, T& value) {
+  return (bool)file.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+TraceRecorder::TraceRecorder(const std::string& path, bool payloads, size_t payloadLimit)
+    : _file(path, std::ios::binary | std::ios::trunc), _payloads(payloads), _payloadLimit(payloadLimit), _last(Clock::now()) {
+  if (!_file.is_open())
+    return;
+  _file.write(Trace::magic, sizeof(Trace::magic));
+  WritePod<uint8_t>(_file, Trace::version);
+  WritePod<uint8_t>(_file, payloads ? Trace::flag_payloads : 0);
+  WritePod<uint16_t>(_file, 0);
+  WritePod<uint64_t>(_file, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+TraceRecorder::~TraceRecorder() { Flush(); }
+
+bool TraceRecorder::IsOk() const { return _file.is_open() && _file.good(); }
+bool TraceRecorder::StoresPayloads() const { return _payloads; }
+uint64_t TraceRecorder::GetRecordCount() const {
+  std::lock_guard lock(_mutex);
+  return _records;
+}
+
+void TraceRecorder::WriteVarint(uint64_t value) {
+  char bytes[10];
+  int n = 0;
+  do {
+    bytes[n] = (char)(value & 0x7F);
+    value >>= 7;
+    if (value)
+      bytes[n] |= 0x80;
+    n++;
+  } while (value);
+  _file.write(bytes, n);
+}
+
+void TraceRecorder::Record(Trace::Direction direction, const char* data, size_t size) { Record(direction, size, { { data, size } }); }
+void TraceRecorder::Record(Trace::Direction direction, uint64_t size, const Pieces& pieces) {
+  std::lock_guard lock(_mutex);
+  if (!IsOk())
+    return;
+  uint8_t action = Trace::no_action;
+  if (direction == Trace::SENT)
+    for (auto& [data, length] : pieces)
+      if (length) {
+        action = (uint8_t)data[0];
+        break;
+      }
+  auto now = Clock::now();
+  WritePod<uint8_t>(_file, direction);
+  WritePod<uint8_t>(_file, action);
+  WriteVarint(std::chrono::duration_cast<std::chrono::microseconds>(now - _last).count());
+  WriteVarint(size);
+  _last = now;
+  _records++;
+  if (!_payloads)
+    return;
+  uint64_t available = 0;
+  for (auto& piece : pieces)
+    available += piece.second;
+  uint64_t stored = std::min<uint64_t>({ size, available, _payloadLimit });
+  WriteVarint(stored);
+  for (auto& [data, length] : pieces) {
+    if (!stored)
+      break;
+    size_t part = (size_t)std::min<uint64_t>(length, stored);
+    _file.write(data, part);
+    stored -= part;
+  }
+}
+void TraceRecorder::Flush() {
+  std::lock_guard lock(_mutex);
+  if (_file.is_open())
+    _file.flush();
+}
+
+bool TraceReader::Open(const std::string& path) {
+  _file.open(path, std::ios::binary);
+  char magic[sizeof(Trace::magic)];
+  uint8_t version;
+  uint16_t reserved;
+  if (!_file.read(magic, sizeof(magic)) || memcmp(magic, Trace::magic, sizeof(magic)) != 0)
+    return false;
+  if (!ReadPod(_file, version) || version != Trace::version)
+    return false;
+  return ReadPod(_file, _flags) && ReadPod(_file, reserved) && ReadPod(_file, _startTimeMs);
+}
+bool TraceReader::HasPayloads() const { return _flags & Trace::flag_payloads; }
+uint64_t TraceReader::GetStartTimeMs() const { return _startTimeMs; }
+
+bool TraceReader::ReadVarint(uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    uint8_t byte;
+    if (!ReadPod(_file, byte))
+      return false;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+bool TraceReader::Next(Trace::Record& record) {
+  uint8_t direction;
+  uint64_t delta;
+  if (!ReadPod(_file, direction) || !ReadPod(_file, record.action) || !ReadVarint(delta) || !ReadVarint(record.size))
+    return false;
+  record.direction = (Trace::Direction)direction;
+  _offset += std::chrono::microseconds(delta);
+  record.offset = _offset;
+  record.payload.clear();
+  if (!HasPayloads())
+    return true;
+  uint64_t stored;
+  if (!ReadVarint(stored) || stored > record.size)
+    return false;
+  record.payload.resize((size_t)stored);
+  return stored == 0 || (bool)_file.read(record.payload.data(), (std::streamsize)stored);
+}
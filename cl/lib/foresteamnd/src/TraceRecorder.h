@@ -0,0 +1,88 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// @brief Binary trace of framed messages, for reproducing a session's traffic offline (see rut-replay).
+///
+/// File: "MRTR", u8 version, u8 flags (bit 0: payloads stored), u16 reserved, u64 start time (unix ms), then one record per message:
+/// u8 direction, u8 action (first payload byte of sent messages, `no_action` for received ones), varint microseconds since the previous
+/// record, varint message size, and with payloads: varint stored size (at most the payload limit) followed by that many bytes.
+/// Little-endian throughout
+namespace Trace {
+  static constexpr char magic[4] = { 'M', 'R', 'T', 'R' };
+  static constexpr uint8_t version = 1;
+  static constexpr uint8_t flag_payloads = 1;
+  static constexpr uint8_t no_action = 0xFF;
+
+  enum Direction : uint8_t { SENT = 0, RECEIVED = 1 };
+
+  struct Record {
+    Direction direction;
+    uint8_t action;
+    /// @brief Since the start of the trace
+    std::chrono::microseconds offset;
+    uint64_t size;
+    /// @brief Empty unless the trace stores payloads; shorter than `size` if it was cut at the payload limit
+    std::string payload;
+  };
+} // namespace Trace
+
+/// @brief Appends records to a trace file. Thread-safe: one recorder may be shared by a client's sending and receiving threads
+class TraceRecorder {
+public:
+  using Pieces = std::vector<std::pair<const char*, size_t>>;
+
+  /// @param payloads Store message contents, not just their sizes (traces get as large as the traffic, and may hold sensitive data)
+  /// @param payloadLimit Longer payloads are cut to this many bytes
+  TraceRecorder(const std::string& path, bool payloads = false, size_t payloadLimit = SIZE_MAX);
+  ~TraceRecorder();
+  TraceRecorder(const TraceRecorder&) = delete;
+  TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+  /// @returns false if the file couldn't be created or a write failed
+  bool IsOk() const;
+  bool StoresPayloads() const;
+  uint64_t GetRecordCount() const;
+
+  void Record(Trace::Direction direction, const char* data, size_t size);
+  /// @brief One message made of several pieces. `size` may exceed their sum (file contents that were never in memory): the payload is
+  /// stored only as far as the pieces go
+  void Record(Trace::Direction direction, uint64_t size, const Pieces& pieces);
+  void Flush();
+
+private:
+  using Clock = std::chrono::steady_clock;
+  mutable std::mutex _mutex;
+  std::ofstream _file;
+  bool _payloads;
+  size_t _payloadLimit;
+  Clock::time_point _last;
+  uint64_t _records = 0;
+
+  void WriteVarint(uint64_t value);
+};
+
+/// @brief Reads a trace written by TraceRecorder
+class TraceReader {
+public:
+  /// @returns false if the file can't be opened or is not a trace of a known version
+  bool Open(const std::string& path);
+  /// @returns false at the end of the trace (or at a truncated record: the recorder may have died mid-write)
+  bool Next(Trace::Record& record);
+  bool HasPayloads() const;
+  /// @brief Wall-clock start of the recording, unix ms
+  uint64_t GetStartTimeMs() const;
+
+private:
+  std::ifstream _file;
+  uint8_t _flags = 0;
+  uint64_t _startTimeMs = 0;
+  std::chrono::microseconds _offset { 0 };
+
+  bool ReadVarint(uint64_t& value);
+};
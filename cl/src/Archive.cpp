@@ -0,0 +1,727 @@
+#include "Archive.h"
+#include "Compression.h"
+#include "helpers/GeneralHelpers.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+  constexpr size_t block_header_size = 8;
+
+  std::string FileName(std::string path) {
+    while (path.size() > 1 && (path.back() == '/' || path.back() == '\\'))
+      path.pop_back();
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+  }
+  std::filesystem::path NativePath(const std::string& path) {
+#ifdef _WIN32
+    return std::filesystem::path(GlobalHelpers::StringToWstring(path));
+#else
+    return std::filesystem::path(path);
+#endif
+  }
+  void Fail(Archive::Stats& stats, const std::string& path, const std::string& reason) {
+    if (stats.failed++ < Archive::max_reported_errors)
+      stats.errors.append(stats.errors.empty() ? "" : "\n").append(path).append(": ").append(reason);
+  }
+
+  template <typename T>
+  void Put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+  template <typename T>
+  T Get(const char* data) {
+    T value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+  std::string PathRecord(Archive::Record type, const std::string& path) {
+    std::string record(1, (char)type);
+    Put<uint16_t>(record, (uint16_t)path.size());
+    return record.append(path);
+  }
+
+  struct Entry {
+    std::string path, name;
+    bool directory = false, regular = false;
+    int64_t modified = 0;
+  };
+#ifdef _WIN32
+  /// @brief Links (reparse points) aren't followed: they can loop, and a junction may lead anywhere
+  void Classify(Entry& entry, DWORD attributes, const FILETIME& modified) {
+    bool link = attributes & FILE_ATTRIBUTE_REPARSE_POINT;
+    entry.directory = (attributes & FILE_ATTRIBUTE_DIRECTORY) && !link;
+    entry.regular = !(attributes & FILE_ATTRIBUTE_DIRECTORY) && !link;
+    entry.modified = GlobalHelpers::FileTimeToUnixMs(modified);
+  }
+#else
+  void Classify(Entry& entry, const struct stat& info) {
+    entry.directory = S_ISDIR(info.st_mode);
+    entry.regular = S_ISREG(info.st_mode);
+    entry.modified = GlobalHelpers::StatTimeToUnixMs(info);
+  }
+#endif
+  bool Stat(const std::string& path, Entry& entry) {
+    entry.path = path;
+    entry.name = FileName(path);
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(GlobalHelpers::StringToWstring(path).c_str(), GetFileExInfoStandard, &data))
+      return false;
+    // the root itself is followed if it's a link: that's what was asked for
+    Classify(entry, data.dwFileAttributes & ~FILE_ATTRIBUTE_REPARSE_POINT, data.ftLastWriteTime);
+#else
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+      return false;
+    Classify(entry, info);
+#endif
+    return true;
+  }
+  /// @brief Type and time come with the entry (FindFirstFileExW) or from one fstatat
+  bool List(const std::string& directory, std::vector<Entry>& entries) {
+#ifdef _WIN32
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileExW(GlobalHelpers::StringToWstring(GlobalHelpers::JoinPath(directory, "*")).c_str(), FindExInfoBasic, &data,
+                                   FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE)
+      return false;
+    do {
+      if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0)
+        continue;
+      Entry& entry = entries.emplace_back();
+      entry.name = GlobalHelpers::WindowsWstringToString(data.cFileName);
+      entry.path = GlobalHelpers::JoinPath(directory, entry.name);
+      Classify(entry, data.dwFileAttributes, data.ftLastWriteTime);
+    } while (FindNextFileW(find, &data));
+    FindClose(find);
+#else
+    DIR* handle = opendir(directory.c_str());
+    if (!handle)
+      return false;
+    while (dirent* found = readdir(handle)) {
+      if (strcmp(found->d_name, ".") == 0 || strcmp(found->d_name, "..") == 0)
+        continue;
+      struct stat info;
+      if (fstatat(dirfd(handle), found->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+        continue;
+      Entry& entry = entries.emplace_back();
+      entry.name = found->d_name;
+      entry.path = GlobalHelpers::JoinPath(directory, entry.name);
+      Classify(entry, info);
+    }
+    closedir(handle);
+#endif
+    return true;
+  }
+
+  class InputFile {
+  public:
+    ~InputFile() {
+#ifdef _WIN32
+      if (_file != INVALID_HANDLE_VALUE)
+        CloseHandle(_file);
+#else
+      if (_file >= 0)
+        close(_file);
+#endif
+    }
+    bool Open(const std::string& path) {
+#ifdef _WIN32
+      _file = CreateFileW(GlobalHelpers::StringToWstring(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      return _file != INVALID_HANDLE_VALUE;
+#else
+      _file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (_file < 0)
+        return false;
+      posix_fadvise(_file, 0, 0, POSIX_FADV_SEQUENTIAL);
+      return true;
+#endif
+    }
+    /// @returns What was read, short only at the end of the file; -1 on error
+    int64_t Read(char* buffer, size_t size) {
+      size_t total = 0;
+      while (total < size) {
+#ifdef _WIN32
+        DWORD read;
+        if (!ReadFile(_file, buffer + total, (DWORD)(size - total), &read, NULL))
+          return -1;
+#else
+        ssize_t read = ::read(_file, buffer + total, size - total);
+        if (read < 0 && errno == EINTR)
+          continue;
+        if (read < 0)
+          return -1;
+#endif
+        if (read == 0)
+          break;
+        total += read;
+      }
+      return (int64_t)total;
+    }
+
+  private:
+#ifdef _WIN32
+    HANDLE _file = INVALID_HANDLE_VALUE;
+#else
+    int _file = -1;
+#endif
+  };
+
+  class OutputFile {
+  public:
+    ~OutputFile() { Close(); }
+    bool Open(const std::string& path) {
+      Close();
+#ifdef _WIN32
+      _file = CreateFileW(GlobalHelpers::StringToWstring(path).c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                          NULL);
+      return _file != INVALID_HANDLE_VALUE;
+#else
+      _file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+      return _file >= 0;
+#endif
+    }
+    bool IsOpen() const {
+#ifdef _WIN32
+      return _file != INVALID_HANDLE_VALUE;
+#else
+      return _file >= 0;
+#endif
+    }
+    bool Write(const char* data, size_t size) {
+      while (size) {
+#ifdef _WIN32
+        DWORD written;
+        if (!WriteFile(_file, data, (DWORD)size, &written, NULL))
+          return false;
+#else
+        ssize_t written = ::write(_file, data, size);
+        if (written < 0 && errno == EINTR)
+          continue;
+        if (written <= 0)
+          return false;
+#endif
+        data += written;
+        size -= written;
+      }
+      return true;
+    }
+    /// @param modified ms since 1970
+    void SetModified(int64_t modified) {
+#ifdef _WIN32
+      uint64_t ticks = GlobalHelpers::UnixMsToFileTime(modified);
+      FILETIME time = { (DWORD)ticks, (DWORD)(ticks >> 32) };
+      SetFileTime(_file, NULL, NULL, &time);
+#else
+      timespec times[2] = { { 0, UTIME_OMIT }, { (time_t)(modified / 1000), (long)(modified % 1000) * 1000000 } };
+      futimens(_file, times);
+#endif
+    }
+    void Close() {
+      if (!IsOpen())
+        return;
+#ifdef _WIN32
+      CloseHandle(_file);
+      _file = INVALID_HANDLE_VALUE;
+#else
+      close(_file);
+      _file = -1;
+#endif
+    }
+
+  private:
+#ifdef _WIN32
+    HANDLE _file = INVALID_HANDLE_VALUE;
+#else
+    int _file = -1;
+#endif
+  };
+
+  /// @brief Pieces of the archive in order, some still being compressed. The reader adds, compressors fill in, the writer takes from the
+  /// front once it's ready. At most `_maxPieces` at once: that's the memory it takes
+  class Pipeline {
+  public:
+    explicit Pipeline(size_t compressors) : _maxPieces(2 * compressors + 4) {}
+
+    /// @returns false if the writer stopped: the reader should too
+    bool Emit(std::string data, bool compress = false) {
+      auto piece = std::make_shared<Piece>(Piece{ std::move(data), !compress });
+      std::unique_lock lock(_mutex);
+      _space.wait(lock, [&]() { return _stopped || _order.size() < _maxPieces; });
+      if (_stopped)
+        return false;
+      _order.push_back(piece);
+      if (compress) {
+        _todo.push_back(piece);
+        _work.notify_one();
+      }
+      else
+        _ready.notify_one();
+      return true;
+    }
+    void EndOfInput() {
+      std::lock_guard lock(_mutex);
+      _inputEnded = true;
+      _work.notify_all();
+      _ready.notify_all();
+    }
+    void Stop() {
+      std::lock_guard lock(_mutex);
+      _stopped = true;
+      _space.notify_all();
+      _work.notify_all();
+      _ready.notify_all();
+    }
+    /// @brief A compressor's loop: blocks that don't shrink stay as they are
+    void Compress() {
+      std::unique_lock lock(_mutex);
+      while (true) {
+        _work.wait(lock, [&]() { return _stopped || _inputEnded || !_todo.empty(); });
+        if (_stopped || _todo.empty())
+          return;
+        auto piece = _todo.front();
+        _todo.pop_front();
+        lock.unlock();
+        std::string compressed;
+        const std::string& block = piece->data;
+        if (Compression::Compress(Compression::DEFLATE, block.data() + block_header_size, block.size() - block_header_size, compressed)) {
+          std::string stored(block, 0, block_header_size);
+          uint32_t storedSize = (uint32_t)compressed.size();
+          memcpy(stored.data() + 4, &storedSize, sizeof(storedSize));
+          piece->data = std::move(stored.append(compressed));
+        }
+        lock.lock();
+        piece->ready = true;
+        _ready.notify_all();
+      }
+    }
+    /// @returns false at the end (or once stopped)
+    bool Next(std::string& data) {
+      std::unique_lock lock(_mutex);
+      _ready.wait(lock, [&]() { return _stopped || (_inputEnded && _order.empty()) || (!_order.empty() && _order.front()->ready); });
+      if (_stopped || _order.empty())
+        return false;
+      data = std::move(_order.front()->data);
+      _order.pop_front();
+      _space.notify_one();
+      return true;
+    }
+
+  private:
+    struct Piece {
+      std::string data;
+      bool ready;
+    };
+    size_t _maxPieces;
+    std::mutex _mutex;
+    std::condition_variable _space, _work, _ready;
+    std::deque<std::shared_ptr<Piece>> _order, _todo;
+    bool _inputEnded = false, _stopped = false;
+  };
+
+  /// @brief The reader's side of Write(): walks the tree and reads the files into `pipeline`
+  class Reader {
+  public:
+    Reader(const Archive::Options& options, Pipeline& pipeline, Archive::Stats& stats) : _options(options), _pipeline(pipeline), _stats(stats) {}
+
+    void Run() {
+      std::string header(Archive::magic, sizeof(Archive::magic));
+      Put<uint32_t>(header, _options.token);
+      if (!_pipeline.Emit(std::move(header)))
+        return;
+      Entry root;
+      if (!Stat(_options.root, root)) {
+        Error(FileName(_options.root), GlobalHelpers::LastErrorMessage());
+        return End();
+      }
+      if (!root.directory) {
+        if (!ReadFile(root, root.name))
+          return;
+        return End();
+      }
+      // parents are recorded before what's in them: the extractor creates directories as it meets them
+      std::vector<std::pair<std::string, std::string>> directories = { { root.path, "" } };
+      while (!directories.empty()) {
+        auto [directory, relative] = std::move(directories.back());
+        directories.pop_back();
+        std::vector<Entry> entries;
+        if (!List(directory, entries)) {
+          if (!Error(relative.empty() ? "." : relative, GlobalHelpers::LastErrorMessage()))
+            return;
+          continue;
+        }
+        for (const auto& entry : entries) {
+          std::string path = relative.empty() ? entry.name : relative + '/' + entry.name;
+          if (entry.directory) {
+            if (!_pipeline.Emit(PathRecord(Archive::RECORD_DIRECTORY, path)))
+              return;
+            _stats.directories++;
+            directories.emplace_back(entry.path, path);
+          }
+          else if (entry.regular && !ReadFile(entry, path))
+            return;
+        }
+      }
+      End();
+    }
+
+  private:
+    const Archive::Options& _options;
+    Pipeline& _pipeline;
+    Archive::Stats& _stats;
+
+    /// @returns false if the writer stopped
+    bool Error(const std::string& path, const std::string& message) {
+      Fail(_stats, path, message);
+      std::string record = PathRecord(Archive::RECORD_ERROR, path);
+      Put<uint16_t>(record, (uint16_t)std::min<size_t>(message.size(), UINT16_MAX));
+      return _pipeline.Emit(record.append(message, 0, UINT16_MAX));
+    }
+    /// @returns false if the writer stopped
+    bool ReadFile(const Entry& entry, const std::string& path) {
+      InputFile file;
+      if (!file.Open(entry.path))
+        return Error(path, GlobalHelpers::LastErrorMessage());
+      std::string header = PathRecord(Archive::RECORD_FILE, path);
+      Put<int64_t>(header, entry.modified);
+      if (!_pipeline.Emit(std::move(header)))
+        return false;
+      bool compress = _options.compress, first = true;
+      std::string error;
+      while (true) {
+        std::string block(block_header_size + Archive::block_size, '\0');
+        int64_t read = file.Read(block.data() + block_header_size, Archive::block_size);
+        if (read < 0)
+          error = GlobalHelpers::LastErrorMessage();
+        if (read <= 0)
+          break;
+        block.resize(block_header_size + (size_t)read);
+        uint32_t size = (uint32_t)read;
+        memcpy(block.data(), &size, sizeof(size));
+        memcpy(block.data() + 4, &size, sizeof(size));
+        // a zip or a JPEG is as small as it gets: none of its blocks is worth trying
+        if (first && Compression::LooksCompressed(block.data() + block_header_size, (size_t)read))
+          compress = false;
+        first = false;
+        _stats.bytes += size;
+        if (!_pipeline.Emit(std::move(block), compress))
+          return false;
+        if ((size_t)read < Archive::block_size)
+          break;
+      }
+      // what was sent stays a file of its own; the error after it tells the extractor it's not whole
+      if (!_pipeline.Emit(std::string(block_header_size, '\0')))
+        return false;
+      if (!error.empty())
+        return Error(path, error);
+      _stats.files++;
+      return true;
+    }
+    void End() {
+      std::string record(1, (char)Archive::RECORD_END);
+      Put<uint64_t>(record, _stats.files);
+      Put<uint64_t>(record, _stats.bytes);
+      _pipeline.Emit(std::move(record));
+    }
+  };
+
+  /// @brief No way out of the root: relative, no empty, `.` or `..` parts, nothing a Windows path would read as a drive or a separator
+  bool IsSafe(const std::string& path) {
+    if (path.empty() || path.find_first_of(std::string("\\:\0", 3)) != std::string::npos)
+      return false;
+    for (size_t start = 0;;) {
+      size_t slash = path.find('/', start);
+      std::string part = path.substr(start, slash == std::string::npos ? std::string::npos : slash - start);
+      if (part.empty() || part == "." || part == "..")
+        return false;
+      if (slash == std::string::npos)
+        return true;
+      start = slash + 1;
+    }
+  }
+} // namespace
+
+Archive::Stats Archive::Write(const Options& options, const Sink& sink, const std::function<bool()>& isCancelled) {
+  Stats stats;
+  size_t compressors = options.compress ? std::max<size_t>(options.compressors, 1) : 0;
+  Pipeline pipeline(compressors);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < compressors; i++)
+    threads.emplace_back([&]() { pipeline.Compress(); });
+  Reader reader(options, pipeline, stats);
+  threads.emplace_back([&]() {
+    reader.Run();
+    pipeline.EndOfInput();
+  });
+  std::string piece;
+  stats.complete = true;
+  while (pipeline.Next(piece)) {
+    sink(piece.data(), piece.size());
+    stats.stored += piece.size();
+    if (isCancelled && isCancelled()) {
+      pipeline.Stop();
+      stats.complete = false;
+      Fail(stats, options.root, "cancelled");
+    }
+  }
+  for (auto& thread : threads)
+    thread.join();
+  return stats;
+}
+
+/// @brief The extractor's state machine, fed whatever came so far
+class Archive::Extractor::Parser {
+public:
+  explicit Parser(std::string root) : _root(std::move(root)) {
+    std::error_code ec;
+    std::filesystem::create_directories(NativePath(_root), ec);
+  }
+
+  void Feed(const char* data, size_t size) {
+    if (_state == DONE || _state == BROKEN)
+      return;
+    _buffer.append(data, size);
+    while (Step()) {
+    }
+    // parsed bytes are dropped once they're the bigger part: the buffer stays about a block long
+    if (_offset > _buffer.size() / 2) {
+      _buffer.erase(0, _offset);
+      _offset = 0;
+    }
+  }
+  Stats Finish() {
+    if (_state != DONE && _state != BROKEN)
+      Broken("the archive is cut off");
+    return _stats;
+  }
+
+private:
+  enum State { HEADER, RECORD, BLOCKS, DONE, BROKEN };
+  std::string _root;
+  std::string _buffer;
+  size_t _offset = 0;
+  State _state = HEADER;
+  Stats _stats;
+  OutputFile _file;
+  /// @brief Of the file being written, or the last one written
+  std::string _path;
+  int64_t _modified = 0;
+  bool _fileFailed = false;
+  std::string _block;
+
+  size_t Available() const { return _buffer.size() - _offset; }
+  const char* At(size_t offset = 0) const { return _buffer.data() + _offset + offset; }
+
+  /// @returns false when more data is needed
+  bool Step() {
+    switch (_state) {
+      case HEADER:
+        if (Available() < header_size)
+          return false;
+        if (memcmp(At(), magic, sizeof(magic)) != 0) {
+          Broken("not an archive");
+          return false;
+        }
+        _offset += header_size;
+        _state = RECORD;
+        return true;
+      case RECORD:
+        return ReadRecord();
+      case BLOCKS:
+        return ReadBlock();
+      default:
+        return false;
+    }
+  }
+  /// @returns The path of a record starting with one, if it's all there; `size` is how many bytes the record takes so far
+  bool ReadPath(std::string& path, size_t& size) const {
+    if (Available() < 1 + 2)
+      return false;
+    uint16_t length = Get<uint16_t>(At(1));
+    if (Available() < 1 + 2 + (size_t)length)
+      return false;
+    path.assign(At(3), length);
+    size = 1 + 2 + length;
+    return true;
+  }
+  bool ReadRecord() {
+    if (Available() < 1)
+      return false;
+    std::string path;
+    size_t size;
+    switch ((uint8_t)*At()) {
+      case RECORD_END:
+        if (Available() < 1 + 16)
+          return false;
+        _offset += 1 + 16;
+        _stats.complete = true;
+        _state = DONE;
+        return false;
+      case RECORD_DIRECTORY: {
+        if (!ReadPath(path, size))
+          return false;
+        _offset += size;
+        std::error_code ec;
+        if (!IsSafe(path))
+          Fail(_stats, path, "refused: leads out of the directory");
+        else if (std::filesystem::create_directories(NativePath(GlobalHelpers::JoinPath(_root, path)), ec), ec)
+          Fail(_stats, path, ec.message());
+        else
+          _stats.directories++;
+        return true;
+      }
+      case RECORD_FILE: {
+        if (!ReadPath(path, size))
+          return false;
+        if (Available() < size + 8)
+          return false;
+        _modified = Get<int64_t>(At(size));
+        _offset += size + 8;
+        _path = path;
+        _fileFailed = false;
+        _state = BLOCKS;
+        if (!IsSafe(path)) {
+          FailFile("refused: leads out of the directory");
+          return true;
+        }
+        std::string target = GlobalHelpers::JoinPath(_root, path);
+        std::error_code ec;
+        std::filesystem::create_directories(NativePath(target).parent_path(), ec);
+        if (!_file.Open(target))
+          FailFile(GlobalHelpers::LastErrorMessage());
+        return true;
+      }
+      case RECORD_ERROR: {
+        if (!ReadPath(path, size) || Available() < size + 2)
+          return false;
+        uint16_t length = Get<uint16_t>(At(size));
+        if (Available() < size + 2 + length)
+          return false;
+        std::string message(At(size + 2), length);
+        _offset += size + 2 + length;
+        // the sender couldn't read all of the file it just sent: what's here of it isn't the file
+        if (path == _path && !_fileFailed && IsSafe(path)) {
+          std::error_code ec;
+          std::filesystem::remove(NativePath(GlobalHelpers::JoinPath(_root, path)), ec);
+          _stats.files--;
+        }
+        Fail(_stats, path, message);
+        return true;
+      }
+      default:
+        Broken("malformed archive");
+        return false;
+    }
+  }
+  bool ReadBlock() {
+    if (Available() < block_header_size)
+      return false;
+    uint32_t size = Get<uint32_t>(At()), stored = Get<uint32_t>(At(4));
+    if (size > block_size || stored > size) {
+      Broken("malformed archive");
+      return false;
+    }
+    if (Available() < block_header_size + stored)
+      return false;
+    const char* data = At(block_header_size);
+    _offset += block_header_size + stored;
+    if (!size) {
+      EndFile();
+      return true;
+    }
+    if (_fileFailed)
+      return true;
+    if (stored < size) {
+      if (!Compression::Decompress(data, stored, size, _block)) {
+        Broken("a block doesn't decompress");
+        return false;
+      }
+      data = _block.data();
+    }
+    if (!_file.Write(data, size))
+      FailFile(GlobalHelpers::LastErrorMessage());
+    else
+      _stats.bytes += size;
+    return true;
+  }
+  void EndFile() {
+    _state = RECORD;
+    if (_fileFailed)
+      return;
+    _file.SetModified(_modified);
+    _file.Close();
+    _stats.files++;
+  }
+  /// @brief The rest of its blocks are skipped, and what was written of it removed
+  void FailFile(const std::string& reason) {
+    Fail(_stats, _path, reason);
+    _fileFailed = true;
+    if (!_file.IsOpen())
+      return;
+    _file.Close();
+    std::error_code ec;
+    std::filesystem::remove(NativePath(GlobalHelpers::JoinPath(_root, _path)), ec);
+  }
+  void Broken(const std::string& reason) {
+    if (_state == BLOCKS && !_fileFailed)
+      FailFile(reason);
+    else
+      Fail(_stats, "archive", reason);
+    _state = BROKEN;
+  }
+};
+
+Archive::Extractor::Extractor(std::string root) : _parser(std::make_unique<Parser>(std::move(root))), _thread(&Extractor::Run, this) {}
+
+Archive::Extractor::~Extractor() {
+  if (_thread.joinable())
+    Finish();
+}
+
+void Archive::Extractor::Push(const char* data, size_t size) {
+  std::unique_lock lock(_mutex);
+  _taken.wait(lock, [&]() { return _queued < max_queued; });
+  _queue.emplace_back(data, size);
+  _queued += size;
+  _pushed.notify_one();
+}
+
+Archive::Stats Archive::Extractor::Finish() {
+  {
+    std::lock_guard lock(_mutex);
+    _closed = true;
+    _pushed.notify_one();
+  }
+  if (_thread.joinable())
+    _thread.join();
+  return _parser->Finish();
+}
+
+void Archive::Extractor::Run() {
+  std::unique_lock lock(_mutex);
+  while (true) {
+    _pushed.wait(lock, [&]() { return _closed || !_queue.empty(); });
+    if (_queue.empty())
+      return;
+    std::string piece = std::move(_queue.front());
+    _queue.pop_front();
+    _queued -= piece.size();
+    _taken.notify_one();
+    lock.unlock();
+    _parser->Feed(piece.data(), piece.size());
+    lock.lock();
+  }
+}
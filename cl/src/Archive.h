@@ -0,0 +1,85 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// @brief Streaming archive of a tree, so a folder moves as one transfer instead of a SendFile per file (fs.Archive, net.ReceiveArchive;
+/// nsv protocol/Archive.ts is the server's side). tar-like: a record per directory and file in walk order, a file's contents in blocks,
+/// each deflated on its own where that pays. Neither side holds more than a few blocks: the writer reads, compresses and hands out on
+/// separate threads, the extractor decompresses and writes while the rest is still coming.
+/// Header: "RUTA" [u32 token] (which transfer it is, for the server). Then records, [u8 type] and:
+///   DIRECTORY [u16 path size][path]
+///   FILE      [u16 path size][path][i64 modified, ms since 1970], then blocks [u32 size][u32 stored size][stored bytes] (deflated if
+///             shorter than `size`); a 0-sized block ends the file
+///   ERROR     [u16 path size][path][u16 message size][message]: what the writer couldn't read
+///   END       [u64 files][u64 bytes]
+/// Paths are relative to the root, '/'-separated, UTF-8. Little-endian
+namespace Archive {
+  enum Record : uint8_t { RECORD_END = 0, RECORD_DIRECTORY, RECORD_FILE, RECORD_ERROR };
+  constexpr char magic[4] = { 'R', 'U', 'T', 'A' };
+  constexpr size_t header_size = sizeof(magic) + 4;
+  /// @brief Contents of a file go in blocks of at most this: the unit of compression, and of what's in flight
+  constexpr size_t block_size = 256 * 1024;
+  constexpr size_t max_reported_errors = 50;
+
+  struct Stats {
+    uint64_t files = 0, directories = 0;
+    /// @brief Of the files' contents, and of the archive as it went over the wire
+    uint64_t bytes = 0, stored = 0;
+    size_t failed = 0;
+    /// @brief "path: reason" per line, the first max_reported_errors of them
+    std::string errors;
+    /// @brief Writer: not cancelled. Extractor: the END record was seen, nothing was cut off
+    bool complete = false;
+  };
+
+  struct Options {
+    /// @brief A directory, or a single file (then the archive holds just that, under its name)
+    std::string root;
+    uint32_t token = 0;
+    bool compress = true;
+    /// @brief Threads deflating blocks while the next ones are read
+    size_t compressors = 2;
+  };
+  /// @brief Where the archive goes, in order. May block: the writer waits, and so does the reading
+  using Sink = std::function<void(const char* data, size_t size)>;
+
+  /// @brief Walks the tree, reading and compressing ahead; `sink` gets the archive on the calling thread. Links aren't followed.
+  /// A file that can't be read goes as an ERROR record, the rest still goes
+  Stats Write(const Options& options, const Sink& sink, const std::function<bool()>& isCancelled);
+
+  /// @brief Unpacks into a directory (created if missing) on a thread of its own, while the caller keeps receiving. What's there is
+  /// overwritten; a path that would leave the directory is refused
+  class Extractor {
+  public:
+    /// @brief Past this much received and not written yet, Push() waits
+    static constexpr size_t max_queued = 4 * 1024 * 1024;
+
+    explicit Extractor(std::string root);
+    ~Extractor();
+    Extractor(const Extractor&) = delete;
+    Extractor& operator=(const Extractor&) = delete;
+
+    /// @brief The next piece of the archive
+    void Push(const char* data, size_t size);
+    /// @brief No more is coming: waits until the rest is written
+    Stats Finish();
+
+  private:
+    class Parser;
+    std::unique_ptr<Parser> _parser;
+    std::mutex _mutex;
+    std::condition_variable _pushed, _taken;
+    std::deque<std::string> _queue;
+    size_t _queued = 0;
+    bool _closed = false;
+    std::thread _thread;
+
+    void Run();
+  };
+} // namespace Archive
@@ -0,0 +1,132 @@
+#include "ChunkCache.h"
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+}
+#include <cstring>
+#include <new>
+
+static const char* registry_key = "ChunkCache";
+
+ChunkCache::ChunkCache(size_t capacity) : _capacity(capacity ? capacity : 1) {}
+
+ChunkCache& ChunkCache::Of(lua_State* L) {
+  if (lua_getfield(L, LUA_REGISTRYINDEX, registry_key) == LUA_TUSERDATA) {
+    auto cache = static_cast<ChunkCache*>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return *cache;
+  }
+  lua_pop(L, 1);
+  auto cache = new (lua_newuserdatauv(L, sizeof(ChunkCache), 0)) ChunkCache();
+  // the registry refs go away with the state, only the C++ side needs freeing
+  lua_createtable(L, 0, 1);
+  lua_pushcfunction(L, [](lua_State* L) {
+    static_cast<ChunkCache*>(lua_touserdata(L, 1))->~ChunkCache();
+    return 0;
+  });
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, registry_key);
+  return *cache;
+}
+
+bool ChunkCache::Load(lua_State* L, std::string_view source) {
+  auto found = _index.find(source);
+  if (found != _index.end()) {
+    _hits++;
+    _entries.splice(_entries.begin(), _entries, found->second);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, found->second->ref);
+    return true;
+  }
+  _misses++;
+  if (luaL_loadbufferx(L, source.data(), source.size(), "=command", "t") != LUA_OK) {
+    // nil, message: what load() returns
+    lua_pushnil(L);
+    lua_insert(L, -2);
+    return false;
+  }
+  if (_entries.size() >= _capacity) {
+    Entry& oldest = _entries.back();
+    _index.erase(oldest.source);
+    luaL_unref(L, LUA_REGISTRYINDEX, oldest.ref);
+    _entries.pop_back();
+  }
+  lua_pushvalue(L, -1);
+  _entries.push_front({ std::string(source), luaL_ref(L, LUA_REGISTRYINDEX) });
+  _index.emplace(_entries.front().source, _entries.begin());
+  return true;
+}
+
+bool ChunkCache::Prepare(lua_State* L, uint32_t id, std::string_view source) {
+  if (luaL_loadbufferx(L, source.data(), source.size(), "=prepared", "t") != LUA_OK)
+    return false;
+  auto found = _prepared.find(id);
+  if (found != _prepared.end())
+    luaL_unref(L, LUA_REGISTRYINDEX, found->second.ref);
+  _prepared[id] = { std::string(source), luaL_ref(L, LUA_REGISTRYINDEX) };
+  return true;
+}
+const std::string* ChunkCache::PushPrepared(lua_State* L, uint32_t id) {
+  auto found = _prepared.find(id);
+  if (found == _prepared.end()) {
+    lua_pushnil(L);
+    return nullptr;
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, found->second.ref);
+  return &found->second.source;
+}
+void ChunkCache::ClearPrepared(lua_State* L) {
+  for (auto& [id, prepared] : _prepared)
+    luaL_unref(L, LUA_REGISTRYINDEX, prepared.ref);
+  _prepared.clear();
+}
+
+int ChunkCache::PushArguments(lua_State* L, std::string_view encoded) {
+  int count = 0;
+  size_t offset = 0;
+  auto fail = [&] {
+    lua_pop(L, count);
+    return -1;
+  };
+  while (offset < encoded.size()) {
+    luaL_checkstack(L, 1, "too many arguments");
+    switch ((uint8_t)encoded[offset++]) {
+    case ARG_NIL:
+      lua_pushnil(L);
+      break;
+    case ARG_FALSE:
+    case ARG_TRUE:
+      lua_pushboolean(L, encoded[offset - 1] == ARG_TRUE);
+      break;
+    case ARG_NUMBER: {
+      double value;
+      if (encoded.size() - offset < sizeof(value))
+        return fail();
+      memcpy(&value, encoded.data() + offset, sizeof(value));
+      offset += sizeof(value);
+      lua_pushnumber(L, value);
+      break;
+    }
+    case ARG_STRING: {
+      uint32_t size;
+      if (encoded.size() - offset < sizeof(size))
+        return fail();
+      memcpy(&size, encoded.data() + offset, sizeof(size));
+      offset += sizeof(size);
+      if (encoded.size() - offset < size)
+        return fail();
+      lua_pushlstring(L, encoded.data() + offset, size);
+      offset += size;
+      break;
+    }
+    default:
+      return fail();
+    }
+    count++;
+  }
+  return count;
+}
+
+uint64_t ChunkCache::GetHits() const { return _hits; }
+uint64_t ChunkCache::GetMisses() const { return _misses; }
+size_t ChunkCache::GetSize() const { return _entries.size(); }
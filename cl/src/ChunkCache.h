@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+struct lua_State;
+
+/// @brief Compiled remote commands of one lua_State, so a command the server repeats is parsed once. Keyed by the source (hashed, then
+/// compared), least recently used chunks are dropped past `capacity`.
+/// Also keeps the chunks the server prepared (see nsv protocol/Batch.ts): those stay until ClearPrepared(), the server decides what to
+/// keep. Functions live in the state's registry, so a cache is only ever used with the state it belongs to
+class ChunkCache {
+public:
+  static constexpr size_t default_capacity = 256;
+  /// @brief Types of INVOKE arguments: [u8 type] then f64 for numbers, [u32 size][bytes] for strings
+  enum ArgumentType : uint8_t { ARG_NIL = 0, ARG_FALSE, ARG_TRUE, ARG_NUMBER, ARG_STRING };
+
+  explicit ChunkCache(size_t capacity = default_capacity);
+  ChunkCache(const ChunkCache&) = delete;
+  ChunkCache& operator=(const ChunkCache&) = delete;
+
+  /// @brief The cache of `L`, created on first use and destroyed with the state
+  static ChunkCache& Of(lua_State* L);
+
+  /// @brief Pushes the compiled `source`, like load(): the function, or nil and the error message
+  /// @returns true if a function was pushed
+  bool Load(lua_State* L, std::string_view source);
+  /// @brief Compiles `source` and keeps it under `id`, replacing what was there
+  /// @returns false (error message pushed) if it doesn't compile
+  bool Prepare(lua_State* L, uint32_t id, std::string_view source);
+  /// @brief Pushes the function prepared under `id`, nil if there's none
+  /// @returns Its source, nullptr if there's none
+  const std::string* PushPrepared(lua_State* L, uint32_t id);
+  /// @brief The server forgets what it prepared when the connection drops: so does the agent
+  void ClearPrepared(lua_State* L);
+
+  /// @brief Pushes the values of an encoded argument list
+  /// @returns How many were pushed, -1 if the list is malformed (nothing pushed)
+  static int PushArguments(lua_State* L, std::string_view encoded);
+
+  uint64_t GetHits() const;
+  uint64_t GetMisses() const;
+  size_t GetSize() const;
+
+private:
+  struct Entry {
+    std::string source;
+    int ref;
+  };
+  struct Prepared {
+    std::string source;
+    int ref;
+  };
+
+  size_t _capacity;
+  /// @brief Most recently used first. Keys of `_index` point into the entries' sources, which list nodes keep in place
+  std::list<Entry> _entries;
+  std::unordered_map<std::string_view, std::list<Entry>::iterator> _index;
+  std::unordered_map<uint32_t, Prepared> _prepared;
+  uint64_t _hits = 0, _misses = 0;
+};
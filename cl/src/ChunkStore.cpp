@@ -0,0 +1,230 @@
+#include "ChunkStore.h"
+#include "helpers/GeneralHelpers.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <openssl/evp.h>
+#include <set>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+namespace {
+  constexpr size_t manifest_entry_size = 4 + ChunkStore::hash_size;
+
+  ChunkStore::Hash Sha256(const char* data, size_t size) {
+    ChunkStore::Hash hash;
+    unsigned int hashSize;
+    EVP_Digest(data, size, hash.data(), &hashSize, EVP_sha256(), nullptr);
+    return hash;
+  }
+  std::string Hex(const ChunkStore::Hash& hash) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(hash.size() * 2, 0);
+    for (size_t i = 0; i < hash.size(); i++) {
+      hex[i * 2] = digits[hash[i] >> 4];
+      hex[i * 2 + 1] = digits[hash[i] & 15];
+    }
+    return hex;
+  }
+  /// @brief Trim() walks and deletes: one at a time, whatever the store. Also guards storeSizes
+  std::mutex trimMutex;
+  /// @brief Bytes in each store (by directory) as of its last walk, plus what was put since. Chunks that go some other way (damaged
+  /// ones, by hand) only make it larger than it is: the next walk sets it right
+  std::map<fs::path, uint64_t> storeSizes;
+} // namespace
+
+bool ChunkStore::ParseManifest(const char* data, size_t size, std::vector<Chunk>& chunks, size_t& consumed) {
+  uint32_t count;
+  if (size < sizeof(count))
+    return false;
+  memcpy(&count, data, sizeof(count));
+  if ((size - sizeof(count)) / manifest_entry_size < count)
+    return false;
+  chunks.resize(count);
+  const char* entry = data + sizeof(count);
+  for (auto& chunk : chunks) {
+    memcpy(&chunk.size, entry, sizeof(chunk.size));
+    memcpy(chunk.hash.data(), entry + sizeof(chunk.size), hash_size);
+    entry += manifest_entry_size;
+  }
+  consumed = entry - data;
+  return true;
+}
+
+bool ChunkStore::ParseSent(const char* data, size_t size, size_t chunkCount, std::vector<uint32_t>& sent, size_t& consumed) {
+  uint32_t count;
+  if (size < sizeof(count))
+    return false;
+  memcpy(&count, data, sizeof(count));
+  if ((size - sizeof(count)) / sizeof(uint32_t) < count)
+    return false;
+  sent.resize(count);
+  memcpy(sent.data(), data + sizeof(count), count * sizeof(uint32_t));
+  for (size_t i = 0; i < sent.size(); i++)
+    if (sent[i] >= chunkCount || (i > 0 && sent[i] <= sent[i - 1]))
+      return false;
+  consumed = sizeof(count) + count * sizeof(uint32_t);
+  return true;
+}
+
+ChunkStore::ChunkStore(fs::path directory, uint64_t maxSize)
+    : _directory(directory.is_relative() ? GlobalHelpers::GetExecutableDirectory() / directory : std::move(directory)), _maxSize(maxSize) {}
+
+std::vector<uint32_t> ChunkStore::Missing(const std::vector<Chunk>& chunks) {
+  std::vector<uint32_t> missing;
+  std::set<Hash> asked;
+  for (uint32_t i = 0; i < chunks.size(); i++)
+    if (!asked.count(chunks[i].hash) && !Touch(chunks[i])) {
+      missing.push_back(i);
+      asked.insert(chunks[i].hash);
+    }
+  return missing;
+}
+
+std::string ChunkStore::Assemble(const std::vector<Chunk>& chunks, const std::vector<uint32_t>& sent, const char* data, size_t size,
+                                 const fs::path& path) {
+  fs::path temporary = path;
+  temporary += ".chunks~";
+  std::string error;
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return "can't write the file";
+    // what came in this time, in case keeping it in the store failed
+    std::map<Hash, const char*> received;
+    std::string stored;
+    size_t offset = 0;
+    auto next = sent.begin();
+    for (size_t i = 0; i < chunks.size() && error.empty(); i++) {
+      const Chunk& chunk = chunks[i];
+      if (next != sent.end() && *next == i) {
+        next++;
+        if (size - offset < chunk.size) {
+          error = "chunk " + std::to_string(i) + " is said to be sent, but isn't";
+          break;
+        }
+        if (Sha256(data + offset, chunk.size) != chunk.hash) {
+          error = "chunk " + std::to_string(i) + " doesn't match its hash";
+          break;
+        }
+        out.write(data + offset, chunk.size);
+        received.emplace(chunk.hash, data + offset);
+        Put(chunk.hash, data + offset, chunk.size);
+        offset += chunk.size;
+        continue;
+      }
+      if (auto it = received.find(chunk.hash); it != received.end()) {
+        out.write(it->second, chunk.size);
+        continue;
+      }
+      fs::path chunkPath = PathOf(chunk.hash);
+      std::error_code ec;
+      if (fs::file_size(chunkPath, ec) == chunk.size && !ec) {
+        stored.resize(chunk.size);
+        std::ifstream in(chunkPath, std::ios::binary);
+        in.read(stored.data(), chunk.size);
+        // a damaged chunk is dropped: the next upload brings it again
+        if ((size_t)in.gcount() == chunk.size && Sha256(stored.data(), stored.size()) == chunk.hash) {
+          out.write(stored.data(), chunk.size);
+          continue;
+        }
+        in.close();
+        fs::remove(chunkPath, ec);
+        error = "chunk " + std::to_string(i) + " is damaged in the store";
+        break;
+      }
+      error = "chunk " + std::to_string(i) + " is neither in the store nor sent (evicted since?)";
+    }
+    if (error.empty() && offset != size)
+      error = "more data than the chunks said to be sent";
+    if (error.empty() && !out.flush())
+      error = "can't write the file";
+  }
+  std::error_code ec;
+  if (error.empty())
+    fs::rename(temporary, path, ec);
+  if (ec)
+    error = ec.message();
+  if (!error.empty())
+    fs::remove(temporary, ec);
+  Trim();
+  return error;
+}
+
+void ChunkStore::Trim() {
+  std::lock_guard lock(trimMutex);
+  if (auto known = storeSizes.find(_directory); known != storeSizes.end() && known->second <= _maxSize)
+    return;
+  struct Stored {
+    fs::path path;
+    fs::file_time_type used;
+    uint64_t size;
+  };
+  std::vector<Stored> stored;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (fs::recursive_directory_iterator it(_directory, ec), end; !ec && it != end; it.increment(ec)) {
+    if (!it->is_regular_file(ec))
+      continue;
+    Stored entry{ it->path(), it->last_write_time(ec), it->file_size(ec) };
+    if (ec)
+      continue;
+    total += entry.size;
+    stored.push_back(std::move(entry));
+  }
+  if (total > _maxSize) {
+    std::sort(stored.begin(), stored.end(), [](const Stored& a, const Stored& b) { return a.used < b.used; });
+    for (const auto& entry : stored) {
+      if (total <= _maxSize)
+        break;
+      if (fs::remove(entry.path, ec))
+        total -= entry.size;
+    }
+  }
+  storeSizes[_directory] = total;
+}
+
+fs::path ChunkStore::PathOf(const Hash& hash) const {
+  std::string hex = Hex(hash);
+  // 256 directories, so none grows too long to list
+  return _directory / hex.substr(0, 2) / hex;
+}
+
+bool ChunkStore::Touch(const Chunk& chunk) const {
+  fs::path path = PathOf(chunk.hash);
+  std::error_code ec;
+  if (fs::file_size(path, ec) != chunk.size || ec)
+    return false;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+  return true;
+}
+
+void ChunkStore::Put(const Hash& hash, const char* data, size_t size) const {
+  static std::atomic<uint32_t> puts = 0;
+  fs::path path = PathOf(hash), temporary = path;
+  temporary += "." + std::to_string(puts++) + ".tmp";
+  std::error_code ec;
+  fs::create_directories(path.parent_path(), ec);
+  std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+  out.write(data, size);
+  out.close();
+  // written whole or not at all: a reader never sees half a chunk
+  if (!out) {
+    fs::remove(temporary, ec);
+    return;
+  }
+  bool existed = fs::exists(path, ec);
+  if (!ec)
+    fs::rename(temporary, path, ec);
+  if (ec) {
+    fs::remove(temporary, ec);
+    return;
+  }
+  std::lock_guard lock(trimMutex);
+  if (auto known = storeSizes.find(_directory); known != storeSizes.end() && !existed)
+    known->second += size;
+}
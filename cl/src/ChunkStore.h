@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/// @brief Content-addressed store of file chunks (upload; nsv protocol/Chunks.ts cuts the files with FastCDC). The server sends a
+/// file's manifest first, the agent answers with the chunks it doesn't have, and only those travel: the file is put together here from
+/// the store and what came. A chunk is a file named after its SHA-256; the least recently used ones go once the store is over its size.
+/// A relative store directory is under the executable's
+class ChunkStore {
+public:
+  static constexpr size_t hash_size = 32;
+  using Hash = std::array<uint8_t, hash_size>;
+  struct Chunk {
+    Hash hash;
+    uint32_t size = 0;
+  };
+
+  /// @brief Manifest: [u32 chunks], then [u32 size][32 bytes SHA-256] per chunk, in file order
+  /// @param consumed Bytes the manifest took: the chunk data that follows it starts there
+  /// @returns false if it's malformed
+  static bool ParseManifest(const char* data, size_t size, std::vector<Chunk>& chunks, size_t& consumed);
+  /// @brief Which chunks an upload carries, after its manifest: [u32 count], then [u32 index] each, ascending
+  /// @param chunkCount Of the manifest: indices must be below it
+  /// @returns false if it's malformed
+  static bool ParseSent(const char* data, size_t size, size_t chunkCount, std::vector<uint32_t>& sent, size_t& consumed);
+
+  ChunkStore(std::filesystem::path directory, uint64_t maxSize);
+  /// @brief Indices of the chunks to send: not in the store, and not already asked for earlier in the list. The ones that are there are
+  /// marked as used, so making room for the others won't evict them
+  std::vector<uint32_t> Missing(const std::vector<Chunk>& chunks);
+  /// @brief Writes the file from `data`, which holds the chunks listed in `sent` (as Missing() listed them, whatever the store holds by
+  /// now), in order, and from the store for the others. The sent ones are checked against their hash and kept for next time
+  /// @returns Empty if done, else why not (the file is left as it was then)
+  std::string Assemble(const std::vector<Chunk>& chunks, const std::vector<uint32_t>& sent, const char* data, size_t size,
+                       const std::filesystem::path& path);
+  /// @brief Evicts the least recently used chunks until the store fits in its size. The size is kept from the last walk of the store
+  /// plus what was put since, so the store is walked only when something has to go
+  void Trim();
+
+private:
+  std::filesystem::path _directory;
+  uint64_t _maxSize;
+
+  std::filesystem::path PathOf(const Hash& hash) const;
+  /// @returns Whether the chunk is there, marking it as used
+  bool Touch(const Chunk& chunk) const;
+  /// @brief Keeps the chunk, counting it in the store's size if it's new there
+  void Put(const Hash& hash, const char* data, size_t size) const;
+};
@@ -0,0 +1,53 @@
+#include "Compression.h"
+#include "lodepng/lodepng.h"
+#include <cstring>
+#include <vector>
+
+Compression::Codec Compression::FromName(const std::string& name) {
+  if (name == "deflate")
+    return DEFLATE;
+  return NONE;
+}
+
+bool Compression::LooksCompressed(const char* data, size_t size) {
+  static const std::string magics[] = {
+    "RIFF",                              // WebP, WAV/AVI containers
+    "\x89PNG",                           // PNG
+    std::string("\xFF\xD8\xFF", 3),      // JPEG
+    std::string("PK\x03\x04", 4),        // zip, docx/xlsx, jar
+    std::string("\x1F\x8B", 2),          // gzip
+    std::string("\x28\xB5\x2F\xFD", 4),  // zstd
+    std::string("7z\xBC\xAF\x27\x1C", 6) // 7z
+  };
+  for (const auto& magic : magics)
+    if (size >= magic.size() && !memcmp(data, magic.data(), magic.size()))
+      return true;
+  return false;
+}
+
+bool Compression::Compress(Codec codec, const char* data, size_t size, std::string& out) {
+  if (codec == NONE || size < min_size || LooksCompressed(data, size))
+    return false;
+
+  LodePNGCompressSettings settings;
+  lodepng_compress_settings_init(&settings);
+  // feedback is line-oriented JSON/text: a full window catches repeats across many lines
+  settings.windowsize = 32768;
+  std::vector<unsigned char> compressed;
+  if (lodepng::compress(compressed, reinterpret_cast<const unsigned char*>(data), size, settings) || compressed.size() >= size)
+    return false;
+  out.assign(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+  return true;
+}
+
+bool Compression::Decompress(const char* data, size_t size, size_t expectedSize, std::string& out) {
+  LodePNGDecompressSettings settings;
+  lodepng_decompress_settings_init(&settings);
+  // a lying stream stops at the size it should have, not when memory runs out
+  settings.max_output_size = expectedSize;
+  std::vector<unsigned char> decompressed;
+  if (lodepng::decompress(decompressed, reinterpret_cast<const unsigned char*>(data), size, settings) || decompressed.size() != expectedSize)
+    return false;
+  out.assign(reinterpret_cast<const char*>(decompressed.data()), decompressed.size());
+  return true;
+}
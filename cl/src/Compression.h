@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// @brief Per-message compression of outgoing messages. The codec is agreed on in HANDSHAKE; a compressed message carries
+/// `action_flag` on its action byte
+namespace Compression {
+  enum Codec : uint8_t { NONE = 0, DEFLATE };
+  constexpr uint8_t action_flag = 0x80;
+  /// @brief Below this the zlib header and the flag cost more than they save
+  constexpr size_t min_size = 512;
+
+  /// @returns NONE for unknown names, so a server offering something we don't have disables compression
+  Codec FromName(const std::string& name);
+  /// @brief Sniffs the magic of formats that are compressed already (WebP/RIFF, PNG, JPEG, zip, gzip, zstd, 7z...)
+  bool LooksCompressed(const char* data, size_t size);
+  /// @brief Compresses `data` into `out` if that's worth it
+  /// @returns false if the message should go out as is (codec off, too small, already compressed, or didn't shrink)
+  bool Compress(Codec codec, const char* data, size_t size, std::string& out);
+  /// @brief Inverse of Compress() with DEFLATE
+  /// @returns false if `data` is malformed or doesn't come out `expectedSize` bytes long
+  bool Decompress(const char* data, size_t size, size_t expectedSize, std::string& out);
+}
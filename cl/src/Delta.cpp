@@ -0,0 +1,371 @@
+#include "Delta.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <openssl/evp.h>
+#include <vector>
+
+namespace {
+  /// @brief Steps the target is read in
+  constexpr size_t read_size = 1024 * 1024;
+  /// @brief Bits of the table that turns most rolling checksums away before the sorted blocks are searched
+  constexpr unsigned filter_bits = 20;
+
+  template <class T>
+  void Put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+  template <class T>
+  T Get(const char* data) {
+    T value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  void Md5(const void* data, size_t size, uint8_t* digest) {
+    unsigned int digestSize;
+    EVP_Digest(data, size, digest, &digestSize, EVP_md5(), nullptr);
+  }
+
+  uint32_t Roll(uint32_t rolling, uint8_t out, uint8_t in, size_t blockSize) {
+    uint32_t a = ((rolling & 0xffff) - out + in) & 0xffff;
+    uint32_t b = ((rolling >> 16) - (uint32_t)blockSize * out + a) & 0xffff;
+    return a | (b << 16);
+  }
+
+  /// @brief MD5 of everything passed through it
+  class Md5Stream {
+  public:
+    Md5Stream() : _context(EVP_MD_CTX_new()) { EVP_DigestInit_ex(_context.get(), EVP_md5(), nullptr); }
+    void Update(const void* data, size_t size) { EVP_DigestUpdate(_context.get(), data, size); }
+    void Final(uint8_t* digest) {
+      unsigned int digestSize;
+      EVP_DigestFinal_ex(_context.get(), digest, &digestSize);
+    }
+
+  private:
+    struct ContextDeleter {
+      void operator()(EVP_MD_CTX* context) const { EVP_MD_CTX_free(context); }
+    };
+    std::unique_ptr<EVP_MD_CTX, ContextDeleter> _context;
+  };
+
+  /// @brief The basis's blocks, searchable by rolling checksum
+  class Signature {
+  public:
+    uint32_t blockSize = 0;
+    uint32_t blockCount = 0;
+    /// @brief Of the last block if it's short, 0 if they're all whole
+    uint32_t shortSize = 0;
+
+    bool Parse(const std::string& data) {
+      if (data.size() < Delta::signature_header_size)
+        return false;
+      blockSize = Get<uint32_t>(data.data());
+      uint64_t basisSize = Get<uint64_t>(data.data() + 4);
+      if (blockSize == 0)
+        return false;
+      uint64_t blocks = (basisSize + blockSize - 1) / blockSize;
+      if (blocks > UINT32_MAX || data.size() != Delta::signature_header_size + blocks * (4 + Delta::strong_size))
+        return false;
+      blockCount = (uint32_t)blocks;
+      shortSize = (uint32_t)(basisSize % blockSize);
+      _data = data.data() + Delta::signature_header_size;
+      _filter.assign((size_t(1) << filter_bits) / 64, 0);
+      // a short last block only ever matches the end of the target: it's looked for there, not in the table
+      uint32_t wholeBlocks = shortSize ? blockCount - 1 : blockCount;
+      _blocks.reserve(wholeBlocks);
+      for (uint32_t i = 0; i < wholeBlocks; i++) {
+        uint32_t rolling = RollingOf(i);
+        _blocks.push_back({ rolling, i });
+        uint32_t slot = Slot(rolling);
+        _filter[slot / 64] |= uint64_t(1) << (slot % 64);
+      }
+      std::sort(_blocks.begin(), _blocks.end(), [](const Block& a, const Block& b) { return a.rolling < b.rolling || (a.rolling == b.rolling && a.index < b.index); });
+      return true;
+    }
+    /// @brief A whole block with these contents, `hint` first: the one after the last match keeps COPY runs going
+    /// @returns Its index, -1 if there's none
+    int64_t Find(uint32_t rolling, const uint8_t* data, uint32_t hint) const {
+      uint32_t slot = Slot(rolling);
+      if (!(_filter[slot / 64] & (uint64_t(1) << (slot % 64))))
+        return -1;
+      auto range = std::equal_range(_blocks.begin(), _blocks.end(), Block{ rolling, 0 }, [](const Block& a, const Block& b) { return a.rolling < b.rolling; });
+      if (range.first == range.second)
+        return -1;
+      uint8_t digest[Delta::strong_size];
+      Md5(data, blockSize, digest);
+      int64_t found = -1;
+      for (auto block = range.first; block != range.second; ++block)
+        if (!memcmp(StrongOf(block->index), digest, sizeof(digest))) {
+          if (block->index == hint)
+            return hint;
+          if (found < 0)
+            found = block->index;
+        }
+      return found;
+    }
+    /// @returns Whether `data` is the short last block
+    bool IsShortBlock(const uint8_t* data, size_t size) const {
+      if (!shortSize || size != shortSize || Delta::Rolling(data, size) != RollingOf(blockCount - 1))
+        return false;
+      uint8_t digest[Delta::strong_size];
+      Md5(data, size, digest);
+      return !memcmp(StrongOf(blockCount - 1), digest, sizeof(digest));
+    }
+
+  private:
+    struct Block {
+      uint32_t rolling;
+      uint32_t index;
+    };
+    const char* _data = nullptr;
+    std::vector<Block> _blocks;
+    std::vector<uint64_t> _filter;
+
+    static uint32_t Slot(uint32_t rolling) { return (rolling * 2654435761u) >> (32 - filter_bits); }
+    uint32_t RollingOf(uint32_t index) const { return Get<uint32_t>(_data + (size_t)index * (4 + Delta::strong_size)); }
+    const char* StrongOf(uint32_t index) const { return _data + (size_t)index * (4 + Delta::strong_size) + 4; }
+  };
+
+  /// @brief Writes the instructions, merging adjacent blocks into one COPY
+  class Writer {
+  public:
+    Writer(std::ostream& out, Delta::Stats* stats) : _out(out), _stats(stats) {}
+
+    void Copy(uint32_t index, size_t size) {
+      if (_copyCount && index == _copyFirst + _copyCount)
+        _copyCount++;
+      else {
+        FlushCopy();
+        _copyFirst = index;
+        _copyCount = 1;
+      }
+      if (_stats)
+        _stats->copied += size;
+    }
+    void Literal(const char* data, size_t size) {
+      if (!size)
+        return;
+      FlushCopy();
+      for (size_t offset = 0; offset < size; offset += Delta::max_literal) {
+        uint32_t pieceSize = (uint32_t)std::min(Delta::max_literal, size - offset);
+        std::string header;
+        Put<uint8_t>(header, Delta::LITERAL);
+        Put(header, pieceSize);
+        _out.write(header.data(), header.size());
+        _out.write(data + offset, pieceSize);
+      }
+      if (_stats)
+        _stats->literal += size;
+    }
+    void End(uint64_t targetSize, const uint8_t* digest) {
+      FlushCopy();
+      std::string trailer;
+      Put<uint8_t>(trailer, Delta::END);
+      Put(trailer, targetSize);
+      trailer.append(reinterpret_cast<const char*>(digest), Delta::strong_size);
+      _out.write(trailer.data(), trailer.size());
+    }
+
+  private:
+    std::ostream& _out;
+    Delta::Stats* _stats;
+    uint32_t _copyFirst = 0;
+    uint32_t _copyCount = 0;
+
+    void FlushCopy() {
+      if (!_copyCount)
+        return;
+      std::string instruction;
+      Put<uint8_t>(instruction, Delta::COPY);
+      Put(instruction, _copyFirst);
+      Put(instruction, _copyCount);
+      _out.write(instruction.data(), instruction.size());
+      _copyCount = 0;
+    }
+  };
+} // namespace
+
+uint32_t Delta::BlockSize(uint64_t basisSize) {
+  if (basisSize <= (uint64_t)min_block_size * min_block_size)
+    return min_block_size;
+  uint64_t size = ((uint64_t)std::sqrt((double)basisSize) + 7) & ~uint64_t(7);
+  return (uint32_t)std::min<uint64_t>(size, max_block_size);
+}
+
+uint32_t Delta::Rolling(const uint8_t* data, size_t size) {
+  uint32_t a = 0, b = 0;
+  for (size_t i = 0; i < size; i++) {
+    a += data[i];
+    b += a;
+  }
+  return (a & 0xffff) | ((b & 0xffff) << 16);
+}
+
+std::string Delta::Sign(std::istream& basis, uint64_t basisSize, uint32_t blockSize) {
+  if (!blockSize)
+    blockSize = BlockSize(basisSize);
+  std::string signature;
+  signature.reserve(signature_header_size + (basisSize / blockSize + 1) * (4 + strong_size));
+  Put(signature, blockSize);
+  Put<uint64_t>(signature, 0);
+  std::vector<char> block(blockSize);
+  uint64_t size = 0;
+  while (basis) {
+    basis.read(block.data(), blockSize);
+    size_t read = (size_t)basis.gcount();
+    if (!read)
+      break;
+    auto data = reinterpret_cast<const uint8_t*>(block.data());
+    Put(signature, Rolling(data, read));
+    uint8_t digest[strong_size];
+    Md5(data, read, digest);
+    signature.append(reinterpret_cast<const char*>(digest), strong_size);
+    size += read;
+  }
+  memcpy(&signature[4], &size, sizeof(size));
+  return signature;
+}
+
+bool Delta::Diff(const std::string& signatureData, std::istream& target, std::ostream& delta, Stats* stats) {
+  Signature signature;
+  if (!signature.Parse(signatureData))
+    return false;
+  const size_t blockSize = signature.blockSize;
+  std::string header;
+  Put(header, signature.blockSize);
+  delta.write(header.data(), header.size());
+  Writer writer(delta, stats);
+  Md5Stream md5;
+  uint64_t targetSize = 0;
+
+  // [literal, window) is yet to be sent as a literal, the window is the next block-sized piece to look up
+  std::string buffer;
+  size_t literal = 0, window = 0;
+  bool ended = false;
+  // keeps `bytes` past the window in the buffer unless the target ends first; what was sent already is dropped on the way
+  auto fill = [&](size_t bytes) {
+    if (ended || buffer.size() - window >= bytes)
+      return;
+    buffer.erase(0, literal);
+    window -= literal;
+    literal = 0;
+    size_t old = buffer.size();
+    buffer.resize(old + std::max(bytes, read_size));
+    target.read(&buffer[old], buffer.size() - old);
+    size_t read = (size_t)target.gcount();
+    buffer.resize(old + read);
+    md5.Update(buffer.data() + old, read);
+    targetSize += read;
+    ended = !target;
+  };
+
+  uint32_t rolling = 0, hint = 0;
+  bool rollingValid = false;
+  for (;;) {
+    fill(blockSize + 1);
+    size_t available = buffer.size() - window;
+    if (available < blockSize)
+      break;
+    auto data = reinterpret_cast<const uint8_t*>(buffer.data()) + window;
+    if (!rollingValid) {
+      rolling = Rolling(data, blockSize);
+      rollingValid = true;
+    }
+    int64_t match = signature.Find(rolling, data, hint);
+    if (match >= 0) {
+      writer.Literal(buffer.data() + literal, window - literal);
+      writer.Copy((uint32_t)match, blockSize);
+      window += blockSize;
+      literal = window;
+      hint = (uint32_t)match + 1;
+      rollingValid = false;
+      continue;
+    }
+    if (window - literal >= max_literal) {
+      writer.Literal(buffer.data() + literal, window - literal);
+      literal = window;
+    }
+    // the target ends with this window: what's left is shorter than a block
+    if (available == blockSize) {
+      window++;
+      rollingValid = false;
+      continue;
+    }
+    rolling = Roll(rolling, data[0], data[blockSize], blockSize);
+    window++;
+  }
+  size_t rest = buffer.size() - window;
+  if (rest && signature.IsShortBlock(reinterpret_cast<const uint8_t*>(buffer.data()) + window, rest)) {
+    writer.Literal(buffer.data() + literal, window - literal);
+    writer.Copy(signature.blockCount - 1, rest);
+    literal = buffer.size();
+  }
+  writer.Literal(buffer.data() + literal, buffer.size() - literal);
+  if (target.bad())
+    return false;
+  uint8_t digest[strong_size];
+  md5.Final(digest);
+  writer.End(targetSize, digest);
+  return !!delta;
+}
+
+std::string Delta::Patch(std::istream& basis, const char* delta, size_t deltaSize, std::ostream& target) {
+  if (deltaSize < 4 + delta_trailer_size)
+    return "truncated delta";
+  uint32_t blockSize = Get<uint32_t>(delta);
+  if (!blockSize)
+    return "malformed delta";
+  Md5Stream md5;
+  uint64_t written = 0;
+  std::vector<char> buffer(std::max<size_t>(blockSize, read_size));
+  size_t offset = 4;
+  while (offset < deltaSize) {
+    uint8_t instruction = (uint8_t)delta[offset++];
+    if (instruction == END) {
+      if (deltaSize - offset != delta_trailer_size - 1)
+        return "malformed delta";
+      uint8_t digest[strong_size];
+      md5.Final(digest);
+      if (Get<uint64_t>(delta + offset) != written || memcmp(delta + offset + 8, digest, strong_size))
+        return "the result doesn't match: the basis isn't the one the delta was made for";
+      return target ? "" : "can't write the result";
+    }
+    if (instruction == COPY) {
+      if (deltaSize - offset < 8)
+        return "truncated delta";
+      uint64_t first = Get<uint32_t>(delta + offset), count = Get<uint32_t>(delta + offset + 4);
+      offset += 8;
+      basis.clear();
+      basis.seekg((std::streamoff)(first * blockSize));
+      // the last block of the basis may be short: reading stops where it ends
+      for (uint64_t left = count * blockSize; left && basis;) {
+        basis.read(buffer.data(), (std::streamsize)std::min<uint64_t>(left, buffer.size()));
+        size_t read = (size_t)basis.gcount();
+        target.write(buffer.data(), read);
+        md5.Update(buffer.data(), read);
+        written += read;
+        left -= read;
+      }
+    }
+    else if (instruction == LITERAL) {
+      if (deltaSize - offset < 4)
+        return "truncated delta";
+      uint32_t size = Get<uint32_t>(delta + offset);
+      offset += 4;
+      if (deltaSize - offset < size)
+        return "truncated delta";
+      target.write(delta + offset, size);
+      md5.Update(delta + offset, size);
+      written += size;
+      offset += size;
+    }
+    else
+      return "malformed delta";
+    if (!target)
+      return "can't write the result";
+  }
+  return "truncated delta";
+}
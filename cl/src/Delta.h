@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+
+/// @brief rsync-style delta transfer (net.SendSignature, net.SendDelta, net.ReceivePatch; nsv protocol/Delta.ts is the server's side).
+/// The side that has an old copy (the basis) sends its signature: a rolling checksum and an MD5 per block. The side that has the new
+/// file slides a block-sized window over it one byte at a time, and where the rolling checksum and then the MD5 match a block, sends
+/// that block's index instead of its bytes. Only what's new goes over the wire. All integers are little-endian
+namespace Delta {
+  /// @brief Blocks are about the square root of the basis in size, between these
+  constexpr uint32_t min_block_size = 700;
+  constexpr uint32_t max_block_size = 128 * 1024;
+  constexpr size_t strong_size = 16;
+  /// @brief Literal data is sent in pieces of at most this, so the new file is never held whole
+  constexpr size_t max_literal = 1024 * 1024;
+
+  /// @brief [u32 block size][u64 basis size], then [u32 rolling checksum][16 bytes MD5] per block. The last block may be short
+  constexpr size_t signature_header_size = 4 + 8;
+  /// @brief [u32 block size], the instructions, then END: [u8 0][u64 target size][16 bytes MD5 of the target]
+  constexpr size_t delta_trailer_size = 1 + 8 + strong_size;
+  enum Instruction : uint8_t {
+    END = 0,
+    /// @brief [u32 first block][u32 blocks]: blocks of the basis, in order
+    COPY = 1,
+    /// @brief [u32 size][bytes]
+    LITERAL = 2
+  };
+
+  struct Stats {
+    /// @brief Bytes of the target taken from the basis
+    uint64_t copied = 0;
+    /// @brief Bytes of the target sent as they are
+    uint64_t literal = 0;
+  };
+
+  uint32_t BlockSize(uint64_t basisSize);
+  /// @brief rsync's weak checksum: a = sum of the bytes, b = sum of a's running values, both mod 2^16, as a | b << 16
+  uint32_t Rolling(const uint8_t* data, size_t size);
+
+  /// @brief Signature of the basis (an empty stream is a valid basis: everything will be literal)
+  /// @param blockSize 0 = BlockSize(basisSize)
+  std::string Sign(std::istream& basis, uint64_t basisSize, uint32_t blockSize = 0);
+  /// @brief Instructions that turn the basis `signature` describes into `target`, written as the target is read
+  /// @returns false if the signature is malformed or `delta` failed
+  bool Diff(const std::string& signature, std::istream& target, std::ostream& delta, Stats* stats = nullptr);
+  /// @brief Rebuilds the target from the basis and the delta. Its size and MD5 are checked against what the delta says
+  /// @returns Empty if done, else why not (what was written to `target` is garbage then)
+  std::string Patch(std::istream& basis, const char* delta, size_t deltaSize, std::ostream& target);
+} // namespace Delta
@@ -0,0 +1,385 @@
+#include "DirectoryWatcher.h"
+#include "Json.h"
+#include "helpers/GeneralHelpers.h"
+#include <algorithm>
+#include <charconv>
+#include <unordered_map>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief What's happened to the names since the last flush, one change each
+  class Changes {
+  public:
+    enum Change { CREATE, MODIFY, DELETE, RENAME };
+
+    Changes(const DirectoryWatcher::Options& options, const std::string& base) : _options(options), _base(base) {}
+    bool IsOverflowing() const { return _pending.size() > _options.maxPending; }
+    /// @brief Quiet for the debounce, or held back for too long already
+    bool IsDue(Clock::time_point now) const {
+      return (!_pending.empty() || _overflowed) && (now - _last >= _options.debounce || now - _first >= std::max(_options.maxDelay, _options.debounce));
+    }
+
+    void Add(const std::string& name, Change change);
+    void Rename(const std::string& from, const std::string& to);
+    /// @brief The folded events, entries as they are now
+    std::string Flush();
+    /// @brief What's pending is dropped, and what comes until it's due: the listing is read again anyway
+    void Overflow();
+    void Clear() {
+      _pending.clear();
+      _overflowed = false;
+    }
+
+  private:
+    struct Pending {
+      Change change;
+      /// @brief The name it had before the window, for a rename
+      std::string from;
+      uint64_t sequence;
+    };
+    const DirectoryWatcher::Options& _options;
+    /// @brief The directory with '/' at the end
+    const std::string& _base;
+    std::unordered_map<std::string, Pending> _pending;
+    uint64_t _sequence = 0;
+    bool _overflowed = false;
+    Clock::time_point _first, _last;
+
+    void Touch();
+    /// @brief The listing's entry of `name` has to go, or be read again if the name's been taken meanwhile
+    void Forget(const std::string& name);
+    /// @brief `pending` null (or a DELETE): only the name and path
+    void AppendEvent(std::string& out, const char* event, const std::string& name, const Pending* pending);
+  };
+
+  void Changes::Touch() {
+    _last = Clock::now();
+    if (_pending.empty() && !_overflowed)
+      _first = _last;
+  }
+
+  void Changes::Overflow() {
+    Touch();
+    _pending.clear();
+    _overflowed = true;
+  }
+
+  void Changes::Add(const std::string& name, Change change) {
+    Touch();
+    if (_overflowed)
+      return;
+    auto found = _pending.find(name);
+    if (found == _pending.end()) {
+      _pending.emplace(name, Pending{ change, {}, _sequence++ });
+      return;
+    }
+    Pending& pending = found->second;
+    switch (pending.change) {
+    case CREATE:
+      // came and went within the window: nobody saw it
+      if (change == DELETE)
+        _pending.erase(found);
+      break;
+    case DELETE:
+      // replaced
+      if (change != DELETE)
+        pending.change = MODIFY;
+      break;
+    case RENAME:
+      if (change == DELETE) {
+        // renamed, then deleted: the old name's entry is what the listing has
+        std::string from = pending.from;
+        pending = { DELETE, {}, pending.sequence };
+        Forget(from);
+      }
+      break;
+    default:
+      if (change == DELETE)
+        pending.change = DELETE;
+    }
+  }
+
+  void Changes::Rename(const std::string& from, const std::string& to) {
+    Touch();
+    if (_overflowed)
+      return;
+    Pending moved{ RENAME, from, _sequence++ };
+    auto found = _pending.find(from);
+    if (found != _pending.end()) {
+      if (found->second.change == CREATE)
+        moved = { CREATE, {}, found->second.sequence };
+      else if (found->second.change == RENAME)
+        moved.from = found->second.from;
+      _pending.erase(found);
+    }
+    if (moved.change == RENAME && moved.from == to)
+      moved = { MODIFY, {}, moved.sequence };
+    // what was renamed onto is replaced: a rename it had pending still takes its old name out of the listing
+    auto replaced = _pending.find(to);
+    if (replaced != _pending.end() && replaced->second.change == RENAME && replaced->second.from != from) {
+      std::string gone = replaced->second.from;
+      _pending.erase(replaced);
+      Forget(gone);
+    }
+    _pending[to] = moved;
+  }
+
+  void Changes::Forget(const std::string& name) {
+    auto found = _pending.find(name);
+    if (found == _pending.end())
+      _pending.emplace(name, Pending{ DELETE, {}, _sequence++ });
+    else if (found->second.change == CREATE)
+      found->second.change = MODIFY;
+  }
+
+  std::string Changes::Flush() {
+    if (_overflowed) {
+      Clear();
+      return "{\"event\":\"overflow\"}\n";
+    }
+    std::vector<std::pair<const std::string*, const Pending*>> order;
+    order.reserve(_pending.size());
+    for (const auto& [name, pending] : _pending)
+      order.emplace_back(&name, &pending);
+    std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.second->sequence < b.second->sequence; });
+    std::string out;
+    for (const auto& [name, pending] : order) {
+      static const char* events[] = { "create", "modify", "delete", "rename" };
+      AppendEvent(out, events[pending->change], *name, pending);
+    }
+    _pending.clear();
+    return out;
+  }
+
+  void Changes::AppendEvent(std::string& out, const char* event, const std::string& name, const Pending* pending) {
+    std::string path = _base + name;
+    bool isDirectory = false;
+    uint64_t size = 0;
+    int64_t modified = 0;
+    if (pending && pending->change != DELETE) {
+      // as it is now, a single stat for whatever happened in the window
+#ifdef _WIN32
+      WIN32_FILE_ATTRIBUTE_DATA data;
+      bool exists = GetFileAttributesExW(GlobalHelpers::StringToWstring(path).c_str(), GetFileExInfoStandard, &data);
+      if (exists) {
+        isDirectory = data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+        size = isDirectory ? 0 : (uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow;
+        modified = GlobalHelpers::FileTimeToUnixMs(data.ftLastWriteTime);
+      }
+#else
+      struct stat info;
+      // links followed, like ListDirectory; a dangling one as itself
+      bool exists = stat(path.c_str(), &info) == 0 || lstat(path.c_str(), &info) == 0;
+      if (exists) {
+        isDirectory = S_ISDIR(info.st_mode);
+        size = isDirectory ? 0 : (uint64_t)info.st_size;
+        modified = GlobalHelpers::StatTimeToUnixMs(info);
+      }
+#endif
+      // gone again by now: the next events say so, but the listing shouldn't show it meanwhile
+      if (!exists) {
+        if (pending->change == RENAME)
+          AppendEvent(out, "delete", pending->from, nullptr);
+        return AppendEvent(out, "delete", name, nullptr);
+      }
+    }
+    char number[24];
+    out += "{\"event\":\"";
+    out += event;
+    out += "\",\"name\":";
+    Json::AppendString(out, name.data(), name.size());
+    out += ",\"path\":";
+    Json::AppendString(out, path.data(), path.size());
+    if (pending && pending->change != DELETE) {
+      if (pending->change == RENAME) {
+        std::string oldPath = _base + pending->from;
+        out += ",\"oldName\":";
+        Json::AppendString(out, pending->from.data(), pending->from.size());
+        out += ",\"oldPath\":";
+        Json::AppendString(out, oldPath.data(), oldPath.size());
+      }
+      out += isDirectory ? ",\"type\":\"dir\"" : ",\"type\":\"file\"";
+      if (!isDirectory) {
+        out += ",\"size\":";
+        out.append(number, std::to_chars(number, number + sizeof(number), size).ptr);
+      }
+      out += ",\"dateModified\":";
+      out.append(number, std::to_chars(number, number + sizeof(number), modified).ptr);
+    }
+    out += "}\n";
+  }
+
+  /// @brief The pending changes go out when they're due: one overflow for a whole burst of them
+  void Settle(Changes& changes, const DirectoryWatcher::Emit& emit, bool overflow) {
+    if (overflow || changes.IsOverflowing())
+      changes.Overflow();
+    if (changes.IsDue(Clock::now()))
+      emit(changes.Flush());
+  }
+} // namespace
+
+bool DirectoryWatcher::Run(const Options& options, const Emit& emit, const IsCancelled& isCancelled) {
+  std::string base = options.path;
+  std::replace(base.begin(), base.end(), '\\', '/');
+  if (base.empty() || base.back() != '/')
+    base += '/';
+  Changes changes(options, base);
+  char number[16];
+  std::string ready = "{\"event\":\"ready\",\"token\":";
+  ready.append(number, std::to_chars(number, number + sizeof(number), options.token).ptr);
+  ready += "}\n";
+#ifdef _WIN32
+  HANDLE directory = CreateFileW(GlobalHelpers::StringToWstring(base).c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                 NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+  if (directory == INVALID_HANDLE_VALUE)
+    return false;
+  OVERLAPPED overlapped = {};
+  overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+  // DWORD-aligned, and no more than 64 KB: a bigger buffer fails for network shares
+  std::vector<DWORD> buffer(64 * 1024 / sizeof(DWORD));
+  auto read = [&]() {
+    ResetEvent(overlapped.hEvent);
+    return ReadDirectoryChangesW(directory, buffer.data(), (DWORD)(buffer.size() * sizeof(DWORD)), FALSE,
+                                 FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE |
+                                     FILE_NOTIFY_CHANGE_CREATION,
+                                 NULL, &overlapped, NULL);
+  };
+  bool reading = read();
+  if (!reading) {
+    CloseHandle(overlapped.hEvent);
+    CloseHandle(directory);
+    return false;
+  }
+  emit(ready);
+  std::string renamedFrom;
+  while (!isCancelled()) {
+    bool overflow = false;
+    if (WaitForSingleObject(overlapped.hEvent, (DWORD)poll_interval.count()) == WAIT_OBJECT_0) {
+      DWORD bytes = 0;
+      reading = false;
+      if (!GetOverlappedResult(directory, &overlapped, &bytes, FALSE)) {
+        if (GetLastError() != ERROR_NOTIFY_ENUM_DIR)
+          break;
+        overflow = true;
+      }
+      // the changes didn't fit the buffer
+      else if (bytes == 0)
+        overflow = true;
+      for (size_t offset = 0; !overflow;) {
+        auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(reinterpret_cast<const char*>(buffer.data()) + offset);
+        std::string name = GlobalHelpers::WindowsWstringToString(std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR)));
+        switch (info->Action) {
+        case FILE_ACTION_ADDED:
+          changes.Add(name, Changes::CREATE);
+          break;
+        case FILE_ACTION_REMOVED:
+          changes.Add(name, Changes::DELETE);
+          break;
+        case FILE_ACTION_MODIFIED:
+          changes.Add(name, Changes::MODIFY);
+          break;
+        case FILE_ACTION_RENAMED_OLD_NAME:
+          renamedFrom = name;
+          break;
+        case FILE_ACTION_RENAMED_NEW_NAME:
+          if (renamedFrom.empty())
+            changes.Add(name, Changes::CREATE);
+          else
+            changes.Rename(renamedFrom, name);
+          renamedFrom.clear();
+          break;
+        }
+        if (!info->NextEntryOffset)
+          break;
+        offset += info->NextEntryOffset;
+      }
+      // the next changes are queued by the system meanwhile; failing here, the directory is gone
+      if (!(reading = read()))
+        break;
+    }
+    Settle(changes, emit, overflow);
+  }
+  if (reading) {
+    DWORD bytes;
+    CancelIoEx(directory, &overlapped);
+    GetOverlappedResult(directory, &overlapped, &bytes, TRUE);
+  }
+  CloseHandle(overlapped.hEvent);
+  CloseHandle(directory);
+  if (!isCancelled())
+    emit("{\"event\":\"gone\"}\n");
+#else
+  int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (notify < 0)
+    return false;
+  if (inotify_add_watch(notify, base.c_str(),
+                        IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                            IN_ONLYDIR) < 0) {
+    close(notify);
+    return false;
+  }
+  emit(ready);
+  alignas(inotify_event) char buffer[64 * 1024];
+  // a rename is IN_MOVED_FROM then IN_MOVED_TO with the same cookie; alone, it was moved out of the directory or into it
+  uint32_t movedCookie = 0;
+  std::string movedFrom;
+  bool gone = false;
+  while (!gone && !isCancelled()) {
+    bool overflow = false;
+    pollfd waiting = { notify, POLLIN, 0 };
+    if (poll(&waiting, 1, (int)poll_interval.count()) > 0) {
+      ssize_t size = read(notify, buffer, sizeof(buffer));
+      for (ssize_t offset = 0; offset < size;) {
+        auto event = reinterpret_cast<const inotify_event*>(buffer + offset);
+        offset += sizeof(inotify_event) + event->len;
+        std::string name = event->len ? event->name : "";
+        if (!movedFrom.empty() && !(event->mask & IN_MOVED_TO && event->cookie == movedCookie)) {
+          changes.Add(movedFrom, Changes::DELETE);
+          movedFrom.clear();
+        }
+        if (event->mask & IN_Q_OVERFLOW)
+          overflow = true;
+        else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+          gone = true;
+        else if (event->mask & IN_MOVED_FROM) {
+          movedFrom = name;
+          movedCookie = event->cookie;
+        }
+        else if (event->mask & IN_MOVED_TO) {
+          if (movedFrom.empty())
+            changes.Add(name, Changes::CREATE);
+          else
+            changes.Rename(movedFrom, name);
+          movedFrom.clear();
+        }
+        else if (event->mask & IN_CREATE)
+          changes.Add(name, Changes::CREATE);
+        else if (event->mask & IN_DELETE)
+          changes.Add(name, Changes::DELETE);
+        else if (!name.empty())
+          changes.Add(name, Changes::MODIFY);
+      }
+    }
+    // its IN_MOVED_TO would have come with it: moved out
+    else if (!movedFrom.empty()) {
+      changes.Add(movedFrom, Changes::DELETE);
+      movedFrom.clear();
+    }
+    Settle(changes, emit, overflow);
+  }
+  close(notify);
+  if (gone)
+    emit("{\"event\":\"gone\"}\n");
+#endif
+  return true;
+}
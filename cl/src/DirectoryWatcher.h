@@ -0,0 +1,35 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/// @brief Watches one directory (not its subdirectories) for entries that come, change, go or are renamed (fs.Watch), with the OS's
+/// notifications: ReadDirectoryChangesW on Windows, inotify elsewhere. What happens to a name within the debounce window is folded
+/// into one event (created then written: one create; created then deleted: nothing), and it goes out once the directory has been
+/// quiet that long. Too much at once, or the OS's queue overflowing, is an `overflow`: the listing has to be read again
+class DirectoryWatcher {
+public:
+  struct Options {
+    std::string path;
+    /// @brief Names the watch to the server: its first line carries it
+    uint32_t token = 0;
+    std::chrono::milliseconds debounce = std::chrono::milliseconds(200);
+    /// @brief A directory that never goes quiet still shows its changes this often
+    std::chrono::milliseconds maxDelay = std::chrono::milliseconds(1000);
+    /// @brief More names changed at once than this: an overflow instead
+    size_t maxPending = 2000;
+  };
+  /// @brief Events since the last call, one JSON object per line: `{ "event": "ready", "token" }` first, then `create`, `modify` and
+  /// `rename` (with `oldName` and `oldPath`) with the entry as ListDirectory prints it, `delete` with its name and path, `overflow`;
+  /// `gone` last if the directory itself is deleted or moved
+  using Emit = std::function<void(const std::string& batch)>;
+  using IsCancelled = std::function<bool()>;
+
+  /// @brief How often the cancellation and the debounce are checked while nothing comes
+  static constexpr auto poll_interval = std::chrono::milliseconds(50);
+
+  /// @brief Watches until cancelled or the directory is gone
+  /// @returns false if it can't be watched
+  static bool Run(const Options& options, const Emit& emit, const IsCancelled& isCancelled);
+};
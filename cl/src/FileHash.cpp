@@ -0,0 +1,407 @@
+#include "FileHash.h"
+#include "Json.h"
+#include "helpers/GeneralHelpers.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <openssl/evp.h>
+#include <thread>
+#include <unordered_map>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+  /// @brief XXH64 as in its specification, fed in pieces of any size
+  class Xxh64State {
+  public:
+    void Update(const uint8_t* data, size_t size) {
+      _total += size;
+      if (_buffered + size < 32) {
+        memcpy(_buffer + _buffered, data, size);
+        _buffered += size;
+        return;
+      }
+      if (_buffered) {
+        size_t fill = 32 - _buffered;
+        memcpy(_buffer + _buffered, data, fill);
+        Stripe(_buffer);
+        data += fill;
+        size -= fill;
+        _buffered = 0;
+      }
+      for (; size >= 32; data += 32, size -= 32)
+        Stripe(data);
+      memcpy(_buffer, data, size);
+      _buffered = size;
+    }
+    uint64_t Digest() const {
+      uint64_t hash;
+      if (_total >= 32) {
+        hash = Rotl(_v[0], 1) + Rotl(_v[1], 7) + Rotl(_v[2], 12) + Rotl(_v[3], 18);
+        for (uint64_t v : _v)
+          hash = (hash ^ Round(0, v)) * p1 + p4;
+      }
+      else
+        hash = p5;
+      hash += _total;
+      const uint8_t* data = _buffer;
+      size_t size = _buffered;
+      for (; size >= 8; data += 8, size -= 8)
+        hash = Rotl(hash ^ Round(0, Read64(data)), 27) * p1 + p4;
+      if (size >= 4) {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        hash = Rotl(hash ^ word * p1, 23) * p2 + p3;
+        data += 4;
+        size -= 4;
+      }
+      for (; size > 0; data++, size--)
+        hash = Rotl(hash ^ *data * p5, 11) * p1;
+      hash ^= hash >> 33;
+      hash *= p2;
+      hash ^= hash >> 29;
+      hash *= p3;
+      return hash ^ hash >> 32;
+    }
+
+  private:
+    static constexpr uint64_t p1 = 0x9E3779B185EBCA87ull, p2 = 0xC2B2AE3D27D4EB4Full, p3 = 0x165667B19E3779F9ull, p4 = 0x85EBCA77C2B2AE63ull,
+                              p5 = 0x27D4EB2F165667C5ull;
+    uint64_t _v[4] = { p1 + p2, p2, 0, 0 - p1 };
+    uint64_t _total = 0;
+    uint8_t _buffer[32];
+    size_t _buffered = 0;
+
+    static uint64_t Rotl(uint64_t x, int bits) { return x << bits | x >> (64 - bits); }
+    static uint64_t Read64(const uint8_t* data) {
+      uint64_t value;
+      memcpy(&value, data, 8);
+      return value;
+    }
+    static uint64_t Round(uint64_t accumulator, uint64_t input) { return Rotl(accumulator + input * p2, 31) * p1; }
+    void Stripe(const uint8_t* data) {
+      for (int i = 0; i < 4; i++)
+        _v[i] = Round(_v[i], Read64(data + i * 8));
+    }
+  };
+
+  std::string Hex(const uint8_t* data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(size * 2, 0);
+    for (size_t i = 0; i < size; i++) {
+      hex[i * 2] = digits[data[i] >> 4];
+      hex[i * 2 + 1] = digits[data[i] & 15];
+    }
+    return hex;
+  }
+  std::string Hex(uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++)
+      bytes[i] = (uint8_t)(value >> (56 - i * 8));
+    return Hex(bytes, 8);
+  }
+
+  class Hasher {
+  public:
+    explicit Hasher(FileHash::Algorithm algorithm) : _algorithm(algorithm) {
+      if (algorithm == FileHash::XXH64)
+        return;
+      _context.reset(EVP_MD_CTX_new());
+      if (!_context || !EVP_DigestInit_ex(_context.get(), algorithm == FileHash::SHA256 ? EVP_sha256() : EVP_blake2b512(), nullptr))
+        throw std::runtime_error("Can't initialize the digest");
+    }
+    void Update(const uint8_t* data, size_t size) {
+      if (_algorithm == FileHash::XXH64)
+        _xxh64.Update(data, size);
+      else
+        EVP_DigestUpdate(_context.get(), data, size);
+    }
+    std::string Final() {
+      if (_algorithm == FileHash::XXH64)
+        return Hex(_xxh64.Digest());
+      uint8_t digest[EVP_MAX_MD_SIZE];
+      unsigned int size = 0;
+      EVP_DigestFinal_ex(_context.get(), digest, &size);
+      return Hex(digest, size);
+    }
+
+  private:
+    struct ContextDeleter {
+      void operator()(EVP_MD_CTX* context) const { EVP_MD_CTX_free(context); }
+    };
+    FileHash::Algorithm _algorithm;
+    Xxh64State _xxh64;
+    std::unique_ptr<EVP_MD_CTX, ContextDeleter> _context;
+  };
+
+  /// @brief Adds the files of `root` (a file, or a directory walked down to the bottom) to `files`
+  void Collect(const std::string& root, std::vector<FileHash::Entry>& files) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA rootData;
+    if (!GetFileAttributesExW(GlobalHelpers::StringToWstring(root).c_str(), GetFileExInfoStandard, &rootData)) {
+      files.push_back({ root, 0, 0, "", GlobalHelpers::LastErrorMessage() });
+      return;
+    }
+    if (!(rootData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      files.push_back(
+          { root, (uint64_t)rootData.nFileSizeHigh << 32 | rootData.nFileSizeLow, GlobalHelpers::FileTimeToUnixMs(rootData.ftLastWriteTime), "", "" });
+      return;
+    }
+#else
+    struct stat rootInfo;
+    if (stat(root.c_str(), &rootInfo) != 0) {
+      files.push_back({ root, 0, 0, "", GlobalHelpers::LastErrorMessage() });
+      return;
+    }
+    if (!S_ISDIR(rootInfo.st_mode)) {
+      files.push_back({ root, (uint64_t)rootInfo.st_size, GlobalHelpers::StatTimeToUnixMs(rootInfo), "", "" });
+      return;
+    }
+#endif
+    std::vector<std::string> directories = { root };
+    while (!directories.empty()) {
+      std::string directory = std::move(directories.back());
+      directories.pop_back();
+#ifdef _WIN32
+      WIN32_FIND_DATAW data;
+      HANDLE find = FindFirstFileExW(GlobalHelpers::StringToWstring(GlobalHelpers::JoinPath(directory, "*")).c_str(), FindExInfoBasic, &data,
+                                     FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+      if (find == INVALID_HANDLE_VALUE) {
+        files.push_back({ directory, 0, 0, "", GlobalHelpers::LastErrorMessage() });
+        continue;
+      }
+      do {
+        if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0)
+          continue;
+        std::string path = GlobalHelpers::JoinPath(directory, GlobalHelpers::WindowsWstringToString(data.cFileName));
+        // links to directories aren't followed: they can loop
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+          if (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            directories.push_back(std::move(path));
+        }
+        else
+          files.push_back(
+              { std::move(path), (uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow, GlobalHelpers::FileTimeToUnixMs(data.ftLastWriteTime), "", "" });
+      } while (FindNextFileW(find, &data));
+      FindClose(find);
+#else
+      DIR* handle = opendir(directory.c_str());
+      if (!handle) {
+        files.push_back({ directory, 0, 0, "", GlobalHelpers::LastErrorMessage() });
+        continue;
+      }
+      while (dirent* found = readdir(handle)) {
+        if (strcmp(found->d_name, ".") == 0 || strcmp(found->d_name, "..") == 0)
+          continue;
+        struct stat info;
+        if (fstatat(dirfd(handle), found->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+          continue;
+        std::string path = GlobalHelpers::JoinPath(directory, found->d_name);
+        if (S_ISDIR(info.st_mode))
+          directories.push_back(std::move(path));
+        else if (S_ISREG(info.st_mode))
+          files.push_back({ std::move(path), (uint64_t)info.st_size, GlobalHelpers::StatTimeToUnixMs(info), "", "" });
+      }
+      closedir(handle);
+#endif
+    }
+  }
+
+  /// @returns false if it couldn't be read: `entry.error` says why
+  bool HashFile(FileHash::Entry& entry, FileHash::Algorithm algorithm, const std::function<bool()>& isCancelled) {
+    if (isCancelled && isCancelled()) {
+      entry.error = "cancelled";
+      return false;
+    }
+    static thread_local std::vector<uint8_t> buffer(FileHash::read_size);
+    Hasher hasher(algorithm);
+#ifdef _WIN32
+    HANDLE file = CreateFileW(GlobalHelpers::StringToWstring(entry.path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      entry.error = GlobalHelpers::LastErrorMessage();
+      return false;
+    }
+    DWORD read;
+    BOOL ok;
+    while ((ok = ReadFile(file, buffer.data(), (DWORD)buffer.size(), &read, NULL)) && read > 0 && !(isCancelled && isCancelled()))
+      hasher.Update(buffer.data(), read);
+    bool failed = !ok;
+    if (failed)
+      entry.error = GlobalHelpers::LastErrorMessage();
+    CloseHandle(file);
+#else
+    int file = open(entry.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+      entry.error = GlobalHelpers::LastErrorMessage();
+      return false;
+    }
+    posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+    ssize_t read;
+    while ((read = ::read(file, buffer.data(), buffer.size())) > 0 && !(isCancelled && isCancelled()))
+      hasher.Update(buffer.data(), read);
+    bool failed = read < 0;
+    if (failed)
+      entry.error = GlobalHelpers::LastErrorMessage();
+    close(file);
+#endif
+    if (failed)
+      return false;
+    if (isCancelled && isCancelled()) {
+      entry.error = "cancelled";
+      return false;
+    }
+    entry.hash = hasher.Final();
+    return true;
+  }
+
+  /// @brief The cache file: a line per file, "algorithm \t size \t modified \t hash \t path"
+  class Cache {
+  public:
+    explicit Cache(const std::string& path) : _path(path) {
+      std::ifstream file(FilePath());
+      std::string line;
+      while (std::getline(file, line)) {
+        size_t tabs[4], from = 0;
+        for (size_t& tab : tabs)
+          from = (tab = line.find('\t', from)) == std::string::npos ? from : tab + 1;
+        if (std::find(std::begin(tabs), std::end(tabs), std::string::npos) != std::end(tabs))
+          continue;
+        Record record;
+        record.algorithm = line.substr(0, tabs[0]);
+        std::from_chars(line.data() + tabs[0] + 1, line.data() + tabs[1], record.size);
+        std::from_chars(line.data() + tabs[1] + 1, line.data() + tabs[2], record.modified);
+        record.hash = line.substr(tabs[2] + 1, tabs[3] - tabs[2] - 1);
+        _records[line.substr(tabs[3] + 1)] = std::move(record);
+      }
+    }
+    /// @returns true if `entry` is unchanged since it was hashed with `algorithm`: its hash is filled in
+    bool Find(FileHash::Entry& entry, const char* algorithm) const {
+      auto found = _records.find(entry.path);
+      if (found == _records.end() || found->second.algorithm != algorithm || found->second.size != entry.size ||
+          found->second.modified != entry.modified)
+        return false;
+      entry.hash = found->second.hash;
+      return true;
+    }
+    /// @brief Replaces what's known under `roots` with `entries`, keeps the rest
+    void Save(const std::vector<std::string>& roots, const std::vector<FileHash::Entry>& entries, const char* algorithm) {
+      for (auto record = _records.begin(); record != _records.end();) {
+        bool walked = std::any_of(roots.begin(), roots.end(), [&](const std::string& root) {
+          return record->first.compare(0, root.size(), root) == 0 &&
+                 (record->first.size() == root.size() || root.back() == '/' || record->first[root.size()] == '/');
+        });
+        record = walked ? _records.erase(record) : std::next(record);
+      }
+      for (const auto& entry : entries)
+        if (!entry.hash.empty())
+          _records[entry.path] = { algorithm, entry.size, entry.modified, entry.hash };
+      // written aside and swapped in, so an interrupted save doesn't cost the whole cache
+      std::string temporary = _path + ".tmp";
+      {
+        std::ofstream file(FilePath(temporary), std::ios::trunc);
+        for (const auto& [path, record] : _records)
+          if (path.find_first_of("\t\n") == std::string::npos)
+            file << record.algorithm << '\t' << record.size << '\t' << record.modified << '\t' << record.hash << '\t' << path << '\n';
+        if (!file)
+          return;
+      }
+#ifdef _WIN32
+      MoveFileExW(FilePath(temporary).c_str(), FilePath().c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+      rename(temporary.c_str(), _path.c_str());
+#endif
+    }
+
+  private:
+    struct Record {
+      std::string algorithm;
+      uint64_t size = 0;
+      int64_t modified = 0;
+      std::string hash;
+    };
+    std::string _path;
+    std::unordered_map<std::string, Record> _records;
+
+#ifdef _WIN32
+    std::wstring FilePath(const std::string& path = "") const { return GlobalHelpers::StringToWstring(path.empty() ? _path : path); }
+#else
+    std::string FilePath(const std::string& path = "") const { return path.empty() ? _path : path; }
+#endif
+  };
+} // namespace
+
+std::vector<FileHash::Entry> FileHash::Run(const std::vector<std::string>& paths, const Options& options) {
+  std::vector<std::string> roots;
+  std::vector<Entry> entries;
+  for (std::string root : paths) {
+    std::replace(root.begin(), root.end(), '\\', '/');
+    while (root.size() > 1 && root.back() == '/' && root[root.size() - 2] != ':')
+      root.pop_back();
+    roots.push_back(root);
+    Collect(root, entries);
+  }
+  std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.path < b.path; });
+  entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.path == b.path; }), entries.end());
+
+  const char* algorithmName = FileHash::algorithm_names[options.algorithm];
+  std::unique_ptr<Cache> cache = options.cachePath.empty() ? nullptr : std::make_unique<Cache>(options.cachePath);
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < entries.size(); i++)
+    if (entries[i].error.empty() && !(cache && cache->Find(entries[i], algorithmName)))
+      pending.push_back(i);
+
+  std::atomic<size_t> next = 0;
+  auto worker = [&]() {
+    for (size_t i; (i = next++) < pending.size();)
+      HashFile(entries[pending[i]], options.algorithm, options.isCancelled);
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(std::max<size_t>(options.workers, 1), pending.size()); i++)
+    workers.emplace_back(worker);
+  worker();
+  for (auto& thread : workers)
+    thread.join();
+
+  if (cache && !(options.isCancelled && options.isCancelled()))
+    cache->Save(roots, entries, algorithmName);
+  return entries;
+}
+
+std::string FileHash::Encode(const std::vector<Entry>& entries) {
+  std::string out;
+  char number[24];
+  for (const auto& entry : entries) {
+    if (!out.empty())
+      out += '\n';
+    out += "{\"path\":";
+    Json::AppendString(out, entry.path.data(), entry.path.size());
+    if (entry.hash.empty()) {
+      out += ",\"error\":";
+      Json::AppendString(out, entry.error.data(), entry.error.size());
+      out += '}';
+      continue;
+    }
+    out += ",\"size\":";
+    out.append(number, std::to_chars(number, number + sizeof(number), entry.size).ptr);
+    out += ",\"dateModified\":";
+    out.append(number, std::to_chars(number, number + sizeof(number), entry.modified).ptr);
+    out += ",\"hash\":\"" + entry.hash + "\"}";
+  }
+  return out;
+}
+
+std::string FileHash::Xxh64(const void* data, size_t size) {
+  Xxh64State state;
+  state.Update(static_cast<const uint8_t*>(data), size);
+  return Hex(state.Digest());
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/// @brief Hashes of files and whole trees (fs.Hash), for integrity checks and for telling what needs syncing. Files are read in large
+/// sequential steps by a few threads at once. A cache file remembers (path, size, modification time) -> hash, so a repeated run only
+/// reads what changed
+class FileHash {
+public:
+  enum Algorithm {
+    /// @brief Not cryptographic, bound by the disk rather than the CPU: for finding changes
+    XXH64,
+    /// @brief OpenSSL's, vectorized
+    BLAKE2B,
+    /// @brief OpenSSL's, with the SHA extensions where the CPU has them
+    SHA256
+  };
+  struct Options {
+    Algorithm algorithm = XXH64;
+    size_t workers = 4;
+    /// @brief Empty = no cache
+    std::string cachePath;
+    std::function<bool()> isCancelled;
+  };
+  struct Entry {
+    /// @brief With '/'
+    std::string path;
+    uint64_t size = 0;
+    /// @brief ms since 1970
+    int64_t modified = 0;
+    /// @brief Lowercase hex, empty if the file couldn't be read
+    std::string hash;
+    std::string error;
+  };
+
+  /// @brief By Algorithm, null-terminated for luaL_checkoption
+  static constexpr const char* algorithm_names[] = { "xxh64", "blake2b", "sha256", nullptr };
+  /// @brief Steps files are read in
+  static constexpr size_t read_size = 1024 * 1024;
+
+  /// @brief Hashes each file, and each file under each directory, of `paths`. Links aren't followed
+  /// @returns The entries sorted by path
+  static std::vector<Entry> Run(const std::vector<std::string>& paths, const Options& options);
+  /// @brief The manifest: a JSON object per line, { path, size, dateModified, hash } or { path, error }
+  static std::string Encode(const std::vector<Entry>& entries);
+
+  /// @brief XXH64 (seed 0), as its canonical (big-endian) hex
+  static std::string Xxh64(const void* data, size_t size);
+};
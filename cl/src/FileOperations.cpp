@@ -0,0 +1,509 @@
+#include "FileOperations.h"
+#include "helpers/GeneralHelpers.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief Links are never followed; on Windows, only symbolic links and junctions count as such (not OneDrive's placeholders)
+  enum Kind { MISSING, REGULAR, DIRECTORY, LINK, DIRECTORY_LINK };
+  struct Item {
+    Kind kind;
+    std::string source, target;
+    uint64_t size;
+  };
+  struct Tree {
+    /// @brief Parents before their children
+    std::vector<Item> directories;
+    std::vector<Item> files;
+  };
+
+  std::string Trim(std::string path) {
+    while (path.size() > 1 && (path.back() == '/' || path.back() == '\\') && path[path.size() - 2] != ':')
+      path.pop_back();
+    return path;
+  }
+  std::string FileName(const std::string& path) {
+    std::string trimmed = Trim(path);
+    size_t slash = trimmed.find_last_of("/\\");
+    return slash == std::string::npos ? trimmed : trimmed.substr(slash + 1);
+  }
+  std::string Parent(const std::string& path) {
+    std::string trimmed = Trim(path);
+    size_t slash = trimmed.find_last_of("/\\");
+    return slash == std::string::npos ? "" : Trim(trimmed.substr(0, slash + 1));
+  }
+  bool SamePath(std::string a, std::string b) {
+    a = Trim(a);
+    b = Trim(b);
+    std::replace(a.begin(), a.end(), '\\', '/');
+    std::replace(b.begin(), b.end(), '\\', '/');
+#ifdef _WIN32
+    return CompareStringOrdinal(GlobalHelpers::StringToWstring(a).c_str(), -1, GlobalHelpers::StringToWstring(b).c_str(), -1, TRUE) == CSTR_EQUAL;
+#else
+    return a == b;
+#endif
+  }
+  std::string FormatSize(uint64_t bytes) {
+    char text[32];
+    if (bytes >= 1024ull * 1024 * 1024)
+      snprintf(text, sizeof(text), "%.1f GB", bytes / (1024.0 * 1024 * 1024));
+    else
+      snprintf(text, sizeof(text), "%.1f MB", bytes / (1024.0 * 1024));
+    return text;
+  }
+
+  /// @brief One call: totals, what's done, failures, and the workers that share them
+  class Operation {
+  public:
+    Operation(const char* verb, const FileOperations::Options& options)
+        : _verb(verb), _options(options), _lastProgress(Clock::now().time_since_epoch().count()) {}
+
+    uint64_t totalFiles = 0, totalBytes = 0;
+
+    void Fail(const std::string& path, const std::string& reason) {
+      std::lock_guard lock(_errorsMutex);
+      if (_report.failed++ < FileOperations::max_reported_errors)
+        _report.errors.append(_report.errors.empty() ? "" : "\n").append(path).append(": ").append(reason);
+    }
+    size_t GetFailed() {
+      std::lock_guard lock(_errorsMutex);
+      return _report.failed;
+    }
+    /// @brief Stays true once it's been seen
+    bool IsCancelled() {
+      if (!_cancelled && _options.isCancelled && _options.isCancelled()) {
+        _cancelled = true;
+        Fail(_verb, "cancelled");
+      }
+      return _cancelled;
+    }
+    void Done(uint64_t files, uint64_t bytes) {
+      _doneFiles += files;
+      _doneBytes += bytes;
+      if (!_options.progress)
+        return;
+      // whichever worker sees the interval pass first reports
+      auto now = Clock::now().time_since_epoch().count();
+      auto last = _lastProgress.load();
+      if (now - last < std::chrono::duration_cast<Clock::duration>(FileOperations::progress_interval).count() ||
+          !_lastProgress.compare_exchange_strong(last, now))
+        return;
+      std::string line = std::string(_verb) + ' ' + std::to_string(_doneFiles.load()) + '/' + std::to_string(totalFiles) + " files";
+      if (totalBytes)
+        line += ", " + FormatSize(_doneBytes) + '/' + FormatSize(totalBytes);
+      _options.progress(line + '\n');
+    }
+    /// @brief `work(i)` for each i < count, on up to options.workers threads (this one included)
+    void ForEach(size_t count, const std::function<void(size_t)>& work) {
+      std::atomic<size_t> next = 0;
+      auto worker = [&]() {
+        for (size_t i; (i = next++) < count && !IsCancelled();)
+          work(i);
+      };
+      std::vector<std::thread> threads;
+      for (size_t i = 1; i < std::min(std::max<size_t>(_options.workers, 1), count); i++)
+        threads.emplace_back(worker);
+      worker();
+      for (auto& thread : threads)
+        thread.join();
+    }
+    FileOperations::Report GetReport() {
+      std::lock_guard lock(_errorsMutex);
+      FileOperations::Report report = _report;
+      if (report.failed > FileOperations::max_reported_errors)
+        report.errors += "\n... " + std::to_string(report.failed - FileOperations::max_reported_errors) + " more";
+      return report;
+    }
+
+  private:
+    const char* _verb;
+    const FileOperations::Options& _options;
+    std::atomic<uint64_t> _doneFiles = 0, _doneBytes = 0;
+    std::atomic<Clock::rep> _lastProgress;
+    std::atomic<bool> _cancelled = false;
+    std::mutex _errorsMutex;
+    FileOperations::Report _report;
+  };
+
+#ifdef _WIN32
+  std::wstring Wide(const std::string& path) {
+    return GlobalHelpers::StringToWstring(path);
+  }
+  Kind KindOf(DWORD attributes, DWORD reparseTag) {
+    bool isLink = attributes & FILE_ATTRIBUTE_REPARSE_POINT && (reparseTag == IO_REPARSE_TAG_SYMLINK || reparseTag == IO_REPARSE_TAG_MOUNT_POINT);
+    if (attributes & FILE_ATTRIBUTE_DIRECTORY)
+      return isLink ? DIRECTORY_LINK : DIRECTORY;
+    return isLink ? LINK : REGULAR;
+  }
+#endif
+  Kind GetKind(const std::string& path) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesW(Wide(path).c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES)
+      return MISSING;
+    WIN32_FIND_DATAW data;
+    // the reparse tag comes only with the entry
+    HANDLE find = attributes & FILE_ATTRIBUTE_REPARSE_POINT ? FindFirstFileW(Wide(path).c_str(), &data) : INVALID_HANDLE_VALUE;
+    if (find != INVALID_HANDLE_VALUE)
+      FindClose(find);
+    return KindOf(attributes, find != INVALID_HANDLE_VALUE ? data.dwReserved0 : 0);
+#else
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0)
+      return MISSING;
+    if (S_ISLNK(info.st_mode))
+      return LINK;
+    return S_ISDIR(info.st_mode) ? DIRECTORY : REGULAR;
+#endif
+  }
+  /// @brief With its parents
+  bool MakeDirectories(const std::string& path, std::string& error) {
+    std::error_code ec;
+#ifdef _WIN32
+    std::filesystem::create_directories(Wide(path), ec);
+#else
+    std::filesystem::create_directories(path, ec);
+#endif
+    error = ec.message();
+    return !ec;
+  }
+
+  /// @brief Lists the tree under `source` (a directory), mirrored under `target` (empty when deleting)
+  void Collect(Operation& op, const std::string& source, const std::string& target, bool withSizes, Tree& tree) {
+    tree.directories.push_back({ DIRECTORY, source, target, 0 });
+    for (size_t next = tree.directories.size() - 1; next < tree.directories.size() && !op.IsCancelled(); next++) {
+      // copies: the vector grows below
+      std::string directory = tree.directories[next].source, mirror = tree.directories[next].target;
+      auto add = [&](const std::string& name, Kind kind, uint64_t size) {
+        std::string path = GlobalHelpers::JoinPath(directory, name), mirrored = mirror.empty() ? "" : GlobalHelpers::JoinPath(mirror, name);
+        if (kind == DIRECTORY)
+          tree.directories.push_back({ kind, path, mirrored, 0 });
+        else {
+          tree.files.push_back({ kind, path, mirrored, size });
+          op.totalFiles++;
+          op.totalBytes += size;
+        }
+      };
+#ifdef _WIN32
+      WIN32_FIND_DATAW data;
+      HANDLE find = FindFirstFileExW(Wide(GlobalHelpers::JoinPath(directory, "*")).c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, NULL,
+                                     FIND_FIRST_EX_LARGE_FETCH);
+      if (find == INVALID_HANDLE_VALUE) {
+        op.Fail(directory, GlobalHelpers::LastErrorMessage());
+        continue;
+      }
+      do {
+        if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0)
+          continue;
+        Kind kind = KindOf(data.dwFileAttributes, data.dwReserved0);
+        add(GlobalHelpers::WindowsWstringToString(data.cFileName), kind, kind == REGULAR ? (uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow : 0);
+      } while (FindNextFileW(find, &data));
+      FindClose(find);
+#else
+      DIR* handle = opendir(directory.c_str());
+      if (!handle) {
+        op.Fail(directory, GlobalHelpers::LastErrorMessage());
+        continue;
+      }
+      while (dirent* found = readdir(handle)) {
+        if (strcmp(found->d_name, ".") == 0 || strcmp(found->d_name, "..") == 0)
+          continue;
+        struct stat info;
+        // a delete doesn't need sizes: a stat only if the entry comes without its type
+        if (withSizes || found->d_type == DT_UNKNOWN) {
+          if (fstatat(dirfd(handle), found->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0) {
+            op.Fail(GlobalHelpers::JoinPath(directory, found->d_name), GlobalHelpers::LastErrorMessage());
+            continue;
+          }
+          Kind kind = S_ISDIR(info.st_mode) ? DIRECTORY : S_ISLNK(info.st_mode) ? LINK : REGULAR;
+          add(found->d_name, kind, kind == REGULAR ? (uint64_t)info.st_size : 0);
+        }
+        else
+          add(found->d_name, found->d_type == DT_DIR ? DIRECTORY : found->d_type == DT_LNK ? LINK : REGULAR, 0);
+      }
+      closedir(handle);
+#endif
+    }
+  }
+
+  bool MakeDirectory(const std::string& path) {
+#ifdef _WIN32
+    return CreateDirectoryW(Wide(path).c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+#endif
+  }
+
+#ifdef _WIN32
+  struct CopyProgress {
+    Operation* op;
+    uint64_t reported = 0;
+  };
+  DWORD CALLBACK OnCopyProgress(LARGE_INTEGER, LARGE_INTEGER transferred, LARGE_INTEGER, LARGE_INTEGER, DWORD, DWORD, HANDLE, HANDLE, LPVOID data) {
+    auto progress = static_cast<CopyProgress*>(data);
+    progress->op->Done(0, transferred.QuadPart - progress->reported);
+    progress->reported = transferred.QuadPart;
+    return progress->op->IsCancelled() ? PROGRESS_CANCEL : PROGRESS_CONTINUE;
+  }
+#endif
+
+  /// @brief Copies one file (or link) over whatever is at its target
+  void CopyOne(Operation& op, const Item& item) {
+    if (item.kind == DIRECTORY_LINK) {
+      op.Fail(item.source, "a link to a directory, not copied");
+      return;
+    }
+#ifdef _WIN32
+    CopyProgress progress{ &op };
+    DWORD flags = item.kind == LINK ? COPY_FILE_COPY_SYMLINK : 0;
+    if (item.size >= FileOperations::large_file)
+      flags |= COPY_FILE_NO_BUFFERING;
+    if (!CopyFileExW(Wide(item.source).c_str(), Wide(item.target).c_str(), OnCopyProgress, &progress, NULL, flags)) {
+      if (GetLastError() != ERROR_REQUEST_ABORTED)
+        op.Fail(item.source, GlobalHelpers::LastErrorMessage());
+      return;
+    }
+    op.Done(1, item.size - std::min(progress.reported, item.size));
+#else
+    if (item.kind == LINK) {
+      char link[4096];
+      ssize_t length = readlink(item.source.c_str(), link, sizeof(link) - 1);
+      if (length < 0) {
+        op.Fail(item.source, GlobalHelpers::LastErrorMessage());
+        return;
+      }
+      link[length] = 0;
+      unlink(item.target.c_str());
+      if (symlink(link, item.target.c_str()) != 0)
+        op.Fail(item.target, GlobalHelpers::LastErrorMessage());
+      else
+        op.Done(1, 0);
+      return;
+    }
+    int in = open(item.source.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (in < 0 || fstat(in, &info) != 0) {
+      op.Fail(item.source, GlobalHelpers::LastErrorMessage());
+      if (in >= 0)
+        close(in);
+      return;
+    }
+    int out = open(item.target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, info.st_mode & 07777);
+    if (out < 0) {
+      op.Fail(item.target, GlobalHelpers::LastErrorMessage());
+      close(in);
+      return;
+    }
+    // in steps, so progress and cancellation get a say during a big file
+    constexpr size_t step = 16 * 1024 * 1024;
+    bool complete = false, failed = false;
+#ifdef __linux__
+    // in the kernel, or on the device itself (reflinks, server-side copies)
+    for (bool started = false; !op.IsCancelled(); started = true) {
+      ssize_t result = copy_file_range(in, NULL, out, NULL, step, 0);
+      if (result == 0)
+        complete = true;
+      // not for this pair of files: the plain copy below takes over
+      else if (result < 0 && (started || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)))
+        failed = true;
+      if (result <= 0)
+        break;
+      op.Done(0, result);
+    }
+#endif
+    if (!complete && !failed && info.st_size >= (off_t)FileOperations::large_file)
+      posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    static thread_local std::vector<char> buffer(1024 * 1024);
+    while (!complete && !failed && !op.IsCancelled()) {
+      ssize_t read = ::read(in, buffer.data(), buffer.size());
+      complete = read == 0;
+      failed = read < 0;
+      for (ssize_t written = 0, result; written < read && !failed; written += result)
+        failed = (result = write(out, buffer.data() + written, read - written)) < 0;
+      if (read > 0 && !failed)
+        op.Done(0, read);
+    }
+    if (failed)
+      op.Fail(item.source, GlobalHelpers::LastErrorMessage());
+    if (close(out) != 0 && complete) {
+      complete = false;
+      op.Fail(item.target, GlobalHelpers::LastErrorMessage());
+    }
+    close(in);
+    if (complete)
+      op.Done(1, 0);
+    // cancelled halfway: not left looking like a copy
+    else if (!failed)
+      unlink(item.target.c_str());
+#endif
+  }
+
+  /// @brief Deletes a file or a link (not what it points to)
+  void DeleteOne(Operation& op, const Item& item) {
+#ifdef _WIN32
+    std::wstring path = Wide(item.source);
+    // a link to a directory is a directory itself
+    auto remove = [&]() { return item.kind == DIRECTORY_LINK ? RemoveDirectoryW(path.c_str()) : DeleteFileW(path.c_str()); };
+    // read-only: only cleared when it gets in the way, not on every entry
+    if (!remove() && (GetLastError() != ERROR_ACCESS_DENIED || !SetFileAttributesW(path.c_str(), FILE_ATTRIBUTE_NORMAL) || !remove())) {
+      op.Fail(item.source, GlobalHelpers::LastErrorMessage());
+      return;
+    }
+#else
+    if (unlink(item.source.c_str()) != 0) {
+      op.Fail(item.source, GlobalHelpers::LastErrorMessage());
+      return;
+    }
+#endif
+    op.Done(1, 0);
+  }
+
+  bool RemoveEmptyDirectory(const std::string& path) {
+#ifdef _WIN32
+    std::wstring wide = Wide(path);
+    return RemoveDirectoryW(wide.c_str()) ||
+           (GetLastError() == ERROR_ACCESS_DENIED && SetFileAttributesW(wide.c_str(), FILE_ATTRIBUTE_NORMAL) && RemoveDirectoryW(wide.c_str()));
+#else
+    return rmdir(path.c_str()) == 0;
+#endif
+  }
+
+  void DeleteTree(Operation& op, const std::string& path) {
+    Kind kind = GetKind(path);
+    if (kind == MISSING)
+      return;
+    if (kind != DIRECTORY) {
+      op.totalFiles++;
+      DeleteOne(op, { kind, path, "", 0 });
+      return;
+    }
+    size_t failed = op.GetFailed();
+    Tree tree;
+    Collect(op, path, "", false, tree);
+    op.ForEach(tree.files.size(), [&](size_t i) { DeleteOne(op, tree.files[i]); });
+    if (op.IsCancelled())
+      return;
+    // children first. One left non-empty by a failure fails too, and so do its parents: only the first is worth reporting
+    for (auto directory = tree.directories.rbegin(); directory != tree.directories.rend(); directory++)
+      if (!RemoveEmptyDirectory(directory->source) && op.GetFailed() == failed)
+        op.Fail(directory->source, GlobalHelpers::LastErrorMessage());
+  }
+
+  void CopyTree(Operation& op, const std::string& source, const std::string& target) {
+    Kind kind = GetKind(source);
+    if (kind == MISSING) {
+      op.Fail(source, "not found");
+      return;
+    }
+    Tree tree;
+    if (kind == DIRECTORY)
+      Collect(op, source, target, true, tree);
+    else {
+      uint64_t size = 0;
+#ifdef _WIN32
+      WIN32_FILE_ATTRIBUTE_DATA data;
+      if (kind == REGULAR && GetFileAttributesExW(Wide(source).c_str(), GetFileExInfoStandard, &data))
+        size = (uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow;
+#else
+      struct stat info;
+      if (kind == REGULAR && lstat(source.c_str(), &info) == 0)
+        size = info.st_size;
+#endif
+      tree.files.push_back({ kind, source, target, size });
+      op.totalFiles++;
+      op.totalBytes += size;
+    }
+    for (const Item& directory : tree.directories)
+      if (!MakeDirectory(directory.target))
+        op.Fail(directory.target, GlobalHelpers::LastErrorMessage());
+    op.ForEach(tree.files.size(), [&](size_t i) { CopyOne(op, tree.files[i]); });
+  }
+
+  bool IsCrossDevice() {
+#ifdef _WIN32
+    return GetLastError() == ERROR_NOT_SAME_DEVICE;
+#else
+    return errno == EXDEV;
+#endif
+  }
+} // namespace
+
+FileOperations::Report FileOperations::Copy(const std::vector<std::string>& sources, const std::string& destination, const Options& options) {
+  Operation op("copy", options);
+  std::string error;
+  if (!MakeDirectories(destination, error)) {
+    op.Fail(destination, error);
+    return op.GetReport();
+  }
+  for (const auto& source : sources) {
+    // already there
+    if (op.IsCancelled() || SamePath(Parent(source), destination))
+      continue;
+    CopyTree(op, Trim(source), GlobalHelpers::JoinPath(destination, FileName(source)));
+  }
+  return op.GetReport();
+}
+
+FileOperations::Report FileOperations::Move(const std::vector<std::string>& sources, const std::string& destination, const Options& options) {
+  Operation op("move", options);
+  std::string error;
+  if (!MakeDirectories(destination, error)) {
+    op.Fail(destination, error);
+    return op.GetReport();
+  }
+  for (const auto& path : sources) {
+    std::string source = Trim(path), target = GlobalHelpers::JoinPath(destination, FileName(source));
+    if (op.IsCancelled() || SamePath(source, target))
+      continue;
+    if (GetKind(source) == MISSING) {
+      op.Fail(source, "not found");
+      continue;
+    }
+    size_t failed = op.GetFailed();
+    // replaced as a whole, as before
+    DeleteTree(op, target);
+    if (op.GetFailed() > failed)
+      continue;
+#ifdef _WIN32
+    bool moved = MoveFileExW(Wide(source).c_str(), Wide(target).c_str(), 0);
+#else
+    bool moved = rename(source.c_str(), target.c_str()) == 0;
+#endif
+    if (moved) {
+      op.totalFiles++;
+      op.Done(1, 0);
+      continue;
+    }
+    if (!IsCrossDevice()) {
+      op.Fail(source, GlobalHelpers::LastErrorMessage());
+      continue;
+    }
+    // another volume: the source goes only once all of it is there
+    CopyTree(op, source, target);
+    if (op.GetFailed() == failed && !op.IsCancelled())
+      DeleteTree(op, source);
+  }
+  return op.GetReport();
+}
+
+FileOperations::Report FileOperations::Delete(const std::string& path, const Options& options) {
+  Operation op("delete", options);
+  DeleteTree(op, Trim(path));
+  return op.GetReport();
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/// @brief Copy, move and delete of whole trees (fs.Copy, fs.Move, fs.Rm). A tree is read once, natively (type and size come with the
+/// entry), then its files are handled by a few threads at once: many small files are bound by per-file latency, not bandwidth. Big files
+/// go through the system's own copy (CopyFileEx, unbuffered past large_file; copy_file_range) in large steps. A failure doesn't stop
+/// the rest: all of them are reported at the end. Links are copied and deleted as links, never followed
+class FileOperations {
+public:
+  struct Options {
+    /// @brief Files handled at once
+    size_t workers = 8;
+    /// @brief Called every progress_interval while it lasts, from any worker: "copy 120/5000 files, 1.2/3.4 GB"
+    std::function<void(const std::string& line)> progress;
+    /// @brief Checked between files and between the steps of a big one
+    std::function<bool()> isCancelled;
+  };
+  struct Report {
+    size_t failed = 0;
+    /// @brief "path: reason" per line, the first max_reported_errors of them
+    std::string errors;
+  };
+
+  static constexpr auto progress_interval = std::chrono::seconds(1);
+  /// @brief From this size on, a file is copied without the system cache: it would only push out what's worth keeping
+  static constexpr uint64_t large_file = 256ull * 1024 * 1024;
+  static constexpr size_t max_reported_errors = 50;
+
+  /// @brief Copies each source (file or directory) into the directory `destination`, created if missing. What's there is overwritten
+  static Report Copy(const std::vector<std::string>& sources, const std::string& destination, const Options& options);
+  /// @brief Renames each source into `destination`; across volumes, copies it and deletes it once the copy is complete
+  static Report Move(const std::vector<std::string>& sources, const std::string& destination, const Options& options);
+  /// @brief Deletes the file or the tree. A path that isn't there is fine
+  static Report Delete(const std::string& path, const Options& options);
+};
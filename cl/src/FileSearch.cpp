@@ -0,0 +1,283 @@
+#include "FileSearch.h"
+#include "Json.h"
+#include "helpers/GeneralHelpers.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  class Walk {
+  public:
+    Walk(const FileSearch::Options& options, const FileSearch::Emit& emit, const FileSearch::IsCancelled& isCancelled)
+        : _options(options), _emit(emit), _isCancelled(isCancelled) {
+      for (size_t i = 0; i < std::max<size_t>(options.scanners, 1); i++)
+        _scanners.push_back(std::make_unique<Scanner>());
+    }
+    size_t GetScannerCount() const { return _scanners.size(); }
+    int64_t GetMatches() const {
+      int64_t matches = _matches;
+      return _options.maxResults ? std::min<int64_t>(matches, (int64_t)_options.maxResults) : matches;
+    }
+    void Push(size_t scanner, std::string directory);
+    /// @brief One scanner, until the whole tree is done
+    void Scan(size_t scanner);
+
+  private:
+    struct Scanner {
+      std::mutex mutex;
+      std::deque<std::string> directories;
+    };
+    const FileSearch::Options& _options;
+    const FileSearch::Emit& _emit;
+    const FileSearch::IsCancelled& _isCancelled;
+    std::vector<std::unique_ptr<Scanner>> _scanners;
+    /// @brief Directories queued or being read: the walk is over at 0
+    std::atomic<size_t> _pending = 0;
+    std::atomic<int64_t> _matches = 0;
+    std::atomic<bool> _stop = false;
+    std::atomic<size_t> _idle = 0;
+    std::mutex _idleMutex, _emitMutex;
+    std::condition_variable _workQueued;
+
+    bool Take(size_t scanner, std::string& directory);
+    void Read(size_t scanner, const std::string& directory, std::string& batch);
+    /// @brief Appends the match, if it's still within maxResults
+    void Add(std::string& batch, const std::string& directory, const std::string& name, bool isDirectory, uint64_t size, int64_t modified);
+    void Flush(std::string& batch);
+  };
+
+  void Walk::Push(size_t scanner, std::string directory) {
+    _pending++;
+    {
+      std::lock_guard lock(_scanners[scanner]->mutex);
+      _scanners[scanner]->directories.push_back(std::move(directory));
+    }
+    if (_idle > 0) {
+      // taken, so a scanner about to wait can't miss the notification
+      std::lock_guard lock(_idleMutex);
+    }
+    _workQueued.notify_one();
+  }
+
+  bool Walk::Take(size_t scanner, std::string& directory) {
+    // its own newest first, then the oldest of the others
+    for (size_t i = 0; i < _scanners.size(); i++) {
+      Scanner& from = *_scanners[(scanner + i) % _scanners.size()];
+      std::lock_guard lock(from.mutex);
+      if (from.directories.empty())
+        continue;
+      if (i == 0) {
+        directory = std::move(from.directories.back());
+        from.directories.pop_back();
+      }
+      else {
+        directory = std::move(from.directories.front());
+        from.directories.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void Walk::Scan(size_t scanner) {
+    std::string batch, directory;
+    auto lastFlush = Clock::now();
+    while (true) {
+      if (!Take(scanner, directory)) {
+        std::unique_lock lock(_idleMutex);
+        if (_pending == 0)
+          break;
+        _idle++;
+        _workQueued.wait_for(lock, std::chrono::milliseconds(50));
+        _idle--;
+        continue;
+      }
+      // once stopped, what's queued is only drained
+      if (!_stop && _isCancelled())
+        _stop = true;
+      if (!_stop)
+        Read(scanner, directory, batch);
+      if (--_pending == 0) {
+        std::lock_guard lock(_idleMutex);
+        _workQueued.notify_all();
+      }
+      if (batch.size() >= FileSearch::batch_size || (!batch.empty() && Clock::now() - lastFlush >= FileSearch::batch_delay)) {
+        Flush(batch);
+        lastFlush = Clock::now();
+      }
+    }
+    Flush(batch);
+  }
+
+  void Walk::Read(size_t scanner, const std::string& directory, std::string& batch) {
+    bool matchAll = _options.glob.empty() || _options.glob == "*";
+#ifdef _WIN32
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileExW(GlobalHelpers::StringToWstring(GlobalHelpers::JoinPath(directory, "*")).c_str(), FindExInfoBasic, &data,
+                                   FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE)
+      return;
+    do {
+      if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0)
+        continue;
+      std::string name = GlobalHelpers::WindowsWstringToString(data.cFileName);
+      bool isDirectory = data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+      // junctions and directory links: not followed, they can loop
+      if (isDirectory && !(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+        Push(scanner, GlobalHelpers::JoinPath(directory, name));
+      if (!matchAll && !FileSearch::Match(_options.glob, name, true))
+        continue;
+      Add(batch, directory, name, isDirectory, isDirectory ? 0 : (uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow,
+          GlobalHelpers::FileTimeToUnixMs(data.ftLastWriteTime));
+    } while (!_stop && FindNextFileW(find, &data));
+    FindClose(find);
+#else
+    DIR* handle = opendir(directory.c_str());
+    if (!handle)
+      return;
+    while (dirent* found = readdir(handle)) {
+      if (strcmp(found->d_name, ".") == 0 || strcmp(found->d_name, "..") == 0)
+        continue;
+      std::string name = found->d_name;
+      bool matches = matchAll || FileSearch::Match(_options.glob, name, false);
+      // the type usually comes with the entry: a stat only for matches
+      if (found->d_type == DT_DIR && !matches) {
+        Push(scanner, GlobalHelpers::JoinPath(directory, name));
+        continue;
+      }
+      if (found->d_type != DT_UNKNOWN && found->d_type != DT_DIR && !matches)
+        continue;
+      struct stat info;
+      // links themselves, not followed
+      if (fstatat(dirfd(handle), found->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+        continue;
+      bool isDirectory = S_ISDIR(info.st_mode);
+      if (isDirectory)
+        Push(scanner, GlobalHelpers::JoinPath(directory, name));
+      if (matches)
+        Add(batch, directory, name, isDirectory, isDirectory ? 0 : (uint64_t)info.st_size, GlobalHelpers::StatTimeToUnixMs(info));
+      if (_stop)
+        break;
+    }
+    closedir(handle);
+#endif
+  }
+
+  void Walk::Add(std::string& batch, const std::string& directory, const std::string& name, bool isDirectory, uint64_t size, int64_t modified) {
+    if ((_options.minSize && (isDirectory || size < _options.minSize)) || (_options.newerThan && modified <= _options.newerThan))
+      return;
+    if (_options.maxResults && (size_t)_matches.fetch_add(1) >= _options.maxResults) {
+      _stop = true;
+      return;
+    }
+    if (!_options.maxResults)
+      _matches++;
+    char number[24];
+    if (!batch.empty())
+      batch += '\n';
+    batch += "{\"name\":";
+    Json::AppendString(batch, name.data(), name.size());
+    batch += ",\"path\":";
+    std::string path = GlobalHelpers::JoinPath(directory, name);
+    Json::AppendString(batch, path.data(), path.size());
+    batch += isDirectory ? ",\"type\":\"dir\"" : ",\"type\":\"file\"";
+    if (!isDirectory) {
+      batch += ",\"size\":";
+      batch.append(number, std::to_chars(number, number + sizeof(number), size).ptr);
+    }
+    batch += ",\"dateModified\":";
+    batch.append(number, std::to_chars(number, number + sizeof(number), modified).ptr);
+    batch += '}';
+  }
+
+  void Walk::Flush(std::string& batch) {
+    if (batch.empty())
+      return;
+    // lines of different scanners don't interleave; a batch ends where the next one starts
+    batch += '\n';
+    {
+      std::lock_guard lock(_emitMutex);
+      _emit(batch);
+    }
+    batch.clear();
+  }
+} // namespace
+
+int64_t FileSearch::Run(const Options& options, const Emit& emit, const IsCancelled& isCancelled) {
+  std::string root = options.root;
+  std::replace(root.begin(), root.end(), '\\', '/');
+  // "C:" is the drive's current directory, "C:/" its root
+  if (root.size() == 2 && root[1] == ':')
+    root += '/';
+#ifdef _WIN32
+  DWORD attributes = GetFileAttributesW(GlobalHelpers::StringToWstring(root).c_str());
+  if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY))
+    return -1;
+#else
+  struct stat info;
+  if (stat(root.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+    return -1;
+#endif
+  Walk walk(options, emit, isCancelled);
+  walk.Push(0, root);
+  std::vector<std::thread> scanners;
+  for (size_t i = 1; i < walk.GetScannerCount(); i++)
+    scanners.emplace_back(&Walk::Scan, &walk, i);
+  walk.Scan(0);
+  for (auto& scanner : scanners)
+    scanner.join();
+  return walk.GetMatches();
+}
+
+bool FileSearch::Match(const std::string& glob, const std::string& name, bool ignoreCase) {
+  auto same = [&](char a, char b) {
+    if (ignoreCase) {
+      a = a >= 'A' && a <= 'Z' ? a + 32 : a;
+      b = b >= 'A' && b <= 'Z' ? b + 32 : b;
+    }
+    return a == b;
+  };
+  // the usual greedy match: on a mismatch, the last '*' takes one more byte
+  size_t g = 0, n = 0, starG = std::string::npos, starN = 0;
+  while (n < name.size()) {
+    if (g < glob.size() && glob[g] == '?') {
+      g++;
+      // a whole UTF-8 character
+      for (n++; n < name.size() && ((unsigned char)name[n] & 0xc0) == 0x80; n++) {
+      }
+    }
+    else if (g < glob.size() && glob[g] == '*') {
+      starG = g++;
+      starN = n;
+    }
+    else if (g < glob.size() && same(glob[g], name[n])) {
+      g++;
+      n++;
+    }
+    else if (starG != std::string::npos) {
+      g = starG + 1;
+      n = ++starN;
+    }
+    else
+      return false;
+  }
+  while (g < glob.size() && glob[g] == '*')
+    g++;
+  return g == glob.size();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/// @brief Recursive search by name pattern, size and modification time (fs.Find). The tree is walked by a few scanner threads, each
+/// with a deque of directories of its own: it takes the newest one (depth first, close to what it just read), an idle one steals the
+/// oldest from another (a whole subtree). The number of scanners is the I/O concurrency: 1 for a spinning disk, more for SSDs.
+/// Directory links aren't followed
+class FileSearch {
+public:
+  struct Options {
+    std::string root;
+    /// @brief Matched against the name: `*` and `?`, case-insensitive on Windows
+    std::string glob = "*";
+    /// @brief Only files of at least this size; directories match only while it's 0
+    uint64_t minSize = 0;
+    /// @brief Only what was modified after this, ms since 1970; 0 = any time
+    int64_t newerThan = 0;
+    /// @brief 0 = no limit
+    size_t maxResults = 0;
+    size_t scanners = 4;
+  };
+  /// @brief Matches found since the last call, one JSON object per line ({ name, path, type, size, dateModified }, as ListDirectory)
+  using Emit = std::function<void(const std::string& batch)>;
+  using IsCancelled = std::function<bool()>;
+
+  /// @brief A scanner hands over its matches once it has this much
+  static constexpr size_t batch_size = 16 * 1024;
+  /// @brief ...or once they've waited this long, so a slow walk still shows progress
+  static constexpr auto batch_delay = std::chrono::milliseconds(250);
+
+  /// @brief Walks the tree from `options.root`, handing matches to `emit` in batches as they're found. `emit` may be called from any
+  /// scanner, one at a time
+  /// @returns The number of matches, -1 if the root can't be read
+  static int64_t Run(const Options& options, const Emit& emit, const IsCancelled& isCancelled);
+
+  /// @brief `*` and `?`, folding ASCII case if `ignoreCase`
+  static bool Match(const std::string& glob, const std::string& name, bool ignoreCase);
+};
@@ -14,7 +14,7 @@
 namespace ih = InstallerHelpers;
 namespace gh = GlobalHelpers;
 
-std::vector<std::string> otherFiles = { "0_Config.lua", "1_json.lua", "2_Startup.lua", "3_MainCycle.lua", "root.crt" };
+std::vector<std::string> otherFiles = { "0_Config.lua", "2_Startup.lua", "3_MainCycle.lua", "root.crt" };
 
 std::wstring Installer::GetInstallationDirectory() {
   return ih::GetProgramFilesDirectory() + L"\\" + appConfig.appName;
@@ -0,0 +1,118 @@
+#include "JobPool.h"
+#include "ChunkCache.h"
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+#include <iostream>
+#include <utility>
+
+JobPool::JobPool(size_t threads, std::function<void(lua_State*)> setup) : _threadCount(threads ? threads : 1), _setup(std::move(setup)) {}
+JobPool::~JobPool() {
+  {
+    std::lock_guard lock(_mutex);
+    _stop = true;
+  }
+  _jobReady.notify_all();
+  for (auto& thread : _threads)
+    thread.join();
+}
+
+void JobPool::Submit(uint32_t id, std::string code, std::string args) {
+  {
+    std::lock_guard lock(_mutex);
+    _jobs.push_back({ id, std::move(code), std::move(args), _generation });
+    if (_threads.size() < _threadCount && _threads.size() < _jobs.size() + _running)
+      _threads.emplace_back(&JobPool::Worker, this);
+  }
+  _jobReady.notify_one();
+}
+std::vector<JobPool::Result> JobPool::Collect() {
+  std::lock_guard lock(_mutex);
+  return std::exchange(_results, {});
+}
+size_t JobPool::GetPending() {
+  std::lock_guard lock(_mutex);
+  return _jobs.size() + _running + _results.size();
+}
+bool JobPool::Wait(std::chrono::milliseconds timeout) {
+  std::unique_lock lock(_mutex);
+  return _resultReady.wait_for(lock, timeout, [this] { return !_results.empty(); });
+}
+void JobPool::Discard() {
+  std::lock_guard lock(_mutex);
+  _generation++;
+  _jobs.clear();
+  _results.clear();
+}
+
+void JobPool::Worker() {
+  lua_State* L = luaL_newstate();
+  try {
+    _setup(L);
+  }
+  catch (std::exception& e) {
+    // the jobs still run, they'll just fail on whatever the setup didn't define
+    std::cerr << "Job worker setup: " << e.what() << std::endl;
+  }
+  std::unique_lock lock(_mutex);
+  while (true) {
+    _jobReady.wait(lock, [this] { return _stop || !_jobs.empty(); });
+    if (_stop)
+      break;
+    Job job = std::move(_jobs.front());
+    _jobs.pop_front();
+    _running++;
+    lock.unlock();
+    Result result = Run(L, job);
+    lock.lock();
+    _running--;
+    if (job.generation != _generation)
+      continue;
+    _results.push_back(std::move(result));
+    _resultReady.notify_all();
+  }
+  lock.unlock();
+  lua_close(L);
+}
+
+JobPool::Result JobPool::Run(lua_State* L, const Job& job) {
+  Result result { job.id, "", true };
+  // workers see the same commands over and over too
+  int argCount = -1;
+  if (ChunkCache::Of(L).Load(L, job.code)) {
+    argCount = ChunkCache::PushArguments(L, job.args);
+    if (argCount < 0) {
+      lua_pop(L, 1);
+      lua_pushliteral(L, "Malformed argument list");
+    }
+  }
+  if (argCount < 0 || lua_pcall(L, argCount, 0, 0) != LUA_OK) {
+    std::cerr << "Lua Error (job " << job.id << "): " << lua_tostring(L, -1) << std::endl;
+    lua_settop(L, 0);
+    result.ok = false;
+  }
+  // same as RunCommand in 3_MainCycle.lua: the output is whatever was printed
+  lua_getglobal(L, "printBuf");
+  if (lua_istable(L, -1)) {
+    lua_Integer count = luaL_len(L, -1);
+    for (lua_Integer i = 1; i <= count; i++) {
+      lua_rawgeti(L, -1, i);
+      size_t size;
+      const char* line = lua_tolstring(L, -1, &size);
+      if (line) {
+        if (!result.output.empty())
+          result.output += '\n';
+        result.output.append(line, size);
+      }
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+  lua_newtable(L);
+  lua_setglobal(L, "printBuf");
+  if (!result.ok)
+    result.output += result.output.empty() ? "false" : "\nfalse";
+  return result;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct lua_State;
+
+/// @brief Runs independent commands concurrently. Each worker thread owns a lua_State of its own, prepared like the main one, so commands
+/// never share Lua state; results come back in completion order, tagged with the id they were submitted with.
+/// Commands run here can't use `net` (its functions raise, see LuaFunctions::RegisterConcurrent()): the connection belongs to the main cycle
+class JobPool {
+public:
+  struct Result {
+    uint32_t id;
+    /// @brief What the command printed (printBuf), lines joined with '\n'
+    std::string output;
+    bool ok;
+  };
+
+  /// @param setup Prepares a worker's fresh state (libraries, bindings, startup scripts). Runs on the worker thread, before its first job
+  JobPool(size_t threads, std::function<void(lua_State*)> setup);
+  ~JobPool();
+  JobPool(const JobPool&) = delete;
+  JobPool& operator=(const JobPool&) = delete;
+
+  /// @brief Workers are started on the first call, so agents whose server never sends concurrent commands don't pay for their states
+  /// @param args Encoded argument list for `code` (see ChunkCache::PushArguments)
+  void Submit(uint32_t id, std::string code, std::string args = "");
+  /// @returns Results finished since the last call
+  std::vector<Result> Collect();
+  /// @brief Submitted and not collected yet
+  size_t GetPending();
+  /// @brief Waits until a result is ready or `timeout` passes
+  /// @returns true if there's something to Collect()
+  bool Wait(std::chrono::milliseconds timeout);
+  /// @brief Forgets queued jobs and the results of running ones: they were meant for a connection that's gone
+  void Discard();
+
+private:
+  struct Job {
+    uint32_t id;
+    std::string code;
+    std::string args;
+    uint64_t generation;
+  };
+
+  size_t _threadCount;
+  std::function<void(lua_State*)> _setup;
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _jobReady, _resultReady;
+  std::deque<Job> _jobs;
+  std::vector<Result> _results;
+  size_t _running = 0;
+  uint64_t _generation = 0;
+  bool _stop = false;
+
+  void Worker();
+  Result Run(lua_State* L, const Job& job);
+};
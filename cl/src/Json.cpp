@@ -0,0 +1,552 @@
+#include "Json.h"
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+}
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+  constexpr uint64_t ones = 0x0101010101010101ull, highs = 0x8080808080808080ull;
+
+  /// @returns Non-zero if one of the 8 bytes is '"', '\\' or below 0x20
+  inline uint64_t NeedsEscape(uint64_t word) {
+    auto anyZero = [](uint64_t v) { return (v - ones) & ~v & highs; };
+    return ((word - ones * 0x20) & ~word & highs) | anyZero(word ^ (ones * '"')) | anyZero(word ^ (ones * '\\'));
+  }
+  /// @returns How many bytes from `begin` on can be copied as they are: up to the first '"', '\\' or control character
+  size_t ScanPlain(const char* begin, const char* end) {
+    const char* p = begin;
+    for (; end - p >= 8; p += 8) {
+      uint64_t word;
+      memcpy(&word, p, sizeof(word));
+      if (NeedsEscape(word))
+        break;
+    }
+    while (p < end && (unsigned char)*p >= 0x20 && *p != '"' && *p != '\\')
+      p++;
+    return p - begin;
+  }
+
+  class Encoder {
+  public:
+    Encoder(lua_State* L, std::string& out) : _L(L), _out(out) {}
+    void Value(int index, int depth);
+
+  private:
+    lua_State* _L;
+    std::string& _out;
+    /// @brief Tables being encoded, outermost first
+    std::vector<const void*> _path;
+
+    void Number(int index);
+    void Table(int index, int depth);
+  };
+
+  void Encoder::Value(int index, int depth) {
+    switch (lua_type(_L, index)) {
+    case LUA_TNIL:
+      _out += "null";
+      break;
+    case LUA_TBOOLEAN:
+      _out += lua_toboolean(_L, index) ? "true" : "false";
+      break;
+    case LUA_TNUMBER:
+      Number(index);
+      break;
+    case LUA_TSTRING: {
+      size_t size;
+      const char* data = lua_tolstring(_L, index, &size);
+      Json::AppendString(_out, data, size);
+      break;
+    }
+    case LUA_TTABLE:
+      Table(index, depth);
+      break;
+    default:
+      throw std::runtime_error(std::string("unexpected type '") + luaL_typename(_L, index) + "'");
+    }
+  }
+
+  void Encoder::Number(int index) {
+    char buffer[32];
+    if (lua_isinteger(_L, index)) {
+      lua_Integer value = lua_tointeger(_L, index);
+      // %.14g prints integers of up to 14 digits as they are
+      if (value > -100000000000000 && value < 100000000000000) {
+        _out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+        return;
+      }
+    }
+    double value = lua_tonumber(_L, index);
+    if (std::isnan(value) || std::isinf(value)) {
+      // spelled the way tostring() does it here ("-nan" or "nan"...)
+      lua_pushvalue(_L, index);
+      throw std::runtime_error(std::string("unexpected number value '") + lua_tostring(_L, -1) + "'");
+    }
+    // the same digits as %.14g, without the locale
+    _out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::general, 14).ptr);
+  }
+
+  void Encoder::Table(int index, int depth) {
+    const void* table = lua_topointer(_L, index);
+    if (std::find(_path.begin(), _path.end(), table) != _path.end())
+      throw std::runtime_error("circular reference");
+    if (depth >= Json::max_depth || !lua_checkstack(_L, 3))
+      throw std::runtime_error("too deep");
+    _path.push_back(table);
+
+    // json.lua's rule: an array if it has [1] or is empty
+    bool array = lua_rawgeti(_L, index, 1) != LUA_TNIL;
+    lua_pop(_L, 1);
+    if (!array) {
+      lua_pushnil(_L);
+      array = !lua_next(_L, index);
+      if (!array)
+        lua_pop(_L, 2);
+    }
+
+    if (array) {
+      // number keys only, as many as the length says
+      lua_Integer count = 0;
+      lua_pushnil(_L);
+      while (lua_next(_L, index)) {
+        lua_pop(_L, 1);
+        if (lua_type(_L, -1) != LUA_TNUMBER)
+          throw std::runtime_error("invalid table: mixed or invalid key types");
+        count++;
+      }
+      if (count != (lua_Integer)lua_rawlen(_L, index))
+        throw std::runtime_error("invalid table: sparse array");
+      _out += '[';
+      for (lua_Integer i = 1; lua_rawgeti(_L, index, i) != LUA_TNIL; i++) {
+        if (i > 1)
+          _out += ',';
+        Value(lua_gettop(_L), depth + 1);
+        lua_pop(_L, 1);
+      }
+      lua_pop(_L, 1);
+      _out += ']';
+    }
+    else {
+      _out += '{';
+      bool first = true;
+      lua_pushnil(_L);
+      while (lua_next(_L, index)) {
+        // checked before lua_tolstring: converting a number key in place would derail lua_next
+        if (lua_type(_L, -2) != LUA_TSTRING)
+          throw std::runtime_error("invalid table: mixed or invalid key types");
+        if (!first)
+          _out += ',';
+        first = false;
+        size_t size;
+        const char* key = lua_tolstring(_L, -2, &size);
+        Json::AppendString(_out, key, size);
+        _out += ':';
+        Value(lua_gettop(_L), depth + 1);
+        lua_pop(_L, 1);
+      }
+      _out += '}';
+    }
+    _path.pop_back();
+  }
+
+  class Decoder {
+  public:
+    Decoder(lua_State* L, const char* data, size_t size) : _L(L), _begin(data), _p(data), _end(data + size) {}
+    void Document();
+
+  private:
+    lua_State* _L;
+    const char *_begin, *_p, *_end;
+    /// @brief Strings with escapes are put together here
+    std::string _buffer;
+
+    [[noreturn]] void Fail(const char* at, const std::string& message) const;
+    void SkipSpace();
+    /// @returns Where the number or literal at _p ends: the next space, ']', '}' or ','
+    const char* TokenEnd() const;
+    void Value(int depth);
+    void String();
+    /// @brief The \u escape at _p (on the 'u'), into _buffer
+    void Unicode();
+    void Number();
+    void Literal();
+    void Array(int depth);
+    void Object(int depth);
+  };
+
+  void Decoder::Document() {
+    SkipSpace();
+    Value(0);
+    SkipSpace();
+    if (_p < _end)
+      Fail(_p, "trailing garbage");
+  }
+
+  void Decoder::Fail(const char* at, const std::string& message) const {
+    // json.lua counts past the end too: "expected ']'" on "[1" is one column beyond it
+    int line = 1, column = 1;
+    for (const char* c = _begin; c < at; c++) {
+      column++;
+      if (c < _end && *c == '\n') {
+        line++;
+        column = 1;
+      }
+    }
+    throw std::runtime_error(message + " at line " + std::to_string(line) + " col " + std::to_string(column));
+  }
+
+  void Decoder::SkipSpace() {
+    while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\r' || *_p == '\n'))
+      _p++;
+  }
+
+  const char* Decoder::TokenEnd() const {
+    const char* p = _p;
+    while (p < _end && !strchr(" \t\r\n]},", *p))
+      p++;
+    return p;
+  }
+
+  void Decoder::Value(int depth) {
+    if (_p == _end)
+      Fail(_p, "unexpected character ''");
+    switch (*_p) {
+    case '"':
+      String();
+      break;
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+      Number();
+      break;
+    case 't':
+    case 'f':
+    case 'n':
+      Literal();
+      break;
+    case '[':
+      Array(depth);
+      break;
+    case '{':
+      Object(depth);
+      break;
+    default:
+      Fail(_p, std::string("unexpected character '") + *_p + "'");
+    }
+  }
+
+  void Decoder::String() {
+    const char* quote = _p++;
+    const char* run = _p;
+    bool escaped = false;
+    while (true) {
+      _p += ScanPlain(_p, _end);
+      if (_p == _end)
+        Fail(quote, "expected closing quote for string");
+      char c = *_p;
+      if (c == '"')
+        break;
+      if ((unsigned char)c < 0x20)
+        Fail(_p, "control character in string");
+      // a backslash: from here on the string is put together in _buffer
+      if (!escaped)
+        _buffer.clear();
+      escaped = true;
+      _buffer.append(run, _p);
+      const char* backslash = _p++;
+      switch (_p < _end ? *_p : '\0') {
+      case '"':
+      case '\\':
+      case '/':
+        _buffer += *_p++;
+        break;
+      case 'b':
+        _buffer += '\b';
+        _p++;
+        break;
+      case 'f':
+        _buffer += '\f';
+        _p++;
+        break;
+      case 'n':
+        _buffer += '\n';
+        _p++;
+        break;
+      case 'r':
+        _buffer += '\r';
+        _p++;
+        break;
+      case 't':
+        _buffer += '\t';
+        _p++;
+        break;
+      case 'u':
+        Unicode();
+        break;
+      default:
+        Fail(backslash, std::string("invalid escape char '") + (_p < _end ? std::string(1, *_p) : "") + "' in string");
+      }
+      run = _p;
+    }
+    if (escaped) {
+      _buffer.append(run, _p);
+      lua_pushlstring(_L, _buffer.data(), _buffer.size());
+    }
+    else
+      lua_pushlstring(_L, run, _p - run);
+    _p++;
+  }
+
+  void Decoder::Unicode() {
+    auto hex = [&](const char* at, size_t count) -> long {
+      if (_end - at < (ptrdiff_t)count)
+        return -1;
+      long value = 0;
+      for (size_t i = 0; i < count; i++) {
+        int digit;
+        if (std::from_chars(at + i, at + i + 1, digit, 16).ec != std::errc())
+          return -1;
+        value = value * 16 + digit;
+      }
+      return value;
+    };
+    long first = hex(_p + 1, 4);
+    if (first < 0)
+      Fail(_p - 1, "invalid unicode escape in string");
+    uint32_t codepoint = first;
+    _p += 5;
+    // a high surrogate followed by another \u: a pair, like json.lua takes it
+    if (first >= 0xd800 && first <= 0xdbff && _end - _p >= 6 && _p[0] == '\\' && _p[1] == 'u') {
+      long second = hex(_p + 2, 4);
+      if (second >= 0) {
+        codepoint = (uint32_t)((first - 0xd800) * 0x400 + (second - 0xdc00) + 0x10000);
+        _p += 6;
+      }
+    }
+    if (codepoint <= 0x7f)
+      _buffer += (char)codepoint;
+    else if (codepoint <= 0x7ff) {
+      _buffer += (char)(0xc0 | codepoint >> 6);
+      _buffer += (char)(0x80 | (codepoint & 0x3f));
+    }
+    else if (codepoint <= 0xffff) {
+      _buffer += (char)(0xe0 | codepoint >> 12);
+      _buffer += (char)(0x80 | (codepoint >> 6 & 0x3f));
+      _buffer += (char)(0x80 | (codepoint & 0x3f));
+    }
+    else if (codepoint <= 0x10ffff) {
+      _buffer += (char)(0xf0 | codepoint >> 18);
+      _buffer += (char)(0x80 | (codepoint >> 12 & 0x3f));
+      _buffer += (char)(0x80 | (codepoint >> 6 & 0x3f));
+      _buffer += (char)(0x80 | (codepoint & 0x3f));
+    }
+    else {
+      char message[48];
+      snprintf(message, sizeof(message), "invalid unicode codepoint '%x'", codepoint);
+      throw std::runtime_error(message);
+    }
+  }
+
+  void Decoder::Number() {
+    const char* end = TokenEnd();
+    // plain integers, the usual case: no copy, no strtod
+    const char* digits = _p + (*_p == '-');
+    if (end > digits && end - digits <= 18 && std::all_of(digits, end, [](char c) { return c >= '0' && c <= '9'; })) {
+      int64_t value = 0;
+      std::from_chars(digits, end, value);
+      lua_pushinteger(_L, *_p == '-' ? -value : value);
+      _p = end;
+      return;
+    }
+    // the rest as Lua's tonumber() reads it, like json.lua did
+    std::string token(_p, end);
+    if (lua_stringtonumber(_L, token.c_str()) != token.size() + 1)
+      Fail(_p, "invalid number '" + token + "'");
+    _p = end;
+  }
+
+  void Decoder::Literal() {
+    const char* end = TokenEnd();
+    std::string word(_p, end);
+    if (word == "true")
+      lua_pushboolean(_L, 1);
+    else if (word == "false")
+      lua_pushboolean(_L, 0);
+    else if (word == "null")
+      lua_pushnil(_L);
+    else
+      Fail(_p, "invalid literal '" + word + "'");
+    _p = end;
+  }
+
+  void Decoder::Array(int depth) {
+    if (depth >= Json::max_depth || !lua_checkstack(_L, 3))
+      Fail(_p, "too deep");
+    _p++;
+    lua_newtable(_L);
+    lua_Integer n = 1;
+    while (true) {
+      SkipSpace();
+      if (_p < _end && *_p == ']') {
+        _p++;
+        break;
+      }
+      Value(depth + 1);
+      lua_rawseti(_L, -2, n++);
+      SkipSpace();
+      char c = _p < _end ? *_p : '\0';
+      _p++;
+      if (c == ']')
+        break;
+      if (c != ',')
+        Fail(_p, "expected ']' or ','");
+    }
+  }
+
+  void Decoder::Object(int depth) {
+    if (depth >= Json::max_depth || !lua_checkstack(_L, 4))
+      Fail(_p, "too deep");
+    _p++;
+    lua_newtable(_L);
+    while (true) {
+      SkipSpace();
+      if (_p < _end && *_p == '}') {
+        _p++;
+        break;
+      }
+      if (_p == _end || *_p != '"')
+        Fail(_p, "expected string for key");
+      String();
+      SkipSpace();
+      if (_p == _end || *_p != ':')
+        Fail(_p, "expected ':' after key");
+      _p++;
+      SkipSpace();
+      Value(depth + 1);
+      lua_rawset(_L, -3);
+      SkipSpace();
+      char c = _p < _end ? *_p : '\0';
+      _p++;
+      if (c == '}')
+        break;
+      if (c != ',')
+        Fail(_p, "expected '}' or ','");
+    }
+  }
+
+  /// @brief Raises `message` as a Lua error, with the caller's position like error() does
+  int Raise(lua_State* L) {
+    luaL_where(L, 1);
+    lua_insert(L, -2);
+    lua_concat(L, 2);
+    return lua_error(L);
+  }
+} // namespace
+
+void Json::AppendString(std::string& out, const char* data, size_t size) {
+  static const char hex[] = "0123456789abcdef";
+  const char* end = data + size;
+  out += '"';
+  while (true) {
+    size_t plain = ScanPlain(data, end);
+    out.append(data, plain);
+    data += plain;
+    if (data == end)
+      break;
+    unsigned char c = *data++;
+    out += '\\';
+    switch (c) {
+    case '"':
+    case '\\':
+      out += (char)c;
+      break;
+    case '\b':
+      out += 'b';
+      break;
+    case '\f':
+      out += 'f';
+      break;
+    case '\n':
+      out += 'n';
+      break;
+    case '\r':
+      out += 'r';
+      break;
+    case '\t':
+      out += 't';
+      break;
+    default:
+      out += "u00";
+      out += hex[c >> 4];
+      out += hex[c & 15];
+    }
+  }
+  out += '"';
+}
+
+void Json::Encode(lua_State* L, int index, std::string& out) {
+  Encoder(L, out).Value(lua_absindex(L, index), 0);
+}
+
+void Json::Decode(lua_State* L, const char* data, size_t size) {
+  Decoder(L, data, size).Document();
+}
+
+int Json::CEncode(lua_State* L) {
+  lua_settop(L, 1);
+  {
+    std::string out, error;
+    try {
+      Encode(L, 1, out);
+    }
+    catch (const std::exception& e) {
+      error = e.what();
+    }
+    if (error.empty()) {
+      lua_pushlstring(L, out.data(), out.size());
+      return 1;
+    }
+    lua_pushlstring(L, error.data(), error.size());
+  }
+  // raised out here: a Lua error is a longjmp, it would skip the strings' destructors
+  return Raise(L);
+}
+
+int Json::CDecode(lua_State* L) {
+  if (lua_type(L, 1) != LUA_TSTRING) {
+    lua_pushfstring(L, "expected argument of type string, got %s", luaL_typename(L, 1));
+    return Raise(L);
+  }
+  size_t size;
+  const char* data = lua_tolstring(L, 1, &size);
+  lua_settop(L, 1);
+  {
+    std::string error;
+    try {
+      Decode(L, data, size);
+    }
+    catch (const std::exception& e) {
+      error = e.what();
+    }
+    if (error.empty())
+      return 1;
+    lua_settop(L, 1);
+    lua_pushlstring(L, error.data(), error.size());
+  }
+  return Raise(L);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <string>
+struct lua_State;
+
+/// @brief JSON.encode/JSON.decode in C++, a drop-in for the json.lua (rxi) the agent used to run: same array/object rules, numbers as
+/// %.14g, null decoded to nil, same error messages. Strings are scanned a machine word at a time for what needs escaping
+namespace Json {
+  /// @brief Deeper than this is an error, not a C stack overflow
+  constexpr int max_depth = 512;
+
+  /// @brief Appends the value at `index` to `out`
+  /// @throws std::runtime_error for what json.lua rejects: cycles, mixed or sparse tables, NaN/inf, functions and userdata
+  void Encode(lua_State* L, int index, std::string& out);
+  /// @brief Appends `data` as a quoted, escaped JSON string
+  void AppendString(std::string& out, const char* data, size_t size);
+  /// @brief Pushes the value `data` holds
+  /// @throws std::runtime_error "<what> at line N col M" on malformed input
+  void Decode(lua_State* L, const char* data, size_t size);
+
+  /// @brief JSON.encode(value) for Lua: the errors above become Lua errors
+  int CEncode(lua_State* L);
+  /// @brief JSON.decode(string) for Lua
+  int CDecode(lua_State* L);
+}
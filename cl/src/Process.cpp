@@ -0,0 +1,302 @@
+#include "Process.h"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#ifdef _WIN32
+#include "helpers/GeneralHelpers.h"
+#include <atomic>
+#include <windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+#ifdef _WIN32
+static std::atomic<uint32_t> pipe_serial = 0;
+
+Process::Process(const std::string& command, std::string input) {
+  SECURITY_ATTRIBUTES inherit = { sizeof(inherit), NULL, TRUE };
+  // a named pipe: anonymous ones can't be read overlapped, so a read couldn't time out
+  std::wstring name = L"\\\\.\\pipe\\rut-" + std::to_wstring(GetCurrentProcessId()) + L"-" + std::to_wstring(pipe_serial++);
+  HANDLE output = CreateNamedPipeW(name.c_str(), PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                                   PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 0, (DWORD)read_size, 0, NULL);
+  if (output == INVALID_HANDLE_VALUE)
+    return;
+  HANDLE childOutput = CreateFileW(name.c_str(), GENERIC_WRITE, 0, &inherit, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  HANDLE childInput = NULL, inputWrite = NULL;
+  if (childOutput == INVALID_HANDLE_VALUE || !CreatePipe(&childInput, &inputWrite, &inherit, 0)) {
+    if (childOutput != INVALID_HANDLE_VALUE)
+      CloseHandle(childOutput);
+    CloseHandle(output);
+    return;
+  }
+  SetHandleInformation(inputWrite, HANDLE_FLAG_INHERIT, 0);
+
+  // processes are started from pool threads at once: the child inherits its own two ends and nothing else, not another one's pipes (whose
+  // writer would then stay open and keep that one's reader from ever seeing the end)
+  HANDLE inherited[] = { childInput, childOutput };
+  SIZE_T attributesSize = 0;
+  InitializeProcThreadAttributeList(NULL, 1, 0, &attributesSize);
+  std::vector<char> attributes(attributesSize);
+  auto attributeList = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attributes.data());
+  STARTUPINFOEXW startup = {};
+  startup.StartupInfo.cb = sizeof(startup);
+  startup.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+  startup.StartupInfo.hStdInput = childInput;
+  startup.StartupInfo.hStdOutput = startup.StartupInfo.hStdError = childOutput;
+  if (InitializeProcThreadAttributeList(attributeList, 1, 0, &attributesSize)) {
+    if (UpdateProcThreadAttribute(attributeList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherited, sizeof(inherited), NULL, NULL))
+      startup.lpAttributeList = attributeList;
+    else
+      DeleteProcThreadAttributeList(attributeList);
+  }
+  PROCESS_INFORMATION info = {};
+  std::wstring commandLine = L"cmd.exe /c " + GlobalHelpers::StringToWstring(command);
+  // suspended until it's in the job object, so nothing it starts can escape it
+  HANDLE group = CreateJobObjectW(NULL, NULL);
+  JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {};
+  limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+  SetInformationJobObject(group, JobObjectExtendedLimitInformation, &limits, sizeof(limits));
+  BOOL started = startup.lpAttributeList &&
+                 CreateProcessW(NULL, commandLine.data(), NULL, NULL, TRUE, CREATE_NO_WINDOW | CREATE_SUSPENDED | EXTENDED_STARTUPINFO_PRESENT, NULL,
+                                NULL, &startup.StartupInfo, &info);
+  if (startup.lpAttributeList)
+    DeleteProcThreadAttributeList(attributeList);
+  CloseHandle(childOutput);
+  CloseHandle(childInput);
+  if (!started) {
+    CloseHandle(inputWrite);
+    CloseHandle(output);
+    CloseHandle(group);
+    return;
+  }
+  AssignProcessToJobObject(group, info.hProcess);
+  ResumeThread(info.hThread);
+  CloseHandle(info.hThread);
+  _group = group;
+  _process = info.hProcess;
+  _output = output;
+  _readEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+  _inputWriter = std::thread([inputWrite, input = std::move(input)] {
+    size_t offset = 0;
+    DWORD written;
+    while (offset < input.size() && WriteFile(inputWrite, input.data() + offset, (DWORD)std::min<size_t>(input.size() - offset, 1 << 20), &written, NULL))
+      offset += written;
+    CloseHandle(inputWrite);
+  });
+}
+
+Process::~Process() {
+  if (!IsStarted())
+    return;
+  if (!_exited) {
+    Kill();
+    Wait();
+  }
+  _inputWriter.join();
+  CloseHandle(_readEvent);
+  CloseHandle(_output);
+  CloseHandle(_process);
+  // KILL_ON_JOB_CLOSE: takes down what's left of the group
+  CloseHandle(_group);
+}
+
+bool Process::IsStarted() const {
+  return _process != nullptr;
+}
+
+Process::ReadResult Process::Read(std::string& out, Clock::time_point deadline) {
+  if (!IsStarted())
+    return READ_END;
+  size_t offset = out.size();
+  out.resize(offset + read_size);
+  OVERLAPPED overlapped = {};
+  overlapped.hEvent = _readEvent;
+  ResetEvent(_readEvent);
+  DWORD bytesRead = 0;
+  if (!ReadFile(_output, out.data() + offset, (DWORD)read_size, &bytesRead, &overlapped)) {
+    if (GetLastError() != ERROR_IO_PENDING) {
+      // ERROR_BROKEN_PIPE: every writer is gone
+      out.resize(offset);
+      return READ_END;
+    }
+    DWORD waitMs = INFINITE;
+    if (deadline != Clock::time_point::max()) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+      waitMs = (DWORD)std::clamp<long long>(remaining, 0, INFINITE - 1);
+    }
+    if (WaitForSingleObject(_readEvent, waitMs) == WAIT_TIMEOUT) {
+      CancelIoEx(_output, &overlapped);
+      // it may have completed meanwhile: then it's data, not a timeout
+      if (!GetOverlappedResult(_output, &overlapped, &bytesRead, TRUE)) {
+        out.resize(offset);
+        return GetLastError() == ERROR_OPERATION_ABORTED ? READ_TIMEOUT : READ_END;
+      }
+    }
+    else if (!GetOverlappedResult(_output, &overlapped, &bytesRead, FALSE)) {
+      out.resize(offset);
+      return READ_END;
+    }
+  }
+  out.resize(offset + bytesRead);
+  return READ_DATA;
+}
+
+void Process::Kill() {
+  if (IsStarted())
+    TerminateJobObject(_group, 1);
+}
+
+int32_t Process::Wait() {
+  if (!IsStarted())
+    return -1;
+  if (!_exited) {
+    WaitForSingleObject(_process, INFINITE);
+    DWORD exitCode = 0;
+    GetExitCodeProcess(_process, &exitCode);
+    _exitCode = (int32_t)exitCode;
+    _exited = true;
+  }
+  return _exitCode;
+}
+#else
+Process::Process(const std::string& command, std::string input) {
+  int output[2], childInput[2];
+  if (pipe2(output, O_CLOEXEC) != 0)
+    return;
+  if (pipe2(childInput, O_CLOEXEC) != 0) {
+    close(output[0]);
+    close(output[1]);
+    return;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, childInput[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, output[1], STDERR_FILENO);
+  // a group of its own, killed as a whole
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attributes, 0);
+  const char* argv[] = { "sh", "-c", command.c_str(), nullptr };
+  pid_t pid;
+  int error = posix_spawn(&pid, "/bin/sh", &actions, &attributes, const_cast<char* const*>(argv), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+  close(output[1]);
+  close(childInput[0]);
+  if (error != 0) {
+    close(output[0]);
+    close(childInput[1]);
+    return;
+  }
+  _pid = pid;
+  _output = output[0];
+  _inputWriter = std::thread([inputWrite = childInput[1], input = std::move(input)] {
+    // EPIPE instead of SIGPIPE if the child doesn't read it all
+    sigset_t pipeSignal;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, nullptr);
+    size_t offset = 0;
+    while (offset < input.size()) {
+      ssize_t written = write(inputWrite, input.data() + offset, input.size() - offset);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0)
+        break;
+      offset += (size_t)written;
+    }
+    close(inputWrite);
+  });
+}
+
+Process::~Process() {
+  if (!IsStarted())
+    return;
+  if (!_exited) {
+    Kill();
+    Wait();
+  }
+  _inputWriter.join();
+  close(_output);
+}
+
+bool Process::IsStarted() const {
+  return _pid > 0;
+}
+
+Process::ReadResult Process::Read(std::string& out, Clock::time_point deadline) {
+  if (!IsStarted())
+    return READ_END;
+  while (true) {
+    int waitMs = -1;
+    if (deadline != Clock::time_point::max()) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+      waitMs = (int)std::clamp<long long>(remaining, 0, INT32_MAX);
+    }
+    pollfd readable = { _output, POLLIN, 0 };
+    int ready = poll(&readable, 1, waitMs);
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready == 0)
+      return READ_TIMEOUT;
+    size_t offset = out.size();
+    out.resize(offset + read_size);
+    ssize_t bytesRead = read(_output, out.data() + offset, read_size);
+    out.resize(offset + std::max<ssize_t>(bytesRead, 0));
+    if (bytesRead < 0 && errno == EINTR)
+      continue;
+    return bytesRead > 0 ? READ_DATA : READ_END;
+  }
+}
+
+void Process::Kill() {
+  std::lock_guard lock(_mutex);
+  // not once reaped: the pid could belong to someone else by now
+  if (IsStarted() && !_exited)
+    kill(-_pid, SIGKILL);
+}
+
+int32_t Process::Wait() {
+  if (!IsStarted())
+    return -1;
+  if (_exited)
+    return _exitCode;
+  // waited for without reaping first, so Kill() never races the reap
+  siginfo_t info;
+  while (waitid(P_PID, _pid, &info, WEXITED | WNOWAIT) < 0 && errno == EINTR) {
+  }
+  std::lock_guard lock(_mutex);
+  int status = 0;
+  while (waitpid(_pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  _exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  _exited = true;
+  return _exitCode;
+}
+#endif
+
+Process::Result Process::Run(const std::string& command, std::string input, std::chrono::milliseconds timeout) {
+  Process process(command, std::move(input));
+  if (!process.IsStarted())
+    throw std::runtime_error("Failed to start: " + command);
+  Result result;
+  auto deadline = timeout.count() > 0 ? Clock::now() + timeout : Clock::time_point::max();
+  ReadResult status;
+  while ((status = process.Read(result.output, deadline)) == READ_DATA) {
+  }
+  if (status == READ_TIMEOUT) {
+    result.timedOut = true;
+    process.Kill();
+  }
+  result.exitCode = process.Wait();
+  return result;
+}
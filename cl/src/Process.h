@@ -0,0 +1,57 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// @brief A shell command (cmd.exe /c, /bin/sh -c) started without _popen: stdout and stderr share one pipe read in large blocks, with a
+/// deadline (overlapped on Windows, poll() elsewhere); stdin gets the input given up front, then is closed. The process and whatever it
+/// starts are one group (a job object on Windows), killed together
+class Process {
+public:
+  using Clock = std::chrono::steady_clock;
+  enum ReadResult { READ_DATA, READ_END, READ_TIMEOUT };
+  struct Result {
+    std::string output;
+    int32_t exitCode = -1;
+    bool timedOut = false;
+  };
+
+  static constexpr size_t read_size = 64 * 1024;
+
+  /// @param input Written to stdin by a thread of its own, so a child that doesn't read it can't block the output
+  explicit Process(const std::string& command, std::string input = "");
+  /// @brief Kills the group if it's still running
+  ~Process();
+  Process(const Process&) = delete;
+  Process& operator=(const Process&) = delete;
+
+  bool IsStarted() const;
+  /// @brief Appends up to read_size bytes of output, waiting until `deadline` for some
+  ReadResult Read(std::string& out, Clock::time_point deadline = Clock::time_point::max());
+  /// @brief Safe to call from another thread while Read() or Wait() block
+  void Kill();
+  /// @brief Waits for the exit (after reading to the end, or it may block on a full pipe)
+  /// @returns The exit code, 128 + signal if killed by one (POSIX), -1 if it never started
+  int32_t Wait();
+
+  /// @brief Runs to the end, killed past `timeout` (0 = none)
+  static Result Run(const std::string& command, std::string input = "", std::chrono::milliseconds timeout = {});
+
+private:
+#ifdef _WIN32
+  void* _group = nullptr;
+  void* _process = nullptr;
+  void* _output = nullptr;
+  void* _readEvent = nullptr;
+#else
+  int _pid = -1;
+  int _output = -1;
+  /// @brief Kill() against the reap in Wait()
+  std::mutex _mutex;
+#endif
+  std::thread _inputWriter;
+  bool _exited = false;
+  int32_t _exitCode = -1;
+};
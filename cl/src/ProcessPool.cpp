@@ -0,0 +1,193 @@
+#include "ProcessPool.h"
+#include <algorithm>
+
+ProcessPool::ProcessPool(size_t workers) : _workerCount(workers ? workers : 1) {}
+ProcessPool::~ProcessPool() {
+  {
+    std::lock_guard lock(_mutex);
+    _stop = true;
+    _jobs.clear();
+    for (auto& [id, running] : _running) {
+      running.cancelled = true;
+      if (running.process)
+        running.process->Kill();
+    }
+  }
+  _jobReady.notify_all();
+  _chunksTaken.notify_all();
+  for (auto& worker : _workers)
+    worker.join();
+}
+
+uint32_t ProcessPool::Start(std::string command) {
+  return Enqueue({ 0, std::move(command), nullptr });
+}
+
+uint32_t ProcessPool::Start(Task task) {
+  return Enqueue({ 0, "", std::move(task) });
+}
+
+ProcessPool::Output ProcessPool::Open() {
+  std::lock_guard lock(_mutex);
+  uint32_t jobId = _nextId++;
+  _running[jobId] = {};
+  return Output(*this, jobId);
+}
+
+void ProcessPool::Close(const Output& output, int32_t exitCode) {
+  bool cancelled;
+  {
+    std::lock_guard lock(_mutex);
+    cancelled = _running[output._jobId].cancelled;
+    _running.erase(output._jobId);
+  }
+  PushEnd(output._jobId, cancelled, exitCode);
+}
+
+bool ProcessPool::Cancel(uint32_t jobId) {
+  {
+    std::lock_guard lock(_mutex);
+    auto queued = std::find_if(_jobs.begin(), _jobs.end(), [&](const Job& job) { return job.id == jobId; });
+    if (queued == _jobs.end()) {
+      auto running = _running.find(jobId);
+      if (running == _running.end() || running->second.cancelled)
+        return false;
+      running->second.cancelled = true;
+      // not started yet: Run() kills it as soon as it is
+      if (running->second.process)
+        running->second.process->Kill();
+      // a worker waiting to push output has to see it
+      _chunksTaken.notify_all();
+      return true;
+    }
+    _jobs.erase(queued);
+  }
+  PushEnd(jobId, true, -1);
+  return true;
+}
+
+std::vector<ProcessPool::Chunk> ProcessPool::Collect() {
+  std::vector<Chunk> chunks;
+  {
+    std::lock_guard lock(_mutex);
+    chunks.swap(_chunks);
+    _pendingBytes = 0;
+  }
+  _chunksTaken.notify_all();
+  return chunks;
+}
+
+size_t ProcessPool::GetActive() {
+  std::lock_guard lock(_mutex);
+  return _jobs.size() + _running.size();
+}
+
+void ProcessPool::Discard() {
+  Collect();
+}
+
+uint32_t ProcessPool::Enqueue(Job job) {
+  std::lock_guard lock(_mutex);
+  if (_workers.empty())
+    for (size_t i = 0; i < _workerCount; i++)
+      _workers.emplace_back(&ProcessPool::Worker, this);
+  job.id = _nextId++;
+  _jobs.push_back(std::move(job));
+  _jobReady.notify_one();
+  return _jobs.back().id;
+}
+
+void ProcessPool::Worker() {
+  std::unique_lock lock(_mutex);
+  while (true) {
+    _jobReady.wait(lock, [&] { return _stop || !_jobs.empty(); });
+    if (_stop)
+      return;
+    Job job = std::move(_jobs.front());
+    _jobs.pop_front();
+    _running[job.id] = {};
+    lock.unlock();
+    if (job.task)
+      RunTask(job);
+    else
+      Run(job);
+    lock.lock();
+    _running.erase(job.id);
+  }
+}
+
+void ProcessPool::PushOutput(uint32_t jobId, const char* data, size_t size) {
+  std::unique_lock lock(_mutex);
+  _chunksTaken.wait(lock, [&] { return _pendingBytes < max_pending_bytes || _stop || _running[jobId].cancelled; });
+  _pendingBytes += size;
+  if (!_chunks.empty() && _chunks.back().jobId == jobId && _chunks.back().kind == OUTPUT && _chunks.back().data.size() + size <= max_chunk_size)
+    _chunks.back().data.append(data, size);
+  else
+    _chunks.push_back({ jobId, OUTPUT, std::string(data, size) });
+}
+
+void ProcessPool::PushEnd(uint32_t jobId, bool cancelled, int32_t exitCode) {
+  std::lock_guard lock(_mutex);
+  if (cancelled)
+    _chunks.push_back({ jobId, CANCELLED, "" });
+  else
+    _chunks.push_back({ jobId, EXIT, std::string(reinterpret_cast<const char*>(&exitCode), sizeof(exitCode)) });
+}
+
+void ProcessPool::Run(const Job& job) {
+  Process process(job.command);
+  if (!process.IsStarted()) {
+    PushEnd(job.id, false, -1);
+    return;
+  }
+  {
+    std::lock_guard lock(_mutex);
+    _running[job.id].process = &process;
+    // cancelled before it started
+    if (_running[job.id].cancelled)
+      process.Kill();
+  }
+
+  std::string buffer;
+  while (process.Read(buffer) == Process::READ_DATA) {
+    if (!buffer.empty())
+      PushOutput(job.id, buffer.data(), buffer.size());
+    buffer.clear();
+  }
+  int32_t exitCode = process.Wait();
+  bool cancelled;
+  {
+    std::lock_guard lock(_mutex);
+    cancelled = _running[job.id].cancelled;
+    _running[job.id].process = nullptr;
+  }
+  PushEnd(job.id, cancelled, exitCode);
+}
+
+void ProcessPool::RunTask(const Job& job) {
+  Output output(*this, job.id);
+  int32_t exitCode;
+  try {
+    exitCode = job.task(output);
+  }
+  catch (const std::exception& e) {
+    std::string message = std::string("\n") + e.what();
+    PushOutput(job.id, message.data(), message.size());
+    exitCode = -1;
+  }
+  bool cancelled;
+  {
+    std::lock_guard lock(_mutex);
+    cancelled = _running[job.id].cancelled;
+  }
+  PushEnd(job.id, cancelled, exitCode);
+}
+
+void ProcessPool::Output::Write(const char* data, size_t size) {
+  _pool.PushOutput(_jobId, data, size);
+}
+
+bool ProcessPool::Output::IsCancelled() {
+  std::lock_guard lock(_pool._mutex);
+  return _pool._stop || _pool._running[_jobId].cancelled;
+}
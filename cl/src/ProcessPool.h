@@ -0,0 +1,108 @@
+#pragma once
+#include "Process.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Runs shell commands in the background (AExec) on a fixed number of workers, the rest wait in a queue. What a process writes to
+/// stdout and stderr comes back in chunks as it's written, tagged with the id of its job, then how it ended. Native tasks (fs.Find) run
+/// as jobs the same way. Jobs outlive connections
+class ProcessPool {
+public:
+  /// @brief Mirrors StreamKind in nsv protocol/Batch.ts
+  enum ChunkKind : uint8_t { OUTPUT = 0, EXIT, CANCELLED };
+  struct Chunk {
+    uint32_t jobId;
+    ChunkKind kind;
+    /// @brief OUTPUT: what the process wrote; EXIT: its exit code, i32
+    std::string data;
+  };
+
+  /// @brief Output of one job read in a row is sent as one chunk up to this size
+  static constexpr size_t max_chunk_size = 64 * 1024;
+  /// @brief Past this much output not collected yet, workers stop reading: a chatty process blocks on its pipe instead of filling memory
+  static constexpr size_t max_pending_bytes = 4 * 1024 * 1024;
+
+  /// @brief What a native task writes its output through
+  class Output {
+  public:
+    /// @brief Waits while too much output is pending, as a process would on a full pipe
+    void Write(const char* data, size_t size);
+    void Write(const std::string& data) { Write(data.data(), data.size()); }
+    /// @brief A task checks this between steps and returns early: there's no process to kill
+    bool IsCancelled();
+    uint32_t GetJobId() const { return _jobId; }
+
+  private:
+    friend class ProcessPool;
+    Output(ProcessPool& pool, uint32_t jobId) : _pool(pool), _jobId(jobId) {}
+    ProcessPool& _pool;
+    uint32_t _jobId;
+  };
+  /// @returns The exit code
+  using Task = std::function<int32_t(Output&)>;
+
+  explicit ProcessPool(size_t workers);
+  /// @brief Kills what's still running
+  ~ProcessPool();
+  ProcessPool(const ProcessPool&) = delete;
+  ProcessPool& operator=(const ProcessPool&) = delete;
+
+  /// @brief Workers are started on the first call
+  /// @returns The job id
+  uint32_t Start(std::string command);
+  /// @brief Runs `task` as a job, with the queue, chunks and cancellation of a command
+  uint32_t Start(Task task);
+  /// @brief A job for work that runs on a thread of its own (a long file operation): what's written to it goes out like a command's output
+  /// and Cancel() only marks it. Ended by Close()
+  Output Open();
+  /// @brief Ends a job from Open(): EXIT with `exitCode`, or CANCELLED if it was cancelled
+  void Close(const Output& output, int32_t exitCode);
+  /// @brief Drops the job if it's queued, kills its process (and what that started) if it's running. Ends with a CANCELLED chunk
+  /// @returns false if there's no such job (any more)
+  bool Cancel(uint32_t jobId);
+  /// @returns Chunks produced since the last call, in order
+  std::vector<Chunk> Collect();
+  /// @brief Jobs queued or running
+  size_t GetActive();
+  /// @brief Forgets the output not collected yet: it was meant for a connection that's gone
+  void Discard();
+
+private:
+  struct Job {
+    uint32_t id;
+    std::string command;
+    /// @brief Run instead of `command` if set
+    Task task;
+  };
+  struct Running {
+    /// @brief Owned by the worker running it; null until it's started
+    Process* process = nullptr;
+    bool cancelled = false;
+  };
+
+  size_t _workerCount;
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _jobReady, _chunksTaken;
+  std::deque<Job> _jobs;
+  std::unordered_map<uint32_t, Running> _running;
+  std::vector<Chunk> _chunks;
+  size_t _pendingBytes = 0;
+  uint32_t _nextId = 1;
+  bool _stop = false;
+
+  uint32_t Enqueue(Job job);
+  void Worker();
+  void Run(const Job& job);
+  void RunTask(const Job& job);
+  /// @brief Appends output of `jobId`, waiting while too much is pending
+  void PushOutput(uint32_t jobId, const char* data, size_t size);
+  void PushEnd(uint32_t jobId, bool cancelled, int32_t exitCode);
+};
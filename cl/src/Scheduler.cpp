@@ -0,0 +1,258 @@
+#include "Scheduler.h"
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+}
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+static const char* registry_key = "Scheduler";
+
+Scheduler::Scheduler(lua_State* L) : _L(L) {
+  lua_pushlightuserdata(L, this);
+  lua_setfield(L, LUA_REGISTRYINDEX, registry_key);
+}
+Scheduler::~Scheduler() {
+  Discard(_L);
+  lua_pushnil(_L);
+  lua_setfield(_L, LUA_REGISTRYINDEX, registry_key);
+  {
+    std::lock_guard lock(_mutex);
+    _stop = true;
+  }
+  _workReady.notify_all();
+  for (auto& worker : _workers)
+    worker.join();
+}
+
+Scheduler* Scheduler::Of(lua_State* L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, registry_key);
+  auto scheduler = static_cast<Scheduler*>(lua_touserdata(L, -1));
+  lua_pop(L, 1);
+  return scheduler;
+}
+
+void Scheduler::Spawn(lua_State* L, uint32_t id, int argCount) {
+  auto task = std::make_shared<Task>();
+  task->id = id;
+  task->thread = lua_newthread(L);
+  task->threadRef = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_newtable(L);
+  task->printBufRef = luaL_ref(L, LUA_REGISTRYINDEX);
+  task->argCount = argCount;
+  lua_xmove(L, task->thread, argCount + 1);
+  _tasks.push_back(task);
+  if (_tasks.size() == 1)
+    StartNext(L);
+}
+
+std::vector<Scheduler::Result> Scheduler::Collect(lua_State* L) {
+  if (!_tasks.empty()) {
+    bool ready;
+    {
+      std::lock_guard lock(_mutex);
+      ready = IsReady(*_tasks.front(), Clock::now());
+    }
+    if (ready && Resume(L, *_tasks.front(), 0)) {
+      _tasks.pop_front();
+      StartNext(L);
+    }
+  }
+  return std::exchange(_finished, {});
+}
+
+size_t Scheduler::GetRunning() const {
+  return _tasks.size();
+}
+
+bool Scheduler::Wait(std::chrono::milliseconds timeout) {
+  std::unique_lock lock(_mutex);
+  auto deadline = Clock::now() + timeout;
+  if (_tasks.empty()) {
+    _taskReady.wait_until(lock, deadline);
+    return false;
+  }
+  // only the running one can get ready, the others haven't started
+  auto& running = *_tasks.front();
+  deadline = std::min(deadline, running.wakeAt);
+  auto ready = [&] { return IsReady(running, Clock::now()); };
+  _taskReady.wait_until(lock, deadline, ready);
+  return ready();
+}
+
+void Scheduler::Discard(lua_State* L) {
+  for (auto& task : _tasks)
+    Release(L, *task);
+  _tasks.clear();
+  _finished.clear();
+}
+
+int Scheduler::Await(lua_State* L, Operation operation) {
+  auto scheduler = Of(L);
+  if (!scheduler || !lua_isyieldable(L) || !scheduler->Find(L))
+    return Complete(L, Guard(std::move(operation)));
+  scheduler->Start(scheduler->Find(L), std::move(operation));
+  // yielding from a C function is a longjmp: nothing left here to destroy
+  return lua_yieldk(L, 0, 0, Continue);
+}
+
+int Scheduler::Sleep(lua_State* L, std::chrono::milliseconds duration) {
+  auto scheduler = Of(L);
+  if (!scheduler || !lua_isyieldable(L) || !scheduler->Find(L)) {
+    std::this_thread::sleep_for(duration);
+    return 0;
+  }
+  {
+    auto task = scheduler->Find(L);
+    std::lock_guard lock(scheduler->_mutex);
+    task->waiting = true;
+    task->completion = [](lua_State*) { return 0; };
+    task->wakeAt = Clock::now() + duration;
+  }
+  return lua_yieldk(L, 0, 0, Continue);
+}
+
+int Scheduler::Continue(lua_State* L, int, lua_KContext) {
+  auto scheduler = Of(L);
+  Completion completion;
+  {
+    auto task = scheduler->Find(L);
+    std::lock_guard lock(scheduler->_mutex);
+    completion = std::move(task->completion);
+    task->completion = nullptr;
+    task->waiting = task->ready = false;
+    task->wakeAt = Clock::time_point::max();
+  }
+  return Complete(L, std::move(completion));
+}
+
+void Scheduler::Start(std::shared_ptr<Task> task, Operation operation) {
+  {
+    std::lock_guard lock(_mutex);
+    task->waiting = true;
+  }
+  Enqueue([this, task, operation = std::move(operation)]() mutable {
+    auto completion = Guard(std::move(operation));
+    {
+      std::lock_guard lock(_mutex);
+      task->completion = std::move(completion);
+      task->ready = true;
+    }
+    _taskReady.notify_all();
+  });
+}
+
+Scheduler::Completion Scheduler::Guard(Operation operation) {
+  try {
+    return operation();
+  }
+  catch (const std::exception& e) {
+    return [message = std::string(e.what())](lua_State* L) {
+      lua_pushlstring(L, message.data(), message.size());
+      return -1;
+    };
+  }
+}
+
+int Scheduler::Complete(lua_State* L, Completion completion) {
+  int count = completion(L);
+  // raised out here: Lua errors are longjmps, they'd skip the completion's destructor
+  completion = nullptr;
+  return count < 0 ? lua_error(L) : count;
+}
+
+std::shared_ptr<Scheduler::Task> Scheduler::Find(lua_State* thread) const {
+  auto found = std::find_if(_tasks.begin(), _tasks.end(), [&](auto& task) { return task->thread == thread; });
+  return found != _tasks.end() ? *found : nullptr;
+}
+
+bool Scheduler::IsReady(const Task& task, Clock::time_point now) const {
+  return task.ready || task.wakeAt <= now;
+}
+
+void Scheduler::StartNext(lua_State* L) {
+  while (!_tasks.empty() && !_tasks.front()->started) {
+    auto& task = *_tasks.front();
+    task.started = true;
+    if (!Resume(L, task, task.argCount))
+      return;
+    _tasks.pop_front();
+  }
+}
+
+bool Scheduler::Resume(lua_State* L, Task& task, int argCount) {
+  // the task prints into a buffer of its own, not into whatever runs next to it
+  lua_getglobal(L, "printBuf");
+  lua_rawgeti(L, LUA_REGISTRYINDEX, task.printBufRef);
+  lua_setglobal(L, "printBuf");
+  int resultCount;
+  int status = lua_resume(task.thread, L, argCount, &resultCount);
+  lua_setglobal(L, "printBuf");
+
+  if (status == LUA_YIELD) {
+    lua_pop(task.thread, resultCount);
+    std::lock_guard lock(_mutex);
+    // a plain coroutine.yield(): go on with the next Collect()
+    if (!task.waiting)
+      task.ready = true;
+    return false;
+  }
+
+  Result result = { task.id, "", status == LUA_OK };
+  if (!result.ok)
+    std::cerr << "Lua Error (task " << task.id << "): " << lua_tostring(task.thread, -1) << std::endl;
+  // same as RunCommand in 3_MainCycle.lua: the output is whatever was printed
+  lua_rawgeti(L, LUA_REGISTRYINDEX, task.printBufRef);
+  lua_Integer count = luaL_len(L, -1);
+  for (lua_Integer i = 1; i <= count; i++) {
+    lua_rawgeti(L, -1, i);
+    size_t size;
+    const char* line = lua_tolstring(L, -1, &size);
+    if (line) {
+      if (!result.output.empty())
+        result.output += '\n';
+      result.output.append(line, size);
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  if (!result.ok)
+    result.output += result.output.empty() ? "false" : "\nfalse";
+  _finished.push_back(std::move(result));
+  Release(L, task);
+  return true;
+}
+
+void Scheduler::Release(lua_State* L, Task& task) {
+  luaL_unref(L, LUA_REGISTRYINDEX, task.threadRef);
+  luaL_unref(L, LUA_REGISTRYINDEX, task.printBufRef);
+  std::lock_guard lock(_mutex);
+  task.completion = nullptr;
+}
+
+void Scheduler::Enqueue(std::function<void()> work) {
+  {
+    std::lock_guard lock(_mutex);
+    _work.push_back(std::move(work));
+    if (_idle == 0 && _workers.size() < max_workers)
+      _workers.emplace_back(&Scheduler::Worker, this);
+  }
+  _workReady.notify_one();
+}
+
+void Scheduler::Worker() {
+  std::unique_lock lock(_mutex);
+  while (true) {
+    _idle++;
+    _workReady.wait(lock, [&] { return _stop || !_work.empty(); });
+    _idle--;
+    if (_work.empty())
+      return;
+    auto work = std::move(_work.front());
+    _work.pop_front();
+    lock.unlock();
+    work();
+    lock.lock();
+  }
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct lua_State;
+
+/// @brief Runs commands as coroutines of the main lua_State, so a command waiting on something (a process, a dialog, the disk, a timer)
+/// doesn't hold up the main cycle or the other commands. Blocking natives call Await(): inside a task it hands the blocking part to a pool
+/// thread and yields, the task is resumed by Collect() once it's done; anywhere else (the main cycle, job workers) it just blocks.
+/// Tasks run one at a time, in the order they were spawned: the next one starts once the one before it is finished, so a command sees
+/// what the ones before it did (`copy A B` then `rm A`). A task starts right away if none is running and runs until its first yield, so
+/// payloads it reads from the connection (net.ReceiveFile) must be read before it waits on anything: the main cycle reads the next batch
+/// reply meanwhile. The server hands a command with a payload out only to an agent with no task running, see 3_MainCycle.lua
+class Scheduler {
+public:
+  struct Result {
+    uint32_t id;
+    /// @brief What the task printed (its own printBuf), lines joined with '\n'
+    std::string output;
+    bool ok;
+  };
+  /// @brief Runs on the Lua thread when the task is resumed: pushes what the native returns
+  /// @returns How many values were pushed, -1 to raise the one pushed as an error
+  using Completion = std::function<int(lua_State*)>;
+  /// @brief The blocking part of a native. Runs on a pool thread and must not touch Lua
+  using Operation = std::function<Completion()>;
+
+  /// @brief Pool threads are started as operations need them: dialogs can wait on the user for long
+  static constexpr size_t max_workers = 16;
+
+  explicit Scheduler(lua_State* L);
+  ~Scheduler();
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  /// @returns The scheduler of L's state, nullptr if it has none
+  static Scheduler* Of(lua_State* L);
+
+  /// @brief Makes the function under its `argCount` arguments on top of L's stack (both popped) a new task. It runs now, until it
+  /// finishes or waits, if no other task is running; otherwise after the ones before it. Its output comes back from Collect(), tagged
+  /// with `id`
+  void Spawn(lua_State* L, uint32_t id, int argCount);
+  /// @brief Resumes the running task if its operation is done, starts the next ones as the running one finishes
+  /// @returns Results of the tasks finished since the last call
+  std::vector<Result> Collect(lua_State* L);
+  /// @brief Tasks spawned and not finished, the ones yet to start included
+  size_t GetRunning() const;
+  /// @brief Waits until a task can be resumed or `timeout` passes
+  /// @returns true if Collect() has something to do
+  bool Wait(std::chrono::milliseconds timeout);
+  /// @brief Forgets all tasks: they were started for a connection that's gone. Operations in flight finish into the void
+  void Discard(lua_State* L);
+
+  /// @brief To be returned from a lua_CFunction: the task calling it yields until `operation` is done, then gets what its completion
+  /// pushes. Outside a task `operation` runs in place. An exception from `operation` becomes a Lua error
+  static int Await(lua_State* L, Operation operation);
+  /// @brief Sleep() of a task: no thread waits for it
+  static int Sleep(lua_State* L, std::chrono::milliseconds duration);
+
+private:
+  using Clock = std::chrono::steady_clock;
+  struct Task {
+    uint32_t id;
+    lua_State* thread;
+    int threadRef, printBufRef;
+    /// @brief Of the function, on the thread's stack until it starts
+    int argCount;
+    bool started = false;
+    // guarded by _mutex: pool threads complete operations
+    bool waiting = false, ready = false;
+    Completion completion;
+    /// @brief Set while sleeping: ready from then on
+    Clock::time_point wakeAt = Clock::time_point::max();
+  };
+
+  lua_State* _L;
+  /// @brief In spawn order. The front one is running once started, the rest wait for it
+  std::list<std::shared_ptr<Task>> _tasks;
+  std::vector<Result> _finished;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _workReady, _taskReady;
+  std::vector<std::thread> _workers;
+  std::list<std::function<void()>> _work;
+  size_t _idle = 0;
+  bool _stop = false;
+
+  std::shared_ptr<Task> Find(lua_State* thread) const;
+  bool IsReady(const Task& task, Clock::time_point now) const;
+  /// @brief Starts tasks from the front until one of them waits
+  void StartNext(lua_State* L);
+  /// @returns true if the task is finished (its result is in _finished)
+  bool Resume(lua_State* L, Task& task, int argCount);
+  void Release(lua_State* L, Task& task);
+  /// @brief Hands `operation` to the pool, `task` is ready once it's done
+  void Start(std::shared_ptr<Task> task, Operation operation);
+  void Enqueue(std::function<void()> work);
+  void Worker();
+  static int Continue(lua_State* L, int status, intptr_t context);
+  static Completion Guard(Operation operation);
+  static int Complete(lua_State* L, Completion completion);
+};
@@ -2,7 +2,11 @@
 #include "helpers/GeneralHelpers.h"
 
 TCPClient* client = nullptr;
+DatagramChannel* datagram = nullptr;
 Controller* controller = nullptr;
+JobPool* jobPool = nullptr;
+ProcessPool* processPool = nullptr;
+Scheduler* scheduler = nullptr;
 Config appConfig;
 
 Exception::Exception(Error code, uint64_t code2, const std::string& message) : std::runtime_error("Installer error") {
@@ -1,6 +1,10 @@
 #pragma once
 #include "Controller.h"
+#include "JobPool.h"
+#include "ProcessPool.h"
+#include "Scheduler.h"
 #include <filesystem>
+#include <foresteamnd/DatagramChannel>
 #include <foresteamnd/TCPClient>
 #ifdef _WIN32
 #include <windows.h>
@@ -9,12 +13,24 @@
 #endif
 
 extern TCPClient* client;
+/// @brief Screencast side channel, opened by the main cycle if the server offers one. Lives and dies with `client`
+extern DatagramChannel* datagram;
 extern Controller* controller;
+/// @brief Workers for commands the server marks concurrent. Outlives connections
+extern JobPool* jobPool;
+/// @brief Background shell commands (AExec). Outlives connections
+extern ProcessPool* processPool;
+/// @brief Runs the other commands as coroutines of the main state. Outlives connections
+extern Scheduler* scheduler;
 
 struct Config {
   std::string host;
   short port;
   bool hideWindow;
+  bool ktls = false;
+  /// @brief Trace file for rut-replay, empty = off
+  std::string tracePath;
+  bool tracePayloads = false;
   std::wstring appName;
   std::wstring appTaskName;
   std::wstring targetExecutableName;
@@ -1,7 +1,9 @@
+#include <cerrno>
 #include <fstream>
 #include <iostream>
 #include <random>
 #include <sstream>
+#include <system_error>
 #ifdef _WIN32
 #include <windows.h>
 #endif
@@ -93,6 +95,40 @@ std::string GlobalHelpers::WindowsWstringToString(const std::wstring& wstr) {
   return utf8;
 }
 
+std::string GlobalHelpers::JoinPath(const std::string& directory, const std::string& name) {
+  if (name.empty())
+    return directory;
+  return directory.empty() || directory.back() == '/' || directory.back() == '\\' ? directory + name : directory + '/' + name;
+}
+std::string GlobalHelpers::LastErrorMessage() {
+#ifdef _WIN32
+  return std::system_category().message(GetLastError());
+#else
+  return std::generic_category().message(errno);
+#endif
+}
+
+// 100 ns ticks from 1601 to 1970
+static constexpr int64_t epoch_ticks = 116444736000000000, ticks_per_ms = 10000;
+int64_t GlobalHelpers::FileTimeToUnixMs(uint64_t ticks) {
+  int64_t sinceEpoch = (int64_t)ticks - epoch_ticks;
+  // rounded down, also before 1970
+  return sinceEpoch / ticks_per_ms - (sinceEpoch % ticks_per_ms < 0);
+}
+#ifdef _WIN32
+int64_t GlobalHelpers::FileTimeToUnixMs(const FILETIME& time) {
+  return FileTimeToUnixMs((uint64_t)time.dwHighDateTime << 32 | time.dwLowDateTime);
+}
+#endif
+uint64_t GlobalHelpers::UnixMsToFileTime(int64_t ms) {
+  return (uint64_t)(ms * ticks_per_ms + epoch_ticks);
+}
+#ifndef _WIN32
+int64_t GlobalHelpers::StatTimeToUnixMs(const struct stat& info) {
+  return (int64_t)info.st_mtim.tv_sec * 1000 + info.st_mtim.tv_nsec / 1000000;
+}
+#endif
+
 void Logger::Log(std::string_view log, Logger::LogLevel level) {
   std::ofstream file("mrut.log", std::ios::app);
   std::string levelPrefix;
@@ -1,6 +1,13 @@
 #pragma once
+#include <cstdint>
 #include <filesystem>
 #include <string>
+#include <vector>
+#ifdef _WIN32
+struct _FILETIME;
+#else
+#include <sys/stat.h>
+#endif
 
 namespace GlobalHelpers {
   std::filesystem::path GetExecutablePath();
@@ -12,6 +19,23 @@ namespace GlobalHelpers {
   std::wstring StringToWstring(const std::string& str, unsigned int encoding = 65001);
   std::string WstringToString(const std::wstring& wstr);
   std::string WindowsWstringToString(const std::wstring& wstr);
+
+  /// @brief `name` under `directory`, joined with '/' unless `directory` already ends with a separator; `directory` itself if `name` is empty
+  std::string JoinPath(const std::string& directory, const std::string& name);
+  /// @brief Message of the last error of this thread: GetLastError() on Windows, errno elsewhere
+  std::string LastErrorMessage();
+
+  /// @brief FILETIME (100 ns ticks since 1601) to ms since 1970, negative before it
+  int64_t FileTimeToUnixMs(uint64_t ticks);
+#ifdef _WIN32
+  int64_t FileTimeToUnixMs(const _FILETIME& time);
+#endif
+  /// @brief The other way around
+  uint64_t UnixMsToFileTime(int64_t ms);
+#ifndef _WIN32
+  /// @brief st_mtim in ms since 1970
+  int64_t StatTimeToUnixMs(const struct stat& info);
+#endif
 } // namespace GlobalHelpers
 class Logger {
 public:
@@ -3,6 +3,14 @@ CONFIG = {
 	host = 'localhost',
 	port = 1337,
 	hideWindow = false,
+	-- kernel TLS for file transfers (Linux only, ignored elsewhere)
+	ktls = true,
+	-- record traffic for rut-replay (empty = off); payloads include commands and their output
+	trace = '',
+	tracePayloads = false,
+	-- chunks of uploaded files, so the same content (under any name) isn't sent twice. Relative: under the executable's directory
+	chunkStore = 'chunks',
+	chunkStoreSize = 256 * 1024 * 1024,
 	appName = "MRut",
 	appTaskName = "Autostart MRut",
 	targetExecutableName = "mrut.exe",
@@ -7,7 +7,11 @@ ACTIONS = {
 	FEEDBACK = 1,
 	FILE = 2,
 	SCREENCAST = 3,
-	HANDSHAKE = 4
+	HANDSHAKE = 4,
+	STATS = 5,
+	BATCH = 6,
+	STREAM = 7,
+	ATTACH = 8
 }
 
 MOUSE_BUTTONS = {
@@ -71,8 +75,11 @@ function Print(...)
 	end
 	table.insert(printBuf, table.concat(args, '\t'))
 end
-function PrintFailure()
+function PrintFailure(details)
 	table.insert(printBuf, 'false')
+	if details then
+		table.insert(printBuf, details)
+	end
 end
 string.split = function(inputstr, sep)
 	if sep == nil then
@@ -115,10 +122,79 @@ function ReceiveFile(filename)
 		Print('File reception returned error code (how?)')
 	end
 end
+-- resumable download: the range the server doesn't have yet (length -1 = to the end), all of the file if it's changed since
+function SendFileRange(filename, offset, length, size, modified)
+	local ok, error = net.SendFileRange(ACTIONS.FILE, filename, offset, length, size, modified)
+	if ok then
+		Print('send')
+	else
+		PrintFailure(error)
+	end
+end
+-- striped: each range on a connection of its own, while the loop goes on; stripes is JSON, [{ stripe, offset, length }]
+function SendFileStripes(filename, transfer, size, modified, stripes)
+	local ok, errors = net.SendFileStripes(ACTIONS.FILE, filename, transfer, size, modified, JSON.decode(stripes))
+	if ok then
+		Print('send')
+	else
+		PrintFailure(errors)
+	end
+end
+-- upload through the chunk store: only the chunks it doesn't have come
+function SendMissingChunks()
+	if not net.SendMissingChunks(ACTIONS.FILE, CONFIG.chunkStore) then
+		PrintFailure()
+	end
+end
+function ReceiveChunked(filename)
+	local ok, errors = net.ReceiveChunked(filename, CONFIG.chunkStore, CONFIG.chunkStoreSize)
+	if ok then
+		Print('File received: ' .. filename)
+	else
+		PrintFailure(errors)
+	end
+end
+-- delta sync: only the blocks the other side's copy doesn't have go over the wire
+function SendSignature(filename)
+	if net.SendSignature(ACTIONS.FILE, filename) then
+		Print('send signature')
+	else
+		PrintFailure()
+	end
+end
+function ReceivePatch(filename)
+	local ok, errors = net.ReceivePatch(filename)
+	if ok then
+		Print('File patched: ' .. filename)
+	else
+		PrintFailure(errors)
+	end
+end
+function SendDelta(filename)
+	local ok, errors = net.SendDelta(ACTIONS.FILE, filename)
+	if ok then
+		Print('send delta')
+	else
+		PrintFailure(errors)
+	end
+end
 
 function Exec(command)
 	Print(_Exec(command))
 end
+-- in the background: the output streams back on its own (STREAM), tagged with the job id printed here
+function AExec(command)
+	Print('job ' .. processes.Start(command))
+end
+-- waits for the end, then prints the output and the exit code; killed past timeoutMs
+function Run(command, input, timeoutMs)
+	local output, code, timedOut = processes.Run(command, input, timeoutMs)
+	Print(output)
+	Print(timedOut and 'timeout' or ('exit ' .. code))
+end
+function CancelJob(id)
+	Print(processes.Cancel(id) and 'true' or 'false')
+end
 
 function FixSlashes(s)
 	return s:gsub('\\', '/')
@@ -147,49 +223,85 @@ function ListDisks()
 		table.insert(printBuf, JSON.encode(disk))
 	end
 end
-function ListDirectory(path)
-	local list = fs.ListDirectory(path)
-	if #list == 0 then
+-- a page of a big directory: from `offset`, at most `limit` entries (0 = all), sorted by 'name'|'size'|'modified'|'type' (nil = as listed)
+function ListDirectory(path, offset, limit, sort, descending)
+	local listing, total = fs.ListDirectoryEncoded(path, { offset = offset, limit = limit, sort = sort, descending = descending })
+	if not listing or total == 0 then
 		table.insert(printBuf, 'false')
-		print(0)
-		return
+	elseif listing ~= '' then
+		table.insert(printBuf, listing)
+	end
+end
+function Find(root, glob, minSize, newerThan, maxResults, scanners)
+	Print('job ' .. fs.Find({
+		root = root,
+		glob = glob,
+		minSize = minSize,
+		newerThan = newerThan,
+		maxResults = maxResults,
+		scanners = scanners,
+	}))
+end
+-- a folder as one transfer: the archive streams back as the job's output, starting with the server's token
+function SendArchive(root, token, compress)
+	Print('job ' .. fs.Archive({ root = root, token = token, compress = compress }))
+end
+-- the directory's changes stream back as the job's output, starting with the server's token
+function Watch(path, token, debounceMs)
+	Print('job ' .. fs.Watch({ path = path, token = token, debounceMs = debounceMs }))
+end
+function ReceiveArchive(root)
+	local ok, summary = net.ReceiveArchive(root)
+	if ok then
+		Print('Archive extracted: ' .. root .. ' (' .. summary .. ')')
+	else
+		PrintFailure(summary)
 	end
-	for _, entry in pairs(list) do
-		entry.type = entry.isDirectory and 'dir' or 'file'
-		entry.isDirectory = nil
-		entry.path = FixSlashes(path) .. '/' .. entry.name
-		table.insert(printBuf, JSON.encode(entry))
+end
+function Hash(paths, algo, cache)
+	local manifest, count = fs.Hash({ paths = paths, algo = algo, cache = cache })
+	if count == 0 then
+		PrintFailure()
+	else
+		table.insert(printBuf, manifest)
 	end
 end
 function MkDir(path)
-	local cmd = 'mkdir "' .. FixSlashes(path:gsub('"', '\\"')) .. '"'
-	Exec(cmd)
-	Print(cmd)
+	if fs.MkDir(path) then
+		Print('mkdir ' .. path)
+	else
+		PrintFailure()
+	end
 end
 function Touch(path)
-	local cmd = 'echo "" > "' .. FixSlashes(path:gsub('"', '\\"')) .. '"'
-	Exec(cmd)
-	Print(cmd)
+	if fs.Touch(path) then
+		Print('touch ' .. path)
+	else
+		PrintFailure()
+	end
 end
 function Delete(path)
-	if fs.Rm(path) then
+	local ok, errors = fs.Rm(path)
+	if ok then
 		Print('rm ' .. path)
 	else
-		PrintFailure()
+		PrintFailure(errors)
 	end
 end
 function Move(sourcePaths, destPath)
-	if fs.Move(sourcePaths, destPath) then
+	local ok, errors = fs.Move(sourcePaths, destPath)
+	if ok then
 		Print('move ' .. JSON.encode(sourcePaths) .. ' ' .. destPath)
 	else
-		PrintFailure()
+		PrintFailure(errors)
 	end
 end
 function Copy(sourcePaths, destPath)
-	if fs.Copy(sourcePaths, destPath) then
+	local ok, errors = fs.Copy(sourcePaths, destPath)
+	if ok then
 		Print('copy ' .. JSON.encode(sourcePaths) .. ' ' .. destPath)
 	else
-		PrintFailure()
+		PrintFailure(errors)
 	end
 end
 function Rename(sourcePath, destPath)
@@ -217,15 +329,6 @@ function Logs()
 	end
 end
 
-function GetHostname()
-	local s = _Exec('hostname') or ''
-	return string.sub(s, 1, #s - 1 < 0 and 0 or #s - 1)
-end
-function GetUsername()
-	local s = _Exec('echo %USERNAME%') or ''
-	return string.sub(s, 1, #s - 1 < 0 and 0 or #s - 1)
-end
-
 function SetIsStreaming(value)
 	isStreaming = value
 	if not value then
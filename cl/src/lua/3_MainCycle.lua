@@ -10,39 +10,146 @@ net.Send(
 		timestampMs = START_TIME,
 		username = GetUsername(),
 		hwid = GetHwid(),
-		uuid = GetUuidV4()
+		uuid = GetUuidV4(),
+		compression = { 'deflate' },
+		batch = true,
+		slices = true
 		-- tls...
 	})
 )
 local handshakeResultJson = net.Receive()
 local handshakeResult = JSON.decode(handshakeResultJson)
 print('handshake result:', handshakeResultJson)
+print('compression:', net.SetCompression(handshakeResult.compression or ''))
+-- messages of higher traffic classes can go between the slices of a file on its way
+net.SetSlicing(handshakeResult.slices == true)
+if handshakeResult.datagram then
+	print('datagram:', net.OpenDatagram(handshakeResult.datagram.port, handshakeResult.datagram.fecGroup))
+end
 
 local doExit = false
 function Exit()
 	doExit = true
 end
 
+-- prepared ids belong to the connection that prepared them
+chunks.ClearPrepared()
+
 print('entered main cycle')
+local STATS_INTERVAL_MS = 5000
+local lastStatsSent = 0
 local lastCommandEmpty = false
-while true do
-	local roundtripStart, roundtripAfterSend, roundtripAfterReceive, roundtripAfterSendFeedback, roundtripScreencast = nil, nil, nil, nil, nil
-	roundtripStart = GetTimeMs()
+
+-- Runs a command from the server (source, or a prepared function and its arguments), returns what it printed
+local function RunCommand(command, ...)
+	local chunk = type(command) == 'string' and chunks.Load(command) or command
+	if not chunk or not pcall(chunk, ...) then
+		error('Failed to execute ' .. tostring(command))
+	end
+	local feedback = table.concat(printBuf, '\n')
+	for k in pairs(printBuf) do
+		printBuf[k] = nil
+	end
+	return feedback
+end
+local function SendStatsIfDue()
+	if GetTimeMs() - lastStatsSent >= STATS_INTERVAL_MS then
+		local stats = net.GetLinkStats()
+		net.Send(ACTIONS.STATS, JSON.encode(stats))
+		lastStatsSent = GetTimeMs()
+	end
+end
+
+-- One write and one read per tick: the previous tick's feedback, the poll, a frame and stats go out as a single BATCH, the reply
+-- carries every queued command. Concurrent ones go to the job workers, the rest run as tasks that go on in later ticks while they wait
+-- on something (a process, a dialog, the disk). Either way their feedback rides with whichever tick sees them done
+-- Tasks run one at a time, in order: while one waits, the loop goes on with input, the screencast and the jobs, later commands wait
+-- for it. A command's payloads follow the reply, so it has to start right away: the poll tells the server whether a task is running,
+-- and it holds commands with payloads back until none is
+local pendingFeedback = {}
+-- of what isn't a command (input, prepared chunks): it runs in place, not after the tasks
+local NO_COMMAND = 0xFFFFFFFF
+local function CollectFeedback()
+	for _, results in ipairs({ jobs.Collect(), tasks.Collect() }) do
+		for _, result in ipairs(results) do
+			if #result.text > 0 then
+				table.insert(pendingFeedback, { id = result.id, text = result.text })
+			end
+		end
+	end
+end
+-- background processes (AExec) stream their output as it comes, with whatever goes out next
+-- this much in one tick means a job is producing faster than the naps let it out (an archive): the loop polls on without napping
+local BACKLOG_BYTES = 1024 * 1024
+local outputBacklog = false
+local function SendProcessOutput()
+	local bytes = 0
+	for _, chunk in ipairs(processes.Collect()) do
+		net.SendStream(chunk.id, chunk.kind, chunk.data)
+		bytes = bytes + #chunk.data
+	end
+	outputBacklog = bytes >= BACKLOG_BYTES
+end
+local function BatchTick()
+	CollectFeedback()
+	net.BeginBatch()
+	for _, result in ipairs(pendingFeedback) do
+		net.SendFeedback(result.id, result.text)
+	end
+	pendingFeedback = {}
+	SendProcessOutput()
+	net.Send(ACTIONS.IDLE, tasks.GetRunning() > 0 and 'busy' or '')
+	if isStreaming then
+		net.Screencast()
+	end
+	SendStatsIfDue()
+	net.ProbeRtt()
+	net.FlushBatch()
+	local commands = net.ReceiveBatch()
+	for _, command in ipairs(commands) do
+		if command.prepare then
+			assert(chunks.Prepare(command.prepare, command.code))
+		elseif command.concurrent then
+			if command.invoke then
+				-- workers have states of their own: they get the source, and their caches keep it compiled
+				local _, source = chunks.GetPrepared(command.invoke)
+				jobs.Submit(command.id, source or '', command.args)
+			else
+				jobs.Submit(command.id, command.code, '')
+			end
+		else
+			local chunk, err
+			if command.invoke then
+				chunk = chunks.GetPrepared(command.invoke)
+			else
+				chunk, err = chunks.Load(command.code)
+			end
+			if not chunk then
+				error('Failed to execute ' .. tostring(command.code or command.invoke) .. ': ' .. tostring(err))
+			end
+			if command.id == NO_COMMAND then
+				RunCommand(chunk, chunks.UnpackArgs(command.args))
+			else
+				-- starts now if no task is running, and runs until it finishes or waits: the payloads it reads (ReceiveFile) are read before
+				-- the next reply
+				tasks.Spawn(command.id, chunk, chunks.UnpackArgs(command.args))
+			end
+		end
+	end
+	-- the ones that didn't wait on anything are done already
+	CollectFeedback()
+	lastCommandEmpty = #commands == 0
+end
+
+local function Tick()
+	net.ProbeRtt()
+	SendProcessOutput()
 	net.Send(ACTIONS.IDLE)
-	roundtripAfterSend = GetTimeMs()
 	local command = net.Receive()
-	roundtripAfterReceive = GetTimeMs()
 	if #command > 0 then
-		if not pcall(load(command)) then
-			error('Failed to execute' .. command)
-		end
-		local feedback = table.concat(printBuf, '\n')
+		local feedback = RunCommand(command)
 		if #feedback > 0 then
 			net.Send(ACTIONS.FEEDBACK, feedback)
-			roundtripAfterSendFeedback = GetTimeMs()
-		end
-		for k in pairs(printBuf) do
-			printBuf[k] = nil
 		end
 		lastCommandEmpty = false
 	else
@@ -50,23 +157,43 @@ while true do
 	end
 	if isStreaming then
 		net.Screencast()
-		roundtripScreencast = GetTimeMs()
 		print('Screencast!')
 	end
+	SendStatsIfDue()
+end
+
+while true do
+	if handshakeResult.batch then
+		BatchTick()
+	else
+		Tick()
+	end
 	if doExit then
+		-- don't lose the output of the command that asked to exit
+		CollectFeedback()
+		-- one message if batching, plain FEEDBACK and STREAM messages otherwise
+		if handshakeResult.batch then
+			net.BeginBatch()
+		end
+		for _, result in ipairs(pendingFeedback) do
+			net.SendFeedback(result.id, result.text)
+		end
+		SendProcessOutput()
+		if handshakeResult.batch then
+			net.FlushBatch()
+		end
 		return true
 	end
-	print(
-		'lua roundtrip',
-		GetTimeMs() - roundtripStart,
-		roundtripAfterSend - roundtripStart,
-		roundtripAfterReceive - roundtripAfterSend,
-		roundtripAfterSendFeedback ~= nil and roundtripAfterSendFeedback - roundtripAfterReceive or 0,
-		roundtripScreencast ~= nil and (roundtripScreencast - (roundtripAfterSendFeedback or roundtripAfterReceive)) or 0
-	)
-	if lastCommandEmpty or isStreaming then
-		Sleep(300)
-	else
-		Sleep(50)
+	-- feedback is waiting for the next batch, or job output is piling up: poll again right away instead of holding it back
+	if #pendingFeedback == 0 and not outputBacklog then
+		local sleepMs = (lastCommandEmpty or isStreaming) and 300 or 50
+		-- a task or a job finishing ends the nap early, so its result goes out right away. Tasks first: they also wait on timers
+		if tasks.GetRunning() > 0 then
+			tasks.Wait(sleepMs)
+		elseif jobs.GetPending() > 0 then
+			jobs.Wait(sleepMs)
+		else
+			Sleep(sleepMs)
+		end
 	end
 end
\ No newline at end of file
@@ -1,7 +1,15 @@
 import fs from 'fs';
 import aes from 'js-crypto-aes';
+import { execFileSync } from 'node:child_process';
 import { randomBytes } from 'node:crypto';
 
+// the luac built alongside the agent (CMake passes its path): its bytecode matches the embedded interpreter's build
+const luac = process.argv[2];
+if (!luac) {
+	console.error('Usage: node compile.js <path to luac>');
+	process.exit(1);
+}
+
 const bytesToString = bytes => Array.from(bytes)
 	.map(b => '\\x' + b.toString(16).padStart(2, '0'))
 	.join('');
@@ -14,7 +22,7 @@ const salt = randomBytes(8);
 const key = randomBytes(32);
 const iv = randomBytes(16);
 
-const encrypt = data => aes.encrypt(new TextEncoder().encode(data), key, {
+const encrypt = data => aes.encrypt(data, key, {
 	name: 'AES-CBC',
 	iv
 });
@@ -33,18 +41,10 @@ const unsigned long int ${prefix}${name}_len = ${size};`
 fs.readdirSync('.').filter(v => v.endsWith('.h')).forEach(v => fs.rmSync(v));
 fs.readdirSync('.').filter(v => v.endsWith('.lua')).forEach(async v => {
 	v = v.substring(0, v.length - 4);
-	const unencrypted = fs.readFileSync(`${v}.lua`, { encoding: 'utf-8' }).toString('utf-8')
-		.split('\\n').join('\\\\n')
-		.split('\n')
-		.map(v => v.trim())
-		.filter(v => v.length > 0 && !v.startsWith('--'))
-		.join('\n')
-		.replace(/\{\n/g, '{ ').replace(/,\n/g, ', ').replace(/\n\}/g, ' }')
-		// .replace(/"/g, '\\"').replace(/\\'/g, '\\\\\'')
-		// .split('\n')
-		// .join('\\n');
-		
-	writeEncrypted(v, await encrypt(unencrypted));
+	// stripped bytecode: the agent loads it without parsing, and there are no comments or debug info left to read
+	const bytecode = execFileSync(luac, ['-s', '-o', '-', `${v}.lua`]);
+
+	writeEncrypted(v, await encrypt(bytecode));
 });
 
 if (fs.existsSync('root.crt'))
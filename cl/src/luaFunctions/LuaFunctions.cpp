@@ -1,4 +1,5 @@
 #include "LuaFunctions.h"
+#include "../Json.h"
 #include "../helpers/GeneralHelpers.h"
 
 std::vector<std::string> LuaFunctions::luaGetStringArray(lua_State* L, int index) {
@@ -27,13 +28,6 @@ std::vector<std::string> LuaFunctions::luaGetStringArray(lua_State* L, int index
   return result;
 }
 
-void OkWrapper(const std::string& title, const std::string& text, int type) {
-  LuaFunctions::Lua::System::Dialog::Ok(title, text, static_cast<LuaFunctions::Lua::System::MessageBoxType>(type));
-}
-bool ConfirmWrapper(const std::string& title, const std::string& text, int type) {
-  return LuaFunctions::Lua::System::Dialog::Confirm(title, text, static_cast<LuaFunctions::Lua::System::MessageBoxType>(type));
-}
-
 #ifdef _WIN32
 wstring LuaFunctions::fixUtf8(const std::string& string) {
   return GlobalHelpers::StringToWstring(string);
@@ -44,14 +38,40 @@ string LuaFunctions::fixUtf8(const std::string& string) {
 }
 #endif
 
+/// @brief What net.<name> is in a worker state; the name is its upvalue
+static int netUnavailable(lua_State* L) {
+  const char* name = lua_tostring(L, lua_upvalueindex(1));
+  return luaL_error(L, "net.%s: not available in a concurrent command", name ? name : "?");
+}
+static int netIndex(lua_State* L) {
+  lua_pushvalue(L, 2);
+  lua_pushcclosure(L, netUnavailable, 1);
+  return 1;
+}
+void LuaFunctions::RegisterConcurrent(lua_State* L) {
+  Register(L);
+  // a worker calling SSL_write while the main thread is in SSL_read on the same SSL*, or racing the batch, must fail loudly instead
+  lua_newtable(L);
+  lua_newtable(L);
+  lua_pushcfunction(L, netIndex);
+  lua_setfield(L, -2, "__index");
+  lua_setmetatable(L, -2);
+  lua_setglobal(L, "net");
+}
+
 void LuaFunctions::Register(lua_State* L) {
   getGlobalNamespace(L)
-      .addFunction("_Exec", LuaFunctions::Lua::System::Exec)
-      .addFunction("AExec", LuaFunctions::Lua::System::AExec)
-      .addFunction("Sleep", LuaFunctions::Lua::System::Sleep)
+      .addCFunction("_Exec", LuaFunctions::Lua::System::CExec)
+      .addCFunction("Sleep", LuaFunctions::Lua::System::CSleep)
       .addFunction("GetTimeMs", LuaFunctions::Lua::System::GetTimeMs)
       .addFunction("GetHwid", LuaFunctions::Lua::System::GetHwid)
       .addFunction("GetUuidV4", LuaFunctions::Lua::System::GetUuidV4)
+      .addFunction("GetHostname", LuaFunctions::Lua::System::GetHostname)
+      .addFunction("GetUsername", LuaFunctions::Lua::System::GetUsername)
+      .beginNamespace("JSON")
+      .addCFunction("encode", Json::CEncode)
+      .addCFunction("decode", Json::CDecode)
+      .endNamespace()
       .beginNamespace("dialog")
       .beginNamespace("type")
       .addConstant("BLANK", static_cast<int>(LuaFunctions::Lua::System::MESSAGEBOX_BLANK))
@@ -60,24 +80,84 @@ void LuaFunctions::Register(lua_State* L) {
       .addConstant("ERROR", static_cast<int>(LuaFunctions::Lua::System::MESSAGEBOX_ERROR))
       .addConstant("QUESTION", static_cast<int>(LuaFunctions::Lua::System::MESSAGEBOX_QUESTION))
       .endNamespace()
-      .addFunction("Ok", OkWrapper)
-      .addFunction("Confirm", ConfirmWrapper)
-      .addFunction("Input", LuaFunctions::Lua::System::Dialog::Input)
+      .addCFunction("Ok", LuaFunctions::Lua::System::Dialog::COk)
+      .addCFunction("Confirm", LuaFunctions::Lua::System::Dialog::CConfirm)
+      .addCFunction("Input", LuaFunctions::Lua::System::Dialog::CInput)
       .endNamespace()
       .beginNamespace("net")
       .addFunction("Send", LuaFunctions::Lua::Net::Send)
-      .addFunction("SendFile", LuaFunctions::Lua::Net::SendFile)
+      .addCFunction("SendFile", LuaFunctions::Lua::Net::CSendFile)
+      .addCFunction("SendFileRange", LuaFunctions::Lua::Net::CSendFileRange)
+      .addCFunction("SendFileStripes", LuaFunctions::Lua::Net::CSendFileStripes)
       .addFunction("ReceiveFile", LuaFunctions::Lua::Net::ReceiveFile)
+      .addCFunction("SendSignature", LuaFunctions::Lua::Net::CSendSignature)
+      .addCFunction("ReceivePatch", LuaFunctions::Lua::Net::CReceivePatch)
+      .addCFunction("SendDelta", LuaFunctions::Lua::Net::CSendDelta)
+      .addCFunction("SendMissingChunks", LuaFunctions::Lua::Net::CSendMissingChunks)
+      .addCFunction("ReceiveChunked", LuaFunctions::Lua::Net::CReceiveChunked)
+      .addCFunction("ReceiveArchive", LuaFunctions::Lua::Net::CReceiveArchive)
       .addFunction("Receive", LuaFunctions::Lua::Net::Receive)
       .addFunction("IsConnected", LuaFunctions::Lua::Net::IsConnected)
       .addFunction("Screencast", LuaFunctions::Lua::Net::Screencast)
+      .addFunction("ProbeRtt", LuaFunctions::Lua::Net::ProbeRtt)
+      .addCFunction("GetLinkStats", LuaFunctions::Lua::Net::CGetLinkStats)
+      .addFunction("SetRateLimit", LuaFunctions::Lua::Net::SetRateLimit)
+      .addFunction("SetLinkRateLimit", LuaFunctions::Lua::Net::SetLinkRateLimit)
+      .addFunction("OpenDatagram", LuaFunctions::Lua::Net::OpenDatagram)
+      .addFunction("SetCompression", LuaFunctions::Lua::Net::SetCompression)
+      .addFunction("SetSlicing", LuaFunctions::Lua::Net::SetSlicing)
+      .addFunction("BeginBatch", LuaFunctions::Lua::Net::BeginBatch)
+      .addFunction("SendFeedback", LuaFunctions::Lua::Net::SendFeedback)
+      .addFunction("SendStream", LuaFunctions::Lua::Net::SendStream)
+      .addFunction("FlushBatch", LuaFunctions::Lua::Net::FlushBatch)
+      .addCFunction("ReceiveBatch", LuaFunctions::Lua::Net::CReceiveBatch)
+      .beginNamespace("traffic")
+      .addConstant("CONTROL", static_cast<int>(SendScheduler::CONTROL))
+      .addConstant("INPUT", static_cast<int>(SendScheduler::INPUT))
+      .addConstant("SCREENCAST", static_cast<int>(SendScheduler::SCREENCAST))
+      .addConstant("BULK", static_cast<int>(SendScheduler::BULK))
+      .endNamespace()
+      .endNamespace()
+      .beginNamespace("chunks")
+      .addCFunction("Load", LuaFunctions::Lua::Chunks::CLoad)
+      .addCFunction("Prepare", LuaFunctions::Lua::Chunks::CPrepare)
+      .addCFunction("GetPrepared", LuaFunctions::Lua::Chunks::CGetPrepared)
+      .addCFunction("ClearPrepared", LuaFunctions::Lua::Chunks::CClearPrepared)
+      .addCFunction("UnpackArgs", LuaFunctions::Lua::Chunks::CUnpackArgs)
+      .addCFunction("GetStats", LuaFunctions::Lua::Chunks::CGetStats)
+      .endNamespace()
+      .beginNamespace("jobs")
+      .addFunction("Submit", LuaFunctions::Lua::Jobs::Submit)
+      .addCFunction("Collect", LuaFunctions::Lua::Jobs::CCollect)
+      .addFunction("GetPending", LuaFunctions::Lua::Jobs::GetPending)
+      .addFunction("Wait", LuaFunctions::Lua::Jobs::Wait)
+      .endNamespace()
+      .beginNamespace("processes")
+      .addFunction("Start", LuaFunctions::Lua::Processes::Start)
+      .addFunction("Cancel", LuaFunctions::Lua::Processes::Cancel)
+      .addCFunction("Collect", LuaFunctions::Lua::Processes::CCollect)
+      .addFunction("GetActive", LuaFunctions::Lua::Processes::GetActive)
+      .addCFunction("Run", LuaFunctions::Lua::Processes::CRun)
+      .endNamespace()
+      .beginNamespace("tasks")
+      .addCFunction("Spawn", LuaFunctions::Lua::Tasks::CSpawn)
+      .addCFunction("Collect", LuaFunctions::Lua::Tasks::CCollect)
+      .addFunction("GetRunning", LuaFunctions::Lua::Tasks::GetRunning)
+      .addFunction("Wait", LuaFunctions::Lua::Tasks::Wait)
       .endNamespace()
       .beginNamespace("fs")
-      .addFunction("ReadFile", LuaFunctions::Lua::Fs::ReadFile)
+      .addCFunction("ReadFile", LuaFunctions::Lua::Fs::CReadFile)
       .addFunction("Exists", LuaFunctions::Lua::Fs::Exists)
-      .addFunction("Rm", LuaFunctions::Lua::Fs::Rm)
+      .addCFunction("Rm", LuaFunctions::Lua::Fs::CRm)
       .addFunction("Rename", LuaFunctions::Lua::Fs::Rename)
+      .addFunction("MkDir", LuaFunctions::Lua::Fs::MkDir)
+      .addFunction("Touch", LuaFunctions::Lua::Fs::Touch)
       .addCFunction("ListDirectory", LuaFunctions::Lua::Fs::CListDirectory)
+      .addCFunction("ListDirectoryEncoded", LuaFunctions::Lua::Fs::CListDirectoryEncoded)
+      .addCFunction("Find", LuaFunctions::Lua::Fs::CFind)
+      .addCFunction("Archive", LuaFunctions::Lua::Fs::CArchive)
+      .addCFunction("Watch", LuaFunctions::Lua::Fs::CWatch)
+      .addCFunction("Hash", LuaFunctions::Lua::Fs::CHash)
       .addCFunction("ListDisks", LuaFunctions::Lua::Fs::CListDisks)
       .addCFunction("ListPlaces", LuaFunctions::Lua::Fs::CListPlaces)
       .addCFunction("ReadFileLines", LuaFunctions::Lua::Fs::CReadFileLines)
@@ -15,10 +15,15 @@ using namespace luabridge;
 
 namespace LuaFunctions {
   void Register(lua_State* L);
+  /// @brief Register() for a JobPool worker's state: its `net` only has stubs that raise, the connection belongs to the main cycle
+  void RegisterConcurrent(lua_State* L);
+  /// @brief Forgets what was agreed on with the server (compression) and a batch being collected: the next connection starts plain.
+  /// Waits for files still going out from pool threads, so the client can be deleted
+  void OnDisconnect();
 
   string exec(string cmd);
   void waitReceive();
-  bool sendFile(const int code, char* buffer, size_t size);
+  bool sendFile(const int code, char* buffer, size_t size, SendScheduler::TrafficClass cls = SendScheduler::BULK);
   string GetKnownFolderPath(const KNOWNFOLDERID& folderId);
   std::vector<std::string> luaGetStringArray(lua_State* L, int index);
 #ifdef _WIN32
@@ -42,41 +47,210 @@ namespace LuaFunctions {
       enum MessageBoxType { MESSAGEBOX_BLANK = 0, MESSAGEBOX_INFO, MESSAGEBOX_WARNING, MESSAGEBOX_ERROR, MESSAGEBOX_QUESTION };
 
       void Sleep(const int64_t& ms);
+      /// @brief Sleep() that only holds up the calling task (see Scheduler)
+      int CSleep(lua_State* L);
       /// @param cmd Command
       /// @returns Result of execution
       string Exec(const string& cmd);
-      void AExec(const string& cmd);
+      /// @brief Exec() on a pool thread when called from a task
+      int CExec(lua_State* L);
       long long GetTimeMs();
       string GetHwid();
       string GetUuidV4();
+      /// @brief Without a shell round-trip, for the handshake
+      string GetHostname();
+      string GetUsername();
 
       namespace Dialog {
         bool Confirm(const std::string& title = "", const std::string& text = "", MessageBoxType type = MESSAGEBOX_BLANK);
         void Ok(const std::string& title = "", const std::string& text = "", MessageBoxType type = MESSAGEBOX_BLANK);
         std::string Input(const std::string& title = "", const std::string& prompt = "");
+        // the dialogs above, waited for on a pool thread when called from a task
+        int COk(lua_State* L);
+        int CConfirm(lua_State* L);
+        int CInput(lua_State* L);
       } // namespace Dialog
     } // namespace System
 
     namespace Net {
       bool Send(const int& code, const string& data = "");
-      bool SendFile(const int& code, const string& path);
+      /// @brief The file as a FILE message, BULK. Goes from a pool thread (Scheduler::Await): polls, input and frames go between its slices
+      /// @param 1 action code, 2 path
+      /// @returns true if it was sent
+      int CSendFile(lua_State* L);
+      /// @brief Resumable download: `length` bytes of the file from `offset` as a FILE message, behind a range header ([u64 offset][u64 file
+      /// size][i64 modified], the file's version). If the file isn't of the version the server names any more, all of it goes from 0, and
+      /// the header says so. An empty FILE if it can't be read. Goes from a pool thread like CSendFile()
+      /// @param 1 action code, 2 path, 3 offset, 4 length (negative = to the end), 5 size and 6 modified it should have (0 = any)
+      /// @returns true, or false and why
+      int CSendFileRange(lua_State* L);
+      /// @brief Striped download: ranges of the file at once, each on a connection of its own (TCPClient::Sibling()) that first names
+      /// itself with ATTACH ([key from the TLS session][u32 transfer][u32 stripe]), then carries the range like CSendFileRange()'s. Goes on
+      /// in the background (Scheduler::Await). Once all are done, a FILE on this connection says what failed (empty if nothing did)
+      /// @param 1 action code, 2 path, 3 transfer id, 4 size and 5 modified it should have, 6 array of { stripe, offset, length }
+      /// @returns true, or false and what failed, a line per stripe
+      int CSendFileStripes(lua_State* L);
       bool Screencast();
       string Receive();
       bool ReceiveFile(const string& path);
+      /// @brief Delta sync (Delta.h), upload: sends the signature of the agent's copy of the file as a FILE message
+      /// @param 1 action code, 2 path (a missing file is an empty copy)
+      int CSendSignature(lua_State* L);
+      /// @brief Upload, continued: receives the delta the server made from that signature and rebuilds the file with it
+      /// @returns true, or false and why
+      int CReceivePatch(lua_State* L);
+      /// @brief Download: receives the signature of the server's copy, sends the delta to the agent's file as a FILE message (an empty
+      /// one if there's none to send)
+      /// @param 1 action code, 2 path
+      /// @returns true, or false and why
+      int CSendDelta(lua_State* L);
+      /// @brief Upload through the chunk store (ChunkStore.h): receives the file's manifest, sends the indices of the chunks missing from
+      /// the store ([u32] each) as a FILE message
+      /// @param 1 action code, 2 store directory
+      int CSendMissingChunks(lua_State* L);
+      /// @brief Upload, continued: receives the manifest again, which chunks come and those chunks, and puts the file together
+      /// @param 1 path, 2 store directory, 3 store size in bytes
+      /// @returns true, or false and why
+      int CReceiveChunked(lua_State* L);
+      /// @brief Folder upload: receives an archive (Archive.h) and unpacks it into a directory while it's still coming.
+      /// It comes as a run of messages up to an empty one
+      /// @param 1 directory
+      /// @returns Whether all of it was unpacked, and "N files, N directories, N bytes" followed by what failed, a line each
+      int CReceiveArchive(lua_State* L);
       bool IsConnected();
+      void ProbeRtt();
+      int CGetLinkStats(lua_State* L);
+      /// @param cls SendScheduler::TrafficClass
+      /// @param bytesPerSec 0 = unlimited
+      void SetRateLimit(int cls, double bytesPerSec);
+      void SetLinkRateLimit(double bytesPerSec);
+      /// @brief Opens the UDP screencast channel (keys derived from the TLS session). Screencast() uses it from then on
+      /// @param groupSize Data fragments per XOR parity fragment, 0 = no FEC
+      /// @returns false if there is no TLS session to derive keys from
+      bool OpenDatagram(int port, int groupSize);
+      /// @brief Compresses Send() payloads with the codec the server picked in the handshake reply. "" or unknown = off
+      /// @returns true if compression is on
+      bool SetCompression(const string& codec);
+      /// @brief BULK messages go in slices, so the poll and the rest can go between them (TCPClient::SetSlicing()). Only once the server
+      /// agreed to `slices` in the handshake
+      void SetSlicing(bool slicing);
+
+      /// @brief Collects Send(), SendFeedback() and Screencast() into one BATCH message until FlushBatch(). Only once the server agreed
+      /// to `batch` in the handshake
+      void BeginBatch();
+      /// @brief Output of the batched command `commandId`. A plain FEEDBACK when not batching
+      bool SendFeedback(uint32_t commandId, const string& data);
+      /// @brief A chunk of a background process's output (ProcessPool::Chunk), batched like SendFeedback()
+      bool SendStream(uint32_t jobId, int kind, const string& data);
+      /// @brief Sends what was collected since BeginBatch() as a single message (compressed as a whole) and stops batching
+      bool FlushBatch();
+      /// @brief Receives the server's reply to a batch
+      /// @returns Array of { id = command id, code = Lua chunk, concurrent = may run on a worker } in execution order; empty if nothing
+      /// was queued. Prepared chunks come as { prepare = prepared id, code }, calls to them as { id, invoke = prepared id, args = encoded }
+      int CReceiveBatch(lua_State* L);
     } // namespace Net
 
+    namespace Chunks {
+      /// @brief load() through the state's ChunkCache: a command seen before isn't compiled again
+      /// @returns The function, or nil and the error message
+      int CLoad(lua_State* L);
+      /// @brief Keeps a chunk the server will INVOKE by id
+      /// @returns true, or false and the error message
+      int CPrepare(lua_State* L);
+      /// @returns The function prepared under the id and its source, nil if there's none
+      int CGetPrepared(lua_State* L);
+      int CClearPrepared(lua_State* L);
+      /// @returns The values of an encoded INVOKE argument list
+      int CUnpackArgs(lua_State* L);
+      /// @returns { hits, misses, size }
+      int CGetStats(lua_State* L);
+    } // namespace Chunks
+
+    namespace Jobs {
+      /// @brief Runs `code` on a worker thread with its own Lua state. Its output comes back from Collect(), tagged with `id`
+      /// @param args Encoded argument list (see ChunkCache::PushArguments) for prepared chunks
+      void Submit(uint32_t id, const string& code, const string& args);
+      /// @returns Array of { id, text, ok } for the jobs finished since the last call
+      int CCollect(lua_State* L);
+      /// @brief Jobs submitted and not collected yet
+      int GetPending();
+      /// @brief Sleep() that wakes up as soon as a job finishes
+      /// @returns true if there's something to collect
+      bool Wait(const int64_t& ms);
+    } // namespace Jobs
+
+    namespace Processes {
+      /// @brief Runs a shell command in the background (ProcessPool)
+      /// @returns Its job id
+      uint32_t Start(const string& command);
+      /// @returns false if there's no such job queued or running
+      bool Cancel(uint32_t jobId);
+      /// @returns Array of { id = job id, kind = ProcessPool::ChunkKind, data } produced since the last call
+      int CCollect(lua_State* L);
+      /// @brief Jobs queued or running
+      int GetActive();
+      /// @brief Runs a shell command to the end (Process::Run), on a pool thread when called from a task
+      /// @param 1 command, 2 input for its stdin (optional), 3 timeout in ms (optional, 0 = none)
+      /// @returns Its output, exit code and whether it was killed for the timeout
+      int CRun(lua_State* L);
+    } // namespace Processes
+
+    namespace Tasks {
+      /// @brief Runs a function (and its arguments) as a task of the Scheduler. Its output comes back from Collect(), tagged with `id`
+      int CSpawn(lua_State* L);
+      /// @brief Resumes the tasks whose wait is over
+      /// @returns Array of { id, text, ok } for the tasks finished since the last call
+      int CCollect(lua_State* L);
+      /// @brief Tasks started and not finished
+      int GetRunning();
+      /// @brief Sleep() that wakes up as soon as a task can go on
+      /// @returns true if there's something to collect
+      bool Wait(const int64_t& ms);
+    } // namespace Tasks
+
     namespace Fs {
+      // ListDirectory, ReadFile, Rm, Move and Copy go to a pool thread when called from a task
       int CListDirectory(lua_State* L);
+      /// @brief ListDirectory's output, written natively in one buffer: a JSON object per line ({ name, path, type, size, dateModified })
+      /// @param 2 { offset, limit (0 = all), sort = "none"|"name"|"size"|"modified"|"type" (directories first), descending } (optional)
+      /// @returns The page and the number of entries in the whole directory, nil if it can't be read
+      int CListDirectoryEncoded(lua_State* L);
+      /// @brief Recursive search in the background (FileSearch), streamed back like Exec's output: a JSON object per match
+      /// @param 1 { root, glob = "*", minSize, newerThan (ms since 1970), maxResults (0 = all), scanners = 4 (directories read at once) }
+      /// @returns The job id; it exits with 1 if the root can't be read
+      int CFind(lua_State* L);
+      /// @brief Folder download: the tree as an archive (Archive.h), streamed back as a job's output while it's read and compressed
+      /// @param 1 { root (a directory or a file), token (names the transfer at the start of the archive), compress = true, compressors }
+      /// @returns The job id; it exits with 1 if something couldn't be read (the archive says what)
+      int CArchive(lua_State* L);
+      /// @brief Changes to a directory as they happen (DirectoryWatcher), streamed back as a job's output: a JSON object per event,
+      /// folded over `debounceMs`. Runs on a thread of its own until killed, the directory is gone or the connection drops (StopWatches())
+      /// @param 1 { path, token (names the watch in its first line), debounceMs = 200 }
+      /// @returns The job id; it exits with 1 if the directory can't be watched
+      int CWatch(lua_State* L);
+      /// @brief Cancels the watches and waits for them to end: their events were for the connection that's gone
+      void StopWatches();
+      /// @brief Hashes of files and trees (FileHash)
+      /// @param 1 { paths = path or array of them, algo = "xxh64"|"blake2b"|"sha256", cache = cache file (optional), workers = 4 }
+      /// @returns The manifest, a JSON object per line ({ path, size, dateModified, hash } or { path, error }), and its number of entries
+      int CHash(lua_State* L);
       int CListDisks(lua_State* L);
       int CListPlaces(lua_State* L);
       string ReadFile(const string& filePath);
+      int CReadFile(lua_State* L);
       bool Exists(const string& filePath);
       int CReadFileLines(lua_State* L);
-      bool Rm(const std::string& path);
+      /// @brief Rm, Move and Copy run on FileOperations. Past a second, their progress streams back as a job's output (kill stops them)
+      /// @returns true, or false and every failure ("path: reason" per line)
+      int CRm(lua_State* L);
       int CMove(lua_State* L);
       int CCopy(lua_State* L);
       bool Rename(std::string source, std::string destination);
+      /// @brief Creates the directory and its missing parents
+      /// @returns true if it's there afterwards
+      bool MkDir(const std::string& path);
+      /// @brief Creates an empty file, or updates the modification time of an existing one
+      bool Touch(const std::string& path);
     } // namespace Fs
 
     namespace Input {
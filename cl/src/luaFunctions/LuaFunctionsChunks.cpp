@@ -0,0 +1,50 @@
+#include "../ChunkCache.h"
+#include "LuaFunctions.h"
+
+int LuaFunctions::Lua::Chunks::CLoad(lua_State* L) {
+  size_t size;
+  const char* source = luaL_checklstring(L, 1, &size);
+  return ChunkCache::Of(L).Load(L, { source, size }) ? 1 : 2;
+}
+int LuaFunctions::Lua::Chunks::CPrepare(lua_State* L) {
+  auto id = (uint32_t)luaL_checkinteger(L, 1);
+  size_t size;
+  const char* source = luaL_checklstring(L, 2, &size);
+  if (!ChunkCache::Of(L).Prepare(L, id, { source, size })) {
+    lua_pushboolean(L, false);
+    lua_insert(L, -2);
+    return 2;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+int LuaFunctions::Lua::Chunks::CGetPrepared(lua_State* L) {
+  auto source = ChunkCache::Of(L).PushPrepared(L, (uint32_t)luaL_checkinteger(L, 1));
+  if (!source)
+    return 1;
+  lua_pushlstring(L, source->data(), source->size());
+  return 2;
+}
+int LuaFunctions::Lua::Chunks::CClearPrepared(lua_State* L) {
+  ChunkCache::Of(L).ClearPrepared(L);
+  return 0;
+}
+int LuaFunctions::Lua::Chunks::CUnpackArgs(lua_State* L) {
+  size_t size;
+  const char* encoded = luaL_optlstring(L, 1, "", &size);
+  int count = ChunkCache::PushArguments(L, { encoded, size });
+  if (count < 0)
+    return luaL_error(L, "Malformed argument list");
+  return count;
+}
+int LuaFunctions::Lua::Chunks::CGetStats(lua_State* L) {
+  auto& cache = ChunkCache::Of(L);
+  lua_createtable(L, 0, 3);
+  lua_pushinteger(L, (lua_Integer)cache.GetHits());
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, (lua_Integer)cache.GetMisses());
+  lua_setfield(L, -2, "misses");
+  lua_pushinteger(L, (lua_Integer)cache.GetSize());
+  lua_setfield(L, -2, "size");
+  return 1;
+}
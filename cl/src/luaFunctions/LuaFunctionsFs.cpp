@@ -1,51 +1,36 @@
+#include "../Archive.h"
+#include "../DirectoryWatcher.h"
+#include "../FileHash.h"
+#include "../FileOperations.h"
+#include "../FileSearch.h"
+#include "../Json.h"
+#include "../Scheduler.h"
+#include "../global.h"
 #include "../helpers/GeneralHelpers.h"
 #include "LuaFunctions.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
 #include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <thread>
 #ifdef WIN32
 #include <codecvt>
 #include <locale>
 #include <vector>
 #include <windows.h>
-#endif
-
-namespace fs = filesystem;
-
-bool deleteRecursively(const fs::path& path, std::error_code& ec) {
-  try {
-    if (!fs::exists(path, ec)) {
-      if (ec)
-        return false;
-      return true; // Path doesn't exist - consider this success
-    }
-
-// Remove read-only attributes if needed (Windows)
-#ifdef _WIN32
-    fs::permissions(path, fs::perms::owner_all, fs::perm_options::add, ec);
 #else
-    fs::permissions(path, fs::perms::all, fs::perm_options::add, ec);
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #endif
 
-    if (fs::is_directory(path, ec)) {
-      for (const auto& entry : fs::directory_iterator(path, ec)) {
-        if (ec)
-          return false;
-        if (!deleteRecursively(entry.path(), ec)) {
-          return false;
-        }
-      }
-    }
-
-    return fs::remove(path, ec);
-  }
-  catch (const std::exception& e) {
-    ec = std::error_code(errno, std::generic_category());
-    std::cerr << "Error deleting " << path << ": " << e.what() << '\n';
-    return false;
-  }
-}
+namespace fs = filesystem;
 
 vector<pair<string, KNOWNFOLDERID>> LuaFunctions::placeIds = { { "Home", FOLDERID_Profile },        { "Desktop", FOLDERID_Desktop },
                                                                { "Downloads", FOLDERID_Downloads }, { "Documents", FOLDERID_Documents },
@@ -62,66 +47,320 @@ string LuaFunctions::GetKnownFolderPath(const KNOWNFOLDERID& folderId) {
   return "";
 }
 
+struct DirectoryEntry {
+  std::string name;
+  bool isDirectory;
+  uintmax_t size;
+  lua_Integer dateModified;
+};
+/// @brief One pass over the directory: type, size and time come with the entry (FindFirstFileExW) or from a single stat, not three
+/// @returns false if it can't be read
+static bool listDirectory(const std::string& path, std::vector<DirectoryEntry>& entries) {
+#ifdef WIN32
+  std::wstring pattern = LuaFunctions::fixUtf8(path);
+  if (!pattern.empty() && pattern.back() != L'\\' && pattern.back() != L'/')
+    pattern += L'\\';
+  pattern += L'*';
+  WIN32_FIND_DATAW data;
+  HANDLE find = FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+  if (find == INVALID_HANDLE_VALUE) {
+    cerr << "Can't list " << path << ": " << GetLastError() << endl;
+    return false;
+  }
+  do {
+    if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0)
+      continue;
+    DirectoryEntry& entry = entries.emplace_back();
+    entry.name = GlobalHelpers::WindowsWstringToString(data.cFileName);
+    entry.isDirectory = data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+    entry.size = entry.isDirectory ? 0 : (uintmax_t)data.nFileSizeHigh << 32 | data.nFileSizeLow;
+    entry.dateModified = GlobalHelpers::FileTimeToUnixMs((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32 | data.ftLastWriteTime.dwLowDateTime);
+  } while (FindNextFileW(find, &data));
+  FindClose(find);
+  return true;
+#else
+  DIR* directory = opendir(path.c_str());
+  if (!directory) {
+    cerr << "Can't list " << path << ": " << strerror(errno) << endl;
+    return false;
+  }
+  while (dirent* found = readdir(directory)) {
+    if (strcmp(found->d_name, ".") == 0 || strcmp(found->d_name, "..") == 0)
+      continue;
+    struct stat info;
+    // links followed, like is_directory() did; a dangling one as itself
+    if (fstatat(dirfd(directory), found->d_name, &info, 0) != 0 && fstatat(dirfd(directory), found->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+      continue;
+    DirectoryEntry& entry = entries.emplace_back();
+    entry.name = found->d_name;
+    entry.isDirectory = S_ISDIR(info.st_mode);
+    entry.size = entry.isDirectory ? 0 : (uintmax_t)info.st_size;
+    entry.dateModified = GlobalHelpers::StatTimeToUnixMs(info);
+  }
+  closedir(directory);
+  return true;
+#endif
+}
 int LuaFunctions::Lua::Fs::CListDirectory(lua_State* L) {
-  // Get directory path from Lua argument
-  const char* path = luaL_checkstring(L, 1);
-
-  // Create new table to hold results
-  lua_newtable(L);
-  int resultTableIdx = lua_gettop(L);
-  int entryIndex = 1; // Lua arrays start at 1
-
-  try {
-    for (const auto& entry : fs::directory_iterator(path)) {
-      // Create table for this entry
-      lua_newtable(L);
-      int entryTableIdx = lua_gettop(L);
-
-      // Push name field - using u8string() for proper UTF-8 encoding
-      std::string filename = reinterpret_cast<const char*>(entry.path().filename().u8string().c_str());
-      lua_pushstring(L, filename.c_str());
-      lua_setfield(L, entryTableIdx, "name");
-
-      // Push path field - using u8string() for proper UTF-8 encoding
-      std::string path = reinterpret_cast<const char*>(entry.path().u8string().c_str());
-      lua_pushstring(L, path.c_str());
-      lua_setfield(L, entryTableIdx, "path");
-
-      // Push isDirectory field
-      lua_pushboolean(L, entry.is_directory());
-      lua_setfield(L, entryTableIdx, "isDirectory");
-
-      if (!entry.is_directory()) {
-        // Push size
-        lua_pushinteger(L, static_cast<lua_Integer>(entry.file_size()));
-        lua_setfield(L, entryTableIdx, "size");
+  std::string path = luaL_checkstring(L, 1);
+  return Scheduler::Await(L, [path]() -> Scheduler::Completion {
+    auto entries = make_shared<std::vector<DirectoryEntry>>();
+    // an empty table on error
+    if (!listDirectory(path, *entries))
+      entries->clear();
+    return [entries, path](lua_State* L) {
+      lua_createtable(L, (int)entries->size(), 0);
+      int entryIndex = 1; // Lua arrays start at 1
+      for (const auto& entry : *entries) {
+        lua_createtable(L, 0, 5);
+        lua_pushlstring(L, entry.name.data(), entry.name.size());
+        lua_setfield(L, -2, "name");
+        std::string entryPath = reinterpret_cast<const char*>((fs::path(fixUtf8(path)) / fixUtf8(entry.name)).u8string().c_str());
+        lua_pushlstring(L, entryPath.data(), entryPath.size());
+        lua_setfield(L, -2, "path");
+        lua_pushboolean(L, entry.isDirectory);
+        lua_setfield(L, -2, "isDirectory");
+        if (!entry.isDirectory) {
+          lua_pushinteger(L, static_cast<lua_Integer>(entry.size));
+          lua_setfield(L, -2, "size");
+        }
+        lua_pushinteger(L, entry.dateModified);
+        lua_setfield(L, -2, "dateModified");
+        lua_rawseti(L, -2, entryIndex++);
       }
+      return 1;
+    };
+  });
+}
 
-      // Push last modified time (works for both files and directories)
-      auto ftime = entry.last_write_time();
-      auto sctp = chrono::time_point_cast<chrono::system_clock::duration>(ftime - fs::file_time_type::clock::now() + chrono::system_clock::now());
-      time_t timeS = chrono::system_clock::to_time_t(sctp);
-      lua_pushinteger(L, static_cast<lua_Integer>(timeS * 1000));
-      lua_setfield(L, entryTableIdx, "dateModified");
+struct ListingOptions {
+  enum Sort { NONE, NAME, SIZE, MODIFIED, TYPE };
+  size_t offset = 0;
+  /// @brief 0 = to the end
+  size_t limit = 0;
+  Sort sort = NONE;
+  bool descending = false;
+};
+/// @brief Case-insensitive for ASCII, byte order for the rest and for ties
+static bool nameLess(const std::string& a, const std::string& b) {
+  auto fold = [](unsigned char c) { return c >= 'A' && c <= 'Z' ? c + 32 : c; };
+  for (size_t i = 0; i < a.size() && i < b.size(); i++)
+    if (fold(a[i]) != fold(b[i]))
+      return fold(a[i]) < fold(b[i]);
+  return a.size() != b.size() ? a.size() < b.size() : a < b;
+}
+/// @brief Sorts as much as the page needs (partial_sort: a page of a huge directory isn't a full sort) and writes it the way
+/// ListDirectory always printed it: one JSON object per line
+static std::string encodeListing(const std::string& path, std::vector<DirectoryEntry>& entries, const ListingOptions& options) {
+  size_t begin = std::min(options.offset, entries.size());
+  size_t end = options.limit ? std::min(entries.size(), begin + options.limit) : entries.size();
+  if (options.sort != ListingOptions::NONE && begin < end) {
+    auto less = [&](const DirectoryEntry& a, const DirectoryEntry& b) {
+      switch (options.sort) {
+      case ListingOptions::SIZE:
+        if (a.size != b.size)
+          return a.size < b.size;
+        break;
+      case ListingOptions::MODIFIED:
+        if (a.dateModified != b.dateModified)
+          return a.dateModified < b.dateModified;
+        break;
+      case ListingOptions::TYPE:
+        if (a.isDirectory != b.isDirectory)
+          return a.isDirectory;
+        break;
+      default:
+        break;
+      }
+      return nameLess(a.name, b.name);
+    };
+    auto order = [&](const DirectoryEntry& a, const DirectoryEntry& b) { return options.descending ? less(b, a) : less(a, b); };
+    std::partial_sort(entries.begin(), entries.begin() + end, entries.end(), order);
+  }
 
-      // Add entry to results table
-      lua_rawseti(L, resultTableIdx, entryIndex++);
+  std::string base = path;
+  std::replace(base.begin(), base.end(), '\\', '/');
+  base += '/';
+  std::string out, entryPath;
+  out.reserve((end - begin) * (base.size() + 96));
+  char number[24];
+  for (size_t i = begin; i < end; i++) {
+    const DirectoryEntry& entry = entries[i];
+    if (i > begin)
+      out += '\n';
+    out += "{\"name\":";
+    Json::AppendString(out, entry.name.data(), entry.name.size());
+    out += ",\"path\":";
+    entryPath.assign(base).append(entry.name);
+    Json::AppendString(out, entryPath.data(), entryPath.size());
+    out += entry.isDirectory ? ",\"type\":\"dir\"" : ",\"type\":\"file\"";
+    if (!entry.isDirectory) {
+      out += ",\"size\":";
+      out.append(number, std::to_chars(number, number + sizeof(number), entry.size).ptr);
     }
+    out += ",\"dateModified\":";
+    out.append(number, std::to_chars(number, number + sizeof(number), entry.dateModified).ptr);
+    out += '}';
   }
-  catch (const fs::filesystem_error& e) {
-    cerr << "Filesystem error: " << e.what() << endl;
-    lua_pop(L, 1); // Remove the table we created
-                   // Return empty table (already created)
-  }
-  catch (...) {
-    cerr << "Unknown error while listing directory" << endl;
-    lua_pop(L, 1); // Remove the table we created
-                   // Return empty table (already created)
+  return out;
+}
+int LuaFunctions::Lua::Fs::CListDirectoryEncoded(lua_State* L) {
+  luaL_checkstring(L, 1);
+  ListingOptions options;
+  if (lua_istable(L, 2)) {
+    lua_getfield(L, 2, "offset");
+    options.offset = (size_t)std::max<lua_Integer>(0, lua_tointeger(L, -1));
+    lua_getfield(L, 2, "limit");
+    options.limit = (size_t)std::max<lua_Integer>(0, lua_tointeger(L, -1));
+    lua_getfield(L, 2, "descending");
+    options.descending = lua_toboolean(L, -1);
+    lua_getfield(L, 2, "sort");
+    static const char* sortNames[] = { "none", "name", "size", "modified", "type", nullptr };
+    options.sort = static_cast<ListingOptions::Sort>(luaL_checkoption(L, -1, "none", sortNames));
+    lua_pop(L, 4);
   }
-
-  // Return the results table (already on stack)
+  std::string path = lua_tostring(L, 1);
+  return Scheduler::Await(L, [path, options]() -> Scheduler::Completion {
+    std::vector<DirectoryEntry> entries;
+    if (!listDirectory(path, entries))
+      return [](lua_State* L) {
+        lua_pushnil(L);
+        return 1;
+      };
+    auto listing = make_shared<std::string>(encodeListing(path, entries, options));
+    return [listing, total = entries.size()](lua_State* L) {
+      lua_pushlstring(L, listing->data(), listing->size());
+      lua_pushinteger(L, (lua_Integer)total);
+      return 2;
+    };
+  });
+}
+int LuaFunctions::Lua::Fs::CFind(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  FileSearch::Options options;
+  lua_getfield(L, 1, "root");
+  options.root = luaL_checkstring(L, -1);
+  lua_getfield(L, 1, "glob");
+  options.glob = luaL_optstring(L, -1, "*");
+  lua_getfield(L, 1, "minSize");
+  options.minSize = (uint64_t)std::max<lua_Integer>(0, lua_tointeger(L, -1));
+  lua_getfield(L, 1, "newerThan");
+  options.newerThan = std::max<lua_Integer>(0, lua_tointeger(L, -1));
+  lua_getfield(L, 1, "maxResults");
+  options.maxResults = (size_t)std::max<lua_Integer>(0, lua_tointeger(L, -1));
+  lua_getfield(L, 1, "scanners");
+  if (!lua_isnil(L, -1))
+    options.scanners = (size_t)std::clamp<lua_Integer>(lua_tointeger(L, -1), 1, 64);
+  lua_pop(L, 6);
+  // a job like Exec's: the matches come back as its output, kill stops the walk
+  lua_pushinteger(L, processPool->Start([options](ProcessPool::Output& output) -> int32_t {
+    int64_t found = FileSearch::Run(options, [&](const std::string& batch) { output.Write(batch); }, [&]() { return output.IsCancelled(); });
+    return found < 0 ? 1 : 0;
+  }));
   return 1;
 }
+int LuaFunctions::Lua::Fs::CArchive(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  Archive::Options options;
+  lua_getfield(L, 1, "root");
+  options.root = luaL_checkstring(L, -1);
+  lua_getfield(L, 1, "token");
+  options.token = (uint32_t)lua_tointeger(L, -1);
+  lua_getfield(L, 1, "compress");
+  options.compress = lua_isnil(L, -1) || lua_toboolean(L, -1);
+  lua_getfield(L, 1, "compressors");
+  options.compressors = lua_isnil(L, -1) ? std::clamp<size_t>(std::thread::hardware_concurrency() / 2, 1, 4)
+                                         : (size_t)std::clamp<lua_Integer>(lua_tointeger(L, -1), 1, 16);
+  lua_pop(L, 4);
+  // the archive is the job's output: it goes out as it's made, and the pool's cap on pending output is what holds the reading back
+  lua_pushinteger(L, processPool->Start([options](ProcessPool::Output& output) -> int32_t {
+    Archive::Stats stats = Archive::Write(options, [&](const char* data, size_t size) { output.Write(data, size); }, [&]() { return output.IsCancelled(); });
+    return stats.failed ? 1 : 0;
+  }));
+  return 1;
+}
+/// @brief Watches (CWatch) running, until StopWatches() or the next CWatch after they ended
+struct Watch {
+  uint32_t jobId;
+  std::thread thread;
+  shared_ptr<std::atomic<bool>> done;
+};
+static std::mutex watchesMutex;
+static std::vector<Watch> watches;
+
+int LuaFunctions::Lua::Fs::CWatch(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  DirectoryWatcher::Options options;
+  lua_getfield(L, 1, "path");
+  options.path = luaL_checkstring(L, -1);
+  lua_getfield(L, 1, "token");
+  options.token = (uint32_t)lua_tointeger(L, -1);
+  lua_getfield(L, 1, "debounceMs");
+  if (!lua_isnil(L, -1))
+    options.debounce = std::chrono::milliseconds(std::clamp<lua_Integer>(lua_tointeger(L, -1), 10, 10000));
+  lua_pop(L, 3);
+  std::lock_guard lock(watchesMutex);
+  // the ones that ended by themselves (their directory is gone)
+  std::erase_if(watches, [](Watch& watch) {
+    if (!*watch.done)
+      return false;
+    watch.thread.join();
+    return true;
+  });
+  // on a thread of its own, not a pool worker: it runs for as long as it's wanted. The events are the job's output; kill ends it
+  ProcessPool::Output output = processPool->Open();
+  auto done = make_shared<std::atomic<bool>>(false);
+  std::thread thread([options, output, done]() mutable {
+    bool ok = DirectoryWatcher::Run(options, [&](const std::string& batch) { output.Write(batch); }, [&]() { return output.IsCancelled(); });
+    processPool->Close(output, ok ? 0 : 1);
+    *done = true;
+  });
+  watches.push_back({ output.GetJobId(), std::move(thread), done });
+  lua_pushinteger(L, output.GetJobId());
+  return 1;
+}
+void LuaFunctions::Lua::Fs::StopWatches() {
+  std::lock_guard lock(watchesMutex);
+  for (Watch& watch : watches)
+    processPool->Cancel(watch.jobId);
+  // they see it within DirectoryWatcher::poll_interval
+  for (Watch& watch : watches)
+    watch.thread.join();
+  watches.clear();
+}
+int LuaFunctions::Lua::Fs::CHash(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  // the errors first: C++ locals wouldn't be destroyed
+  lua_getfield(L, 1, "algo");
+  int algorithm = luaL_checkoption(L, -1, "xxh64", FileHash::algorithm_names);
+  lua_getfield(L, 1, "paths");
+  luaL_argcheck(L, lua_isstring(L, -1) || lua_istable(L, -1), 1, "paths: a path or an array of them");
+  lua_pop(L, 2);
+  FileHash::Options options;
+  options.algorithm = static_cast<FileHash::Algorithm>(algorithm);
+  lua_getfield(L, 1, "workers");
+  if (!lua_isnil(L, -1))
+    options.workers = (size_t)std::clamp<lua_Integer>(lua_tointeger(L, -1), 1, 64);
+  lua_getfield(L, 1, "cache");
+  if (lua_isstring(L, -1))
+    options.cachePath = lua_tostring(L, -1);
+  lua_getfield(L, 1, "paths");
+  std::vector<std::string> paths;
+  if (lua_isstring(L, -1))
+    paths.push_back(lua_tostring(L, -1));
+  else
+    paths = LuaFunctions::luaGetStringArray(L, lua_gettop(L));
+  lua_pop(L, 4);
+  return Scheduler::Await(L, [paths, options]() -> Scheduler::Completion {
+    auto entries = FileHash::Run(paths, options);
+    auto manifest = make_shared<std::string>(FileHash::Encode(entries));
+    return [manifest, count = entries.size()](lua_State* L) {
+      lua_pushlstring(L, manifest->data(), manifest->size());
+      lua_pushinteger(L, (lua_Integer)count);
+      return 2;
+    };
+  });
+}
 int LuaFunctions::Lua::Fs::CListDisks(lua_State* L) {
 #ifdef WIN32
   // Create a new Lua table
@@ -226,6 +465,16 @@ string LuaFunctions::Lua::Fs::ReadFile(const string& filePath) {
 
   return string(fileData.begin(), fileData.end());
 }
+int LuaFunctions::Lua::Fs::CReadFile(lua_State* L) {
+  string filePath = luaL_checkstring(L, 1);
+  return Scheduler::Await(L, [filePath]() -> Scheduler::Completion {
+    auto fileData = make_shared<string>(ReadFile(filePath));
+    return [fileData](lua_State* L) {
+      lua_pushlstring(L, fileData->data(), fileData->size());
+      return 1;
+    };
+  });
+}
 bool LuaFunctions::Lua::Fs::Exists(const string& utf8Path) {
   return fs::exists(fixUtf8(utf8Path));
 }
@@ -245,134 +494,50 @@ int LuaFunctions::Lua::Fs::CReadFileLines(lua_State* L) {
   }
   return 1;
 }
-bool LuaFunctions::Lua::Fs::Rm(const std::string& path) {
-  std::error_code ec;
-  bool result = deleteRecursively(fixUtf8(path), ec);
-  if (ec)
-    Logger::Log("Error deleting " + path + ": " + ec.message(), Logger::LOG_ERROR);
-  return result;
+/// @brief Runs a FileOperations call off the Lua thread. Its progress goes out as the output of a job, so kill stops it; the job is opened
+/// with the first progress line, a quick call leaves no trace
+static int runFileOperation(lua_State* L, std::function<FileOperations::Report(const FileOperations::Options&)> operation) {
+  return Scheduler::Await(L, [operation]() -> Scheduler::Completion {
+    std::mutex mutex;
+    std::optional<ProcessPool::Output> job;
+    FileOperations::Options options;
+    options.progress = [&](const std::string& line) {
+      std::lock_guard lock(mutex);
+      if (!job)
+        job.emplace(processPool->Open());
+      job->Write(line);
+    };
+    options.isCancelled = [&]() {
+      std::lock_guard lock(mutex);
+      return job && job->IsCancelled();
+    };
+    FileOperations::Report report = operation(options);
+    if (job)
+      processPool->Close(*job, report.failed ? 1 : 0);
+    if (report.failed)
+      Logger::Log(report.errors, Logger::LOG_ERROR);
+    return [report](lua_State* L) {
+      lua_pushboolean(L, report.failed == 0);
+      if (!report.failed)
+        return 1;
+      lua_pushlstring(L, report.errors.data(), report.errors.size());
+      return 2;
+    };
+  });
 }
-bool _MoveCopyParseArgs(lua_State* L, std::vector<std::string>& paths, std::string& destDir) {
-  paths = LuaFunctions::luaGetStringArray(L, 1);
-  destDir = lua_tostring(L, 2);
-
-  return true;
+int LuaFunctions::Lua::Fs::CRm(lua_State* L) {
+  string path = luaL_checkstring(L, 1);
+  return runFileOperation(L, [path](const FileOperations::Options& options) { return FileOperations::Delete(path, options); });
 }
 int LuaFunctions::Lua::Fs::CMove(lua_State* L) {
-  std::vector<std::string> paths;
-  std::string destDir;
-  if (!_MoveCopyParseArgs(L, paths, destDir)) {
-    lua_pushboolean(L, false);
-    return 1;
-  }
-  std::error_code ec;
-  try {
-    fs::path destination(fixUtf8(destDir));
-
-    // Create destination directory if it doesn't exist
-    if (!fs::exists(destination, ec)) {
-      fs::create_directories(destination, ec);
-      if (ec) {
-        lua_pushboolean(L, false);
-        return 1;
-      }
-    }
-
-    for (const auto& pathStr : paths) {
-      fs::path source(fixUtf8(pathStr));
-      if (!fs::exists(source, ec)) {
-        std::cerr << "Source not found: " << source << "\n";
-        continue;
-      }
-
-      fs::path target = destination / source.filename();
-
-      // Handle overwrite conflicts
-      if (fs::exists(target, ec)) {
-        std::cerr << "Target exists, overwriting: " << target << "\n";
-        fs::remove_all(target, ec);
-        if (ec) {
-          lua_pushboolean(L, false);
-          return 1;
-        }
-      }
-
-      fs::rename(source, target, ec); // Atomic move within same filesystem
-      if (ec) {
-        cout << "Could not move.." << ec.value() << endl;
-        // Fallback to copy+delete if rename fails (e.g., across devices)
-        fs::copy(source, target, fs::copy_options::recursive | fs::copy_options::overwrite_existing, ec);
-        if (!ec)
-          fs::remove_all(source, ec);
-        if (ec) {
-          lua_pushboolean(L, false);
-          return 1;
-        }
-      }
-    }
-    lua_pushboolean(L, true);
-    return 1;
-  }
-  catch (const std::exception& e) {
-    ec = std::error_code(errno, std::generic_category());
-    Logger::Log(std::string("Error moving files: ") + e.what(), Logger::LOG_ERROR);
-    lua_pushboolean(L, false);
-    return 1;
-  }
+  std::vector<std::string> paths = LuaFunctions::luaGetStringArray(L, 1);
+  std::string destination = luaL_checkstring(L, 2);
+  return runFileOperation(L, [paths, destination](const FileOperations::Options& options) { return FileOperations::Move(paths, destination, options); });
 }
 int LuaFunctions::Lua::Fs::CCopy(lua_State* L) {
-  std::vector<std::string> paths;
-  std::string destDir;
-  if (!_MoveCopyParseArgs(L, paths, destDir)) {
-    lua_pushboolean(L, false);
-    return 1;
-  }
-
-  std::error_code ec;
-  try {
-    fs::path destination = fixUtf8(destDir);
-
-    if (!fs::exists(destination, ec)) {
-      fs::create_directories(destination, ec);
-      if (ec) {
-        lua_pushboolean(L, false);
-        return 1;
-      }
-    }
-
-    for (const auto& pathStr : paths) {
-      fs::path source(fixUtf8(pathStr));
-      if (source.parent_path() == destination)
-        continue;
-      if (!fs::exists(source, ec)) {
-        std::cerr << "Source not found: " << source << "\n";
-        continue;
-      }
-
-      fs::path target = destination / source.filename();
-
-      if (fs::is_directory(source, ec)) {
-        fs::copy(source, target, fs::copy_options::recursive | fs::copy_options::overwrite_existing, ec);
-      }
-      else {
-        fs::copy_file(source, target, fs::copy_options::overwrite_existing, ec);
-      }
-      if (ec) {
-        lua_pushboolean(L, false);
-        return 1;
-      }
-    }
-    lua_pushboolean(L, true);
-    return 1;
-  }
-  catch (const std::exception& e) {
-    ec = std::error_code(errno, std::generic_category());
-    std::cerr << "Error copying files: " << e.what() << "\n";
-    {
-      lua_pushboolean(L, false);
-      return 1;
-    }
-  }
+  std::vector<std::string> paths = LuaFunctions::luaGetStringArray(L, 1);
+  std::string destination = luaL_checkstring(L, 2);
+  return runFileOperation(L, [paths, destination](const FileOperations::Options& options) { return FileOperations::Copy(paths, destination, options); });
 }
 bool LuaFunctions::Lua::Fs::Rename(std::string source, std::string destination) {
   if (source == destination)
@@ -405,3 +570,25 @@ bool LuaFunctions::Lua::Fs::Rename(std::string source, std::string destination)
     return false;
   }
 }
+bool LuaFunctions::Lua::Fs::MkDir(const std::string& path) {
+  std::error_code ec;
+  fs::create_directories(fixUtf8(path), ec);
+  if (ec) {
+    Logger::Log("Error creating " + path + ": " + ec.message(), Logger::LOG_ERROR);
+    return false;
+  }
+  return true;
+}
+bool LuaFunctions::Lua::Fs::Touch(const std::string& path) {
+  auto nativePath = fixUtf8(path);
+  std::error_code ec;
+  if (fs::exists(nativePath, ec))
+    fs::last_write_time(nativePath, fs::file_time_type::clock::now(), ec);
+  else if (!ec && !std::ofstream(nativePath, std::ios::binary | std::ios::app))
+    ec = std::make_error_code(std::errc::io_error);
+  if (ec) {
+    Logger::Log("Error touching " + path + ": " + ec.message(), Logger::LOG_ERROR);
+    return false;
+  }
+  return true;
+}
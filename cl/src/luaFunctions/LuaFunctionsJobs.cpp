@@ -0,0 +1,28 @@
+#include "../global.h"
+#include "LuaFunctions.h"
+
+void LuaFunctions::Lua::Jobs::Submit(uint32_t id, const string& code, const string& args) {
+  jobPool->Submit(id, code, args);
+}
+int LuaFunctions::Lua::Jobs::CCollect(lua_State* L) {
+  auto results = jobPool->Collect();
+  lua_createtable(L, (int)results.size(), 0);
+  lua_Integer index = 1;
+  for (auto& result : results) {
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, result.id);
+    lua_setfield(L, -2, "id");
+    lua_pushlstring(L, result.output.data(), result.output.size());
+    lua_setfield(L, -2, "text");
+    lua_pushboolean(L, result.ok);
+    lua_setfield(L, -2, "ok");
+    lua_rawseti(L, -2, index++);
+  }
+  return 1;
+}
+int LuaFunctions::Lua::Jobs::GetPending() {
+  return (int)jobPool->GetPending();
+}
+bool LuaFunctions::Lua::Jobs::Wait(const int64_t& ms) {
+  return jobPool->Wait(std::chrono::milliseconds(ms));
+}
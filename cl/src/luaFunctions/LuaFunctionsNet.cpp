@@ -1,7 +1,19 @@
+#include "../Archive.h"
+#include "../ChunkStore.h"
+#include "../Compression.h"
+#include "../Delta.h"
+#include "../Scheduler.h"
 #include "../Screenshot.h"
 #include "LuaFunctions.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
 #include <filesystem> // C++17 filesystem API
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <openssl/crypto.h>
+#include <thread>
 
 void LuaFunctions::waitReceive() {
   string data = client->ReceiveData();
@@ -9,35 +21,335 @@ void LuaFunctions::waitReceive() {
     throw new exception();
 }
 
-bool LuaFunctions::sendFile(const int code, char* buffer, size_t size) {
-  bool result = client->SendData({ { reinterpret_cast<const char*>(&code), sizeof(char) }, { buffer, size } });
+bool LuaFunctions::sendFile(const int code, char* buffer, size_t size, SendScheduler::TrafficClass cls) {
+  bool result = client->SendData({ { reinterpret_cast<const char*>(&code), sizeof(char) }, { buffer, size } }, cls);
   // Sleep(500);
   // waitReceive();
   return result;
 }
 
+static Compression::Codec compression = Compression::NONE;
+
+// Batch envelope, see nsv protocol/Batch.ts: [u8 action][u32 command id][u32 size][body] per part, [u32 command id][u8 flags]
+// [u32 size][code] per command in the reply
+static constexpr int batch_action = 6; // ACTIONS.BATCH
+static constexpr int stream_action = 7; // ACTIONS.STREAM
+static constexpr uint32_t no_command = UINT32_MAX;
+static constexpr size_t command_header_size = 4 + 1 + 4;
+static constexpr uint8_t command_concurrent = 1;
+// [u32 prepared id] ahead of the code: keep it instead of running it
+static constexpr uint8_t command_prepare = 2;
+// [u32 prepared id] ahead of an argument list (ChunkCache::PushArguments): run that chunk with them
+static constexpr uint8_t command_invoke = 4;
+static bool batching = false;
+static string batch;
+static constexpr int idle_action = 0; // ACTIONS.IDLE
+
+/// @brief The poll goes as INPUT: what the server answers it with is the input queued for this agent
+static SendScheduler::TrafficClass ClassOf(int code) {
+  return code == idle_action || code == batch_action ? SendScheduler::INPUT : SendScheduler::CONTROL;
+}
+
+// files going out from pool threads on `client`, which isn't deleted before they're over
+static mutex sendsMutex;
+static condition_variable sendsDone;
+static size_t sends = 0;
+
+/// @brief Held by an operation that sends on the main connection, until it's done (or dropped unrun)
+static shared_ptr<void> HoldConnection() {
+  lock_guard lock(sendsMutex);
+  sends++;
+  return shared_ptr<void>(nullptr, [](void*) {
+    {
+      lock_guard lock(sendsMutex);
+      sends--;
+    }
+    sendsDone.notify_all();
+  });
+}
+
+void LuaFunctions::OnDisconnect() {
+  {
+    // a lost connection fails them at their next write
+    unique_lock lock(sendsMutex);
+    sendsDone.wait(lock, [] { return sends == 0; });
+  }
+  // the handshake of the next connection must not go compressed with this one's codec
+  compression = Compression::NONE;
+  batching = false;
+  batch.clear();
+}
+
+static void AppendBatchPart(int code, uint32_t commandId, const char* data, size_t size) {
+  uint32_t size32 = (uint32_t)size;
+  batch.push_back((char)code);
+  batch.append(reinterpret_cast<const char*>(&commandId), sizeof(commandId));
+  batch.append(reinterpret_cast<const char*>(&size32), sizeof(size32));
+  batch.append(data, size);
+}
+
 bool LuaFunctions::Lua::Net::Send(const int& code, const string& data) {
-  return client->SendData((char)code + data);
-}
-bool LuaFunctions::Lua::Net::SendFile(const int& code, const string& path) {
-  ifstream file(fixUtf8(path), ios::binary | ios::ate);
-  size_t size = file.tellg();
-  file.seekg(0, ios::beg);
-  char* buffer = new char[size];
-  file.read(buffer, size);
-  file.close();
-  bool result = sendFile(code, buffer, size);
-  delete[] buffer;
-  return result;
+  if (batching) {
+    AppendBatchPart(code, no_command, data.data(), data.size());
+    return true;
+  }
+  string compressed;
+  if (Compression::Compress(compression, data.data(), data.size(), compressed)) {
+    char action = (char)(code | Compression::action_flag);
+    return client->SendData({ { &action, sizeof(action) }, { compressed.data(), compressed.size() } }, ClassOf(code));
+  }
+  return client->SendData((char)code + data, ClassOf(code));
+}
+bool LuaFunctions::Lua::Net::SetCompression(const string& codec) {
+  compression = Compression::FromName(codec);
+  return compression != Compression::NONE;
+}
+void LuaFunctions::Lua::Net::SetSlicing(bool slicing) {
+  client->SetSlicing(slicing);
+}
+int LuaFunctions::Lua::Net::CSendFile(lua_State* L) {
+  int code = (int)luaL_checkinteger(L, 1);
+  string path = luaL_checkstring(L, 2);
+  // off the Lua thread: the main cycle's polls go between the slices, instead of waiting for all of the file
+  return Scheduler::Await(L, [code, path, connection = client, held = HoldConnection()]() -> Scheduler::Completion {
+    char action = (char)code;
+    bool sent = connection->SendFile(filesystem::path(fixUtf8(path)), &action, sizeof(action), SendScheduler::BULK);
+    return [sent](lua_State* L) {
+      lua_pushboolean(L, sent);
+      return 1;
+    };
+  });
+}
+// Resumable downloads, see nsv protocol/Resume.ts. A range goes behind [u64 offset][u64 file size][i64 modified]: size and modification
+// time are the file's version, what the server checks its part against
+struct FileVersion {
+  uint64_t size = 0;
+  int64_t modified = 0;
+};
+static constexpr size_t range_header_size = 8 + 8 + 8;
+static constexpr int attach_action = 8; // ACTIONS.ATTACH
+static constexpr const char* attach_exporter_label = "EXPORTER-mrut-attach";
+static constexpr size_t attach_key_size = 32;
+
+static bool getFileVersion(const filesystem::path& path, FileVersion& version) {
+  error_code ec;
+  version.size = filesystem::file_size(path, ec);
+  if (ec)
+    return false;
+  // only ever compared with what this agent said before: the clock's epoch doesn't matter
+  auto modified = filesystem::last_write_time(path, ec);
+  version.modified = chrono::duration_cast<chrono::milliseconds>(modified.time_since_epoch()).count();
+  return !ec;
+}
+static bool sendRange(TCPClient& to, int code, const filesystem::path& path, const FileVersion& version, uint64_t offset, uint64_t length) {
+  char prefix[1 + range_header_size];
+  prefix[0] = (char)code;
+  memcpy(prefix + 1, &offset, sizeof(offset));
+  memcpy(prefix + 1 + 8, &version.size, sizeof(version.size));
+  memcpy(prefix + 1 + 16, &version.modified, sizeof(version.modified));
+  return to.SendFileRange(path, offset, length, prefix, sizeof(prefix), SendScheduler::BULK);
+}
+int LuaFunctions::Lua::Net::CSendFileRange(lua_State* L) {
+  int code = (int)luaL_checkinteger(L, 1);
+  size_t pathSize;
+  const char* pathData = luaL_checklstring(L, 2, &pathSize);
+  uint64_t offset = (uint64_t)max<lua_Integer>(0, luaL_checkinteger(L, 3));
+  lua_Integer length = luaL_checkinteger(L, 4);
+  FileVersion expected{ (uint64_t)luaL_optinteger(L, 5, 0), (int64_t)luaL_optinteger(L, 6, 0) };
+  string path(pathData, pathSize);
+  filesystem::path file(fixUtf8(path));
+  FileVersion version;
+  if (!getFileVersion(file, version)) {
+    // the server is waiting for a FILE either way: an empty one has no header, and tells it there's nothing
+    char action = (char)code;
+    sendFile(code, &action, 0);
+    lua_pushboolean(L, false);
+    lua_pushstring(L, ("can't read " + path).c_str());
+    return 2;
+  }
+  // the server's part is of another version of the file: it's no use, all of it goes again
+  if ((expected.size || expected.modified) && (expected.size != version.size || expected.modified != version.modified)) {
+    offset = 0;
+    length = -1;
+  }
+  offset = min(offset, version.size);
+  return Scheduler::Await(L, [code, file, version, offset, length, connection = client, held = HoldConnection()]() -> Scheduler::Completion {
+    bool sent = sendRange(*connection, code, file, version, offset, length < 0 ? UINT64_MAX : (uint64_t)length);
+    return [sent](lua_State* L) {
+      lua_pushboolean(L, sent);
+      if (sent)
+        return 1;
+      lua_pushstring(L, "connection lost");
+      return 2;
+    };
+  });
+}
+int LuaFunctions::Lua::Net::CSendFileStripes(lua_State* L) {
+  int code = (int)luaL_checkinteger(L, 1);
+  luaL_checkstring(L, 2);
+  uint32_t transfer = (uint32_t)luaL_checkinteger(L, 3);
+  FileVersion expected{ (uint64_t)luaL_checkinteger(L, 4), (int64_t)luaL_checkinteger(L, 5) };
+  luaL_checktype(L, 6, LUA_TTABLE);
+  struct Stripe {
+    uint32_t index;
+    uint64_t offset, length;
+  };
+  vector<Stripe> stripes;
+  for (lua_Integer i = 1, count = luaL_len(L, 6); i <= count; i++) {
+    lua_geti(L, 6, i);
+    if (lua_istable(L, -1)) {
+      lua_getfield(L, -1, "stripe");
+      lua_getfield(L, -2, "offset");
+      lua_getfield(L, -3, "length");
+      stripes.push_back({ (uint32_t)lua_tointeger(L, -3), (uint64_t)max<lua_Integer>(0, lua_tointeger(L, -2)),
+                          (uint64_t)max<lua_Integer>(0, lua_tointeger(L, -1)) });
+      lua_pop(L, 3);
+    }
+    lua_pop(L, 1);
+  }
+  string path = lua_tostring(L, 2);
+  // proves to the server that the new connections come from this session, without the secret going anywhere
+  unsigned char key[attach_key_size];
+  if (!client->ExportKeyingMaterial(key, sizeof(key), attach_exporter_label)) {
+    string error = "not over TLS";
+    sendFile(code, error.data(), error.size());
+    lua_pushboolean(L, false);
+    lua_pushstring(L, error.c_str());
+    return 2;
+  }
+  string attach(1, (char)attach_action);
+  attach.append(reinterpret_cast<const char*>(key), sizeof(key));
+  attach.append(reinterpret_cast<const char*>(&transfer), sizeof(transfer));
+  OPENSSL_cleanse(key, sizeof(key));
+  return Scheduler::Await(L, [code, path, expected, stripes, attach, open = client->Sibling()]() -> Scheduler::Completion {
+    filesystem::path file(fixUtf8(path));
+    FileVersion version;
+    string errors;
+    if (!getFileVersion(file, version))
+      errors = "can't read " + path;
+    // every stripe has to be of the same file
+    else if (version.size != expected.size || version.modified != expected.modified)
+      errors = path + " changed since the transfer started";
+    else {
+      vector<string> failures(stripes.size());
+      vector<thread> senders;
+      for (size_t i = 0; i < stripes.size(); i++)
+        senders.emplace_back([&, i]() {
+          const Stripe& stripe = stripes[i];
+          try {
+            unique_ptr<TCPClient> connection(open());
+            string message = attach;
+            message.append(reinterpret_cast<const char*>(&stripe.index), sizeof(stripe.index));
+            // the range goes once the server has taken the connection: it reads the FILE with a reader of its own
+            if (!connection->SendData(message) || connection->ReceiveData() != "1")
+              failures[i] = "refused";
+            else if (!sendRange(*connection, code, file, version, stripe.offset, stripe.length))
+              failures[i] = "connection lost";
+          }
+          catch (const exception& e) {
+            failures[i] = e.what();
+          }
+        });
+      for (thread& sender : senders)
+        sender.join();
+      for (size_t i = 0; i < stripes.size(); i++)
+        if (!failures[i].empty())
+          errors += (errors.empty() ? "" : "\n") + ("stripe " + to_string(stripes[i].index) + ": " + failures[i]);
+    }
+    return [code, errors](lua_State* L) {
+      // the server is waiting for this: with no stripe come (none refused, say), it would wait for good
+      string report = errors;
+      sendFile(code, report.data(), report.size());
+      lua_pushboolean(L, errors.empty());
+      if (errors.empty())
+        return 1;
+      lua_pushlstring(L, errors.data(), errors.size());
+      return 2;
+    };
+  });
 }
 bool LuaFunctions::Lua::Net::Screencast() {
   auto start = LuaFunctions::Lua::System::GetTimeMs();
   // takes ENORMOUS time to grab....
   Screenshot pic = Screenshot();
   cout << pic.webp.size() << ' ' << (LuaFunctions::Lua::System::GetTimeMs() - start) << endl;
-  bool result = sendFile(3, pic.webp.data(), pic.webp.size());
+  // a late frame is worthless: prefer the lossy datagram channel over queueing behind TCP retransmits
+  if (datagram)
+    return datagram->SendFrame(pic.webp.data(), pic.webp.size());
+  if (batching) {
+    AppendBatchPart(3, no_command, pic.webp.data(), pic.webp.size());
+    return true;
+  }
+  bool result = sendFile(3, pic.webp.data(), pic.webp.size(), SendScheduler::SCREENCAST);
   return result;
 }
+void LuaFunctions::Lua::Net::BeginBatch() {
+  batching = true;
+  batch.clear();
+}
+bool LuaFunctions::Lua::Net::SendFeedback(uint32_t commandId, const string& data) {
+  if (!batching)
+    return Send(1, data);
+  AppendBatchPart(1, commandId, data.data(), data.size());
+  return true;
+}
+bool LuaFunctions::Lua::Net::SendStream(uint32_t jobId, int kind, const string& data) {
+  string body;
+  body.reserve(sizeof(jobId) + 1 + data.size());
+  if (!batching)
+    body.append(reinterpret_cast<const char*>(&jobId), sizeof(jobId));
+  body.push_back((char)kind);
+  body += data;
+  if (!batching)
+    return Send(stream_action, body);
+  AppendBatchPart(stream_action, jobId, body.data(), body.size());
+  return true;
+}
+bool LuaFunctions::Lua::Net::FlushBatch() {
+  batching = false;
+  string message;
+  message.swap(batch);
+  return message.empty() || Send(batch_action, message);
+}
+int LuaFunctions::Lua::Net::CReceiveBatch(lua_State* L) {
+  size_t size;
+  char* data = client->ReceiveRawData(&size);
+  lua_newtable(L);
+  if (!data)
+    return 1;
+  size_t offset = 0;
+  lua_Integer index = 1;
+  // a single zero byte (the empty reply) is shorter than any command header
+  while (offset + command_header_size <= size) {
+    uint32_t commandId, codeSize;
+    memcpy(&commandId, data + offset, sizeof(commandId));
+    uint8_t flags = (uint8_t)data[offset + 4];
+    memcpy(&codeSize, data + offset + 5, sizeof(codeSize));
+    offset += command_header_size;
+    codeSize = (uint32_t)std::min<size_t>(codeSize, size - offset);
+    lua_newtable(L);
+    lua_pushinteger(L, commandId);
+    lua_setfield(L, -2, "id");
+    lua_pushboolean(L, flags & command_concurrent);
+    lua_setfield(L, -2, "concurrent");
+    const char* body = data + offset;
+    uint32_t bodySize = codeSize;
+    if ((flags & (command_prepare | command_invoke)) && bodySize >= sizeof(uint32_t)) {
+      uint32_t preparedId;
+      memcpy(&preparedId, body, sizeof(preparedId));
+      body += sizeof(preparedId);
+      bodySize -= sizeof(preparedId);
+      lua_pushinteger(L, preparedId);
+      lua_setfield(L, -2, flags & command_prepare ? "prepare" : "invoke");
+    }
+    lua_pushlstring(L, body, bodySize);
+    lua_setfield(L, -2, flags & command_invoke ? "args" : "code");
+    lua_rawseti(L, -2, index++);
+    offset += codeSize;
+  }
+  delete[] data;
+  return 1;
+}
 string LuaFunctions::Lua::Net::Receive() {
   return client->ReceiveData();
 }
@@ -52,6 +364,207 @@ bool LuaFunctions::Lua::Net::ReceiveFile(const string& path) {
   delete[] buf;
   return true;
 }
+// Delta sync. Signatures and deltas are made right here, not on a pool thread: the server names each FILE after the one it expects next,
+// so they have to go out in the order the commands came, like SendFile()'s
+int LuaFunctions::Lua::Net::CSendSignature(lua_State* L) {
+  int code = (int)luaL_checkinteger(L, 1);
+  string path = luaL_checkstring(L, 2);
+  error_code ec;
+  uint64_t size = filesystem::file_size(filesystem::path(fixUtf8(path)), ec);
+  // a file that isn't there is an empty basis: the delta will be all literal
+  ifstream basis(fixUtf8(path), ios::binary);
+  string signature = Delta::Sign(basis, ec ? 0 : size);
+  lua_pushboolean(L, sendFile(code, signature.data(), signature.size()));
+  return 1;
+}
+int LuaFunctions::Lua::Net::CSendDelta(lua_State* L) {
+  int code = (int)luaL_checkinteger(L, 1);
+  string path = luaL_checkstring(L, 2);
+  size_t size;
+  char* data = client->ReceiveRawData(&size);
+  string signature = data ? string(data, size) : string();
+  delete[] data;
+  static uint32_t deltas = 0;
+  error_code ec;
+  filesystem::path temporary =
+      filesystem::temp_directory_path(ec) / ("rut-delta-" + to_string(LuaFunctions::Lua::System::GetTimeMs()) + "-" + to_string(deltas++));
+  string error;
+  {
+    ifstream target(fixUtf8(path), ios::binary);
+    ofstream delta(temporary, ios::binary | ios::trunc);
+    if (!target)
+      error = "can't read " + path;
+    else if (!delta)
+      error = "can't write the delta";
+    else if (!Delta::Diff(signature, target, delta))
+      error = "malformed signature, or the file couldn't be read";
+  }
+  char action = (char)code;
+  // the server is waiting for a FILE either way: an empty one tells it there's no delta
+  bool sent = error.empty() ? client->SendFile(temporary, &action, sizeof(action), SendScheduler::BULK) : sendFile(code, &action, 0);
+  filesystem::remove(temporary, ec);
+  lua_pushboolean(L, sent && error.empty());
+  if (error.empty())
+    return 1;
+  lua_pushlstring(L, error.data(), error.size());
+  return 2;
+}
+// the delta comes right behind the command: it's received before the work goes to a pool thread
+int LuaFunctions::Lua::Net::CReceivePatch(lua_State* L) {
+  string path = luaL_checkstring(L, 1);
+  size_t size;
+  shared_ptr<char[]> delta(client->ReceiveRawData(&size));
+  if (!delta) {
+    lua_pushboolean(L, false);
+    lua_pushstring(L, "no delta received");
+    return 2;
+  }
+  return Scheduler::Await(L, [path, delta, size]() -> Scheduler::Completion {
+    filesystem::path target(fixUtf8(path)), temporary = target;
+    temporary += ".delta~";
+    string error;
+    {
+      // no old copy: the delta has to be all literal, and the check at its end tells
+      ifstream basis(target, ios::binary);
+      ofstream result(temporary, ios::binary | ios::trunc);
+      error = result ? Delta::Patch(basis, delta.get(), size, result) : "can't write " + path;
+    }
+    error_code ec;
+    if (error.empty())
+      filesystem::rename(temporary, target, ec);
+    if (ec)
+      error = ec.message();
+    if (!error.empty())
+      filesystem::remove(temporary, ec);
+    return [error](lua_State* L) {
+      lua_pushboolean(L, error.empty());
+      if (error.empty())
+        return 1;
+      lua_pushlstring(L, error.data(), error.size());
+      return 2;
+    };
+  });
+}
+int LuaFunctions::Lua::Net::CSendMissingChunks(lua_State* L) {
+  int code = (int)luaL_checkinteger(L, 1);
+  string store = luaL_checkstring(L, 2);
+  size_t size;
+  char* data = client->ReceiveRawData(&size);
+  vector<ChunkStore::Chunk> chunks;
+  size_t consumed;
+  vector<uint32_t> missing;
+  bool parsed = data && ChunkStore::ParseManifest(data, size, chunks, consumed);
+  delete[] data;
+  // like a signature, answered right away: the server takes FILEs in order
+  if (parsed)
+    missing = ChunkStore(filesystem::path(fixUtf8(store)), 0).Missing(chunks);
+  lua_pushboolean(L, sendFile(code, reinterpret_cast<char*>(missing.data()), missing.size() * sizeof(uint32_t)) && parsed);
+  return 1;
+}
+int LuaFunctions::Lua::Net::CReceiveChunked(lua_State* L) {
+  string path = luaL_checkstring(L, 1);
+  string store = luaL_checkstring(L, 2);
+  uint64_t maxSize = (uint64_t)max<lua_Integer>(0, luaL_checkinteger(L, 3));
+  size_t size;
+  shared_ptr<char[]> data(client->ReceiveRawData(&size));
+  if (!data) {
+    lua_pushboolean(L, false);
+    lua_pushstring(L, "nothing received");
+    return 2;
+  }
+  return Scheduler::Await(L, [path, store, maxSize, data, size]() -> Scheduler::Completion {
+    vector<ChunkStore::Chunk> chunks;
+    vector<uint32_t> sent;
+    size_t manifestSize, sentSize;
+    string error = "malformed manifest";
+    if (ChunkStore::ParseManifest(data.get(), size, chunks, manifestSize) &&
+        ChunkStore::ParseSent(data.get() + manifestSize, size - manifestSize, chunks.size(), sent, sentSize)) {
+      size_t consumed = manifestSize + sentSize;
+      error = ChunkStore(filesystem::path(fixUtf8(store)), maxSize)
+                  .Assemble(chunks, sent, data.get() + consumed, size - consumed, filesystem::path(fixUtf8(path)));
+    }
+    return [error](lua_State* L) {
+      lua_pushboolean(L, error.empty());
+      if (error.empty())
+        return 1;
+      lua_pushlstring(L, error.data(), error.size());
+      return 2;
+    };
+  });
+}
+int LuaFunctions::Lua::Net::CReceiveArchive(lua_State* L) {
+  string root = luaL_checkstring(L, 1);
+  // unpacked as it comes in: the payload is never whole in memory, and the disk works while the network does
+  auto extractor = make_shared<Archive::Extractor>(root);
+  // it comes a message per piece (the server reads the tree as it sends), an empty one ends it
+  bool received;
+  size_t got;
+  do {
+    got = 0;
+    received = client->ReceiveData([&](const char* data, size_t size) {
+      got += size;
+      extractor->Push(data, size);
+    });
+  } while (received && got > 0);
+  return Scheduler::Await(L, [extractor, received]() -> Scheduler::Completion {
+    Archive::Stats stats = extractor->Finish();
+    return [stats, received](lua_State* L) {
+      bool ok = received && stats.complete && !stats.failed;
+      lua_pushboolean(L, ok);
+      string summary = to_string(stats.files) + " files, " + to_string(stats.directories) + " directories, " + to_string(stats.bytes) + " bytes";
+      if (!stats.errors.empty())
+        summary += "\n" + stats.errors;
+      lua_pushlstring(L, summary.data(), summary.size());
+      return 2;
+    };
+  });
+}
 bool LuaFunctions::Lua::Net::IsConnected() {
   return !!client;
 }
+void LuaFunctions::Lua::Net::SetRateLimit(int cls, double bytesPerSec) {
+  if (cls < 0 || cls >= SendScheduler::CLASS_COUNT)
+    throw runtime_error("Unknown traffic class");
+  client->GetScheduler().SetRateLimit(static_cast<SendScheduler::TrafficClass>(cls), bytesPerSec);
+}
+void LuaFunctions::Lua::Net::SetLinkRateLimit(double bytesPerSec) {
+  client->GetScheduler().SetLinkRateLimit(bytesPerSec);
+}
+bool LuaFunctions::Lua::Net::OpenDatagram(int port, int groupSize) {
+  if (datagram) {
+    delete datagram;
+    datagram = nullptr;
+  }
+  if (port <= 0 || port > UINT16_MAX || groupSize < 0 || groupSize > UINT8_MAX)
+    return false;
+  datagram = DatagramChannel::FromTLS(*client, (uint16_t)port, (uint8_t)groupSize);
+  return !!datagram;
+}
+void LuaFunctions::Lua::Net::ProbeRtt() {
+  client->ProbeRtt();
+}
+int LuaFunctions::Lua::Net::CGetLinkStats(lua_State* L) {
+  auto stats = client->GetLinkStats();
+  lua_newtable(L);
+
+  lua_pushnumber(L, stats.rttMs);
+  lua_setfield(L, -2, "rttMs");
+  lua_pushnumber(L, stats.rttVarMs);
+  lua_setfield(L, -2, "rttVarMs");
+  lua_pushnumber(L, stats.sendBytesPerSec);
+  lua_setfield(L, -2, "sendBytesPerSec");
+  lua_pushnumber(L, stats.receiveBytesPerSec);
+  lua_setfield(L, -2, "receiveBytesPerSec");
+  lua_pushinteger(L, static_cast<lua_Integer>(stats.bytesSent));
+  lua_setfield(L, -2, "bytesSent");
+  lua_pushinteger(L, static_cast<lua_Integer>(stats.bytesReceived));
+  lua_setfield(L, -2, "bytesReceived");
+  lua_pushinteger(L, static_cast<lua_Integer>(stats.messagesSent));
+  lua_setfield(L, -2, "messagesSent");
+  lua_pushinteger(L, static_cast<lua_Integer>(stats.messagesReceived));
+  lua_setfield(L, -2, "messagesReceived");
+  lua_pushinteger(L, static_cast<lua_Integer>(stats.rttSamples));
+  lua_setfield(L, -2, "rttSamples");
+
+  return 1;
+}
@@ -0,0 +1,44 @@
+#include "../Process.h"
+#include "../Scheduler.h"
+#include "../global.h"
+#include "LuaFunctions.h"
+
+uint32_t LuaFunctions::Lua::Processes::Start(const string& command) {
+  return processPool->Start(command);
+}
+bool LuaFunctions::Lua::Processes::Cancel(uint32_t jobId) {
+  return processPool->Cancel(jobId);
+}
+int LuaFunctions::Lua::Processes::CCollect(lua_State* L) {
+  auto chunks = processPool->Collect();
+  lua_createtable(L, (int)chunks.size(), 0);
+  lua_Integer index = 1;
+  for (auto& chunk : chunks) {
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, chunk.jobId);
+    lua_setfield(L, -2, "id");
+    lua_pushinteger(L, chunk.kind);
+    lua_setfield(L, -2, "kind");
+    lua_pushlstring(L, chunk.data.data(), chunk.data.size());
+    lua_setfield(L, -2, "data");
+    lua_rawseti(L, -2, index++);
+  }
+  return 1;
+}
+int LuaFunctions::Lua::Processes::GetActive() {
+  return (int)processPool->GetActive();
+}
+int LuaFunctions::Lua::Processes::CRun(lua_State* L) {
+  string command = luaL_checkstring(L, 1);
+  string input = luaL_optstring(L, 2, "");
+  auto timeout = chrono::milliseconds(luaL_optinteger(L, 3, 0));
+  return Scheduler::Await(L, [command, input, timeout]() -> Scheduler::Completion {
+    auto result = make_shared<Process::Result>(Process::Run(command, input, timeout));
+    return [result](lua_State* L) {
+      lua_pushlstring(L, result->output.data(), result->output.size());
+      lua_pushinteger(L, result->exitCode);
+      lua_pushboolean(L, result->timedOut);
+      return 3;
+    };
+  });
+}
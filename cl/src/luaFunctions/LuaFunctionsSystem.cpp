@@ -1,8 +1,14 @@
 #include "../Hwid.h"
+#include "../Process.h"
+#include "../Scheduler.h"
 #include "../helpers/GeneralHelpers.h"
 #include "LuaFunctions.h"
-#include <array>
+#ifdef _WIN32
 #include <commctrl.h>
+#else
+#include <pwd.h>
+#include <unistd.h>
+#endif
 #pragma comment(                                                                                                                                               \
     linker,                                                                                                                                                    \
     "/manifestdependency:\"type='win32' name='Microsoft.Windows.Common-Controls' version='6.0.0.0' processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
@@ -14,29 +20,7 @@ LPCWSTR ToWstr(const string& s) {
 }
 
 string LuaFunctions::exec(string cmd) {
-#ifdef _WIN32
-  array<char, 128> buffer;
-  string result;
-  unique_ptr<FILE, decltype(&_pclose)> pipe(_popen(cmd.c_str(), "r"), _pclose);
-  if (!pipe) {
-    throw runtime_error("_popen() failed!");
-  }
-  while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-    result += buffer.data();
-  }
-  return result;
-#else
-  array<char, 128> buffer;
-  string result;
-  unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd.c_str(), "r"), pclose);
-  if (!pipe) {
-    throw runtime_error("popen() failed!");
-  }
-  while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-    result += buffer.data();
-  }
-  return result;
-#endif
+  return Process::Run(cmd).output;
 }
 
 /// @param cmd Command
@@ -45,15 +29,25 @@ string LuaFunctions::Lua::System::Exec(const string& cmd) {
   return exec(cmd);
 }
 
-void LuaFunctions::Lua::System::AExec(const string& cmd) {
-  static list<thread> thrs = list<thread>();
-  thrs.push_front(thread(exec, cmd));
+int LuaFunctions::Lua::System::CExec(lua_State* L) {
+  string cmd = luaL_checkstring(L, 1);
+  return Scheduler::Await(L, [cmd]() -> Scheduler::Completion {
+    auto result = make_shared<string>(exec(cmd));
+    return [result](lua_State* L) {
+      lua_pushlstring(L, result->data(), result->size());
+      return 1;
+    };
+  });
 }
 
 void LuaFunctions::Lua::System::Sleep(const int64_t& ms) {
   this_thread::sleep_for(chrono::milliseconds(ms));
 }
 
+int LuaFunctions::Lua::System::CSleep(lua_State* L) {
+  return Scheduler::Sleep(L, chrono::milliseconds(luaL_checkinteger(L, 1)));
+}
+
 long long LuaFunctions::Lua::System::GetTimeMs() {
   using namespace std::chrono;
   return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
@@ -66,6 +60,35 @@ string LuaFunctions::Lua::System::GetUuidV4() {
   return Hwid::GetPcUuidV4();
 }
 
+#ifdef _WIN32
+string LuaFunctions::Lua::System::GetHostname() {
+  wchar_t name[256];
+  DWORD size = ARRAYSIZE(name);
+  if (!GetComputerNameExW(ComputerNameDnsHostname, name, &size))
+    return "";
+  return GlobalHelpers::WindowsWstringToString(wstring(name, size));
+}
+string LuaFunctions::Lua::System::GetUsername() {
+  wchar_t name[257];
+  DWORD size = ARRAYSIZE(name);
+  if (!GetUserNameW(name, &size))
+    return "";
+  // size counts the terminating null
+  return GlobalHelpers::WindowsWstringToString(wstring(name, size ? size - 1 : 0));
+}
+#else
+string LuaFunctions::Lua::System::GetHostname() {
+  char name[256] = {};
+  if (gethostname(name, sizeof(name) - 1) != 0)
+    return "";
+  return name;
+}
+string LuaFunctions::Lua::System::GetUsername() {
+  passwd* user = getpwuid(geteuid());
+  return user ? user->pw_name : "";
+}
+#endif
+
 #ifdef _WIN32
 LONG MapMessageBoxIcon(LuaFunctions::Lua::System::MessageBoxType type);
 bool LuaFunctions::Lua::System::Dialog::Confirm(const std::string& title, const std::string& text, MessageBoxType type) {
@@ -80,7 +103,8 @@ void LuaFunctions::Lua::System::Dialog::Ok(const std::string& title, const std::
 
   MessageBoxW(NULL, GlobalHelpers::StringToWstring(text).c_str(), GlobalHelpers::StringToWstring(title).c_str(), flags);
 }
-std::wstring g_inputText;
+// per thread: dialogs of different tasks can be open at once
+thread_local std::wstring g_inputText;
 HRESULT CALLBACK TaskDialogCallbackProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam, LONG_PTR lpRefData) {
   switch (msg) {
   case TDN_CREATED: {
@@ -140,6 +164,36 @@ std::string LuaFunctions::Lua::System::Dialog::Input(const std::string& title, c
   return GlobalHelpers::WindowsWstringToString((nButton == IDOK) ? g_inputText : L"");
 }
 
+int LuaFunctions::Lua::System::Dialog::COk(lua_State* L) {
+  string title = luaL_optstring(L, 1, ""), text = luaL_optstring(L, 2, "");
+  auto type = static_cast<MessageBoxType>(luaL_optinteger(L, 3, MESSAGEBOX_BLANK));
+  return Scheduler::Await(L, [title, text, type]() -> Scheduler::Completion {
+    Ok(title, text, type);
+    return [](lua_State*) { return 0; };
+  });
+}
+int LuaFunctions::Lua::System::Dialog::CConfirm(lua_State* L) {
+  string title = luaL_optstring(L, 1, ""), text = luaL_optstring(L, 2, "");
+  auto type = static_cast<MessageBoxType>(luaL_optinteger(L, 3, MESSAGEBOX_BLANK));
+  return Scheduler::Await(L, [title, text, type]() -> Scheduler::Completion {
+    bool agree = Confirm(title, text, type);
+    return [agree](lua_State* L) {
+      lua_pushboolean(L, agree);
+      return 1;
+    };
+  });
+}
+int LuaFunctions::Lua::System::Dialog::CInput(lua_State* L) {
+  string title = luaL_optstring(L, 1, ""), prompt = luaL_optstring(L, 2, "");
+  return Scheduler::Await(L, [title, prompt]() -> Scheduler::Completion {
+    auto text = make_shared<string>(Input(title, prompt));
+    return [text](lua_State* L) {
+      lua_pushlstring(L, text->data(), text->size());
+      return 1;
+    };
+  });
+}
+
 LONG MapMessageBoxIcon(LuaFunctions::Lua::System::MessageBoxType type) {
   using namespace LuaFunctions::Lua::System;
   switch (type) {
@@ -0,0 +1,31 @@
+#include "../global.h"
+#include "LuaFunctions.h"
+
+int LuaFunctions::Lua::Tasks::CSpawn(lua_State* L) {
+  auto id = (uint32_t)luaL_checkinteger(L, 1);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  scheduler->Spawn(L, id, lua_gettop(L) - 2);
+  return 0;
+}
+int LuaFunctions::Lua::Tasks::CCollect(lua_State* L) {
+  auto results = scheduler->Collect(L);
+  lua_createtable(L, (int)results.size(), 0);
+  lua_Integer index = 1;
+  for (auto& result : results) {
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, result.id);
+    lua_setfield(L, -2, "id");
+    lua_pushlstring(L, result.output.data(), result.output.size());
+    lua_setfield(L, -2, "text");
+    lua_pushboolean(L, result.ok);
+    lua_setfield(L, -2, "ok");
+    lua_rawseti(L, -2, index++);
+  }
+  return 1;
+}
+int LuaFunctions::Lua::Tasks::GetRunning() {
+  return (int)scheduler->GetRunning();
+}
+bool LuaFunctions::Lua::Tasks::Wait(const int64_t& ms) {
+  return scheduler->Wait(std::chrono::milliseconds(ms));
+}
@@ -12,17 +12,18 @@
 #include <plusaes/plusaes.hpp>
 
 #include "lua/0_Config.h"
-#include "lua/1_json.h"
 #include "lua/2_Startup.h"
 #include "lua/3_MainCycle.h"
 #include "lua/Key.h"
 #include "lua/rootCertificate.h"
 #endif
+#include <algorithm>
 #include <foresteamnd/Utils>
 #include <fstream>
 #include <gdiplus.h>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <string.h>
 #include <thread>
 
@@ -32,14 +33,29 @@
 #define DEBUG false
 #endif
 
-void _RunHandled(lua_State* L, char* code);
-bool RunHandled(lua_State* L, char* code);
+#ifdef DEMO_MODE
+// plain sources next to the executable
+constexpr const char* chunkMode = "t";
+#else
+// luac -s output (see lua/compile.js): nothing to parse at startup, and a tampered blob can't smuggle in source
+constexpr const char* chunkMode = "b";
+#endif
+using Chunk = vector<unsigned char>;
+
+/// @brief Pushes the script as a function. Chunks carry a trailing zero (ReadFile, Decrypt) that isn't part of the script
+void LoadChunk(lua_State* L, const Chunk& chunk, const char* name);
+/// @brief Calls the function on top of the stack, leaving its results
+void _CallHandled(lua_State* L);
+/// @returns The boolean the function returned, false if it didn't
+bool CallHandled(lua_State* L);
+void _RunHandled(lua_State* L, const Chunk& chunk, const char* name);
+bool RunHandled(lua_State* L, const Chunk& chunk, const char* name);
 
 void HideConsoleWindow();
 
 vector<unsigned char> Decrypt(const char* data, size_t length);
 
-Config RunConfig(lua_State* L, char* code);
+Config RunConfig(lua_State* L, const Chunk& chunk);
 
 int wmain(int argc, wchar_t* argv[]) {
 #ifdef _WIN32
@@ -56,20 +72,18 @@ int wmain(int argc, wchar_t* argv[]) {
 #ifdef DEMO_MODE
   auto dir = GlobalHelpers::GetExecutableDirectory();
   auto dConfig = GlobalHelpers::ReadFile((dir / "0_Config.lua").string());
-  auto dJson = GlobalHelpers::ReadFile((dir / "1_json.lua").string());
   auto dStartup = GlobalHelpers::ReadFile((dir / "2_Startup.lua").string());
   auto dMainCycle = GlobalHelpers::ReadFile((dir / "3_MainCycle.lua").string());
   auto dRootCertificate = GlobalHelpers::ReadFile((dir / "root.crt").string());
 #else
   auto dConfig = Decrypt(script_0_Config, script_0_Config_len);
-  auto dJson = Decrypt(script_1_json, script_1_json_len);
   auto dStartup = Decrypt(script_2_Startup, script_2_Startup_len);
   auto dMainCycle = Decrypt(script_3_MainCycle, script_3_MainCycle_len);
   auto dRootCertificate = Decrypt(rootCertificate, rootCertificate_len);
 #endif
 
   L = luaL_newstate();
-  appConfig = RunConfig(L, (char*)dConfig.data());
+  appConfig = RunConfig(L, dConfig);
   Installer installer;
 #if !DEBUG
   if (!installer.HasPermissions())
@@ -109,23 +123,62 @@ int wmain(int argc, wchar_t* argv[]) {
     HideConsoleWindow();
 #endif
 
+  auto scriptsStart = chrono::steady_clock::now();
   luaL_openlibs(L);
   LuaFunctions::Register(L);
 
-  RunHandled(L, (char*)dJson.data());
-  RunHandled(L, (char*)dStartup.data());
+  RunHandled(L, dStartup, "2_Startup");
+  // compiled once: reconnects only call it again
+  LoadChunk(L, dMainCycle, "3_MainCycle");
+  int mainCycle = luaL_ref(L, LUA_REGISTRYINDEX);
+  auto scriptsUs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - scriptsStart).count();
+  Logger::Log(std::format("Startup scripts ready in {} us", scriptsUs), Logger::LOG_INFO);
+
+  processPool = new ProcessPool(4);
+  // the other commands run as coroutines of this one
+  scheduler = new Scheduler(L);
+  // concurrent commands run on states of their own, set up like this one
+  jobPool = new JobPool(std::clamp(thread::hardware_concurrency(), 1u, 4u), [&](lua_State* W) {
+    luaL_openlibs(W);
+    LuaFunctions::RegisterConcurrent(W);
+    _RunHandled(W, dConfig, "0_Config");
+    lua_pop(W, 1); // the config table
+    RunHandled(W, dStartup, "2_Startup");
+  });
+
+  // one trace across reconnects: a regression often shows up as a reconnect storm
+  std::unique_ptr<TraceRecorder> recorder;
+  if (!appConfig.tracePath.empty()) {
+    recorder = std::make_unique<TraceRecorder>(appConfig.tracePath, appConfig.tracePayloads);
+    if (!recorder->IsOk()) {
+      Logger::Log("Can't write trace " + appConfig.tracePath, Logger::LOG_ERROR);
+      recorder = nullptr;
+    }
+  }
 
   while (true) {
     try {
-      client = new TCPClient(appConfig.host, appConfig.port, TCPClient::RetryPolicy::THROW, dRootCertificate, DEBUG);
+      client = new TCPClient(appConfig.host, appConfig.port, TCPClient::RetryPolicy::THROW, dRootCertificate, DEBUG, appConfig.ktls);
+      client->SetRecorder(recorder.get());
       controller = new Controller();
-      bool exit = RunHandled(L, (char*)dMainCycle.data());
+      lua_rawgeti(L, LUA_REGISTRYINDEX, mainCycle);
+      bool exit = CallHandled(L);
       if (exit)
         break;
     }
     catch (exception e) {
       cout << e.what() << endl;
     }
+    jobPool->Discard();
+    scheduler->Discard(L);
+    // before Discard(): what they write as they end goes with the rest
+    LuaFunctions::Lua::Fs::StopWatches();
+    processPool->Discard();
+    LuaFunctions::OnDisconnect();
+    if (datagram) {
+      delete datagram;
+      datagram = nullptr;
+    }
     if (client) {
       delete client;
       client = nullptr;
@@ -136,9 +189,15 @@ int wmain(int argc, wchar_t* argv[]) {
     }
     this_thread::sleep_for(chrono::seconds(5));
   }
+  delete jobPool;
+  delete scheduler;
+  LuaFunctions::Lua::Fs::StopWatches();
+  delete processPool;
   lua_close(L);
 
   Gdiplus::GdiplusShutdown(gdiplusToken);
+  if (datagram)
+    delete datagram;
   if (client)
     delete client;
   if (controller)
@@ -146,25 +205,40 @@ int wmain(int argc, wchar_t* argv[]) {
   return 0;
 }
 
-void _RunHandled(lua_State* L, char* code) {
-  if (luaL_dostring(L, code) != LUA_OK) {
-    // Get the error message from the stack
-    const char* errorMsg = lua_tostring(L, -1);
-    std::cerr << "Lua Error: " << errorMsg << std::endl;
+static void ThrowLuaError(lua_State* L) {
+  // Get the error message from the stack
+  string errorMsg = lua_tostring(L, -1);
+  std::cerr << "Lua Error: " << errorMsg << std::endl;
 
-    // Pop the error message from the stack
-    lua_pop(L, 1);
-    throw runtime_error((string("Lua error: ") + errorMsg).c_str());
-  }
+  // Pop the error message from the stack
+  lua_pop(L, 1);
+  throw runtime_error("Lua error: " + errorMsg);
+}
+void LoadChunk(lua_State* L, const Chunk& chunk, const char* name) {
+  size_t size = chunk.empty() ? 0 : chunk.size() - 1;
+  if (luaL_loadbufferx(L, (const char*)chunk.data(), size, name, chunkMode) != LUA_OK)
+    ThrowLuaError(L);
+}
+void _CallHandled(lua_State* L) {
+  if (lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK)
+    ThrowLuaError(L);
 }
-bool RunHandled(lua_State* L, char* code) {
-  _RunHandled(L, code);
+bool CallHandled(lua_State* L) {
+  _CallHandled(L);
   if (!lua_isboolean(L, -1))
     return false;
   bool value = lua_toboolean(L, -1);
   lua_pop(L, 1);
   return value;
 }
+void _RunHandled(lua_State* L, const Chunk& chunk, const char* name) {
+  LoadChunk(L, chunk, name);
+  _CallHandled(L);
+}
+bool RunHandled(lua_State* L, const Chunk& chunk, const char* name) {
+  LoadChunk(L, chunk, name);
+  return CallHandled(L);
+}
 
 void HideConsoleWindow() {
 #ifdef _WIN32
@@ -179,13 +253,16 @@ vector<unsigned char> Decrypt(const char* data, size_t length) {
   auto decrypted = vector<unsigned char>(plusaes::get_padded_encrypted_size(length));
   unsigned long padded_size = 0;
   plusaes::decrypt_cbc((const unsigned char*)data, length, AES::key, AES::key_size, &AES::iv, decrypted.data(), decrypted.size(), &padded_size);
+  // exact size (bytecode has zeros of its own) plus the terminator ReadFile() adds
+  decrypted.resize(length - padded_size);
+  decrypted.push_back(0);
 
   return decrypted;
 }
 #endif
 
-Config RunConfig(lua_State* L, char* code) {
-  _RunHandled(L, code);
+Config RunConfig(lua_State* L, const Chunk& chunk) {
+  _RunHandled(L, chunk, "0_Config");
 
   Config config;
   // Ensure the Lua stack has the table (assumed to be at the top)
@@ -226,6 +303,20 @@ Config RunConfig(lua_State* L, char* code) {
   }
   lua_pop(L, 1); // Pop the 'hideWindow' value
 
+  // Get 'ktls' field (optional)
+  lua_getfield(L, -1, "ktls");
+  config.ktls = lua_isboolean(L, -1) && lua_toboolean(L, -1);
+  lua_pop(L, 1); // Pop the 'ktls' value
+
+  // Get 'trace' field (optional)
+  lua_getfield(L, -1, "trace");
+  if (lua_isstring(L, -1))
+    config.tracePath = lua_tostring(L, -1);
+  lua_pop(L, 1); // Pop the 'trace' value
+  lua_getfield(L, -1, "tracePayloads");
+  config.tracePayloads = lua_isboolean(L, -1) && lua_toboolean(L, -1);
+  lua_pop(L, 1); // Pop the 'tracePayloads' value
+
   // Get 'appName' field
   lua_getfield(L, -1, "appName");
   if (lua_isstring(L, -1)) {
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/// @brief Agent protocol constants, mirrors ACTIONS in src/lua/2_Startup.lua and Action in nsv common-types.ts
+namespace Protocol {
+  enum Action : uint8_t { IDLE = 0, FEEDBACK, FILE, SCREENCAST, HANDSHAKE, STATS, BATCH, STREAM };
+  /// @brief Set on the action byte of deflated messages (see src/Compression.h)
+  constexpr uint8_t action_compressed = 0x80;
+  constexpr uint8_t action_mask = 0x7F;
+  constexpr const char* action_names[] = { "IDLE", "FEEDBACK", "FILE", "SCREENCAST", "HANDSHAKE", "STATS", "BATCH", "STREAM" };
+  constexpr uint8_t action_count = sizeof(action_names) / sizeof(*action_names);
+  /// @brief Server replies carry no action byte; an empty reply is a single zero byte
+  constexpr char empty_reply[] = { 0 };
+
+  /// @brief BATCH envelope (nsv protocol/Batch.ts): parts of [u8 action][u32 command id][u32 size][body] from the agent, commands of
+  /// [u32 command id][u8 flags][u32 size][code] in the reply
+  constexpr uint32_t batch_no_command = UINT32_MAX;
+  constexpr size_t batch_part_header_size = 1 + 4 + 4;
+  constexpr size_t batch_command_header_size = 4 + 1 + 4;
+  /// @brief The command doesn't depend on the ones before it: the agent may run it on a worker and answer out of order
+  constexpr uint8_t command_concurrent = 1;
+  /// @brief Body is [u32 prepared id][chunk]: the agent keeps it compiled for the connection instead of running it
+  constexpr uint8_t command_prepare = 2;
+  /// @brief Body is [u32 prepared id][arguments]: runs that chunk with them
+  constexpr uint8_t command_invoke = 4;
+  /// @brief STREAM: output of a background process, [u8 kind][data] in a batch part whose command id is the job id, [u32 job id][u8 kind]
+  /// [data] standalone. EXIT data is the i32 exit code (src/ProcessPool.h)
+  enum StreamKind : uint8_t { STREAM_OUTPUT = 0, STREAM_EXIT, STREAM_CANCELLED };
+
+  inline void AppendBatchPart(std::string& out, uint8_t action, uint32_t commandId, const std::string& body) {
+    uint32_t size = (uint32_t)body.size();
+    out.push_back((char)action);
+    out.append(reinterpret_cast<const char*>(&commandId), sizeof(commandId));
+    out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    out += body;
+  }
+  inline void AppendBatchCommand(std::string& out, uint32_t commandId, const std::string& code, uint8_t flags = 0) {
+    uint32_t size = (uint32_t)code.size();
+    out.append(reinterpret_cast<const char*>(&commandId), sizeof(commandId));
+    out.push_back((char)flags);
+    out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    out += code;
+  }
+  /// @brief Calls `onPart(action, commandId, body, size)` for every part of an envelope
+  /// @returns false if the envelope is truncated
+  template <typename F>
+  bool ForEachBatchPart(const char* data, size_t size, F&& onPart) {
+    size_t offset = 0;
+    while (offset < size) {
+      if (size - offset < batch_part_header_size)
+        return false;
+      uint32_t commandId, partSize;
+      memcpy(&commandId, data + offset + 1, sizeof(commandId));
+      memcpy(&partSize, data + offset + 5, sizeof(partSize));
+      if (size - offset - batch_part_header_size < partSize)
+        return false;
+      onPart((uint8_t)data[offset], commandId, data + offset + batch_part_header_size, (size_t)partSize);
+      offset += batch_part_header_size + partSize;
+    }
+    return true;
+  }
+  /// @brief Calls `onCommand(commandId, flags, code, size)` for every command of a batch reply (none for the empty reply)
+  template <typename F>
+  void ForEachBatchCommand(const char* data, size_t size, F&& onCommand) {
+    size_t offset = 0;
+    while (size - offset >= batch_command_header_size) {
+      uint32_t commandId, codeSize;
+      memcpy(&commandId, data + offset, sizeof(commandId));
+      uint8_t flags = (uint8_t)data[offset + 4];
+      memcpy(&codeSize, data + offset + 5, sizeof(codeSize));
+      offset += batch_command_header_size;
+      codeSize = (uint32_t)(codeSize < size - offset ? codeSize : size - offset);
+      onCommand(commandId, flags, data + offset, (size_t)codeSize);
+      offset += codeSize;
+    }
+  }
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+/// @brief Latency samples of one kind, in milliseconds. Not thread-safe: keep one per thread and Merge() at the end
+struct Samples {
+  std::vector<double> values;
+  void Add(double ms) { values.push_back(ms); }
+  void Add(std::chrono::steady_clock::time_point since) { Add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count()); }
+  void Merge(const Samples& other) { values.insert(values.end(), other.values.begin(), other.values.end()); }
+  void Print(const char* name) {
+    if (values.empty()) {
+      printf("%-12s no samples\n", name);
+      return;
+    }
+    std::sort(values.begin(), values.end());
+    auto at = [&](double p) { return values[std::min(values.size() - 1, (size_t)(p * values.size()))]; };
+    printf("%-12s n %-9zu p50 %8.2f  p90 %8.2f  p99 %8.2f  p99.9 %8.2f  max %8.2f ms\n", name, values.size(), at(0.5), at(0.9), at(0.99),
+           at(0.999), values.back());
+  }
+};
@@ -0,0 +1,177 @@
+// Delta transfer benchmark: the agent's rsync-style sync (src/Delta.cpp) on synthetic edits of one basis file. Each pattern is signed,
+// diffed and patched in memory, the result is compared with the edited file byte for byte, and the bytes that didn't have to be sent
+// (signature + delta against the whole file) are reported with the time each step took
+#include "../../src/Delta.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Settings {
+  size_t sizeMb = 64;
+  uint64_t seed = 1;
+  uint32_t blockSize = 0;
+};
+
+struct Pattern {
+  const char* name;
+  function<string(const string& basis, mt19937_64& random)> edit;
+};
+
+static string RandomBytes(mt19937_64& random, size_t size) {
+  string data(size, '\0');
+  for (size_t i = 0; i < size; i += 8) {
+    uint64_t value = random();
+    memcpy(&data[i], &value, min<size_t>(8, size - i));
+  }
+  return data;
+}
+/// @brief Half text-like lines, half random: what a log or a build output looks like to the checksums
+static string MakeBasis(mt19937_64& random, size_t size) {
+  static const char* words[] = { "agent", "connected", "listing", "C:/Users/user/Documents", "size", "0x7ff3", "ok", "retry", "frame" };
+  string data;
+  data.reserve(size + 64);
+  while (data.size() < size) {
+    if (random() % 2)
+      data += RandomBytes(random, 256 + random() % 4096);
+    else
+      for (int line = 0; line < 64; line++) {
+        data += to_string(random() % 100000);
+        for (int word = 0; word < 6; word++)
+          (data += ' ') += words[random() % std::size(words)];
+        data += '\n';
+      }
+  }
+  data.resize(size);
+  return data;
+}
+
+static const Pattern patterns[] = {
+  { "identical", [](const string& basis, mt19937_64&) { return basis; } },
+  { "append 64K", [](const string& basis, mt19937_64& random) { return basis + RandomBytes(random, 64 * 1024); } },
+  { "truncate 1/3", [](const string& basis, mt19937_64&) { return basis.substr(0, basis.size() * 2 / 3); } },
+  { "insert at start", [](const string& basis, mt19937_64& random) { return RandomBytes(random, 100) + basis; } },
+  { "delete 4K middle", [](const string& basis, mt19937_64&) { return basis.substr(0, basis.size() / 2) + basis.substr(basis.size() / 2 + 4096); } },
+  { "16B every 1M",
+    [](const string& basis, mt19937_64& random) {
+      string target = basis;
+      for (size_t offset = 12345; offset + 16 < target.size(); offset += 1024 * 1024)
+        target.replace(offset, 16, RandomBytes(random, 16));
+      return target;
+    } },
+  { "100 ins/del",
+    [](const string& basis, mt19937_64& random) {
+      string target = basis;
+      for (int i = 0; i < 100 && target.size() > 1024; i++) {
+        size_t offset = random() % (target.size() - 1024), size = 1 + random() % 512;
+        if (i % 2)
+          target.insert(offset, RandomBytes(random, size));
+        else
+          target.erase(offset, size);
+      }
+      return target;
+    } },
+  { "reordered",
+    [](const string& basis, mt19937_64&) {
+      size_t quarter = basis.size() / 4;
+      return basis.substr(2 * quarter) + basis.substr(quarter, quarter) + basis.substr(0, quarter);
+    } },
+  { "unrelated", [](const string& basis, mt19937_64& random) { return RandomBytes(random, basis.size()); } },
+  { "empty", [](const string&, mt19937_64&) { return string(); } },
+};
+
+static double Milliseconds(Clock::time_point since) {
+  return chrono::duration<double, milli>(Clock::now() - since).count();
+}
+static string Megabytes(uint64_t bytes) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.2f MB", bytes / 1048576.0);
+  return text;
+}
+
+/// @returns false if the patched file isn't the target
+static bool Run(const char* name, const string& basis, const string& target, uint32_t blockSize) {
+  istringstream basisStream(basis), targetStream(target);
+  ostringstream deltaStream, resultStream;
+  Delta::Stats stats;
+
+  auto start = Clock::now();
+  string signature = Delta::Sign(basisStream, basis.size(), blockSize);
+  double sign = Milliseconds(start);
+  start = Clock::now();
+  if (!Delta::Diff(signature, targetStream, deltaStream, &stats)) {
+    cerr << name << ": diff failed" << endl;
+    return false;
+  }
+  double diff = Milliseconds(start);
+  string delta = deltaStream.str();
+  basisStream.clear();
+  start = Clock::now();
+  string error = Delta::Patch(basisStream, delta.data(), delta.size(), resultStream);
+  double patch = Milliseconds(start);
+  if (!error.empty() || resultStream.str() != target) {
+    cerr << name << ": the patched file differs" << (error.empty() ? "" : ": ") << error << endl;
+    return false;
+  }
+  uint64_t sent = signature.size() + delta.size();
+  double saved = target.empty() ? 0 : 100.0 * (1.0 - (double)sent / target.size());
+  printf("%-17s target %10s  signature %10s  delta %10s  copied %10s  literal %10s  saved %6.2f%%  sign %7.1f  diff %7.1f  patch %7.1f ms\n",
+         name, Megabytes(target.size()).c_str(), Megabytes(signature.size()).c_str(), Megabytes(delta.size()).c_str(),
+         Megabytes(stats.copied).c_str(), Megabytes(stats.literal).c_str(), saved, sign, diff, patch);
+  return true;
+}
+
+static void PrintUsage() {
+  puts("Usage: rut-deltabench [--size-mb 64] [--seed 1] [--block 0]\n"
+       "  --block  block size, 0 = as the agent picks it (about the square root of the basis)");
+}
+static bool ParseArgs(int argc, char** argv, Settings& s) {
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    string v = argv[++i];
+    if (arg == "--size-mb")
+      s.sizeMb = stoul(v);
+    else if (arg == "--seed")
+      s.seed = stoull(v);
+    else if (arg == "--block")
+      s.blockSize = (uint32_t)stoul(v);
+    else
+      return false;
+  }
+  return s.sizeMb > 0;
+}
+
+int main(int argc, char** argv) {
+  Settings settings;
+  try {
+    if (!ParseArgs(argc, argv, settings)) {
+      PrintUsage();
+      return 1;
+    }
+  }
+  catch (exception&) {
+    PrintUsage();
+    return 1;
+  }
+
+  mt19937_64 random(settings.seed);
+  string basis = MakeBasis(random, settings.sizeMb * 1024 * 1024);
+  uint32_t blockSize = settings.blockSize ? settings.blockSize : Delta::BlockSize(basis.size());
+  printf("basis %s, blocks of %u bytes\n", Megabytes(basis.size()).c_str(), blockSize);
+  bool ok = true;
+  for (const auto& pattern : patterns)
+    ok &= Run(pattern.name, basis, pattern.edit(basis, random), blockSize);
+  // a file that isn't there yet: the basis is empty, everything is literal
+  ok &= Run("new file", string(), basis, 0);
+  return ok ? 0 : 1;
+}
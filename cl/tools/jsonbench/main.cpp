@@ -0,0 +1,228 @@
+// JSON benchmark: the agent's native JSON (src/Json.cpp) against json.lua, the pure-Lua module it replaced (kept next to this file).
+// Both get the same listing-shaped data: one encode per entry, the way ListDirectory prints it, a whole document, and its decode.
+// Outputs are compared first: the native module has to produce the same text and the same errors
+#include "../../src/Json.h"
+#include <Samples.h>
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Settings {
+  string reference = "../jsonbench/json.lua";
+  size_t entries = 2000;
+  size_t iterations = 200;
+};
+
+// ENTRIES: what ListDirectory/ListDisks produce, with escapes and non-ASCII names mixed in
+static const char* workload = R"(
+ENTRIES = {}
+for i = 1, ENTRY_COUNT do
+	ENTRIES[i] = {
+		name = (i % 5 == 0 and 'Отчёт "' .. i .. '"' or 'file_' .. i) .. (i % 7 == 0 and '' or '.txt'),
+		path = 'C:/Users/user/Documents\\' .. i,
+		size = i * 4099,
+		modified = 1700000000 + i / 4,
+		isDirectory = i % 7 == 0,
+		tags = i % 3 == 0 and { 'a\tb', 'line\n', i } or {},
+	}
+end
+function EncodeEntries(json)
+	local out = {}
+	for i = 1, #ENTRIES do
+		out[i] = json.encode(ENTRIES[i])
+	end
+	return table.concat(out, '\n')
+end
+function EncodeDocument(json)
+	return json.encode({ hostname = 'HOST', entries = ENTRIES, ok = true })
+end
+function DecodeDocument(json, text)
+	return json.decode(text)
+end
+function Equal(a, b)
+	if type(a) ~= 'table' or type(b) ~= 'table' then
+		return a == b and math.type(a) == math.type(b)
+	end
+	for k, v in pairs(a) do
+		if not Equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+-- the error json.lua raises, without its position in the source
+function ErrorOf(json, method, value)
+	local ok, message = pcall(json[method], value)
+	return ok and '' or tostring(message):gsub('^[^:]*:%d+: ', '')
+end
+)";
+
+static const char* malformed[] = { "", "[1,2", "{\"a\" 1}", "{1:2}", "[tru]", "\"abc", "\"a\\x\"", "\"\\ud800\"", "[1] x", "-", "01e",
+                                   "\"\x01\"", "{\"a\":[1,{\"b\":nul}]}", "[1,]", "\"\\u00e9\\ud83d\\ude00\"", "  \n [\n 1,\n 2 ]\n x" };
+
+/// @brief Calls the global `function` with the module and `arg`, leaving its result on the stack
+static bool Call(lua_State* L, const char* function, const char* module, const string* arg = nullptr) {
+  lua_getglobal(L, function);
+  lua_getglobal(L, module);
+  int args = 1;
+  if (arg) {
+    lua_pushlstring(L, arg->data(), arg->size());
+    args++;
+  }
+  if (lua_pcall(L, args, 1, 0) != LUA_OK) {
+    cerr << function << " (" << module << "): " << lua_tostring(L, -1) << endl;
+    return false;
+  }
+  return true;
+}
+
+static string CallString(lua_State* L, const char* function, const char* module, const string* arg = nullptr) {
+  if (!Call(L, function, module, arg))
+    return "";
+  string result = lua_tostring(L, -1);
+  lua_pop(L, 1);
+  return result;
+}
+
+static string ErrorOf(lua_State* L, const char* module, const char* method, const string& value) {
+  lua_getglobal(L, "ErrorOf");
+  lua_getglobal(L, module);
+  lua_pushstring(L, method);
+  lua_pushlstring(L, value.data(), value.size());
+  lua_pcall(L, 3, 1, 0);
+  string result = lua_tostring(L, -1);
+  lua_pop(L, 1);
+  return result;
+}
+
+/// @returns false if the native module doesn't behave like json.lua
+static bool Compare(lua_State* L) {
+  bool same = true;
+  string entries = CallString(L, "EncodeEntries", "LUA_JSON"), document = CallString(L, "EncodeDocument", "LUA_JSON");
+  if (entries != CallString(L, "EncodeEntries", "JSON") || document != CallString(L, "EncodeDocument", "JSON")) {
+    cerr << "encode differs" << endl;
+    same = false;
+  }
+  // the same tables, down to integer/float subtypes
+  lua_getglobal(L, "Equal");
+  if (!Call(L, "DecodeDocument", "LUA_JSON", &document) || !Call(L, "DecodeDocument", "JSON", &document) || lua_pcall(L, 2, 1, 0) != LUA_OK ||
+      !lua_toboolean(L, -1)) {
+    cerr << "decode differs" << endl;
+    same = false;
+  }
+  lua_settop(L, 0);
+  for (const char* text : malformed) {
+    string reference = ErrorOf(L, "LUA_JSON", "decode", text), native = ErrorOf(L, "JSON", "decode", text);
+    if (reference != native) {
+      cerr << "decode '" << text << "': json.lua says '" << reference << "', native '" << native << "'" << endl;
+      same = false;
+    }
+  }
+  return same;
+}
+
+static void PrintUsage() {
+  puts("Usage: rut-jsonbench [--reference ../jsonbench/json.lua] [--entries 2000] [--iterations 200]\n"
+       "  --reference  the pure-Lua json.lua to compare against");
+}
+static bool ParseArgs(int argc, char** argv, Settings& s) {
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    string v = argv[++i];
+    if (arg == "--reference")
+      s.reference = v;
+    else if (arg == "--entries")
+      s.entries = stoul(v);
+    else if (arg == "--iterations")
+      s.iterations = stoul(v);
+    else
+      return false;
+  }
+  return s.entries > 0 && s.iterations > 0;
+}
+
+int main(int argc, char** argv) {
+  Settings settings;
+  try {
+    if (!ParseArgs(argc, argv, settings)) {
+      PrintUsage();
+      return 1;
+    }
+  }
+  catch (exception&) {
+    PrintUsage();
+    return 1;
+  }
+
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  // json.lua sets the global JSON: kept as LUA_JSON, the native module takes its place as in the agent
+  if (luaL_dofile(L, settings.reference.c_str()) != LUA_OK) {
+    cerr << lua_tostring(L, -1) << endl;
+    return 1;
+  }
+  lua_getglobal(L, "JSON");
+  lua_setglobal(L, "LUA_JSON");
+  lua_newtable(L);
+  lua_pushcfunction(L, Json::CEncode);
+  lua_setfield(L, -2, "encode");
+  lua_pushcfunction(L, Json::CDecode);
+  lua_setfield(L, -2, "decode");
+  lua_setglobal(L, "JSON");
+  lua_pushinteger(L, (lua_Integer)settings.entries);
+  lua_setglobal(L, "ENTRY_COUNT");
+  if (luaL_dostring(L, workload) != LUA_OK) {
+    cerr << lua_tostring(L, -1) << endl;
+    return 1;
+  }
+  if (!Compare(L))
+    return 1;
+
+  string document = CallString(L, "EncodeDocument", "JSON");
+  struct Run {
+    const char* name;
+    const char* module;
+    const char* function;
+    const string* arg;
+    Samples samples;
+  };
+  Run runs[] = {
+    { "lua entries", "LUA_JSON", "EncodeEntries", nullptr, {} },
+    { "native", "JSON", "EncodeEntries", nullptr, {} },
+    { "lua encode", "LUA_JSON", "EncodeDocument", nullptr, {} },
+    { "native", "JSON", "EncodeDocument", nullptr, {} },
+    { "lua decode", "LUA_JSON", "DecodeDocument", &document, {} },
+    { "native", "JSON", "DecodeDocument", &document, {} },
+  };
+  // interleaved, so both see the same cache and frequency conditions
+  for (size_t i = 0; i < settings.iterations; i++)
+    for (auto& run : runs) {
+      auto start = Clock::now();
+      if (!Call(L, run.function, run.module, run.arg))
+        return 1;
+      run.samples.Add(start);
+      lua_settop(L, 0);
+    }
+
+  printf("%zu entries, document %zu bytes, %zu runs each\n", settings.entries, document.size(), settings.iterations);
+  for (auto& run : runs)
+    run.samples.Print(run.name);
+  lua_close(L);
+  return 0;
+}
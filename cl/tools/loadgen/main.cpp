@@ -0,0 +1,402 @@
+// Load generator: thousands of simulated agents on a few event loops. Each agent follows the main cycle of src/lua/3_MainCycle.lua:
+// HANDSHAKE, then IDLE polls (300 ms apart when idle, 50 ms after a command) answered with synthetic FEEDBACK, plus optional
+// SCREENCAST frames, FILE uploads and STATS at fixed rates. Reports latency percentiles and what the server sustained
+#include <Protocol.h>
+#include <Samples.h>
+#include <foresteamnd/FramedConnection>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Settings {
+  string host = "127.0.0.1";
+  uint16_t port = 1337;
+  string caPath;
+  size_t agents = 100;
+  size_t threads = 0;
+  double durationS = 30;
+  double rampS = 5;
+  int idleMs = 300;
+  int busyMs = 50;
+  size_t feedbackBytes = 256;
+  double screencastFps = 0;
+  size_t screencastBytes = 60 * 1024;
+  double fileEveryS = 0;
+  size_t fileBytes = 1024 * 1024;
+  int statsMs = 5000;
+  int reconnectMs = 5000;
+  bool batch = false;
+};
+
+/// @brief Live counters, read by the reporter while loops run
+struct Totals {
+  atomic<uint64_t> connected { 0 };
+  atomic<uint64_t> disconnects { 0 };
+  atomic<uint64_t> failedConnects { 0 };
+  atomic<uint64_t> replies { 0 };
+  atomic<uint64_t> commands { 0 };
+  atomic<uint64_t> messagesSent { 0 };
+  atomic<uint64_t> bytesSent { 0 };
+  atomic<uint64_t> bytesReceived { 0 };
+};
+
+struct Worker;
+
+/// @brief One simulated agent. Lives in its worker's loop thread
+class Agent {
+public:
+  Agent(Worker& worker, size_t index) : _worker(worker), _index(index) {}
+  void Connect();
+  void Stop();
+
+private:
+  enum State { DISCONNECTED, HANDSHAKING, POLLING, WAITING_REPLY };
+  enum TimerSlot { POLL_TIMER, RECONNECT_TIMER, SCREENCAST_TIMER, FILE_TIMER, STATS_TIMER, TIMER_SLOTS };
+  Worker& _worker;
+  size_t _index;
+  State _state = DISCONNECTED;
+  shared_ptr<FramedConnection> _connection;
+  Clock::time_point _connectAt, _idleSentAt;
+  uint64_t _timers[TIMER_SLOTS] = {};
+  /// @brief Negotiated in the handshake: FEEDBACK/SCREENCAST/STATS wait here and go out with the next IDLE as one BATCH
+  bool _batching = false;
+  string _batch;
+
+  void OnMessage(string&& payload);
+  void OnClose();
+  void SendIdle();
+  void Send(Protocol::Action action, const string& body, uint32_t commandId = Protocol::batch_no_command);
+  /// @brief (Re)arms the timer in `slot`
+  void SetTimer(TimerSlot slot, Clock::duration delay, EventLoop::Task task);
+  /// @brief Runs `task` every `period` while connected
+  void Every(TimerSlot slot, Clock::duration period, void (Agent::*task)());
+  void Schedule(TimerSlot slot, Clock::duration delay, Clock::duration period, void (Agent::*task)());
+  void SendScreencast();
+  void SendFile();
+  void SendStats();
+  void CancelTimers();
+};
+
+struct Worker {
+  const Settings& settings;
+  Totals& totals;
+  SSL_CTX* tls;
+  const string& screencast;
+  const string& file;
+  const string& feedback;
+  EventLoop loop;
+  vector<unique_ptr<Agent>> agents;
+  Samples idle, handshake;
+  thread runner;
+  bool stopping = false;
+
+  Worker(const Settings& settings, Totals& totals, SSL_CTX* tls, const string& screencast, const string& file, const string& feedback)
+      : settings(settings), totals(totals), tls(tls), screencast(screencast), file(file), feedback(feedback) {}
+};
+
+void Agent::Connect() {
+  if (_worker.stopping)
+    return;
+  _connection = FramedConnection::Connect(_worker.loop, _worker.settings.host, _worker.settings.port, _worker.tls);
+  if (!_connection) {
+    _worker.totals.failedConnects++;
+    SetTimer(RECONNECT_TIMER, chrono::milliseconds(_worker.settings.reconnectMs), [this] { Connect(); });
+    return;
+  }
+  _state = HANDSHAKING;
+  _connectAt = Clock::now();
+  char uuid[40];
+  snprintf(uuid, sizeof(uuid), "00000000-0000-4000-8000-%012zu", _index);
+  _batching = false;
+  _batch.clear();
+  Send(Protocol::HANDSHAKE, string("{\"hostname\":\"loadgen-") + to_string(_index) + "\",\"timestampMs\":" +
+                                to_string(chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count()) +
+                                ",\"username\":\"loadgen\",\"hwid\":\"loadgen-" + to_string(_index) + "\",\"uuid\":\"" + uuid + "\"" +
+                                (_worker.settings.batch ? ",\"batch\":true}" : "}"));
+  _connection->Start([this](FramedConnection&, string&& payload) { OnMessage(move(payload)); }, [this](FramedConnection&) { OnClose(); });
+}
+void Agent::Stop() {
+  CancelTimers();
+  if (_connection)
+    _connection->Close();
+}
+
+void Agent::OnMessage(string&& payload) {
+  _worker.totals.bytesReceived += sizeof(uint64_t) + payload.size();
+  const Settings& settings = _worker.settings;
+  if (_state == HANDSHAKING) {
+    _worker.handshake.Add(_connectAt);
+    _worker.totals.connected++;
+    _state = POLLING;
+    _batching = settings.batch && payload.find("\"batch\":true") != string::npos;
+    if (settings.screencastFps > 0)
+      Every(SCREENCAST_TIMER, chrono::duration_cast<Clock::duration>(chrono::duration<double>(1 / settings.screencastFps)), &Agent::SendScreencast);
+    if (settings.fileEveryS > 0)
+      Every(FILE_TIMER, chrono::duration_cast<Clock::duration>(chrono::duration<double>(settings.fileEveryS)), &Agent::SendFile);
+    if (settings.statsMs > 0)
+      Every(STATS_TIMER, chrono::milliseconds(settings.statsMs), &Agent::SendStats);
+    SendIdle();
+    return;
+  }
+  if (_state != WAITING_REPLY)
+    return;
+  _worker.idle.Add(_idleSentAt);
+  _worker.totals.replies++;
+  _state = POLLING;
+  bool empty = payload.empty() || (payload.size() == 1 && !payload[0]);
+  if (empty)
+    ;
+  else if (_batching)
+    Protocol::ForEachBatchCommand(payload.data(), payload.size(), [this](uint32_t commandId, uint8_t, const char*, size_t) {
+      _worker.totals.commands++;
+      Send(Protocol::FEEDBACK, _worker.feedback, commandId);
+    });
+  else {
+    _worker.totals.commands++;
+    Send(Protocol::FEEDBACK, _worker.feedback);
+  }
+  SetTimer(POLL_TIMER, chrono::milliseconds(empty ? settings.idleMs : settings.busyMs), [this] { SendIdle(); });
+}
+void Agent::OnClose() {
+  bool wasConnected = _state == POLLING || _state == WAITING_REPLY;
+  if (wasConnected) {
+    _worker.totals.connected--;
+    _worker.totals.disconnects++;
+  }
+  else if (_state == HANDSHAKING)
+    _worker.totals.failedConnects++;
+  _state = DISCONNECTED;
+  CancelTimers();
+  if (!_worker.stopping)
+    SetTimer(RECONNECT_TIMER, chrono::milliseconds(_worker.settings.reconnectMs), [this] { Connect(); });
+}
+
+void Agent::Send(Protocol::Action action, const string& body, uint32_t commandId) {
+  if (_batching && action != Protocol::FILE) {
+    Protocol::AppendBatchPart(_batch, action, commandId, body);
+    if (action != Protocol::IDLE)
+      return;
+    // the IDLE closes the tick
+    _worker.totals.messagesSent++;
+    _worker.totals.bytesSent += sizeof(uint64_t) + 1 + _batch.size();
+    _connection->Send(Protocol::BATCH, _batch.data(), _batch.size());
+    _batch.clear();
+    return;
+  }
+  _worker.totals.messagesSent++;
+  _worker.totals.bytesSent += sizeof(uint64_t) + 1 + body.size();
+  _connection->Send(action, body.data(), body.size());
+}
+void Agent::SendIdle() {
+  if (_state != POLLING)
+    return;
+  _idleSentAt = Clock::now();
+  _state = WAITING_REPLY;
+  Send(Protocol::IDLE, "");
+}
+void Agent::SetTimer(TimerSlot slot, Clock::duration delay, EventLoop::Task task) {
+  if (_timers[slot])
+    _worker.loop.CancelTimer(_timers[slot]);
+  _timers[slot] = _worker.loop.AddTimer(delay, move(task));
+}
+void Agent::Every(TimerSlot slot, Clock::duration period, void (Agent::*task)()) {
+  // stagger the first run so agents connected in the same tick don't fire together
+  Schedule(slot, chrono::duration_cast<Clock::duration>(period * ((double)(_index % 97 + 1) / 97)), period, task);
+}
+void Agent::Schedule(TimerSlot slot, Clock::duration delay, Clock::duration period, void (Agent::*task)()) {
+  SetTimer(slot, delay, [this, slot, period, task] {
+    _timers[slot] = 0;
+    if (_state != POLLING && _state != WAITING_REPLY)
+      return;
+    (this->*task)();
+    Schedule(slot, period, period, task);
+  });
+}
+void Agent::SendScreencast() { Send(Protocol::SCREENCAST, _worker.screencast); }
+void Agent::SendFile() { Send(Protocol::FILE, _worker.file); }
+void Agent::SendStats() { Send(Protocol::STATS, "{\"rttMs\":0,\"rttVarMs\":0,\"sendBytesPerSec\":0,\"receiveBytesPerSec\":0}"); }
+void Agent::CancelTimers() {
+  for (auto& id : _timers) {
+    if (id)
+      _worker.loop.CancelTimer(id);
+    id = 0;
+  }
+}
+
+static void PrintUsage() {
+  puts("Usage: rut-loadgen [--host 127.0.0.1] [--port 1337] [--ca root.crt] [--agents 100] [--threads N] [--duration 30] [--ramp 5]\n"
+       "                   [--idle-ms 300] [--busy-ms 50] [--feedback-bytes 256] [--screencast-fps 0] [--screencast-bytes 61440]\n"
+       "                   [--file-every 0] [--file-bytes 1048576] [--stats-ms 5000] [--reconnect-ms 5000] [--batch]\n"
+       "  --ca          root certificate to verify the server with; plain TCP without it\n"
+       "  --ramp        seconds over which agents connect\n"
+       "  --file-every  seconds between unsolicited FILE uploads per agent (rut-refserver accepts them, the Electron server doesn't)\n"
+       "  --batch       ask for the BATCH envelope: feedback, frames and stats ride with the next IDLE");
+}
+static bool ParseArgs(int argc, char** argv, Settings& s) {
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--batch") {
+      s.batch = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      return false;
+    string v = argv[++i];
+    if (arg == "--host")
+      s.host = v;
+    else if (arg == "--port")
+      s.port = (uint16_t)stoi(v);
+    else if (arg == "--ca")
+      s.caPath = v;
+    else if (arg == "--agents")
+      s.agents = stoul(v);
+    else if (arg == "--threads")
+      s.threads = stoul(v);
+    else if (arg == "--duration")
+      s.durationS = stod(v);
+    else if (arg == "--ramp")
+      s.rampS = stod(v);
+    else if (arg == "--idle-ms")
+      s.idleMs = stoi(v);
+    else if (arg == "--busy-ms")
+      s.busyMs = stoi(v);
+    else if (arg == "--feedback-bytes")
+      s.feedbackBytes = stoul(v);
+    else if (arg == "--screencast-fps")
+      s.screencastFps = stod(v);
+    else if (arg == "--screencast-bytes")
+      s.screencastBytes = stoul(v);
+    else if (arg == "--file-every")
+      s.fileEveryS = stod(v);
+    else if (arg == "--file-bytes")
+      s.fileBytes = stoul(v);
+    else if (arg == "--stats-ms")
+      s.statsMs = stoi(v);
+    else if (arg == "--reconnect-ms")
+      s.reconnectMs = stoi(v);
+    else
+      return false;
+  }
+  return true;
+}
+
+/// @brief Incompressible filler, so server-side compression or caching can't flatter the numbers
+static string RandomBytes(size_t size, mt19937& random) {
+  string bytes(size, '\0');
+  for (auto& c : bytes)
+    c = (char)random();
+  return bytes;
+}
+
+static atomic<bool> interrupted { false };
+
+int main(int argc, char** argv) {
+  Settings settings;
+  try {
+    if (!ParseArgs(argc, argv, settings)) {
+      PrintUsage();
+      return 1;
+    }
+  }
+  catch (const exception&) {
+    PrintUsage();
+    return 1;
+  }
+  if (!settings.threads)
+    settings.threads = max(1u, thread::hardware_concurrency());
+  settings.threads = min(settings.threads, max<size_t>(1, settings.agents));
+
+  SSL_CTX* tls = nullptr;
+  if (!settings.caPath.empty()) {
+    tls = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_min_proto_version(tls, TLS1_3_VERSION);
+    if (SSL_CTX_load_verify_locations(tls, settings.caPath.c_str(), nullptr) != 1) {
+      cerr << "Can't load " << settings.caPath << endl;
+      SSL_CTX_free(tls);
+      return 1;
+    }
+    SSL_CTX_set_verify(tls, SSL_VERIFY_PEER, nullptr);
+  }
+
+  mt19937 random(1337);
+  string screencast = RandomBytes(settings.screencastBytes, random);
+  string file = RandomBytes(settings.fileBytes, random);
+  string feedback(settings.feedbackBytes, 'f');
+
+  Totals totals;
+  vector<unique_ptr<Worker>> workers;
+  for (size_t i = 0; i < settings.threads; i++)
+    workers.push_back(make_unique<Worker>(settings, totals, tls, screencast, file, feedback));
+  for (size_t i = 0; i < settings.agents; i++) {
+    Worker& worker = *workers[i % workers.size()];
+    worker.agents.push_back(make_unique<Agent>(worker, i));
+    Agent* agent = worker.agents.back().get();
+    auto delay = chrono::duration<double>(settings.rampS * i / max<size_t>(1, settings.agents));
+    worker.loop.AddTimer(chrono::duration_cast<Clock::duration>(delay), [agent] { agent->Connect(); });
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, [](int) { interrupted = true; });
+  auto start = Clock::now();
+  for (auto& worker : workers) {
+    Worker* raw = worker.get();
+    raw->runner = thread([raw] { raw->loop.Run(); });
+  }
+
+  uint64_t lastReplies = 0, lastSent = 0, lastReceived = 0;
+  auto lastReport = start;
+  while (!interrupted && Clock::now() - start < chrono::duration<double>(settings.durationS)) {
+    this_thread::sleep_for(chrono::milliseconds(100));
+    auto now = Clock::now();
+    double seconds = chrono::duration<double>(now - lastReport).count();
+    if (seconds < 1)
+      continue;
+    uint64_t replies = totals.replies, sent = totals.bytesSent, received = totals.bytesReceived;
+    printf("agents %llu/%zu  polls/s %.0f  up %.2f MB/s  down %.2f MB/s  disconnects %llu  failed %llu\n",
+           (unsigned long long)totals.connected.load(), settings.agents, (replies - lastReplies) / seconds, (sent - lastSent) / seconds / 1e6,
+           (received - lastReceived) / seconds / 1e6, (unsigned long long)totals.disconnects.load(), (unsigned long long)totals.failedConnects.load());
+    fflush(stdout);
+    lastReplies = replies;
+    lastSent = sent;
+    lastReceived = received;
+    lastReport = now;
+  }
+  double elapsed = chrono::duration<double>(Clock::now() - start).count();
+
+  for (auto& worker : workers) {
+    Worker* raw = worker.get();
+    raw->loop.Post([raw] {
+      raw->stopping = true;
+      for (auto& agent : raw->agents)
+        agent->Stop();
+      raw->loop.Stop();
+    });
+  }
+  Samples idle, handshake;
+  for (auto& worker : workers) {
+    worker->runner.join();
+    idle.Merge(worker->idle);
+    handshake.Merge(worker->handshake);
+  }
+
+  printf("\n%zu agents, %.1f s, %zu threads, %s\n", settings.agents, elapsed, settings.threads, tls ? "TLS" : "plain TCP");
+  handshake.Print("connect+hs");
+  idle.Print("IDLE rtt");
+  printf("server answered %.0f polls/s, ran %llu commands; agents sent %llu messages, %.2f MB/s up, %.2f MB/s down\n",
+         totals.replies / elapsed, (unsigned long long)totals.commands.load(), (unsigned long long)totals.messagesSent.load(),
+         totals.bytesSent / elapsed / 1e6, totals.bytesReceived / elapsed / 1e6);
+  workers.clear();
+  SSL_CTX_free(tls);
+  return 0;
+}
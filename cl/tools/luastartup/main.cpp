@@ -0,0 +1,152 @@
+// Startup benchmark for the embedded scripts: the agent's Lua setup (0_Config, 2_Startup run, 3_MainCycle loaded) from source,
+// the way it used to, against the stripped bytecode lua/compile.js now embeds. Bytecode is produced in-process with lua_dump(strip),
+// which is what luac -s writes. Bindings aren't registered: 2_Startup only defines functions that use them
+#include <Samples.h>
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Settings {
+  string scriptsDir = "../src/lua";
+  size_t iterations = 500;
+};
+
+struct Script {
+  string name;
+  string source;
+  string bytecode;
+  /// @brief 3_MainCycle is only loaded: running it means connecting
+  bool run;
+};
+
+static int Writer(lua_State*, const void* data, size_t size, void* out) {
+  static_cast<string*>(out)->append(static_cast<const char*>(data), size);
+  return 0;
+}
+
+/// @returns Stripped bytecode, empty if the source doesn't compile
+static string Compile(const string& name, const string& source) {
+  lua_State* L = luaL_newstate();
+  string bytecode;
+  if (luaL_loadbufferx(L, source.data(), source.size(), name.c_str(), "t") == LUA_OK)
+    lua_dump(L, Writer, &bytecode, 1);
+  else
+    cerr << lua_tostring(L, -1) << endl;
+  lua_close(L);
+  return bytecode;
+}
+
+/// @brief One agent startup, as in main.cpp
+/// @returns false on a Lua error
+static bool Startup(const vector<Script>& scripts, bool bytecode, Samples* perScript) {
+  lua_State* L = luaL_newstate();
+  luaL_openlibs(L);
+  lua_pushcfunction(L, [](lua_State*) { return 0; });
+  lua_setglobal(L, "print");
+  bool ok = true;
+  for (size_t i = 0; ok && i < scripts.size(); i++) {
+    const Script& script = scripts[i];
+    const string& chunk = bytecode ? script.bytecode : script.source;
+    auto start = Clock::now();
+    ok = luaL_loadbufferx(L, chunk.data(), chunk.size(), script.name.c_str(), bytecode ? "b" : "t") == LUA_OK;
+    if (perScript)
+      perScript[i].Add(start);
+    if (ok && script.run)
+      ok = lua_pcall(L, 0, 0, 0) == LUA_OK;
+    if (!ok)
+      cerr << script.name << ": " << lua_tostring(L, -1) << endl;
+    lua_settop(L, 0);
+  }
+  lua_close(L);
+  return ok;
+}
+
+static void PrintUsage() {
+  puts("Usage: rut-luastartup [--scripts ../src/lua] [--iterations 500]\n"
+       "  --scripts  directory with 0_Config.lua ... 3_MainCycle.lua");
+}
+static bool ParseArgs(int argc, char** argv, Settings& s) {
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    string v = argv[++i];
+    if (arg == "--scripts")
+      s.scriptsDir = v;
+    else if (arg == "--iterations")
+      s.iterations = stoul(v);
+    else
+      return false;
+  }
+  return s.iterations > 0;
+}
+
+int main(int argc, char** argv) {
+  Settings settings;
+  try {
+    if (!ParseArgs(argc, argv, settings)) {
+      PrintUsage();
+      return 1;
+    }
+  }
+  catch (exception&) {
+    PrintUsage();
+    return 1;
+  }
+
+  vector<Script> scripts;
+  for (auto [name, run] : { pair { "0_Config", true }, { "2_Startup", true }, { "3_MainCycle", false } }) {
+    ifstream file(settings.scriptsDir + "/" + name + ".lua", ios::binary);
+    if (!file) {
+      cerr << "Can't read " << settings.scriptsDir << "/" << name << ".lua" << endl;
+      return 1;
+    }
+    stringstream source;
+    source << file.rdbuf();
+    Script script { name, source.str(), "", run };
+    script.bytecode = Compile(script.name, script.source);
+    if (script.bytecode.empty())
+      return 1;
+    scripts.push_back(move(script));
+  }
+
+  vector<Samples> sourceLoad(scripts.size()), bytecodeLoad(scripts.size());
+  Samples sourceStartup, bytecodeStartup;
+  // interleaved, so both see the same cache and frequency conditions
+  for (size_t i = 0; i < settings.iterations; i++) {
+    auto start = Clock::now();
+    if (!Startup(scripts, false, sourceLoad.data()))
+      return 1;
+    sourceStartup.Add(start);
+    start = Clock::now();
+    if (!Startup(scripts, true, bytecodeLoad.data()))
+      return 1;
+    bytecodeStartup.Add(start);
+  }
+
+  printf("%-12s %9s %9s %12s %12s\n", "script", "source", "bytecode", "parse p50", "undump p50");
+  for (size_t i = 0; i < scripts.size(); i++) {
+    auto median = [](Samples& samples) {
+      sort(samples.values.begin(), samples.values.end());
+      return samples.values[samples.values.size() / 2] * 1000;
+    };
+    printf("%-12s %9zu %9zu %9.1f us %9.1f us\n", scripts[i].name.c_str(), scripts[i].source.size(), scripts[i].bytecode.size(),
+           median(sourceLoad[i]), median(bytecodeLoad[i]));
+  }
+  printf("\nwhole startup, %zu runs each\n", settings.iterations);
+  sourceStartup.Print("source");
+  bytecodeStartup.Print("bytecode");
+  return 0;
+}
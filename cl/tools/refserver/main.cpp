@@ -0,0 +1,245 @@
+// Reference server: a native stand-in for the Electron backend, for load tests and local runs.
+//   echo:   every frame is sent back as is (raw transport benchmark)
+//   script: speaks the agent protocol. HANDSHAKE gets "{}" (plus batch if asked for), every IDLE gets the next line of --script
+//           (cycled) or an empty reply, FEEDBACK/FILE/SCREENCAST/STATS are counted and dropped. BATCH parts count as their own
+//           actions, and an IDLE part gets the next line as a one-command batch reply
+#include <Protocol.h>
+#include <foresteamnd/TCPServer>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+struct Settings {
+  uint16_t port = 1337;
+  size_t threads = 0;
+  string certificate, key;
+  bool echo = false;
+  string scriptPath;
+  int reportMs = 1000;
+};
+
+struct Counters {
+  atomic<uint64_t> frames { 0 };
+  array<atomic<uint64_t>, Protocol::action_count> messages {};
+  atomic<uint64_t> bytesIn { 0 };
+  atomic<uint64_t> bytesOut { 0 };
+  atomic<uint64_t> compressed { 0 };
+  atomic<uint64_t> malformed { 0 };
+};
+
+/// @brief Per-connection state in script mode
+struct Session {
+  bool handshaken = false;
+  bool batch = false;
+  size_t nextCommand = 0;
+};
+
+static atomic<bool> interrupted { false };
+
+static void PrintUsage() {
+  puts("Usage: rut-refserver [--port 1337] [--threads N] [--cert server.crt --key server.key] [--echo] [--script commands.lua]\n"
+       "                     [--report-ms 1000]\n"
+       "  --cert/--key  terminate TLS 1.3 (the agent requires it); plain TCP otherwise\n"
+       "  --echo        send every frame back instead of speaking the agent protocol\n"
+       "  --script      one Lua command per line, handed out on IDLE in order (cycled)");
+}
+static bool ParseArgs(int argc, char** argv, Settings& settings) {
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    auto value = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+    const char* v = nullptr;
+    if (arg == "--echo")
+      settings.echo = true;
+    else if (arg == "--port" && (v = value()))
+      settings.port = (uint16_t)stoi(v);
+    else if (arg == "--threads" && (v = value()))
+      settings.threads = stoul(v);
+    else if (arg == "--cert" && (v = value()))
+      settings.certificate = v;
+    else if (arg == "--key" && (v = value()))
+      settings.key = v;
+    else if (arg == "--script" && (v = value()))
+      settings.scriptPath = v;
+    else if (arg == "--report-ms" && (v = value()))
+      settings.reportMs = stoi(v);
+    else
+      return false;
+  }
+  return settings.certificate.empty() == settings.key.empty();
+}
+
+static vector<string> LoadScript(const string& path) {
+  vector<string> commands;
+  ifstream file(path);
+  string line;
+  while (getline(file, line))
+    if (!line.empty())
+      commands.push_back(line);
+  return commands;
+}
+
+int main(int argc, char** argv) {
+  Settings settings;
+  try {
+    if (!ParseArgs(argc, argv, settings)) {
+      PrintUsage();
+      return 1;
+    }
+  }
+  catch (const exception&) {
+    PrintUsage();
+    return 1;
+  }
+  vector<string> commands;
+  if (!settings.scriptPath.empty()) {
+    commands = LoadScript(settings.scriptPath);
+    if (commands.empty()) {
+      cerr << "No commands in " << settings.scriptPath << endl;
+      return 1;
+    }
+  }
+
+  SSL_CTX* tls = nullptr;
+  if (!settings.certificate.empty()) {
+    tls = TCPServer::CreateTlsContext(settings.certificate, settings.key);
+    if (!tls) {
+      cerr << "Can't load " << settings.certificate << " / " << settings.key << endl;
+      return 1;
+    }
+  }
+
+  Counters counters;
+  TCPServer::Handlers handlers;
+  if (settings.echo)
+    handlers.onMessage = [&](FramedConnection& connection, string&& payload) {
+      counters.frames++;
+      counters.bytesIn += sizeof(uint64_t) + payload.size();
+      counters.bytesOut += sizeof(uint64_t) + payload.size();
+      connection.Send(payload);
+    };
+  else {
+    handlers.onConnect = [](const shared_ptr<FramedConnection>& connection) { connection->context = Session(); };
+    handlers.onMessage = [&](FramedConnection& connection, string&& payload) {
+      counters.frames++;
+      counters.bytesIn += sizeof(uint64_t) + payload.size();
+      if (payload.empty()) {
+        counters.malformed++;
+        connection.Close();
+        return;
+      }
+      uint8_t raw = (uint8_t)payload[0];
+      uint8_t action = raw & Protocol::action_mask;
+      if (raw & Protocol::action_compressed)
+        counters.compressed++;
+      if (action >= Protocol::action_count) {
+        counters.malformed++;
+        return;
+      }
+      counters.messages[action]++;
+
+      auto& session = any_cast<Session&>(connection.context);
+      auto reply = [&](const char* data, size_t size) {
+        counters.bytesOut += sizeof(uint64_t) + size;
+        connection.Send(data, size);
+      };
+      auto nextCommand = [&]() -> const string* { return commands.empty() ? nullptr : &commands[session.nextCommand++ % commands.size()]; };
+      switch (action) {
+      case Protocol::HANDSHAKE: {
+        session.handshaken = true;
+        session.batch = payload.find("\"batch\":true") != string::npos;
+        string handshakeReply = session.batch ? "{\"batch\":true}" : "{}";
+        reply(handshakeReply.data(), handshakeReply.size());
+        break;
+      }
+      case Protocol::IDLE:
+        if (!session.handshaken) {
+          // same as the real server: nothing before the handshake
+          counters.malformed++;
+          connection.Close();
+        }
+        else if (auto command = nextCommand())
+          reply(command->data(), command->size());
+        else
+          reply(Protocol::empty_reply, sizeof(Protocol::empty_reply));
+        break;
+      case Protocol::BATCH: {
+        bool idle = false;
+        bool valid = Protocol::ForEachBatchPart(payload.data() + 1, payload.size() - 1, [&](uint8_t part, uint32_t, const char*, size_t) {
+          if (part < Protocol::action_count)
+            counters.messages[part]++;
+          idle |= part == Protocol::IDLE;
+        });
+        if (!valid || !session.batch) {
+          counters.malformed++;
+          connection.Close();
+        }
+        else if (!idle)
+          break;
+        else if (auto command = nextCommand()) {
+          string batchReply;
+          Protocol::AppendBatchCommand(batchReply, (uint32_t)(session.nextCommand - 1), *command);
+          reply(batchReply.data(), batchReply.size());
+        }
+        else
+          reply(Protocol::empty_reply, sizeof(Protocol::empty_reply));
+        break;
+      }
+      default:
+        break;
+      }
+    };
+  }
+
+  TCPServer::Options options;
+  options.port = settings.port;
+  options.threads = settings.threads;
+  options.tls = tls;
+  TCPServer server(options, handlers);
+  if (!server.Start()) {
+    cerr << server.GetError() << endl;
+    SSL_CTX_free(tls);
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, [](int) { interrupted = true; });
+  signal(SIGTERM, [](int) { interrupted = true; });
+  printf("Listening on %u (%s, %s)\n", settings.port, tls ? "TLS" : "plain TCP", settings.echo ? "echo" : "script");
+
+  auto lastReport = chrono::steady_clock::now();
+  uint64_t lastIn = 0, lastOut = 0, lastFrames = 0;
+  while (!interrupted) {
+    this_thread::sleep_for(chrono::milliseconds(100));
+    auto now = chrono::steady_clock::now();
+    double seconds = chrono::duration<double>(now - lastReport).count();
+    if (seconds * 1000 < settings.reportMs)
+      continue;
+    uint64_t frames = counters.frames, in = counters.bytesIn, out = counters.bytesOut;
+    printf("connections %zu  frames/s %.0f  in %.2f MB/s  out %.2f MB/s", server.GetConnectionCount(), (frames - lastFrames) / seconds,
+           (in - lastIn) / seconds / 1e6, (out - lastOut) / seconds / 1e6);
+    if (!settings.echo)
+      for (uint8_t i = 0; i < Protocol::action_count; i++)
+        printf("  %s %llu", Protocol::action_names[i], (unsigned long long)counters.messages[i].load());
+    printf("\n");
+    fflush(stdout);
+    lastIn = in;
+    lastOut = out;
+    lastFrames = frames;
+    lastReport = now;
+  }
+
+  server.Stop();
+  server.Join();
+  SSL_CTX_free(tls);
+  printf("compressed %llu  malformed %llu\n", (unsigned long long)counters.compressed.load(), (unsigned long long)counters.malformed.load());
+  return 0;
+}
@@ -0,0 +1,484 @@
+// Replays a trace recorded by the agent (CONFIG.trace, see TraceRecorder) against a local peer, at recorded or scaled speed.
+//   agent:  plays the recorded agent against a server: every sent message goes out at its recorded time (divided by --speed), and
+//           the next one waits for as many replies as the original got. Reports reply latency per action
+//   server: plays the recorded server against agents (a real one, or rut-loadgen): the n-th message of a connection is answered with
+//           the replies recorded for the n-th sent message, after the recorded delay
+// Payloads missing from the trace (recorded without tracePayloads, or cut) are padded with deterministic filler of the recorded size.
+// Filler replies are whitespace, which a real agent runs as an empty chunk
+#include <Protocol.h>
+#include <Samples.h>
+#include <foresteamnd/TCPServer>
+#include <foresteamnd/TraceRecorder>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Settings {
+  string tracePath;
+  enum Side { AGENT, SERVER, INFO } side = AGENT;
+  string host = "127.0.0.1";
+  uint16_t port = 1337;
+  string caPath, certificate, key;
+  /// @brief Time scale: 2 plays twice as fast, 0 as fast as the peer allows
+  double speed = 1;
+  size_t copies = 1;
+  size_t threads = 0;
+  int replyTimeoutMs = 5000;
+};
+
+/// @brief A sent message and the replies that arrived before the next one
+struct Exchange {
+  uint8_t action;
+  chrono::microseconds offset;
+  string message;
+  struct Reply {
+    chrono::microseconds delay;
+    string payload;
+  };
+  vector<Reply> replies;
+};
+
+struct Script {
+  vector<Exchange> exchanges;
+  chrono::microseconds duration { 0 };
+  uint64_t incomplete = 0;
+};
+
+/// @brief `payload` padded to `size`. Deterministic per `seed`, so every run (and every copy) sends the same bytes
+static string Materialize(const string& payload, uint64_t size, uint64_t seed, bool reply) {
+  if (payload.size() >= size)
+    return payload;
+  string out = payload;
+  out.reserve(size);
+  if (reply) {
+    // whitespace: a valid, empty Lua chunk. A single zero byte is the empty reply
+    out.append(size - out.size(), size == 1 ? '\0' : ' ');
+    return out;
+  }
+  mt19937_64 random(seed);
+  while (out.size() < size)
+    out.push_back((char)random());
+  return out;
+}
+
+static bool LoadScript(const string& path, Script& script, bool& payloads) {
+  TraceReader reader;
+  if (!reader.Open(path))
+    return false;
+  payloads = reader.HasPayloads();
+  Trace::Record record;
+  while (reader.Next(record)) {
+    script.duration = record.offset;
+    uint64_t seed = script.exchanges.size();
+    if (record.direction == Trace::SENT) {
+      if (record.payload.size() < record.size)
+        script.incomplete++;
+      string message = Materialize(record.payload, record.size, seed, false);
+      if (!message.empty())
+        message[0] = (char)record.action;
+      script.exchanges.push_back({ record.action, record.offset, move(message), {} });
+    }
+    else if (!script.exchanges.empty()) {
+      // replies before the first sent message can't be matched to anything
+      Exchange& last = script.exchanges.back();
+      if (record.payload.size() < record.size)
+        script.incomplete++;
+      last.replies.push_back({ record.offset - last.offset, Materialize(record.payload, record.size, seed, true) });
+    }
+  }
+  return true;
+}
+
+static void PrintInfo(const Script& script, bool payloads) {
+  struct Totals {
+    uint64_t count = 0, bytes = 0, replies = 0, replyBytes = 0;
+  } perAction[Protocol::action_count + 1];
+  for (auto& exchange : script.exchanges) {
+    uint8_t base = exchange.action & Protocol::action_mask;
+    auto& totals = perAction[base < Protocol::action_count ? base : Protocol::action_count];
+    totals.count++;
+    totals.bytes += exchange.message.size();
+    totals.replies += exchange.replies.size();
+    for (auto& reply : exchange.replies)
+      totals.replyBytes += reply.payload.size();
+  }
+  printf("%.3f s, %zu sent messages, payloads %s (%llu incomplete)\n", chrono::duration<double>(script.duration).count(), script.exchanges.size(),
+         payloads ? "stored" : "not stored", (unsigned long long)script.incomplete);
+  for (uint8_t i = 0; i <= Protocol::action_count; i++)
+    if (perAction[i].count)
+      printf("%-12s sent %-8llu %12llu B  replies %-8llu %12llu B\n", i < Protocol::action_count ? Protocol::action_names[i] : "other",
+             (unsigned long long)perAction[i].count, (unsigned long long)perAction[i].bytes, (unsigned long long)perAction[i].replies,
+             (unsigned long long)perAction[i].replyBytes);
+}
+
+template <typename Duration>
+static Clock::duration Scaled(Duration duration, double speed) {
+  return speed > 0 ? chrono::duration_cast<Clock::duration>(duration / speed) : Clock::duration::zero();
+}
+
+static atomic<bool> interrupted { false };
+
+//-------------------------------------------------------------------------------
+// Agent side
+//-------------------------------------------------------------------------------
+
+struct AgentTotals {
+  atomic<uint64_t> finished { 0 };
+  atomic<uint64_t> failed { 0 };
+  atomic<uint64_t> timeouts { 0 };
+  atomic<uint64_t> messages { 0 };
+  atomic<uint64_t> bytesSent { 0 };
+  atomic<uint64_t> bytesReceived { 0 };
+};
+
+struct AgentWorker;
+
+/// @brief One replayed copy of the recorded agent
+class Player {
+public:
+  Player(AgentWorker& worker) : _worker(worker) {}
+  void Start();
+
+private:
+  AgentWorker& _worker;
+  shared_ptr<FramedConnection> _connection;
+  Clock::time_point _start, _sentAt;
+  size_t _next = 0;
+  size_t _pendingReplies = 0;
+  uint64_t _timer = 0;
+  bool _done = false;
+
+  void SendNext();
+  void OnMessage(string&& payload);
+  void Advance();
+  void Finish(bool ok);
+};
+
+struct AgentWorker {
+  const Settings& settings;
+  const Script& script;
+  SSL_CTX* tls;
+  AgentTotals& totals;
+  EventLoop loop;
+  vector<unique_ptr<Player>> players;
+  vector<Samples> latency = vector<Samples>(Protocol::action_count + 1);
+  size_t running = 0;
+  thread runner;
+
+  AgentWorker(const Settings& settings, const Script& script, SSL_CTX* tls, AgentTotals& totals)
+      : settings(settings), script(script), tls(tls), totals(totals) {}
+};
+
+void Player::Start() {
+  _connection = FramedConnection::Connect(_worker.loop, _worker.settings.host, _worker.settings.port, _worker.tls);
+  if (!_connection) {
+    Finish(false);
+    return;
+  }
+  _start = Clock::now();
+  _connection->Start([this](FramedConnection&, string&& payload) { OnMessage(move(payload)); }, [this](FramedConnection&) { Finish(false); });
+  SendNext();
+}
+void Player::SendNext() {
+  _timer = 0;
+  if (_done)
+    return;
+  if (_next >= _worker.script.exchanges.size()) {
+    Finish(true);
+    return;
+  }
+  const Exchange& exchange = _worker.script.exchanges[_next];
+  _pendingReplies = exchange.replies.size();
+  _sentAt = Clock::now();
+  _worker.totals.messages++;
+  _worker.totals.bytesSent += sizeof(uint64_t) + exchange.message.size();
+  _connection->Send(exchange.message);
+  if (_pendingReplies)
+    _timer = _worker.loop.AddTimer(chrono::milliseconds(_worker.settings.replyTimeoutMs), [this] {
+      _timer = 0;
+      _worker.totals.timeouts++;
+      Advance();
+    });
+  else
+    Advance();
+}
+void Player::OnMessage(string&& payload) {
+  _worker.totals.bytesReceived += sizeof(uint64_t) + payload.size();
+  if (_done)
+    return;
+  // late replies to an exchange that already timed out are dropped
+  if (!_pendingReplies || --_pendingReplies)
+    return;
+  const Exchange& exchange = _worker.script.exchanges[_next];
+  uint8_t base = exchange.action & Protocol::action_mask;
+  _worker.latency[base < Protocol::action_count ? base : Protocol::action_count].Add(_sentAt);
+  _worker.loop.CancelTimer(_timer);
+  Advance();
+}
+void Player::Advance() {
+  _pendingReplies = 0;
+  _next++;
+  if (_next >= _worker.script.exchanges.size()) {
+    Finish(true);
+    return;
+  }
+  auto& exchanges = _worker.script.exchanges;
+  // the trace starts before the connection does
+  auto at = _start + Scaled(exchanges[_next].offset - exchanges[0].offset, _worker.settings.speed);
+  auto now = Clock::now();
+  if (at <= now)
+    // a recorded burst, or the peer is slower than the original: keep going without idling
+    _worker.loop.Post([this] { SendNext(); });
+  else
+    _timer = _worker.loop.AddTimer(at - now, [this] { SendNext(); });
+}
+void Player::Finish(bool ok) {
+  if (_done)
+    return;
+  _done = true;
+  if (_timer)
+    _worker.loop.CancelTimer(_timer);
+  (ok ? _worker.totals.finished : _worker.totals.failed)++;
+  if (_connection)
+    _connection->Close();
+  if (--_worker.running == 0)
+    _worker.loop.Stop();
+}
+
+static int RunAgent(const Settings& settings, const Script& script) {
+  SSL_CTX* tls = nullptr;
+  if (!settings.caPath.empty()) {
+    tls = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_min_proto_version(tls, TLS1_3_VERSION);
+    if (SSL_CTX_load_verify_locations(tls, settings.caPath.c_str(), nullptr) != 1) {
+      cerr << "Can't load " << settings.caPath << endl;
+      SSL_CTX_free(tls);
+      return 1;
+    }
+    SSL_CTX_set_verify(tls, SSL_VERIFY_PEER, nullptr);
+  }
+  size_t threads = settings.threads ? settings.threads : max(1u, thread::hardware_concurrency());
+  threads = min(threads, settings.copies);
+
+  AgentTotals totals;
+  vector<unique_ptr<AgentWorker>> workers;
+  for (size_t i = 0; i < threads; i++)
+    workers.push_back(make_unique<AgentWorker>(settings, script, tls, totals));
+  for (size_t i = 0; i < settings.copies; i++) {
+    AgentWorker& worker = *workers[i % workers.size()];
+    worker.players.push_back(make_unique<Player>(worker));
+    worker.running++;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, [](int) { interrupted = true; });
+  auto start = Clock::now();
+  for (auto& worker : workers) {
+    AgentWorker* raw = worker.get();
+    raw->loop.Post([raw] {
+      for (auto& player : raw->players)
+        player->Start();
+    });
+    raw->runner = thread([raw] { raw->loop.Run(); });
+  }
+  while (!interrupted && totals.finished + totals.failed < settings.copies)
+    this_thread::sleep_for(chrono::milliseconds(50));
+  for (auto& worker : workers)
+    worker->loop.Stop();
+  vector<Samples> latency(Protocol::action_count + 1);
+  for (auto& worker : workers) {
+    worker->runner.join();
+    for (size_t i = 0; i < latency.size(); i++)
+      latency[i].Merge(worker->latency[i]);
+  }
+  double elapsed = chrono::duration<double>(Clock::now() - start).count();
+
+  printf("%zu copies: %llu finished, %llu failed, %llu reply timeouts; %.3f s (recorded %.3f s at speed %g)\n", settings.copies,
+         (unsigned long long)totals.finished.load(), (unsigned long long)totals.failed.load(), (unsigned long long)totals.timeouts.load(), elapsed,
+         chrono::duration<double>(script.duration).count(), settings.speed);
+  printf("%.0f messages/s, %.2f MB/s up, %.2f MB/s down\n", totals.messages / elapsed, totals.bytesSent / elapsed / 1e6,
+         totals.bytesReceived / elapsed / 1e6);
+  for (uint8_t i = 0; i <= Protocol::action_count; i++)
+    if (!latency[i].values.empty())
+      latency[i].Print(i < Protocol::action_count ? Protocol::action_names[i] : "other");
+  workers.clear();
+  SSL_CTX_free(tls);
+  return totals.failed ? 2 : 0;
+}
+
+//-------------------------------------------------------------------------------
+// Server side
+//-------------------------------------------------------------------------------
+
+struct ServerTotals {
+  atomic<uint64_t> frames { 0 };
+  atomic<uint64_t> replies { 0 };
+  atomic<uint64_t> mismatches { 0 };
+  atomic<uint64_t> exhausted { 0 };
+};
+
+/// @brief Per-connection position in the script
+struct Cursor {
+  size_t next = 0;
+};
+
+static int RunServer(const Settings& settings, const Script& script) {
+  SSL_CTX* tls = nullptr;
+  if (!settings.certificate.empty()) {
+    tls = TCPServer::CreateTlsContext(settings.certificate, settings.key);
+    if (!tls) {
+      cerr << "Can't load " << settings.certificate << " / " << settings.key << endl;
+      return 1;
+    }
+  }
+  ServerTotals totals;
+  TCPServer::Handlers handlers;
+  handlers.onConnect = [](const shared_ptr<FramedConnection>& connection) { connection->context = Cursor(); };
+  handlers.onMessage = [&](FramedConnection& connection, string&& payload) {
+    totals.frames++;
+    auto& cursor = any_cast<Cursor&>(connection.context);
+    if (cursor.next >= script.exchanges.size()) {
+      // the peer went on past the recording: nothing left to say
+      totals.exhausted++;
+      connection.Close();
+      return;
+    }
+    const Exchange& exchange = script.exchanges[cursor.next++];
+    if (payload.empty() || (uint8_t)payload[0] != exchange.action)
+      totals.mismatches++;
+    for (auto& reply : exchange.replies) {
+      auto delay = Scaled(reply.delay, settings.speed);
+      totals.replies++;
+      if (delay <= Clock::duration::zero()) {
+        connection.Send(reply.payload);
+        continue;
+      }
+      connection.GetLoop().AddTimer(delay, [self = connection.shared_from_this(), &reply] { self->Send(reply.payload); });
+    }
+  };
+
+  TCPServer::Options options;
+  options.port = settings.port;
+  options.threads = settings.threads;
+  options.tls = tls;
+  TCPServer server(options, handlers);
+  if (!server.Start()) {
+    cerr << server.GetError() << endl;
+    SSL_CTX_free(tls);
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, [](int) { interrupted = true; });
+  signal(SIGTERM, [](int) { interrupted = true; });
+  printf("Replaying %zu exchanges on %u (%s)\n", script.exchanges.size(), settings.port, tls ? "TLS" : "plain TCP");
+  while (!interrupted) {
+    this_thread::sleep_for(chrono::seconds(1));
+    printf("connections %zu  frames %llu  replies %llu  mismatches %llu  exhausted %llu\n", server.GetConnectionCount(),
+           (unsigned long long)totals.frames.load(), (unsigned long long)totals.replies.load(), (unsigned long long)totals.mismatches.load(),
+           (unsigned long long)totals.exhausted.load());
+    fflush(stdout);
+  }
+  server.Stop();
+  server.Join();
+  SSL_CTX_free(tls);
+  return 0;
+}
+
+//-------------------------------------------------------------------------------
+
+static void PrintUsage() {
+  puts("Usage: rut-replay --trace session.mrtr [--side agent|server|info] [--speed 1] [--threads N]\n"
+       "         agent:  [--host 127.0.0.1] [--port 1337] [--ca root.crt] [--copies 1] [--reply-timeout-ms 5000]\n"
+       "         server: [--port 1337] [--cert server.crt --key server.key]\n"
+       "  --speed   time scale: 10 plays ten times faster, 0 as fast as the peer answers\n"
+       "  --copies  replay the agent this many times in parallel\n"
+       "  info      prints what the trace holds");
+}
+static bool ParseArgs(int argc, char** argv, Settings& s) {
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    string v = argv[++i];
+    if (arg == "--trace")
+      s.tracePath = v;
+    else if (arg == "--side") {
+      if (v == "agent")
+        s.side = Settings::AGENT;
+      else if (v == "server")
+        s.side = Settings::SERVER;
+      else if (v == "info")
+        s.side = Settings::INFO;
+      else
+        return false;
+    }
+    else if (arg == "--host")
+      s.host = v;
+    else if (arg == "--port")
+      s.port = (uint16_t)stoi(v);
+    else if (arg == "--ca")
+      s.caPath = v;
+    else if (arg == "--cert")
+      s.certificate = v;
+    else if (arg == "--key")
+      s.key = v;
+    else if (arg == "--speed")
+      s.speed = stod(v);
+    else if (arg == "--copies")
+      s.copies = max<size_t>(1, stoul(v));
+    else if (arg == "--threads")
+      s.threads = stoul(v);
+    else if (arg == "--reply-timeout-ms")
+      s.replyTimeoutMs = stoi(v);
+    else
+      return false;
+  }
+  return !s.tracePath.empty() && s.speed >= 0 && s.certificate.empty() == s.key.empty();
+}
+
+int main(int argc, char** argv) {
+  Settings settings;
+  try {
+    if (!ParseArgs(argc, argv, settings)) {
+      PrintUsage();
+      return 1;
+    }
+  }
+  catch (const exception&) {
+    PrintUsage();
+    return 1;
+  }
+  Script script;
+  bool payloads;
+  if (!LoadScript(settings.tracePath, script, payloads)) {
+    cerr << "Can't read trace " << settings.tracePath << endl;
+    return 1;
+  }
+  if (script.exchanges.empty()) {
+    cerr << "Nothing was sent in " << settings.tracePath << endl;
+    return 1;
+  }
+  switch (settings.side) {
+  case Settings::INFO:
+    PrintInfo(script, payloads);
+    return 0;
+  case Settings::AGENT:
+    if (script.incomplete)
+      cerr << script.incomplete << " messages without (full) payloads are padded with filler: replay against rut-refserver, the real server will "
+           << "reject them" << endl;
+    return RunAgent(settings, script);
+  case Settings::SERVER:
+    return RunServer(settings, script);
+  }
+  return 1;
+}
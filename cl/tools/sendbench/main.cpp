@@ -0,0 +1,438 @@
+// File send benchmark: what SendFile (the `download` command's path) costs the agent per gigabyte over plain TCP (sendfile), TLS in
+// user space (read + SSL_write) and kernel TLS (SSL_sendfile). A loopback server in the same process, with a throwaway self-signed
+// certificate, reads and drops each message and answers once it has all of it; the sending thread's CPU time (syscalls included) and
+// the wall time until the answer are reported for each mode. Each mode also checks that polls go out between the slices of a transfer
+// capped by the BULK rate limit, sent from another thread like the agent sends its files
+#include <foresteamnd/TCPClient>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Settings {
+  size_t sizeMb = 1024;
+  int repeat = 3;
+  vector<string> modes = { "tcp", "tls", "ktls" };
+  string file;
+};
+
+/// @brief A self-signed certificate for 127.0.0.1, installed in `context`; the client trusts its PEM as the root
+struct Identity {
+  SSL_CTX* context = nullptr;
+  vector<unsigned char> certificatePem;
+};
+
+static string Megabytes(uint64_t bytes) {
+  char text[32];
+  snprintf(text, sizeof text, "%.1f MB", bytes / 1048576.0);
+  return text;
+}
+static double ThreadCpuSeconds() {
+  timespec now {};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool CreateIdentity(Identity& identity) {
+  EVP_PKEY* key = EVP_EC_gen("P-256");
+  X509* certificate = X509_new();
+  bool ok = key && certificate;
+  if (ok) {
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 24 * 60 * 60);
+    X509_NAME* name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"127.0.0.1", -1, -1, 0);
+    X509_set_issuer_name(certificate, name);
+    X509_set_pubkey(certificate, key);
+    ok = X509_sign(certificate, key, EVP_sha256()) > 0;
+  }
+  if (ok) {
+    identity.context = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_set_min_proto_version(identity.context, TLS1_3_VERSION);
+    ok = SSL_CTX_use_certificate(identity.context, certificate) == 1 && SSL_CTX_use_PrivateKey(identity.context, key) == 1;
+  }
+  if (ok) {
+    BIO* bio = BIO_new(BIO_s_mem());
+    PEM_write_bio_X509(bio, certificate);
+    char* data = nullptr;
+    long size = BIO_get_mem_data(bio, &data);
+    identity.certificatePem.assign(data, data + size);
+    // the client reads it as a C string
+    identity.certificatePem.push_back('\0');
+    BIO_free(bio);
+  }
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+  return ok;
+}
+
+static bool ReadAll(int socket, SSL* ssl, char* data, size_t size) {
+  while (size) {
+    int got = ssl ? SSL_read(ssl, data, (int)min<size_t>(size, INT32_MAX)) : (int)recv(socket, data, size, 0);
+    if (got <= 0)
+      return false;
+    data += got;
+    size -= got;
+  }
+  return true;
+}
+static bool WriteAll(int socket, SSL* ssl, const char* data, size_t size) {
+  while (size) {
+    int put = ssl ? SSL_write(ssl, data, (int)size) : (int)send(socket, data, size, MSG_NOSIGNAL);
+    if (put <= 0)
+      return false;
+    data += put;
+    size -= put;
+  }
+  return true;
+}
+
+static bool Drop(int socket, SSL* ssl, vector<char>& sink, uint64_t size) {
+  for (uint64_t left = size; left;) {
+    size_t piece = (size_t)min<uint64_t>(left, sink.size());
+    if (!ReadAll(socket, ssl, sink.data(), piece))
+      return false;
+    left -= piece;
+  }
+  return true;
+}
+/// @brief A message of one character
+static bool Answer(int socket, SSL* ssl, char answer) {
+  char message[sizeof(size_t) + 1] = {};
+  message[0] = 1;
+  message[sizeof(size_t)] = answer;
+  return WriteAll(socket, ssl, message, sizeof message);
+}
+
+/// @returns The connection taken, -1 if none (`ssl` set if it's TLS)
+static int Accept(int listener, SSL_CTX* tls, SSL*& ssl) {
+  int socket = accept(listener, nullptr, nullptr);
+  ssl = nullptr;
+  if (socket < 0 || !tls)
+    return socket;
+  ssl = SSL_new(tls);
+  SSL_set_fd(ssl, socket);
+  if (SSL_accept(ssl) != 1) {
+    SSL_free(ssl);
+    ssl = nullptr;
+    close(socket);
+    return -1;
+  }
+  return socket;
+}
+static void Hangup(int socket, SSL* ssl) {
+  if (ssl) {
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+  }
+  close(socket);
+}
+
+/// @brief Takes one connection: reads messages (size, then that many bytes, dropped) and answers each with "k", until the
+/// client goes away
+static void Serve(int listener, SSL_CTX* tls) {
+  SSL* ssl;
+  int socket = Accept(listener, tls, ssl);
+  if (socket < 0)
+    return;
+  vector<char> sink(1 << 20);
+  size_t size = 0;
+  while (ReadAll(socket, ssl, (char*)&size, sizeof size))
+    if (!Drop(socket, ssl, sink, size) || !Answer(socket, ssl, 'k'))
+      break;
+  Hangup(socket, ssl);
+}
+/// @brief Serve() for a client with slicing on (TCPClient::sliced_message_flag): the sliced message is the file, answered with "f"
+/// once all of it is in; whole messages are polls, answered with "p" right away. Counts the polls that came between two of its slices
+static void ServeSliced(int listener, SSL_CTX* tls, int& pollsBetween) {
+  SSL* ssl;
+  int socket = Accept(listener, tls, ssl);
+  if (socket < 0)
+    return;
+  vector<char> sink(1 << 20);
+  bool inFile = false;
+  uint64_t header = 0, fileLeft = 0;
+  for (bool ok = true; ok && ReadAll(socket, ssl, (char*)&header, sizeof header);) {
+    if (header & TCPClient::slice_flag) {
+      uint64_t size = header & ~TCPClient::slice_flag;
+      ok = inFile && size <= fileLeft && Drop(socket, ssl, sink, size);
+      fileLeft -= ok ? size : 0;
+    }
+    else if (header & TCPClient::sliced_message_flag) {
+      // only one sliced message at a time
+      ok = !inFile;
+      inFile = true;
+      fileLeft = header & ~TCPClient::sliced_message_flag;
+    }
+    else {
+      ok = Drop(socket, ssl, sink, header) && Answer(socket, ssl, 'p');
+      pollsBetween += inFile;
+    }
+    if (ok && inFile && !fileLeft) {
+      inFile = false;
+      ok = Answer(socket, ssl, 'f');
+    }
+  }
+  Hangup(socket, ssl);
+}
+
+static int Listen(uint16_t& port) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof address;
+  if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof address) < 0 || listen(listener, 1) < 0 ||
+      getsockname(listener, (sockaddr*)&address, &length) < 0)
+    return -1;
+  port = ntohs(address.sin_port);
+  return listener;
+}
+
+static bool MakeFile(const string& path, size_t size) {
+  ofstream file(path, ios::binary | ios::trunc);
+  mt19937_64 random(1);
+  vector<uint64_t> block(1 << 17);
+  for (size_t written = 0; file && written < size;) {
+    for (auto& value : block)
+      value = random();
+    size_t piece = min(size - written, block.size() * sizeof(uint64_t));
+    file.write((const char*)block.data(), piece);
+    written += piece;
+  }
+  return (bool)file;
+}
+/// @brief Reads the file once so every mode sends it from the page cache
+static void Warm(const string& path) {
+  ifstream file(path, ios::binary);
+  vector<char> buffer(1 << 20);
+  while (file.read(buffer.data(), buffer.size()) || file.gcount())
+    ;
+}
+
+/// @brief Smallest file the interleaving check runs with: a few slices, and time for polls between them
+static constexpr uint64_t interleave_min_size = 4 * TCPClient::file_chunk_size;
+/// @brief What the check sends of the file, in about `interleave_seconds` (BULK capped to match)
+static constexpr uint64_t interleave_size = 4 << 20;
+static constexpr double interleave_seconds = 2;
+static constexpr auto poll_interval = chrono::milliseconds(50);
+
+/// @brief Sends (part of) the file capped from one thread and polls from this one meanwhile, like 3_MainCycle.lua while a download goes
+/// from a pool thread: the polls have to go out, and be answered, between the file's slices
+static bool CheckInterleave(const string& mode, const Settings& settings, const Identity& identity, uint64_t size) {
+  if (size < interleave_min_size) {
+    printf("%-31s interleaving not checked: the file is under %s\n", mode.c_str(), Megabytes(interleave_min_size).c_str());
+    return true;
+  }
+  bool tls = mode != "tcp";
+  uint16_t port = 0;
+  int listener = Listen(port);
+  if (listener < 0) {
+    cerr << mode << ": can't listen: " << strerror(errno) << endl;
+    return false;
+  }
+  int pollsBetween = 0, polls = 0, answeredBefore = 0;
+  thread server(ServeSliced, listener, tls ? identity.context : nullptr, ref(pollsBetween));
+  bool ok = true, sent = false;
+  atomic<bool> finished = false;
+  try {
+    TCPClient client = tls ? TCPClient("127.0.0.1", port, TCPClient::THROW, identity.certificatePem, false, mode == "ktls")
+                           : TCPClient("127.0.0.1", port, TCPClient::THROW);
+    client.SetSlicing(true);
+    uint64_t length = min(size, interleave_size);
+    client.GetScheduler().SetRateLimit(SendScheduler::BULK, length / interleave_seconds);
+    thread sender([&] {
+      try {
+        sent = client.SendFileRange(settings.file, 0, length);
+      }
+      catch (const exception&) {
+      }
+      finished = true;
+    });
+    try {
+      // not only until the answer: a file that didn't go sliced is answered like a poll
+      for (bool done = false; ok && !done && !finished;) {
+        this_thread::sleep_for(poll_interval);
+        ok = client.SendData(string("i"), SendScheduler::INPUT);
+        polls++;
+        // the file's answer may come first
+        while (ok) {
+          string reply = client.ReceiveData();
+          if (reply == "f")
+            done = true;
+          else if (reply == "p") {
+            answeredBefore += !done;
+            break;
+          }
+          else
+            ok = false;
+        }
+      }
+    }
+    catch (const exception& e) {
+      cerr << mode << ": " << e.what() << endl;
+      ok = false;
+    }
+    sender.join();
+  }
+  catch (const exception& e) {
+    cerr << mode << ": " << e.what() << endl;
+    ok = false;
+  }
+  shutdown(listener, SHUT_RDWR);
+  server.join();
+  close(listener);
+  if (!ok || !sent) {
+    cerr << mode << ": the capped transfer failed" << endl;
+    return false;
+  }
+  printf("%-31s %d of %d polls between the slices, %d answered before the file was in\n", (mode + " (capped)").c_str(), pollsBetween, polls,
+         answeredBefore);
+  if (!pollsBetween || !answeredBefore) {
+    cerr << mode << ": no poll went between the slices of the capped transfer" << endl;
+    return false;
+  }
+  return true;
+}
+
+static bool Run(const string& mode, const Settings& settings, const Identity& identity, uint64_t size) {
+  bool tls = mode != "tcp";
+  uint16_t port = 0;
+  int listener = Listen(port);
+  if (listener < 0) {
+    cerr << mode << ": can't listen: " << strerror(errno) << endl;
+    return false;
+  }
+  thread server(Serve, listener, tls ? identity.context : nullptr);
+  bool ok = true;
+  bool ktlsActive = false;
+  double cpu = 0, wall = 0;
+  try {
+    TCPClient client = tls ? TCPClient("127.0.0.1", port, TCPClient::THROW, identity.certificatePem, false, mode == "ktls")
+                           : TCPClient("127.0.0.1", port, TCPClient::THROW);
+    ktlsActive = client.IsKtlsSendActive();
+    for (int i = 0; ok && i < settings.repeat; i++) {
+      auto startedAt = Clock::now();
+      double cpuAt = ThreadCpuSeconds();
+      ok = client.SendFile(settings.file) && client.ReceiveData() == "k";
+      cpu += ThreadCpuSeconds() - cpuAt;
+      wall += chrono::duration<double>(Clock::now() - startedAt).count();
+    }
+  }
+  catch (const exception& e) {
+    cerr << mode << ": " << e.what() << endl;
+    ok = false;
+  }
+  // wakes the server if the client never got as far as connecting
+  shutdown(listener, SHUT_RDWR);
+  server.join();
+  close(listener);
+  if (!ok) {
+    cerr << mode << ": the transfer failed" << endl;
+    return false;
+  }
+  double gigabytes = (double)size * settings.repeat / (1024.0 * 1024 * 1024);
+  string name = mode;
+  if (mode == "ktls")
+    name += ktlsActive ? " (kernel)" : " (fell back to user space)";
+  printf("%-31s cpu %7.3f s/GB  wall %7.3f s/GB  %8.1f MB/s\n", name.c_str(), cpu / gigabytes, wall / gigabytes, gigabytes * 1024 / wall);
+  return true;
+}
+
+static void PrintUsage() {
+  puts("Usage: rut-sendbench [--size-mb 1024] [--repeat 3] [--mode tcp|tls|ktls]... [--file path]\n"
+       "  --mode  only these (repeatable); all three otherwise\n"
+       "  --file  send this file instead of a random one made in the temp directory");
+}
+static bool ParseArgs(int argc, char** argv, Settings& s) {
+  bool modesGiven = false;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    string v = argv[++i];
+    if (arg == "--size-mb")
+      s.sizeMb = stoul(v);
+    else if (arg == "--repeat")
+      s.repeat = stoi(v);
+    else if (arg == "--file")
+      s.file = v;
+    else if (arg == "--mode" && (v == "tcp" || v == "tls" || v == "ktls")) {
+      if (!modesGiven)
+        s.modes.clear();
+      modesGiven = true;
+      s.modes.push_back(v);
+    }
+    else
+      return false;
+  }
+  return s.sizeMb > 0 && s.repeat > 0;
+}
+
+int main(int argc, char** argv) {
+  Settings settings;
+  try {
+    if (!ParseArgs(argc, argv, settings)) {
+      PrintUsage();
+      return 1;
+    }
+  }
+  catch (exception&) {
+    PrintUsage();
+    return 1;
+  }
+
+  Identity identity;
+  if (!CreateIdentity(identity)) {
+    ERR_print_errors_fp(stderr);
+    return 1;
+  }
+  bool temporary = settings.file.empty();
+  if (temporary) {
+    settings.file = (filesystem::temp_directory_path() / ("rut-sendbench-" + to_string(getpid()))).string();
+    if (!MakeFile(settings.file, settings.sizeMb * 1024 * 1024)) {
+      cerr << "Can't write " << settings.file << endl;
+      return 1;
+    }
+  }
+  error_code error;
+  uint64_t size = filesystem::file_size(settings.file, error);
+  if (error) {
+    cerr << "Can't read " << settings.file << endl;
+    return 1;
+  }
+  Warm(settings.file);
+  // a check that fails hangs up with answers still on their way
+  signal(SIGPIPE, SIG_IGN);
+  printf("%s x %d per mode\n", Megabytes(size).c_str(), settings.repeat);
+  bool ok = true;
+  for (const auto& mode : settings.modes)
+    ok &= Run(mode, settings, identity, size) && CheckInterleave(mode, settings, identity, size);
+  if (temporary)
+    filesystem::remove(settings.file, error);
+  SSL_CTX_free(identity.context);
+  return ok ? 0 : 1;
+}
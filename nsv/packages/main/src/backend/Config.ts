@@ -6,9 +6,18 @@ export class Config implements ConfigData {
   static readonly table = 'Config';
   static readonly defaults = {
     language: 'en' as 'ru' | 'en',
+    /** Agents connect here (TLS) */
+    port: 1337 as number,
+    /** The UDP screencast channel's; 0 keeps screencasts on the TLS connection */
+    datagramPort: 1337 as number,
+    /** What one agent's screencast datagrams may come at, bytes/s: past it they're dropped before they're decrypted */
+    datagramRateLimit: 16 * 1024 * 1024 as number,
   } as const;
 
   language!: ConfigData['language'];
+  port!: ConfigData['port'];
+  datagramPort!: ConfigData['datagramPort'];
+  datagramRateLimit!: ConfigData['datagramRateLimit'];
 
   constructor() {
     for (const key of Object.keys(Config.defaults) as (keyof ConfigData)[]) {
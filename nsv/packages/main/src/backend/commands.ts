@@ -1,39 +1,241 @@
 import { Command, ArgParser } from '@foresteam/cmd-argparse';
-import type { Client } from './protocol/Client';
-import { readFileSync } from 'fs';
-import { basename } from 'path';
+import { type Client, type CommandQueueEntry, StreamedPayload } from './protocol/Client';
+import { ArchiveExtractor, encodeArchive } from './protocol/Archive';
+import { PreparedCall } from './protocol/Batch';
+import { chunk, encodeManifest, encodeUpload, parseMissing } from './protocol/Chunks';
+import { diff, patch, sign } from './protocol/Delta';
+import { MAX_STRIPES, type RangeHeader, ResumableDownload } from './protocol/Resume';
+import { WatchEventReader } from './protocol/Watch';
+import { existsSync, readFileSync, rmSync, writeFileSync } from 'fs';
+import { tmpdir } from 'os';
+import { basename, join } from 'path';
 import type { Logger } from './Logger';
 import { activeLanguage } from '../../../../types/Locales';
 import { Config } from './Config';
+import type { IWatchEvent } from '$types/Common';
 
-type CommandFunction = (clients: Client[], netQ: (client: Client) => Client['netQueue'][number]['queue'], logger: Logger) => unknown;
+/**
+ * @param continueWith Queues more for a client as part of the same command, once it's known what (after a FILE came back, say): the
+ * command isn't over for that client until this is done too
+ */
+type CommandFunction = (
+	clients: Client[],
+	netQ: (client: Client) => Client['netQueue'][number]['queue'],
+	logger: Logger,
+	continueWith: (client: Client, tasks: CommandQueueEntry[]) => void,
+) => unknown;
 export type Commands = typeof commands;
 type QueuedCommand = { clientIds: number[]; action: CommandFunction; id: number; name: keyof Commands | null };
 type RunningQueuedCommand = QueuedCommand & { results: Record<string, string[]>; accumulateResults: boolean; resolve?: () => void };
 
 export const luaString = (value: string) => `'${value.replaceAll('\'', '\\\'')}'`;
+/** Client send priorities, highest first (`SendScheduler::TrafficClass`) */
+export const trafficClasses = ['CONTROL', 'INPUT', 'SCREENCAST', 'BULK'] as const;
 
 const russian = new Config().language === 'ru';
 
 const argParser = new ArgParser('');
 const commands = {
+	/**
+	 * Resumable: what comes is kept in `<dst>.part` until it's all there, and a download that broke off goes on from where it stopped. With
+	 * `streams` > 1 a big file comes in stripes, each over a data connection of its own; its size has to be asked for first
+	 */
 	download: new Command(
 		['download'],
-		[{ type: 'string', name: 'src' }, { type: 'string|', name: 'dst' }],
+		[{ type: 'string', name: 'src' }, { type: 'string|', name: 'dst' }, { type: 'string|', name: 'streams' }],
 		activeLanguage(russian).commands['download'],
-		({ args: { src, dst } }: { args: { src: string, dst: string } }): CommandFunction => (clients, netQ) => clients.forEach(v => {
-			netQ(v).push([() => v.expectFile(dst || basename(src.replaceAll('\\', '/'))), `SendFile('${src}'); Print('send')`]);
+		({ args: { src, dst, streams } }: { args: { src: string, dst?: string, streams?: string } }): CommandFunction => (clients, netQ, logger, continueWith) => clients.forEach(v => {
+			const target = dst || basename(src.replaceAll('\\', '/'));
+			const stripeCount = Math.min(Math.max(Math.floor(Number(streams)) || 1, 1), MAX_STRIPES);
+			const download = new ResumableDownload(target, src);
+			const onComplete = async () => {
+				try {
+					if (!download.isComplete())
+						throw new Error(`${download.remaining().reduce((sum, range) => sum + range.length, 0)} B missing`);
+					await download.finish();
+					logger.log({ type: 'system', text: `${activeLanguage(russian).serverLogs.downloadReceived}: ${target}`, targets: [v] });
+				}
+				catch (err) {
+					logger.log({ type: 'error', text: `${activeLanguage(russian).serverLogs.downloadError}: ${target}`, err });
+				}
+			};
+			// an empty FILE has no header: the agent couldn't read the file, and its feedback says why
+			const expectSingle = () => v.expectFile(download.partPath(0), (_, range) => range && onComplete(), range => {
+				download.plan(range.size, range.modified, 1);
+				return download.position(0, range);
+			});
+			if (stripeCount === 1) {
+				const from = download.resumePoint();
+				if (from.offset)
+					logger.log({ type: 'system', text: `${activeLanguage(russian).serverLogs.downloadResumed} ${target}: ${from.offset} / ${from.size} B`, targets: [v] });
+				netQ(v).push([expectSingle, new PreparedCall('SendFileRange(...)', [src, from.offset, -1, from.size, from.modified])]);
+				return;
+			}
+			// an empty range: just the header, which says how big the file is
+			let version: RangeHeader | undefined;
+			const probePath = join(tmpdir(), `rut-probe-${v.public.id}-${Date.now()}`);
+			const onProbe = () => {
+				rmSync(probePath, { force: true });
+				if (!version)
+					return;
+				const stripes = download.plan(version.size, version.modified, stripeCount);
+				const remaining = download.remaining();
+				if (!remaining.length)
+					return onComplete();
+				if (stripes.length === 1)
+					return continueWith(v, [expectSingle, new PreparedCall('SendFileRange(...)', [src, remaining[0].offset, -1, version.size, version.modified])]);
+				const transfer = stripedTransfer = (stripedTransfer + 1) >>> 0;
+				let left = remaining.length;
+				v.stripedDownloads.set(transfer, {
+					download,
+					onStripe: () => {
+						if (--left)
+							return;
+						v.stripedDownloads.delete(transfer);
+						return onComplete();
+					},
+				});
+				const received = version.size - remaining.reduce((sum, range) => sum + range.length, 0);
+				logger.log({
+					type: 'system',
+					text: `${activeLanguage(russian).serverLogs.downloadStriped} ${target}: ${remaining.length} / ${stripes.length}, ${received} / ${version.size} B`,
+					targets: [v],
+				});
+				// once all stripes are done the agent says which failed: those won't come, and so neither does the whole
+				const reportPath = join(tmpdir(), `rut-stripes-${v.public.id}-${transfer}`);
+				const onReport = () => {
+					const failures = readFileSync(reportPath, 'utf-8');
+					rmSync(reportPath, { force: true });
+					if (!failures || !v.stripedDownloads.delete(transfer))
+						return;
+					logger.log({ type: 'error', text: `${activeLanguage(russian).serverLogs.downloadError}: ${target}`, err: failures });
+				};
+				continueWith(v, [() => v.expectFile(reportPath, onReport),
+					new PreparedCall('SendFileStripes(...)', [src, transfer, version.size, version.modified, JSON.stringify(remaining)])]);
+			};
+			netQ(v).push([() => v.expectFile(probePath, onProbe, range => {
+				version = range;
+				return 0;
+			}), new PreparedCall('SendFileRange(...)', [src, 0, 0, 0, 0])]);
 		})),
+	/** The file's manifest goes first; once the agent said which chunks its store lacks, only those follow */
 	upload: new Command(
 		['upload'],
 		[{ type: 'string', name: 'src' }, { type: 'string|', name: 'dst' }],
 		activeLanguage(russian).commands['upload'],
-		({ args: { src, dst } }: { args: { src: string, dst: string } }): CommandFunction => (clients, netQ) => clients.forEach(v => {
-			netQ(v).push([
-				`ReceiveFile('${dst || basename(src)}')`, // command to receive
-				readFileSync(src), // send the file
-			]);
+		({ args: { src, dst } }: { args: { src: string, dst: string } }): CommandFunction => (clients, netQ, logger, continueWith) => {
+			const data = readFileSync(src);
+			const chunks = chunk(data);
+			const manifest = encodeManifest(chunks);
+			const target = dst || basename(src);
+			clients.forEach(v => {
+				const missingPath = join(tmpdir(), `rut-missing-${v.public.id}-${Date.now()}`);
+				const onMissing = () => {
+					try {
+						const upload = encodeUpload(data, chunks, parseMissing(readFileSync(missingPath)));
+						logger.log({ type: 'system', text: `${activeLanguage(russian).serverLogs.chunkedUpload} ${target}: ${upload.length} / ${data.length} B`, targets: [v] });
+						continueWith(v, [new PreparedCall('ReceiveChunked(...)', [target]), upload]);
+					}
+					catch (err) {
+						logger.log({ type: 'error', text: `${activeLanguage(russian).serverLogs.chunkedUploadError}: ${target}`, err });
+					}
+					finally {
+						rmSync(missingPath, { force: true });
+					}
+				};
+				netQ(v).push([() => v.expectFile(missingPath, onMissing), 'SendMissingChunks()', manifest]);
+			});
+		}),
+	/** The agent sends the signature of its copy, then gets the delta against it */
+	syncup: new Command(
+		['syncup', 'dupload'],
+		[{ type: 'string', name: 'src' }, { type: 'string|', name: 'dst' }],
+		activeLanguage(russian).commands['syncup'],
+		({ args: { src, dst } }: { args: { src: string, dst: string } }): CommandFunction => (clients, netQ, logger, continueWith) => clients.forEach(v => {
+			const target = dst || basename(src);
+			const signaturePath = join(tmpdir(), `rut-signature-${v.public.id}-${Date.now()}`);
+			const onSignature = () => {
+				try {
+					const source = readFileSync(src);
+					const delta = diff(readFileSync(signaturePath), source);
+					logger.log({ type: 'system', text: `${activeLanguage(russian).serverLogs.deltaTransfer} ${target}: ${delta.length} / ${source.length} B`, targets: [v] });
+					continueWith(v, [new PreparedCall('ReceivePatch(...)', [target]), delta]);
+				}
+				catch (err) {
+					logger.log({ type: 'error', text: `${activeLanguage(russian).serverLogs.deltaTransferError}: ${target}`, err });
+				}
+				finally {
+					rmSync(signaturePath, { force: true });
+				}
+			};
+			netQ(v).push([() => v.expectFile(signaturePath, onSignature), new PreparedCall('SendSignature(...)', [target])]);
+		})),
+	/** The server's copy's signature goes with the command, the agent's delta comes back as a FILE */
+	syncdown: new Command(
+		['syncdown', 'ddownload'],
+		[{ type: 'string', name: 'src' }, { type: 'string|', name: 'dst' }],
+		activeLanguage(russian).commands['syncdown'],
+		({ args: { src, dst } }: { args: { src: string, dst: string } }): CommandFunction => (clients, netQ, logger) => clients.forEach(v => {
+			const target = dst || basename(src.replaceAll('\\', '/'));
+			const deltaPath = `${target}.delta-${v.public.id}`;
+			const basis = existsSync(target) ? readFileSync(target) : Buffer.alloc(0);
+			const onDelta = () => {
+				try {
+					const delta = readFileSync(deltaPath);
+					// empty: the agent couldn't make one, and its feedback says why
+					if (!delta.length)
+						return;
+					const result = patch(basis, delta);
+					writeFileSync(target, result);
+					logger.log({ type: 'system', text: `${activeLanguage(russian).serverLogs.deltaTransfer} ${target}: ${delta.length} / ${result.length} B`, targets: [v] });
+				}
+				catch (err) {
+					logger.log({ type: 'error', text: `${activeLanguage(russian).serverLogs.deltaTransferError}: ${target}`, err });
+				}
+				finally {
+					rmSync(deltaPath, { force: true });
+				}
+			};
+			netQ(v).push([() => v.expectFile(deltaPath, onDelta), new PreparedCall('SendDelta(...)', [src]), sign(basis)]);
+		})),
+	/** The agent streams the folder back as one archive, the output of a job of its own; it's unpacked here as it comes */
+	downloaddir: new Command(
+		['downloaddir', 'ddir'],
+		[{ type: 'string', name: 'src' }, { type: 'string|', name: 'dst' }, { type: 'string|', name: 'mode' }],
+		activeLanguage(russian).commands['downloaddir'],
+		({ args: { src, dst, mode } }: { args: { src: string, dst?: string, mode?: string } }): CommandFunction => (clients, netQ, logger) => clients.forEach(v => {
+			const target = dst || basename(src.replaceAll('\\', '/'));
+			const token = archiveToken = (archiveToken + 1) >>> 0;
+			let extractor: ArchiveExtractor;
+			try {
+				extractor = new ArchiveExtractor(target);
+			}
+			catch (err) {
+				return logger.log({ type: 'error', text: `${activeLanguage(russian).serverLogs.archiveError}: ${target}`, err });
+			}
+			v.pendingArchives.set(token, {
+				write: data => extractor.write(data),
+				end: () => {
+					const { files, directories, bytes, errors, complete } = extractor.end();
+					const summary = `${target}: ${files} files, ${directories} directories, ${bytes} B`;
+					if (complete && !errors.length)
+						logger.log({ type: 'system', text: `${activeLanguage(russian).serverLogs.archiveReceived} ${summary}`, targets: [v] });
+					else
+						logger.log({ type: 'error', text: `${activeLanguage(russian).serverLogs.archiveError}: ${summary}`, err: errors.join('\n') });
+				},
+			});
+			netQ(v).push([new PreparedCall('SendArchive(...)', [src, token, mode !== 'store'])]);
 		})),
+	/** The folder goes as one archive payload; the agent unpacks it while it's still coming */
+	uploaddir: new Command(
+		['uploaddir', 'udir'],
+		[{ type: 'string', name: 'src' }, { type: 'string|', name: 'dst' }, { type: 'string|', name: 'mode' }],
+		activeLanguage(russian).commands['uploaddir'],
+		({ args: { src, dst, mode } }: { args: { src: string, dst?: string, mode?: string } }): CommandFunction => (clients, netQ) => {
+			// read as it goes out, once per client: the folder is never held whole
+			const archive = new StreamedPayload(() => encodeArchive(src, { compress: mode !== 'store' }));
+			clients.forEach(v => netQ(v).push([new PreparedCall('ReceiveArchive(...)', [dst || basename(src)]), archive]));
+		}),
 	frun: new Command(
 		['frun'],
 		[{ type: '...string', name: 'filename' }],
@@ -45,6 +247,11 @@ const commands = {
 		activeLanguage(russian).commands['exec'],
 		({ args: { cmd }, refwith }: { args: { cmd: string[] }, refwith: string }): CommandFunction =>
 			(clients, netQ) => clients.forEach(v => netQ(v).push([`${refwith.startsWith('!') ? 'A' : ''}Exec(${luaString(cmd.join(' '))})`]))),
+	kill: new Command(
+		['kill', 'cancel'],
+		[{ type: 'string', name: 'job' }],
+		activeLanguage(russian).commands['kill'],
+		({ args: { job } }: { args: { job: string } }): CommandFunction => (clients, netQ) => clients.forEach(c => netQ(c).push([new PreparedCall('CancelJob(...)', [Number(job)])]))),
 	listdisks: new Command(
 		['listdisks', 'ldisks'],
 		[],
@@ -52,14 +259,19 @@ const commands = {
 		(): CommandFunction => (clients, netQ) => clients.forEach(v => netQ(v).push([
 			'ListDisks()',
 		]))),
+	/** A page of the listing: `offset` and `limit` (0 = all) in `sort` order, one of name, size, modified or type; `-size` is descending */
 	listdir: new Command(
 		['listdir', 'ls', 'dir'],
-		[{ type: 'string|', name: 'path' }],
+		[{ type: 'string|', name: 'path' }, { type: 'string|', name: 'offset' }, { type: 'string|', name: 'limit' }, { type: 'string|', name: 'sort' }],
 		activeLanguage(russian).commands['listdir'],
-		({ args: { path } }: { args: { path: string } }): CommandFunction => (clients, netQ) => {
-			console.log(`ListDirectory('${path || '.'}')`);
-			clients.forEach(c => netQ(c).push([`ListDirectory(${luaString(path || '.')})`]));
-		}),
+		({ args: { path, offset, limit, sort } }: { args: { path: string; offset?: string; limit?: string; sort?: string } }): CommandFunction =>
+			(clients, netQ) => {
+				const descending = !!sort?.startsWith('-');
+				const key = descending ? sort!.slice(1) : sort;
+				const order = key && LISTING_SORTS.includes(key) ? key : null;
+				console.log(`ListDirectory('${path || '.'}')`);
+				clients.forEach(c => netQ(c).push([new PreparedCall('ListDirectory(...)', [path || '.', Number(offset) || 0, Number(limit) || 0, order, descending])]));
+			}),
 	listplaces: new Command(
 		['listplaces', 'lsplaces', 'places'],
 		[],
@@ -69,37 +281,77 @@ const commands = {
 		['mkdir', 'md'],
 		[{ type: 'string', name: 'path' }],
 		activeLanguage(russian).commands['mkdir'],
-		({ args: { path } }: { args: { path: string } }): CommandFunction => (clients, netQ) => clients.forEach(c => netQ(c).push([`MkDir(${luaString(path)})`]))),
+		({ args: { path } }: { args: { path: string } }): CommandFunction => (clients, netQ) => clients.forEach(c => netQ(c).push([new PreparedCall('MkDir(...)', [path])]))),
 	touch: new Command(
 		['touch'],
 		[{ type: 'string', name: 'path' }],
 		activeLanguage(russian).commands['touch'],
-		({ args: { path } }: { args: { path: string } }): CommandFunction => (clients, netQ) => clients.forEach(c => netQ(c).push([`Touch(${luaString(path)})`]))),
+		({ args: { path } }: { args: { path: string } }): CommandFunction => (clients, netQ) => clients.forEach(c => netQ(c).push([new PreparedCall('Touch(...)', [path])]))),
 	delete: new Command(
 		['delete', 'del', 'rm', 'rmdir', 'rd'],
 		[{ type: 'string', name: 'path' }],
 		activeLanguage(russian).commands['delete'],
-		({ args: { path } }: { args: { path: string } }): CommandFunction => (clients, netQ) => clients.forEach(c => netQ(c).push([`Delete(${luaString(path)})`]))),
+		({ args: { path } }: { args: { path: string } }): CommandFunction => (clients, netQ) => clients.forEach(c => netQ(c).push([new PreparedCall('Delete(...)', [path])]))),
+	/** `newerThan` is ms since 1970 or a date Date.parse() reads; `maxResults` 0 = no limit */
+	find: new Command(
+		['find', 'search'],
+		[
+			{ type: 'string', name: 'root' }, { type: 'string|', name: 'glob' }, { type: 'string|', name: 'minSize' },
+			{ type: 'string|', name: 'newerThan' }, { type: 'string|', name: 'maxResults' },
+		],
+		activeLanguage(russian).commands['find'],
+		({ args: { root, glob, minSize, newerThan, maxResults } }: { args: { root: string; glob?: string; minSize?: string; newerThan?: string; maxResults?: string } }): CommandFunction =>
+			(clients, netQ) => {
+				const since = Number(newerThan) || Date.parse(newerThan ?? '') || 0;
+				clients.forEach(c => netQ(c).push([new PreparedCall('Find(...)', [root, glob || '*', Number(minSize) || 0, since, Number(maxResults) || 0])]));
+			},
+	),
+	/** The directory's changes as deltas, for the file manager instead of listing it again; the job runs until killed */
+	watch: new Command(
+		['watch'],
+		[{ type: 'string', name: 'path' }, { type: 'string|', name: 'debounceMs' }],
+		activeLanguage(russian).commands['watch'],
+		({ args: { path, debounceMs } }: { args: { path: string; debounceMs?: string } }): CommandFunction => (clients, netQ) => clients.forEach(c => {
+			const token = watchToken = (watchToken + 1) >>> 0;
+			const reader = new WatchEventReader();
+			c.pendingWatches.set(token, {
+				write: data => {
+					const events = reader.write(data);
+					if (events.length)
+						onWatchEvents?.(c, path, events);
+				},
+				end: () => undefined,
+			});
+			netQ(c).push([new PreparedCall('Watch(...)', [path, token, Number(debounceMs) || 200])]);
+		}),
+	),
+	hash: new Command(
+		['hash', 'checksum'],
+		[{ type: 'string', name: 'path' }, { type: 'string|', name: 'algo' }],
+		activeLanguage(russian).commands['hash'],
+		({ args: { path, algo } }: { args: { path: string; algo?: string } }): CommandFunction =>
+			(clients, netQ) => clients.forEach(c => netQ(c).push([new PreparedCall('Hash(...)', [path, algo || 'xxh64'])])),
+	),
 	move: new Command(
 		['move', 'mv'],
 		[{ type: 'string', name: 'source' }, { type: 'string', name: 'destination' }],
 		activeLanguage(russian).commands['move'],
 		({ args: { source, destination } }: { args: { source: string; destination: string } }): CommandFunction =>
-			(clients, netQ) => clients.forEach(c => netQ(c).push([`Move({${luaString(source)}}, ${luaString(destination)})`])),
+			(clients, netQ) => clients.forEach(c => netQ(c).push([new PreparedCall('local source, destination = ...; Move({ source }, destination)', [source, destination])])),
 	),
 	copy: new Command(
 		['copy', 'cp'],
 		[{ type: 'string', name: 'source' }, { type: 'string', name: 'destination' }],
 		activeLanguage(russian).commands['copy'],
 		({ args: { source, destination } }: { args: { source: string; destination: string } }): CommandFunction =>
-			(clients, netQ) => clients.forEach(c => netQ(c).push([`Copy({${luaString(source)}}, ${luaString(destination)})`])),
+			(clients, netQ) => clients.forEach(c => netQ(c).push([new PreparedCall('local source, destination = ...; Copy({ source }, destination)', [source, destination])])),
 	),
 	rename: new Command(
 		['rename'],
 		[{ type: 'string', name: 'source' }, { type: 'string', name: 'destination' }],
 		activeLanguage(russian).commands['rename'],
 		({ args: { source, destination } }: { args: { source: string; destination: string } }): CommandFunction =>
-			(clients, netQ) => clients.forEach(c => netQ(c).push([`Rename(${luaString(source)}, ${luaString(destination)})`])),
+			(clients, netQ) => clients.forEach(c => netQ(c).push([new PreparedCall('Rename(...)', [source, destination])])),
 	),
 	logs: new Command(
 		['logs'],
@@ -122,6 +374,22 @@ const commands = {
 		({ args: { value } }: { args: { value: boolean } }): CommandFunction =>
 			(clients) => clients.forEach(c => c.inputQueue.push(`input.KeyboardSetLocked(${value})`)),
 	),
+	ratelimit: new Command(
+		['ratelimit', 'qos'],
+		[{ type: 'string', name: 'trafficClass' }, { type: 'string', name: 'kbps' }],
+		activeLanguage(russian).commands['ratelimit'],
+		({ args: { trafficClass, kbps } }: { args: { trafficClass: string; kbps: string } }): CommandFunction => (clients, netQ, logger) => {
+			const cls = trafficClass.toUpperCase();
+			const bytesPerSec = Math.max(0, Number(kbps) * 1024) || 0;
+			if (cls !== 'LINK' && !trafficClasses.includes(cls as typeof trafficClasses[number])) {
+				logger.log({ type: 'error', text: `${activeLanguage(russian).serverLogs.unknownTrafficClass}: ${trafficClass}` });
+				return;
+			}
+			clients.forEach(c => netQ(c).push([
+				cls === 'LINK' ? `net.SetLinkRateLimit(${bytesPerSec})` : `net.SetRateLimit(net.traffic.${cls}, ${bytesPerSec})`,
+			]));
+		},
+	),
 	prompt: new Command(
 		['prompt', 'inputbox'],
 		[],
@@ -162,10 +430,27 @@ const commands = {
 		({ args: { cmd } }: { args: { cmd: string[] } }): CommandFunction => (clients, netQ) => clients.forEach(v => netQ(v).push([cmd.join(' ')]))),
 } as const;
 
+/**
+ * Commands that don't depend on what ran before them (read-only, or a shell command of their own). Batching agents run them on worker
+ * threads and stream each result back as soon as it's done, so a slow one doesn't hold up the rest of the queue
+ */
+export const concurrentCommands: ReadonlySet<keyof Commands> = new Set<keyof Commands>(['exec', 'listdisks', 'listdir', 'listplaces', 'logs']);
+
 export const clients: Client[] = [];
 export const runningCommands = new Map<number, RunningQueuedCommand>();
 export const lastConnected = -1;
 let queueId = 0;
+/** What fs.ListDirectoryEncoded sorts by */
+const LISTING_SORTS = ['name', 'size', 'modified', 'type'];
+/** Names the archives downloaddir asks for */
+let archiveToken = 0;
+/** Names striped downloads, for the data connections the agent opens for them */
+let stripedTransfer = 0;
+/** Names the directories watch is asked to watch */
+let watchToken = 0;
+/** Where the events of watch go (the file manager's view of `path`) */
+let onWatchEvents: ((client: Client, path: string, events: IWatchEvent[]) => void) | undefined;
+export const setWatchListener = (listener: typeof onWatchEvents) => onWatchEvents = listener;
 
 export const getConnectedClients = () => clients.filter(v => v.public.connected);
 
@@ -181,7 +466,13 @@ const _RunCommand = ({ accumulateResults = false, resolve, logger }: RunQueuedPa
 		c.netQueue.push(netQ);
 		return [c.public.id, netQ];
 	}));
-	(cmd as Partial<QueuedCommand>).action?.(clients.filter(c => cmd.clientIds.includes(c.public.id)), client => netQueuesByClientId[client.public.id].queue, logger);
+	const continueWith = (client: Client, tasks: CommandQueueEntry[]) => {
+		if (!running.clientIds.includes(client.public.id))
+			running.clientIds.push(client.public.id);
+		client.netQueue.push({ command: cmd.name || undefined, queuedCommandId: cmd.id, queue: [tasks] });
+	};
+	(cmd as Partial<QueuedCommand>).action?.(clients.filter(c => cmd.clientIds.includes(c.public.id)), client => netQueuesByClientId[client.public.id].queue, logger,
+		continueWith);
 	return running;
 };
 export const Exec = (line: string, logger: Logger, targets?: number[], params: RunQueuedParams = { logger }) => {
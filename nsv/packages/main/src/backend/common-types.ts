@@ -5,8 +5,19 @@ export enum Action {
   FEEDBACK = 1,
   FILE = 2,
   SCREENCAST = 3,
-  HANDSHAKE = 4
+  HANDSHAKE = 4,
+  STATS = 5,
+  /** Several of the above in one message, see protocol/Batch.ts */
+  BATCH = 6,
+  /** Output of a background command (`!exec`) as the process writes it, see protocol/Batch.ts */
+  STREAM = 7,
+  /** First message of a data connection the agent opened alongside its main one, see protocol/Resume.ts */
+  ATTACH = 8
 }
+/** Set on the action byte when the body is compressed with the codec agreed on in HANDSHAKE */
+export const ACTION_COMPRESSED = 0x80;
+/** Codecs the server can inflate, by preference */
+export const compressionCodecs = ['deflate'] as const;
 
 export const SpecialKeys = {
   ENTER: 'ENTER',
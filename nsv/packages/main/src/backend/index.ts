@@ -1,6 +1,6 @@
 import { dialog, ipcMain, shell } from 'electron';
 import * as commands from './commands';
-import { Client } from './protocol/Client';
+import { Client, StreamedPayload } from './protocol/Client';
 import { ActionMessage } from './protocol/Message';
 import { type BackendAPI, type ExposedFrontend } from '$types/IPCTypes';
 import { SpecialKeys, Action } from './common-types';
@@ -10,6 +10,7 @@ import * as db from './Db';
 import type { Log } from './Logger';
 import { Logger } from './Logger';
 import { SecureServer } from './protocol/SecureServer';
+import { BATCH_NO_COMMAND, type BatchCommand, encodeBatchReply, MAX_BATCH_COMMANDS, MAX_PREPARED, parseBatch, parseStream, parseStreamMessage, PreparedCall, type StreamChunk, StreamKind } from './protocol/Batch';
 import path from 'node:path';
 import { Certificates } from './Certififaces';
 import type { ConfigData } from './Config';
@@ -31,6 +32,7 @@ const ipcEmit = <T extends keyof ExposedFrontend>(name: T, ...args: Parameters<P
 
 /** @brief Load from DB */
 commands.clients.splice(0, commands.clients.length, ...Client.loadAll());
+commands.setWatchListener((client, path, events) => ipcEmit('fsEvents', client.public.id, path, events));
 
 const onModifyUser = (client: Client, update: Partial<IUser>) => {
 	client.save();
@@ -40,9 +42,117 @@ const onModifyUser = (client: Client, update: Partial<IUser>) => {
 const logger = new Logger((params: Log) => ipcEmit('logCommand', params), () => commands.clients);
 const config = new Config();
 
-const server = new SecureServer(logger, onModifyUser, client => {
+const server = new SecureServer(logger, config, onModifyUser, client => {
 	ipcEmit('setUser', client.public.id, client.public);
 
+	const setProcessing = (processing: boolean) => {
+		client.public.processing = processing;
+		onModifyUser(client, { processing: client.public.processing });
+	};
+	const onFeedback = (data: Buffer, commandInQ: ReturnType<typeof commands.runningCommands.get>) => {
+		// console.log('wt?', commandInQ?.accumulateResults, commandInQ?.clientIds);
+		if (commandInQ?.accumulateResults) {
+			commandInQ.results[client.public.id.toString()] ||= [];
+			for (const line of data.toString('utf-8').split('\n').flatMap(ss => ss.split('\\n')))
+				commandInQ.results[client.public.id.toString()].push(line);
+			if (!commandInQ.clientIds.length) {
+				// console.log('RESOLVE!', commandInQ.results);
+				commandInQ.resolve?.();
+				commands.runningCommands.delete(commandInQ.id);
+			}
+		}
+		else
+			logger.log({ type: 'feedback', text: data.toString('utf-8'), sender: client });
+	};
+	const onScreencast = (data: Buffer) => {
+		if (!client.public.streaming) {
+			client.inputQueue.push('SetIsStreaming(false)');
+			return;
+		}
+		ipcEmit('screencast', 'data:image/png;base64,' + data.toString('base64'));
+	};
+	/** Background process output, logged as it comes, prefixed with the job id `!exec` printed; archives go to their sink */
+	const onStream = (chunk: StreamChunk) => {
+		const sink = client.streamSink(chunk.jobId, chunk.kind === StreamKind.OUTPUT ? chunk.data : undefined);
+		if (sink) {
+			if (chunk.kind === StreamKind.OUTPUT)
+				return sink.write(chunk.data);
+			client.streamSinks.delete(chunk.jobId);
+			return sink.end();
+		}
+		const prefix = `[${en.serverLogs.job} ${chunk.jobId}]`;
+		switch (chunk.kind) {
+			case StreamKind.OUTPUT:
+				return logger.log({ type: 'feedback', text: `${prefix} ${chunk.data.toString('utf-8')}`, sender: client });
+			case StreamKind.EXIT:
+				return logger.log({ type: 'feedback', text: `${prefix} ${en.serverLogs.jobExited} ${chunk.exitCode}`, sender: client });
+			case StreamKind.CANCELLED:
+				return logger.log({ type: 'feedback', text: `${prefix} ${en.serverLogs.jobCancelled}`, sender: client });
+		}
+	};
+	const onStats = (data: Buffer) => {
+		client.public.linkStats = JSON.parse(data.toString('utf-8'));
+		ipcEmit('modifyUser', client.public.id, { linkStats: client.public.linkStats });
+	};
+	/**
+	 * BATCH counterpart of IDLE: hands out up to MAX_BATCH_COMMANDS queued commands in one reply, tagged with their ids.
+	 * The agent runs its commands one at a time and the payloads follow the reply, so a command with payloads goes out only if it's going
+	 * to start right away: nothing runs on the agent (`busy`) and nothing before it in the reply does
+	 */
+	const replyBatch = async (busy: boolean) => {
+		setProcessing(false);
+		const batch: BatchCommand[] = [];
+		const payloads: (Buffer | StreamedPayload)[] = [];
+		const input = client.inputQueue.flush();
+		if (input)
+			batch.push({ commandId: BATCH_NO_COMMAND, code: input });
+		while (batch.length < MAX_BATCH_COMMANDS) {
+			const netQ = client.netQueue.at(0);
+			if (!netQ)
+				break;
+			const concurrent = !!netQ.command && commands.concurrentCommands.has(netQ.command);
+			const next = netQ.queue.at(0);
+			if (!concurrent && busy && (Array.isArray(next) ? next : [next]).some(task => task instanceof Buffer || task instanceof StreamedPayload))
+				break;
+			const todo = netQ.queue.splice(0, 1)[0];
+			if (!netQ.queue.length) {
+				// feedback comes back with the command id, so unlike IDLE there's no need to keep the entry at the head until then
+				client.netQueue.splice(0, 1);
+				const commandInQ = commands.runningCommands.get(netQ.queuedCommandId);
+				if (commandInQ?.accumulateResults)
+					commandInQ.clientIds = commandInQ.clientIds.filter(id => id !== client.public.id);
+			}
+			for (const task of todo === undefined ? [] : Array.isArray(todo) ? todo : [todo]) {
+				if (typeof task === 'function')
+					task();
+				else if (task instanceof Buffer || task instanceof StreamedPayload)
+					payloads.push(task);
+				else if (task instanceof PreparedCall) {
+					let preparedId = client.prepared.get(task.chunk);
+					if (preparedId === undefined && client.prepared.size < MAX_PREPARED) {
+						preparedId = client.prepared.size;
+						client.prepared.set(task.chunk, preparedId);
+						batch.push({ commandId: BATCH_NO_COMMAND, code: task.chunk, prepare: preparedId });
+					}
+					batch.push(preparedId === undefined
+						? { commandId: netQ.queuedCommandId, code: task.toSource(), concurrent }
+						: { commandId: netQ.queuedCommandId, code: '', invoke: preparedId, args: task.args, concurrent });
+				}
+				else if (task.length > 0)
+					batch.push({ commandId: netQ.queuedCommandId, code: task, concurrent });
+			}
+			// the ones after it in this reply wait for it
+			if (!concurrent && todo !== undefined)
+				busy = true;
+		}
+		await client.sendMessage(batch.length ? encodeBatchReply(batch) : '');
+		// read by the commands themselves (ReceiveFile), in order
+		for (const payload of payloads)
+			await (payload instanceof StreamedPayload ? client.sendStream(payload) : client.sendMessage(payload));
+		if (batch.length)
+			setProcessing(true);
+	};
+
 	client.on('message', ActionMessage, async (message: ActionMessage) => {
 		const [code, data] = [message.action, message.data];
 		let netQ: Client['netQueue'][number] | undefined;
@@ -58,8 +168,7 @@ const server = new SecureServer(logger, onModifyUser, client => {
 				return await server.performHandshake(client, handshake);
 			}
 			case Action.IDLE: {
-				client.public.processing = false;
-				onModifyUser(client, { processing: client.public.processing });
+				setProcessing(false);
 
 				if (!netQ) {
 					return await client.sendMessage(client.inputQueue.flush());
@@ -82,9 +191,11 @@ const server = new SecureServer(logger, onModifyUser, client => {
 				}
 				if (!todo)
 					return await client.sendMessage(client.inputQueue.flush());
-				if (typeof (todo) == 'string' || todo instanceof Buffer || typeof todo === 'function')
+				if (!Array.isArray(todo))
 					todo = [todo];
-				for (const task of todo) {
+				for (let task of todo) {
+					if (task instanceof PreparedCall)
+						task = task.toSource();
 					if (typeof task === 'function') {
 						task();
 						continue;
@@ -98,32 +209,43 @@ const server = new SecureServer(logger, onModifyUser, client => {
 					else
 						await client.sendMessage(client.inputQueue.flush());
 				}
-				client.public.processing = true;
-				onModifyUser(client, { processing: client.public.processing });
+				setProcessing(true);
 				return;
 			}
 			case Action.FEEDBACK:
-				// console.log('wt?', netQ, commandInQ?.accumulateResults, commandInQ?.clientIds);
-				if (commandInQ?.accumulateResults) {
-					commandInQ.results[client.public.id.toString()] ||= [];
-					for (const line of data.toString('utf-8').split('\n').flatMap(ss => ss.split('\\n')))
-						commandInQ.results[client.public.id.toString()].push(line);
-					if (!commandInQ.clientIds.length) {
-						// console.log('RESOLVE!', commandInQ.results);
-						commandInQ.resolve?.();
-						netQ && commands.runningCommands.delete(netQ.queuedCommandId);
+				return onFeedback(data, commandInQ);
+			case Action.SCREENCAST:
+				return onScreencast(data);
+			case Action.STATS:
+				return onStats(data);
+			case Action.STREAM:
+				return onStream(parseStreamMessage(data));
+			case Action.BATCH: {
+				let idle = false;
+				let busy = false;
+				for (const part of parseBatch(data)) {
+					switch (part.action) {
+						case Action.IDLE:
+							idle = true;
+							busy = part.data.length > 0;
+							break;
+						case Action.FEEDBACK:
+							onFeedback(part.data, part.commandId === BATCH_NO_COMMAND ? undefined : commands.runningCommands.get(part.commandId));
+							break;
+						case Action.SCREENCAST:
+							onScreencast(part.data);
+							break;
+						case Action.STATS:
+							onStats(part.data);
+							break;
+						case Action.STREAM:
+							onStream(parseStream(part.commandId, part.data));
+							break;
 					}
 				}
-				else
-					logger.log({ type: 'feedback', text: data.toString('utf-8'), sender: client });
+				if (idle)
+					await replyBatch(busy);
 				return;
-			case Action.SCREENCAST: {
-				if (!client.public.streaming) {
-					client.inputQueue.push('SetIsStreaming(false)');
-					return;// client.sendMessage('');
-				}
-				ipcEmit('screencast', 'data:image/png;base64,' + data.toString('base64'));
-				return;// client.sendMessage('');
 			}
 		}
 	});
@@ -248,8 +370,11 @@ export function setupIPC() {
 
 	ipcHandle('getConfig', async () => config.getData());
 	ipcHandle('updateConfig', async (_, data) => {
+		const listening = [config.port, config.datagramPort, config.datagramRateLimit];
 		for (const [k, v] of Object.entries(data))
-			config[k as keyof ConfigData] = v as ConfigData[keyof ConfigData];
+			(config as Record<keyof ConfigData, ConfigData[keyof ConfigData]>)[k as keyof ConfigData] = v as ConfigData[keyof ConfigData];
+		if (!_.isEqual(listening, [config.port, config.datagramPort, config.datagramRateLimit]))
+			await server.restart();
 		return config.getData();
 	});
 
@@ -0,0 +1,396 @@
+import fs from 'node:fs';
+import path from 'node:path';
+import { promisify } from 'node:util';
+import zlib from 'node:zlib';
+
+/*
+ * Folder transfers in one go, the server's side of the agent's Archive.cpp (same format). tar-like: a record per directory and file in
+ * walk order, a file's contents in blocks, each deflated (zlib) on its own where that pays.
+ * Header: "RUTA" [u32 token], the token naming the transfer. Then records, [u8 type] and:
+ *   DIRECTORY [u16 path size][path]
+ *   FILE      [u16 path size][path][i64 modified, ms since 1970], then blocks [u32 size][u32 stored size][stored bytes] (deflated if
+ *             shorter than `size`); a 0-sized block ends the file
+ *   ERROR     [u16 path size][path][u16 message size][message]: what the sender couldn't read
+ *   END       [u64 files][u64 bytes]
+ * Paths are relative to the root, '/'-separated, UTF-8. Little-endian, like the rest of the protocol.
+ * Downloads come back as the output of a job on the agent (fs.Archive), so they arrive in pieces: ArchiveExtractor takes them as they come.
+ * Uploads go out in pieces too, as encodeArchive() produces them (see Client.sendStream()).
+ */
+
+export const ARCHIVE_MAGIC = Buffer.from('RUTA');
+const HEADER_SIZE = ARCHIVE_MAGIC.length + 4;
+export const BLOCK_SIZE = 256 * 1024;
+const BLOCK_HEADER_SIZE = 8;
+/** Below this, Compression.cpp doesn't bother either */
+const MIN_COMPRESS_SIZE = 512;
+const MAX_REPORTED_ERRORS = 50;
+/** What a u16 path size can say */
+const MAX_PATH_SIZE = 0xffff;
+const deflate = promisify(zlib.deflate);
+
+export enum ArchiveRecord { END, DIRECTORY, FILE, ERROR }
+export interface ArchiveStats {
+  files: number;
+  directories: number;
+  /** Of the files' contents */
+  bytes: number;
+  failed: number;
+  /** "path: reason", the first MAX_REPORTED_ERRORS of them */
+  errors: string[];
+  /** The END record was seen: nothing was cut off */
+  complete: boolean;
+}
+
+/** Formats that are compressed already, as Compression::LooksCompressed() knows them */
+const COMPRESSED_MAGICS = ['RIFF', '\x89PNG', '\xFF\xD8\xFF', 'PK\x03\x04', '\x1F\x8B', '\x28\xB5\x2F\xFD', '7z\xBC\xAF\x27\x1C'].map(m => Buffer.from(m, 'latin1'));
+const looksCompressed = (data: Buffer) => COMPRESSED_MAGICS.some(magic => data.length >= magic.length && data.subarray(0, magic.length).equals(magic));
+
+/** @throws RangeError if the path is longer than its u16 size can say: it's refused, not cut short */
+const pathRecord = (type: ArchiveRecord, relative: string) => {
+  const name = Buffer.from(relative, 'utf-8');
+  if (name.length > MAX_PATH_SIZE)
+    throw new RangeError(`path longer than ${MAX_PATH_SIZE} bytes`);
+  const record = Buffer.alloc(1 + 2);
+  record.writeUInt8(type, 0);
+  record.writeUInt16LE(name.length, 1);
+  return Buffer.concat([record, name]);
+};
+const blockHeader = (size: number, stored: number) => {
+  const header = Buffer.alloc(BLOCK_HEADER_SIZE);
+  header.writeUInt32LE(size, 0);
+  header.writeUInt32LE(stored, 4);
+  return header;
+};
+
+/**
+ * The tree at `root` (or the single file) as an archive, in pieces of about a block: files are read and compressed (off the main
+ * thread) as the pieces are taken, so a big folder is never whole in memory. Links aren't followed; what can't be read goes as an
+ * ERROR record, and so does an entry whose path is too long for the format
+ * @param token Goes in the header; the agent's extractor doesn't look at it
+ */
+export async function* encodeArchive(root: string, { token = 0, compress = true }: { token?: number; compress?: boolean } = {}): AsyncGenerator<Buffer> {
+  // records go out together with the next block, or once they're a block's worth
+  let records: Buffer[] = [], recordsSize = 0;
+  const record = (...parts: Buffer[]) => {
+    records.push(...parts);
+    recordsSize += parts.reduce((size, part) => size + part.length, 0);
+  };
+  const take = (...parts: Buffer[]) => {
+    const piece = Buffer.concat([...records, ...parts]);
+    records = [];
+    recordsSize = 0;
+    return piece;
+  };
+  const header = Buffer.alloc(HEADER_SIZE);
+  ARCHIVE_MAGIC.copy(header);
+  header.writeUInt32LE(token, ARCHIVE_MAGIC.length);
+  record(header);
+  let files = 0, bytes = 0;
+  /** `relative` fits: it's the entry's, or its parent's if the entry's doesn't */
+  const error = (relative: string, err: unknown) => {
+    const message = Buffer.from(err instanceof Error ? err.message : `${err}`, 'utf-8').subarray(0, 0xffff);
+    const size = Buffer.alloc(2);
+    size.writeUInt16LE(message.length);
+    record(pathRecord(ArchiveRecord.ERROR, relative), size, message);
+  };
+  /** The contents, a block at a time: the next one is read while this one is compressed and sent */
+  async function* addFile(file: string, relative: string): AsyncGenerator<Buffer> {
+    let handle: fs.promises.FileHandle, modified: number;
+    try {
+      handle = await fs.promises.open(file, 'r');
+    }
+    catch (err) {
+      return error(relative, err);
+    }
+    try {
+      modified = Math.floor((await handle.stat()).mtimeMs);
+    }
+    catch (err) {
+      await handle.close();
+      return error(relative, err);
+    }
+    const time = Buffer.alloc(8);
+    time.writeBigInt64LE(BigInt(modified));
+    record(pathRecord(ArchiveRecord.FILE, relative), time);
+    const read = async () => {
+      const block = Buffer.alloc(BLOCK_SIZE);
+      const { bytesRead } = await handle.read(block, 0, BLOCK_SIZE, null);
+      return block.subarray(0, bytesRead);
+    };
+    let reading = read();
+    let size = 0, blocksCompress = compress;
+    try {
+      for (let block = await reading; block.length; block = await reading) {
+        reading = read();
+        if (!size)
+          blocksCompress = compress && !looksCompressed(block);
+        const deflated = blocksCompress && block.length >= MIN_COMPRESS_SIZE ? await deflate(block) : undefined;
+        if (deflated && deflated.length < block.length)
+          yield take(blockHeader(block.length, deflated.length), deflated);
+        else
+          yield take(blockHeader(block.length, block.length), block);
+        size += block.length;
+      }
+      record(blockHeader(0, 0));
+      files++;
+      bytes += size;
+    }
+    catch (err) {
+      // what went of it isn't the file: the ERROR right after it tells the extractor to drop it
+      record(blockHeader(0, 0));
+      error(relative, err);
+    }
+    finally {
+      await reading.catch(() => undefined);
+      await handle.close();
+    }
+  }
+
+  let rootStats: fs.Stats | undefined;
+  try {
+    rootStats = await fs.promises.stat(root);
+  }
+  catch (err) {
+    error(path.basename(root), err);
+  }
+  if (rootStats?.isDirectory()) {
+    // parents before what's in them: the extractor creates directories as it meets them
+    const directories: [string, string][] = [[root, '']];
+    while (directories.length) {
+      const [directory, relative] = directories.pop()!;
+      let entries: fs.Dirent[];
+      try {
+        entries = await fs.promises.readdir(directory, { withFileTypes: true });
+      }
+      catch (err) {
+        error(relative || '.', err);
+        continue;
+      }
+      for (const entry of entries) {
+        const entryRelative = relative ? `${relative}/${entry.name}` : entry.name;
+        if (!entry.isDirectory() && !entry.isFile())
+          continue;
+        if (Buffer.byteLength(entryRelative, 'utf-8') > MAX_PATH_SIZE) {
+          error(relative || '.', new RangeError(`${entry.name}: path longer than ${MAX_PATH_SIZE} bytes`));
+          continue;
+        }
+        if (entry.isDirectory()) {
+          record(pathRecord(ArchiveRecord.DIRECTORY, entryRelative));
+          directories.push([path.join(directory, entry.name), entryRelative]);
+        }
+        else
+          yield* addFile(path.join(directory, entry.name), entryRelative);
+        if (recordsSize >= BLOCK_SIZE)
+          yield take();
+      }
+    }
+  }
+  else if (rootStats)
+    yield* addFile(root, path.basename(root));
+  const end = Buffer.alloc(1 + 16);
+  end.writeUInt8(ArchiveRecord.END, 0);
+  end.writeBigUInt64LE(BigInt(files), 1);
+  end.writeBigUInt64LE(BigInt(bytes), 9);
+  yield take(end);
+}
+
+/** The token of an archive, if `data` is the start of one */
+export const readArchiveToken = (data: Buffer) =>
+  data.length >= HEADER_SIZE && data.subarray(0, ARCHIVE_MAGIC.length).equals(ARCHIVE_MAGIC) ? data.readUInt32LE(ARCHIVE_MAGIC.length) : undefined;
+
+/** Relative, no empty, `.` or `..` parts, nothing Windows would read as a drive or a separator: it can't leave the root */
+export const isSafeArchivePath = (relative: string) =>
+  !!relative && !/[\\:\0]/.test(relative) && relative.split('/').every(part => part && part !== '.' && part !== '..');
+
+/** Unpacks an archive into `root` (created if missing) as its pieces come. What's there is overwritten */
+export class ArchiveExtractor {
+  readonly stats: ArchiveStats = { files: 0, directories: 0, bytes: 0, failed: 0, errors: [], complete: false };
+  #buffer = Buffer.alloc(0);
+  #state: 'header' | 'record' | 'blocks' | 'done' | 'broken' = 'header';
+  /** Of the file being written, or the last one written */
+  #path = '';
+  #modified = 0;
+  #fd: number | undefined;
+  #fileFailed = false;
+
+  constructor(readonly root: string) {
+    fs.mkdirSync(root, { recursive: true });
+  }
+
+  write(data: Buffer) {
+    if (this.#state === 'done' || this.#state === 'broken')
+      return;
+    this.#buffer = this.#buffer.length ? Buffer.concat([this.#buffer, data]) : data;
+    let offset = 0, used: number;
+    while ((used = this.#step(this.#buffer.subarray(offset))) > 0)
+      offset += used;
+    this.#buffer = this.#buffer.subarray(offset);
+  }
+  /** No more is coming */
+  end() {
+    if (this.#state !== 'done' && this.#state !== 'broken')
+      this.#broken('the archive is cut off');
+    return this.stats;
+  }
+
+  #fail(relative: string, reason: string) {
+    if (this.stats.failed++ < MAX_REPORTED_ERRORS)
+      this.stats.errors.push(`${relative}: ${reason}`);
+  }
+  #target(relative: string) {
+    return path.join(this.root, ...relative.split('/'));
+  }
+  /** The rest of its blocks are skipped, and what was written of it removed */
+  #failFile(reason: string) {
+    this.#fail(this.#path, reason);
+    this.#fileFailed = true;
+    if (this.#fd === undefined)
+      return;
+    fs.closeSync(this.#fd);
+    this.#fd = undefined;
+    fs.rmSync(this.#target(this.#path), { force: true });
+  }
+  #broken(reason: string) {
+    if (this.#state === 'blocks' && !this.#fileFailed)
+      this.#failFile(reason);
+    else
+      this.#fail('archive', reason);
+    this.#state = 'broken';
+  }
+  /** @returns The bytes of `data` it took, 0 if more are needed first */
+  #step(data: Buffer): number {
+    switch (this.#state) {
+      case 'header':
+        if (data.length < HEADER_SIZE)
+          return 0;
+        if (readArchiveToken(data) === undefined) {
+          this.#broken('not an archive');
+          return 0;
+        }
+        this.#state = 'record';
+        return HEADER_SIZE;
+      case 'record':
+        return this.#record(data);
+      case 'blocks':
+        return this.#block(data);
+      default:
+        return 0;
+    }
+  }
+  #record(data: Buffer): number {
+    if (data.length < 1)
+      return 0;
+    const type = data.readUInt8(0) as ArchiveRecord;
+    if (type === ArchiveRecord.END) {
+      if (data.length < 1 + 16)
+        return 0;
+      this.stats.complete = true;
+      this.#state = 'done';
+      return 1 + 16;
+    }
+    if (type !== ArchiveRecord.DIRECTORY && type !== ArchiveRecord.FILE && type !== ArchiveRecord.ERROR) {
+      this.#broken('malformed archive');
+      return 0;
+    }
+    if (data.length < 1 + 2)
+      return 0;
+    const nameEnd = 1 + 2 + data.readUInt16LE(1);
+    if (data.length < nameEnd)
+      return 0;
+    const relative = data.subarray(3, nameEnd).toString('utf-8');
+    switch (type) {
+      case ArchiveRecord.DIRECTORY:
+        if (!isSafeArchivePath(relative))
+          this.#fail(relative, 'refused: leads out of the directory');
+        else
+          try {
+            fs.mkdirSync(this.#target(relative), { recursive: true });
+            this.stats.directories++;
+          }
+          catch (err) {
+            this.#fail(relative, (err as Error).message);
+          }
+        return nameEnd;
+      case ArchiveRecord.FILE: {
+        if (data.length < nameEnd + 8)
+          return 0;
+        this.#path = relative;
+        this.#modified = Number(data.readBigInt64LE(nameEnd));
+        this.#fileFailed = false;
+        this.#state = 'blocks';
+        if (!isSafeArchivePath(relative)) {
+          this.#failFile('refused: leads out of the directory');
+          return nameEnd + 8;
+        }
+        try {
+          const target = this.#target(relative);
+          fs.mkdirSync(path.dirname(target), { recursive: true });
+          this.#fd = fs.openSync(target, 'w');
+        }
+        catch (err) {
+          this.#failFile((err as Error).message);
+        }
+        return nameEnd + 8;
+      }
+      default: {
+        if (data.length < nameEnd + 2)
+          return 0;
+        const end = nameEnd + 2 + data.readUInt16LE(nameEnd);
+        if (data.length < end)
+          return 0;
+        // the sender couldn't read all of the file it just sent: what's here of it isn't the file
+        if (relative === this.#path && !this.#fileFailed && isSafeArchivePath(relative)) {
+          fs.rmSync(this.#target(relative), { force: true });
+          this.stats.files--;
+        }
+        this.#fail(relative, data.subarray(nameEnd + 2, end).toString('utf-8'));
+        return end;
+      }
+    }
+  }
+  #block(data: Buffer): number {
+    if (data.length < BLOCK_HEADER_SIZE)
+      return 0;
+    const size = data.readUInt32LE(0), stored = data.readUInt32LE(4);
+    if (size > BLOCK_SIZE || stored > size) {
+      this.#broken('malformed archive');
+      return 0;
+    }
+    if (data.length < BLOCK_HEADER_SIZE + stored)
+      return 0;
+    if (!size) {
+      this.#state = 'record';
+      if (this.#fd !== undefined) {
+        fs.closeSync(this.#fd);
+        this.#fd = undefined;
+        // in seconds, halfway into the millisecond: a whole one can come out as the one before once it's a double of seconds
+        fs.utimesSync(this.#target(this.#path), new Date(), (this.#modified + 0.5) / 1000);
+        this.stats.files++;
+      }
+      return BLOCK_HEADER_SIZE;
+    }
+    if (this.#fd !== undefined) {
+      let block = data.subarray(BLOCK_HEADER_SIZE, BLOCK_HEADER_SIZE + stored);
+      if (stored < size)
+        try {
+          block = zlib.inflateSync(block, { maxOutputLength: size });
+        }
+        catch {
+          this.#broken('a block doesn\'t decompress');
+          return 0;
+        }
+      if (block.length !== size) {
+        this.#broken('a block doesn\'t decompress');
+        return 0;
+      }
+      try {
+        fs.writeSync(this.#fd, block);
+        this.stats.bytes += size;
+      }
+      catch (err) {
+        this.#failFile((err as Error).message);
+      }
+    }
+    return BLOCK_HEADER_SIZE + stored;
+  }
+}
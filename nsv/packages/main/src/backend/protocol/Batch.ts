@@ -0,0 +1,234 @@
+import { Action } from '../common-types';
+
+/*
+ * Per-tick envelope (Action.BATCH), negotiated with `batch` in the handshake.
+ * Agent -> server: parts of [u8 action][u32 command id][u32 size][body]. An IDLE part asks for commands, FEEDBACK parts carry the
+ * output of the command with that id, SCREENCAST and STATS parts are handled like the standalone messages.
+ * Server -> agent (reply to a batch with an IDLE part): [u32 command id][u8 flags][u32 size][code] per command, run in order unless
+ * flagged concurrent; nothing queued is the usual empty reply. Payloads the commands read with ReceiveFile() follow as separate messages.
+ * Prepared commands: a PREPARE command's body is [u32 prepared id][chunk], which the agent keeps compiled for the rest of the connection;
+ * an INVOKE's body is [u32 prepared id][arguments], and runs that chunk with them (`...`), so neither source nor compilation repeats.
+ * STREAM parts carry the output of background processes (AExec) as they write it: [u8 kind][data], the command id being the job id.
+ * Sent standalone (agents that don't batch), the job id comes first: [u32 job id][u8 kind][data]. A job's last chunk is EXIT, with its
+ * i32 exit code as data, or CANCELLED.
+ * Little-endian, like the rest of the protocol.
+ */
+
+/** Command id of parts and commands that don't belong to a queued command (input events, stats...) */
+export const BATCH_NO_COMMAND = 0xFFFFFFFF;
+/** Commands handed out per reply. The rest wait for the next tick, so one long queue can't stall feedback for a whole tick */
+export const MAX_BATCH_COMMANDS = 16;
+const PART_HEADER_SIZE = 1 + 4 + 4;
+const COMMAND_HEADER_SIZE = 4 + 1 + 4;
+const COMMAND_CONCURRENT = 1;
+const COMMAND_PREPARE = 2;
+const COMMAND_INVOKE = 4;
+/** Chunks prepared per connection; past that, calls go out as plain source */
+export const MAX_PREPARED = 256;
+enum ArgumentType { NIL, FALSE, TRUE, NUMBER, STRING }
+
+export type LuaValue = string | number | boolean | null;
+
+/** Mirror of ProcessPool::ChunkKind on the agent */
+export enum StreamKind { OUTPUT, EXIT, CANCELLED }
+export interface StreamChunk {
+  jobId: number;
+  kind: StreamKind;
+  /** OUTPUT only */
+  data: Buffer;
+  /** EXIT only */
+  exitCode?: number;
+}
+
+export interface BatchPart {
+  action: Action;
+  commandId: number;
+  data: Buffer;
+}
+export interface BatchCommand {
+  commandId: number;
+  code: string;
+  /** Independent of the commands before it: the agent runs it on a worker thread and its feedback may come back out of order */
+  concurrent?: boolean;
+  /** Keep `code` under this prepared id instead of running it */
+  prepare?: number;
+  /** Run the chunk prepared under this id with `args`; `code` is empty */
+  invoke?: number;
+  args?: LuaValue[];
+}
+
+const luaLiteral = (value: LuaValue) => {
+  if (value === null)
+    return 'nil';
+  if (typeof value !== 'string')
+    return String(value);
+  const escaped = value.replace(/[\\'\n\r\0]/g, c => ({ '\\': '\\\\', '\'': '\\\'', '\n': '\\n', '\r': '\\r', '\0': '\\0' })[c]!);
+  return `'${escaped}'`;
+};
+
+/** Queue entry for a chunk the server calls repeatedly with different arguments (`...` in the chunk) */
+export class PreparedCall {
+  constructor(readonly chunk: string, readonly args: LuaValue[]) {}
+  /** The same call as plain source, for agents that don't batch */
+  toSource() {
+    return `(function(...) ${this.chunk} end)(${this.args.map(luaLiteral).join(', ')})`;
+  }
+}
+
+/** Mirror of ChunkCache::PushArguments() on the agent */
+export function encodeArgs(args: LuaValue[]): Buffer {
+  return Buffer.concat(args.map(arg => {
+    if (arg === null)
+      return Buffer.from([ArgumentType.NIL]);
+    if (typeof arg === 'boolean')
+      return Buffer.from([arg ? ArgumentType.TRUE : ArgumentType.FALSE]);
+    if (typeof arg === 'number') {
+      const buffer = Buffer.alloc(1 + 8);
+      buffer.writeUInt8(ArgumentType.NUMBER, 0);
+      buffer.writeDoubleLE(arg, 1);
+      return buffer;
+    }
+    const body = Buffer.from(arg, 'utf-8');
+    const header = Buffer.alloc(1 + 4);
+    header.writeUInt8(ArgumentType.STRING, 0);
+    header.writeUInt32LE(body.length, 1);
+    return Buffer.concat([header, body]);
+  }));
+}
+/** @throws If the list is malformed */
+export function parseArgs(data: Buffer): LuaValue[] {
+  const args: LuaValue[] = [];
+  for (let offset = 0; offset < data.length;) {
+    const type = data.readUInt8(offset++) as ArgumentType;
+    switch (type) {
+      case ArgumentType.NIL:
+        args.push(null);
+        break;
+      case ArgumentType.FALSE:
+      case ArgumentType.TRUE:
+        args.push(type === ArgumentType.TRUE);
+        break;
+      case ArgumentType.NUMBER:
+        args.push(data.readDoubleLE(offset));
+        offset += 8;
+        break;
+      case ArgumentType.STRING: {
+        const size = data.readUInt32LE(offset);
+        offset += 4;
+        if (offset + size > data.length)
+          throw new Error('Truncated argument');
+        args.push(data.subarray(offset, offset + size).toString('utf-8'));
+        offset += size;
+        break;
+      }
+      default:
+        throw new Error(`Unknown argument type ${type}`);
+    }
+  }
+  return args;
+}
+
+/** @throws If a part runs past the end of the envelope */
+export function parseBatch(data: Buffer): BatchPart[] {
+  const parts: BatchPart[] = [];
+  for (let offset = 0; offset < data.length;) {
+    if (offset + PART_HEADER_SIZE > data.length)
+      throw new Error('Truncated batch part header');
+    const action = data.readUInt8(offset) as Action;
+    const commandId = data.readUInt32LE(offset + 1);
+    const size = data.readUInt32LE(offset + 5);
+    offset += PART_HEADER_SIZE;
+    if (offset + size > data.length)
+      throw new Error('Truncated batch part');
+    parts.push({ action, commandId, data: data.subarray(offset, offset + size) });
+    offset += size;
+  }
+  return parts;
+}
+/** Mirror of the agent's net.FlushBatch(), used to exercise the server */
+export function encodeBatch(parts: { action: Action, commandId?: number, data?: Buffer | string }[]): Buffer {
+  return Buffer.concat(parts.map(({ action, commandId = BATCH_NO_COMMAND, data = '' }) => {
+    const body = Buffer.from(data);
+    const header = Buffer.alloc(PART_HEADER_SIZE);
+    header.writeUInt8(action, 0);
+    header.writeUInt32LE(commandId, 1);
+    header.writeUInt32LE(body.length, 5);
+    return Buffer.concat([header, body]);
+  }));
+}
+
+export function encodeBatchReply(commands: BatchCommand[]): Buffer {
+  return Buffer.concat(commands.map(({ commandId, code, concurrent, prepare, invoke, args = [] }) => {
+    let body = invoke !== undefined ? encodeArgs(args) : Buffer.from(code, 'utf-8');
+    const preparedId = prepare ?? invoke;
+    if (preparedId !== undefined) {
+      const id = Buffer.alloc(4);
+      id.writeUInt32LE(preparedId, 0);
+      body = Buffer.concat([id, body]);
+    }
+    const flags = (concurrent ? COMMAND_CONCURRENT : 0) | (prepare !== undefined ? COMMAND_PREPARE : 0) | (invoke !== undefined ? COMMAND_INVOKE : 0);
+    const header = Buffer.alloc(COMMAND_HEADER_SIZE);
+    header.writeUInt32LE(commandId, 0);
+    header.writeUInt8(flags, 4);
+    header.writeUInt32LE(body.length, 5);
+    return Buffer.concat([header, body]);
+  }));
+}
+/** Mirror of the agent's net.ReceiveBatch() */
+export function parseBatchReply(data: Buffer): BatchCommand[] {
+  const commands: BatchCommand[] = [];
+  if (data.length === 1 && data[0] === 0)
+    return commands;
+  for (let offset = 0; offset + COMMAND_HEADER_SIZE <= data.length;) {
+    const commandId = data.readUInt32LE(offset);
+    const flags = data.readUInt8(offset + 4);
+    const size = data.readUInt32LE(offset + 5);
+    offset += COMMAND_HEADER_SIZE;
+    let body = data.subarray(offset, offset + size);
+    const command: BatchCommand = { commandId, code: '' };
+    if (flags & COMMAND_CONCURRENT)
+      command.concurrent = true;
+    if (flags & (COMMAND_PREPARE | COMMAND_INVOKE)) {
+      const preparedId = body.readUInt32LE(0);
+      body = body.subarray(4);
+      if (flags & COMMAND_PREPARE)
+        command.prepare = preparedId;
+      else {
+        command.invoke = preparedId;
+        command.args = parseArgs(body);
+      }
+    }
+    if (!(flags & COMMAND_INVOKE))
+      command.code = body.toString('utf-8');
+    commands.push(command);
+    offset += size;
+  }
+  return commands;
+}
+
+/** @param body Of a STREAM batch part, whose command id is `jobId` */
+export function parseStream(jobId: number, body: Buffer): StreamChunk {
+  if (body.length < 1)
+    throw new Error('Empty stream chunk');
+  const kind = body.readUInt8(0) as StreamKind;
+  const data = body.subarray(1);
+  if (kind === StreamKind.EXIT)
+    return { jobId, kind, data: Buffer.alloc(0), exitCode: data.readInt32LE(0) };
+  return { jobId, kind, data: kind === StreamKind.OUTPUT ? data : Buffer.alloc(0) };
+}
+/** @param body Of a standalone STREAM message */
+export function parseStreamMessage(body: Buffer): StreamChunk {
+  if (body.length < 4)
+    throw new Error('Truncated stream message');
+  return parseStream(body.readUInt32LE(0), body.subarray(4));
+}
+/** Mirror of the agent's net.SendStream() while batching, used to exercise the server */
+export function encodeStream({ kind, data = Buffer.alloc(0), exitCode = 0 }: Omit<StreamChunk, 'jobId' | 'data'> & { data?: Buffer | string }): Buffer {
+  if (kind === StreamKind.EXIT) {
+    const body = Buffer.alloc(1 + 4);
+    body.writeUInt8(kind, 0);
+    body.writeInt32LE(exitCode, 1);
+    return body;
+  }
+  return Buffer.concat([Buffer.from([kind]), Buffer.from(data)]);
+}
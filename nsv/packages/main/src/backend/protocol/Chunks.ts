@@ -0,0 +1,87 @@
+import crypto from 'node:crypto';
+
+/*
+ * Uploads through the agent's chunk store (ChunkStore.cpp). Files are cut with FastCDC: boundaries depend on the content around them,
+ * not on offsets, so the same tool under another name, or with bytes inserted, still yields mostly the same chunks.
+ * Manifest: [u32 chunks], then [u32 size][32 bytes SHA-256] per chunk in file order. The agent answers with the indices ([u32] each)
+ * of the chunks it lacks; the upload itself is the manifest again, the indices of the chunks it carries ([u32 count][u32] each, ascending)
+ * and those chunks' data, in that order: what the agent's store holds may have changed in between, the upload says what it brings.
+ * Little-endian, like the rest of the protocol.
+ */
+
+export const MIN_CHUNK_SIZE = 16 * 1024;
+export const AVERAGE_CHUNK_SIZE = 64 * 1024;
+export const MAX_CHUNK_SIZE = 256 * 1024;
+const HASH_SIZE = 32;
+const MANIFEST_ENTRY_SIZE = 4 + HASH_SIZE;
+// normalized chunking: a cut is harder to find before the average size, easier after (2 bits either way around log2(average) = 16)
+const MASK_SMALL = 0xFFFFC000;
+const MASK_LARGE = 0xFFFC0000;
+
+/** Random but fixed, or the same file would be cut differently from one server run to the next, and nothing would dedupe */
+const GEAR = new Uint32Array(256).map((_, i) => crypto.createHash('md5').update(`gear ${i}`).digest().readUInt32LE(0));
+
+export interface Chunk {
+  offset: number;
+  size: number;
+  hash: Buffer;
+}
+
+/** Length of the chunk that starts at `start` */
+const cutPoint = (data: Buffer, start: number) => {
+  const left = data.length - start;
+  if (left <= MIN_CHUNK_SIZE)
+    return left;
+  const end = start + Math.min(left, MAX_CHUNK_SIZE);
+  const normal = start + Math.min(left, AVERAGE_CHUNK_SIZE);
+  let fingerprint = 0;
+  let i = start + MIN_CHUNK_SIZE;
+  for (; i < normal; i++) {
+    fingerprint = ((fingerprint << 1) + GEAR[data[i]]) >>> 0;
+    if (!(fingerprint & MASK_SMALL))
+      return i - start;
+  }
+  for (; i < end; i++) {
+    fingerprint = ((fingerprint << 1) + GEAR[data[i]]) >>> 0;
+    if (!(fingerprint & MASK_LARGE))
+      return i - start;
+  }
+  return end - start;
+};
+
+export const chunk = (data: Buffer): Chunk[] => {
+  const chunks: Chunk[] = [];
+  for (let offset = 0; offset < data.length;) {
+    const size = cutPoint(data, offset);
+    chunks.push({ offset, size, hash: crypto.createHash('sha256').update(data.subarray(offset, offset + size)).digest() });
+    offset += size;
+  }
+  return chunks;
+};
+
+export const encodeManifest = (chunks: Chunk[]) => {
+  const manifest = Buffer.alloc(4 + chunks.length * MANIFEST_ENTRY_SIZE);
+  manifest.writeUInt32LE(chunks.length, 0);
+  chunks.forEach(({ size, hash }, i) => {
+    manifest.writeUInt32LE(size, 4 + i * MANIFEST_ENTRY_SIZE);
+    hash.copy(manifest, 4 + i * MANIFEST_ENTRY_SIZE + 4);
+  });
+  return manifest;
+};
+
+/** The agent's answer to a manifest */
+export const parseMissing = (data: Buffer) => {
+  const missing: number[] = [];
+  for (let offset = 0; offset + 4 <= data.length; offset += 4)
+    missing.push(data.readUInt32LE(offset));
+  return missing;
+};
+
+/** What goes to the agent once it said what it lacks: the manifest, which chunks follow, then those chunks */
+export const encodeUpload = (data: Buffer, chunks: Chunk[], missing: number[]) => {
+  const sent = [...new Set(missing.filter(i => i < chunks.length))].sort((a, b) => a - b);
+  const indices = Buffer.alloc(4 + sent.length * 4);
+  indices.writeUInt32LE(sent.length, 0);
+  sent.forEach((index, i) => indices.writeUInt32LE(index, 4 + i * 4));
+  return Buffer.concat([encodeManifest(chunks), indices, ...sent.map(i => data.subarray(chunks[i].offset, chunks[i].offset + chunks[i].size))]);
+};
@@ -1,10 +1,15 @@
 import type { Commands, IUser } from '$types/Common';
 import type { Socket } from 'net';
 import type { Message } from './Message';
-import { MessageReader } from './MessageReader';
+import { MessageReader, type OnFileRange, type OnFileWritten } from './MessageReader';
 import InputQueue from './InputQueue';
 import _ from 'lodash';
 import * as db from '../Db';
+import type { PreparedCall } from './Batch';
+import { readArchiveToken } from './Archive';
+import type { StripedDownload } from './Resume';
+import { readWatchToken } from './Watch';
+import { SliceSplitter } from './Slices';
 
 export interface ClientContainer {
   public: IUser;
@@ -12,15 +17,42 @@ export interface ClientContainer {
 
 let idCounter = 0;
 export type OnMessageHook<T extends Message = Message> = (message: T) => Promise<void> | void;
-export type CommandQueueEntry = string | Buffer | (() => unknown | Promise<unknown>);
+/**
+ * A payload too big to hold whole (a folder's archive): it goes out as it's produced, a message per piece, then an empty message.
+ * `open` starts it over for each client it goes to
+ */
+export class StreamedPayload {
+  constructor(readonly open: () => AsyncIterable<Buffer>) {}
+}
+export type CommandQueueEntry = string | Buffer | StreamedPayload | PreparedCall | (() => unknown | Promise<unknown>);
 export type AnyClass = new (...args: any[]) => any;
+/** Takes a job's output instead of the log */
+export interface StreamSink {
+  write(data: Buffer): void;
+  /** The job ended, or its output won't come any more (the connection dropped) */
+  end(): void;
+}
 export class Client implements db.Serializable<IUser>, ClientContainer {
   readonly inputQueue: InputQueue;
   netQueue: { queuedCommandId: number, command: keyof Commands | undefined, queue: (CommandQueueEntry | CommandQueueEntry[])[] }[];
   public: IUser;
+  /** Chunks the agent keeps compiled on this connection (see Batch.ts), by source */
+  readonly prepared = new Map<string, number>();
+  /** Archives asked for (downloaddir), by the token they'll start with: the agent picks the job id, the first chunk says which it is */
+  readonly pendingArchives = new Map<number, StreamSink>();
+  /** Directories being watched (watch), by the token their first line carries, until it comes */
+  readonly pendingWatches = new Map<number, StreamSink>();
+  /** By job id */
+  readonly streamSinks = new Map<number, StreamSink>();
+  /** Striped downloads waiting for the agent's data connections (ATTACH), by transfer id */
+  readonly stripedDownloads = new Map<number, StripedDownload>();
+  /** What the agent proves its data connections are of this session with: exported from its TLS session, never sent in the clear */
+  attachKey?: Buffer;
   #socket: Socket | null;
 
   #reader: MessageReader | undefined;
+  /** Reads the whole messages that come between the slices of a sliced one (see Slices.ts): they're never files */
+  #interleavedReader: MessageReader | undefined;
   #onMessage: [AnyClass, OnMessageHook][];
 
   constructor(socket?: Socket) {
@@ -40,32 +72,58 @@ export class Client implements db.Serializable<IUser>, ClientContainer {
   }
   onReconnect(socket: Socket) {
     this.#socket = socket;
+    this.prepared.clear();
+    // the agent drops the output of its jobs with the connection
+    for (const sink of [...this.streamSinks.values(), ...this.pendingArchives.values(), ...this.pendingWatches.values()])
+      sink.end();
+    this.streamSinks.clear();
+    this.pendingArchives.clear();
+    this.pendingWatches.clear();
+    // data connections are named with the old session's key: what they brought stays for a resumed download
+    this.stripedDownloads.clear();
     this.public.online = true;
     /// @todo re-make
     this.public.streaming = false;
     this.#onMessage = [];
     if (this.#reader)
       this.#reader.cleanup();
-    this.#reader = new MessageReader();
+    this.#interleavedReader?.cleanup();
+    // what comes after a message that can't be read can't be either
+    const drop = (err: Error) => {
+      console.error(err);
+      socket.destroy();
+    };
+    this.#reader = new MessageReader(drop);
+    this.#interleavedReader = new MessageReader(drop);
+    const slices = new SliceSplitter();
 
     const q: Buffer[] = [];
     let runningQ = false;
     this.#socket.on('data', async data => {
-      if (!this.#reader)
+      if (!this.#reader || !this.#interleavedReader)
         throw new Error('No reader?!');
       q.push(data);
       if (runningQ)
         return;
 
       runningQ = true;
-      while (q.length)
-        await this.#reader.read(q.splice(0, 1)[0], async message => {
-          for (const listener of this.#onMessage)
-            await message instanceof listener[0] && listener[1](message);
-        });
+      try {
+        while (q.length)
+          for (const piece of slices.write(q.splice(0, 1)[0]))
+            await (piece.interleaved ? this.#interleavedReader : this.#reader).read(piece.data, message => this.dispatch(message));
+      }
+      catch (err) {
+        q.length = 0;
+        drop(err instanceof Error ? err : new Error(String(err)));
+      }
       runningQ = false;
     });
   }
+  /** Hands a message to the listeners as if it came through the socket (used by side channels) */
+  async dispatch(message: Message) {
+    for (const listener of this.#onMessage)
+      await message instanceof listener[0] && listener[1](message);
+  }
   close() {
     if (this.#socket)
       this.#socket.end();
@@ -80,13 +138,72 @@ export class Client implements db.Serializable<IUser>, ClientContainer {
     await new Promise<void>((resolve, reject) => this.#socket!.write(new Uint8Array(sizeBuf), err => !err ? resolve() : reject(err)));
     await new Promise<void>((resolve, reject) => this.#socket!.write(buf, err => !err ? resolve() : reject(err)));
   }
+  /**
+   * Each piece as a message of its own once the one before it is written out, so a slow agent holds the producer back. The empty message
+   * that ends it goes even if producing fails: the agent sees a cut off payload then, not a connection gone silent
+   */
+  async sendStream(payload: StreamedPayload): Promise<void> {
+    try {
+      for await (const piece of payload.open())
+        if (piece.length)
+          await this.sendMessage(piece);
+    }
+    catch (err) {
+      console.error(err);
+    }
+    await new Promise<void>((resolve, reject) => this.#socket!.write(new Uint8Array(8), err => !err ? resolve() : reject(err)));
+  }
   on<T extends AnyClass, U extends Message>(_event: 'message', type: T, hook: OnMessageHook<U>) {
     this.#onMessage.push([type, hook as OnMessageHook]);
   }
-  expectFile(name: string) {
+  /** See MessageReader.expectFile() */
+  expectFile(name: string, onWritten?: OnFileWritten, onRange?: OnFileRange) {
     if (!this.#reader)
       throw new Error('No reader?!');
-    this.#reader.expectFile(name);
+    this.#reader.expectFile(name, onWritten, onRange);
+  }
+  /** A data connection the agent opened for a stripe of a download: it carries that stripe's FILE, read with a reader of its own */
+  attach(socket: Socket, transfer: number, stripe: number) {
+    const striped = this.stripedDownloads.get(transfer);
+    const reply = (accepted: boolean) => {
+      const sizeBuf = Buffer.alloc(8);
+      sizeBuf.writeBigUInt64LE(1n);
+      socket.write(Buffer.concat([sizeBuf, Buffer.from(accepted ? '1' : '0')]));
+    };
+    if (!striped || !striped.download.stripes[stripe]) {
+      reply(false);
+      return socket.end();
+    }
+    const reader = new MessageReader();
+    reader.expectFile(striped.download.partPath(stripe), (_, range) => striped.onStripe(stripe, range), range => striped.download.position(stripe, range));
+    // one piece at a time: the reader writes to the disk between them
+    socket.on('data', async data => {
+      socket.pause();
+      try {
+        await reader.read(data, () => undefined);
+        socket.resume();
+      }
+      catch (err) {
+        console.error(err);
+        socket.destroy();
+      }
+    });
+    socket.on('close', () => reader.cleanup());
+    reply(true);
+  }
+  /** Where the output of job `jobId` goes if it's not for the log. `data` is its chunk of output, if that's what came */
+  streamSink(jobId: number, data?: Buffer) {
+    let sink = this.streamSinks.get(jobId);
+    if (sink || !data)
+      return sink;
+    for (const [pending, token] of [[this.pendingArchives, readArchiveToken(data)], [this.pendingWatches, readWatchToken(data)]] as const) {
+      if (token !== undefined && (sink = pending.get(token))) {
+        pending.delete(token);
+        this.streamSinks.set(jobId, sink);
+        return sink;
+      }
+    }
+    return undefined;
   }
   expectBinary() {
     if (!this.#reader)
@@ -105,6 +222,7 @@ export class Client implements db.Serializable<IUser>, ClientContainer {
   serialize() {
     const rs = _.cloneDeep(this.public);
     rs.pendingVerification = undefined;
+    rs.linkStats = undefined;
     return rs;
   }
   save() {
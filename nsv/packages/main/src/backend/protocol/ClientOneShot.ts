@@ -54,7 +54,7 @@ export class ClientOneShot implements ClientContainer {
       if (!this.#reader)
         throw new Error('No reader?!');
       await this.#reader.read(data, async message => {
-        if (!(message instanceof ActionMessage) || message.action !== Action.HANDSHAKE) {
+        if (!(message instanceof ActionMessage) || (message.action !== Action.HANDSHAKE && message.action !== Action.ATTACH)) {
           console.log(message);
           this.dispose();
           this.close();
@@ -69,7 +69,7 @@ export class ClientOneShot implements ClientContainer {
   close() {
     this.#socket?.end();
   }
-  on<T extends AnyClass, U extends ActionMessage<Action.HANDSHAKE>>(_event: 'message', type: T, hook: OnMessageHook<U>) {
+  on<T extends AnyClass, U extends ActionMessage<Action.HANDSHAKE | Action.ATTACH>>(_event: 'message', type: T, hook: OnMessageHook<U>) {
     this.#onMessage.push([type, hook as OnMessageHook]);
   }
 }
\ No newline at end of file
@@ -0,0 +1,279 @@
+import dgram from 'node:dgram';
+import crypto from 'node:crypto';
+import type tls from 'node:tls';
+
+/*
+ * Receiving end of the client's DatagramChannel (see foresteamnd/DatagramChannel.h for the packet layout).
+ * Screencast frames arrive as AES-256-GCM sealed UDP fragments with one XOR parity fragment per group; key and session id are
+ * derived from the agent's TLS session, so a datagram can only be attributed to the connection that produced the key.
+ */
+
+export const DATAGRAM_EXPORTER_LABEL = 'EXPORTER-mrut-screencast';
+export const DATAGRAM_FRAGMENT_SIZE = 1152;
+export const DATAGRAM_FEC_GROUP = 8;
+const KEY_SIZE = 32;
+const SESSION_ID_SIZE = 8;
+const HEADER_SIZE = SESSION_ID_SIZE + 4 + 2 + 2 + 1 + 4;
+const TAG_SIZE = 16;
+const PACKET_SIZE = HEADER_SIZE + DATAGRAM_FRAGMENT_SIZE + TAG_SIZE;
+/** Incomplete frames kept per session. Older ones are abandoned: a newer frame supersedes them anyway */
+const MAX_PENDING_FRAMES = 4;
+
+export interface DatagramHeader {
+  sessionId: Buffer;
+  frameSeq: number;
+  fragIndex: number;
+  fragCount: number;
+  groupSize: number;
+  frameSize: number;
+}
+
+const nonceOf = (header: Buffer) => Buffer.concat([header.subarray(SESSION_ID_SIZE, SESSION_ID_SIZE + 6), Buffer.alloc(6)]);
+
+export function parseHeader(packet: Buffer): DatagramHeader {
+  return {
+    sessionId: packet.subarray(0, SESSION_ID_SIZE),
+    frameSeq: packet.readUInt32LE(8),
+    fragIndex: packet.readUInt16LE(12),
+    fragCount: packet.readUInt16LE(14),
+    groupSize: packet.readUInt8(16),
+    frameSize: packet.readUInt32LE(17),
+  };
+}
+
+/** @returns The plaintext fragment, or undefined if the packet is malformed or doesn't authenticate */
+export function openPacket(key: Buffer, packet: Buffer): Buffer | undefined {
+  if (packet.length !== PACKET_SIZE)
+    return undefined;
+  const header = packet.subarray(0, HEADER_SIZE);
+  try {
+    const decipher = crypto.createDecipheriv('aes-256-gcm', key, nonceOf(header));
+    decipher.setAAD(header);
+    decipher.setAuthTag(packet.subarray(HEADER_SIZE + DATAGRAM_FRAGMENT_SIZE));
+    return Buffer.concat([decipher.update(packet.subarray(HEADER_SIZE, HEADER_SIZE + DATAGRAM_FRAGMENT_SIZE)), decipher.final()]);
+  }
+  catch {
+    return undefined;
+  }
+}
+
+/** Mirror of DatagramChannel::SendFrame, used to exercise the receiver */
+export function sealFrame(key: Buffer, sessionId: Buffer, frameSeq: number, frame: Buffer, groupSize = DATAGRAM_FEC_GROUP): Buffer[] {
+  const count = Math.ceil(frame.length / DATAGRAM_FRAGMENT_SIZE);
+  const packets: Buffer[] = [];
+  const seal = (index: number, fragment: Buffer) => {
+    const header = Buffer.alloc(HEADER_SIZE);
+    sessionId.copy(header, 0);
+    header.writeUInt32LE(frameSeq >>> 0, 8);
+    header.writeUInt16LE(index, 12);
+    header.writeUInt16LE(count, 14);
+    header.writeUInt8(groupSize, 16);
+    header.writeUInt32LE(frame.length, 17);
+    const cipher = crypto.createCipheriv('aes-256-gcm', key, nonceOf(header));
+    cipher.setAAD(header);
+    const body = Buffer.concat([cipher.update(fragment), cipher.final()]);
+    packets.push(Buffer.concat([header, body, cipher.getAuthTag()]));
+  };
+  let parity = Buffer.alloc(DATAGRAM_FRAGMENT_SIZE);
+  for (let i = 0; i < count; i++) {
+    const fragment = Buffer.alloc(DATAGRAM_FRAGMENT_SIZE);
+    frame.copy(fragment, 0, i * DATAGRAM_FRAGMENT_SIZE, (i + 1) * DATAGRAM_FRAGMENT_SIZE);
+    seal(i, fragment);
+    if (!groupSize)
+      continue;
+    for (let b = 0; b < DATAGRAM_FRAGMENT_SIZE; b++)
+      parity[b] ^= fragment[b];
+    if ((i + 1) % groupSize === 0 || i + 1 === count) {
+      seal(count + Math.floor(i / groupSize), parity);
+      parity = Buffer.alloc(DATAGRAM_FRAGMENT_SIZE);
+    }
+  }
+  return packets;
+}
+
+interface PendingFrame {
+  count: number;
+  groupSize: number;
+  size: number;
+  fragments: (Buffer | undefined)[];
+  parity: (Buffer | undefined)[];
+}
+
+/** `a` is newer than `b` in u32 serial number arithmetic (RFC 1982) */
+const isNewer = (a: number, b: number) => a !== b && ((a - b) >>> 0) < 0x80000000;
+
+/** Reassembles frames from fragments of one session. Never delivers a frame older than the last delivered one */
+export class FrameAssembler {
+  #pending = new Map<number, PendingFrame>();
+  #lastDelivered: number | undefined;
+
+  /** @returns The whole frame once it can be reconstructed */
+  push(header: DatagramHeader, fragment: Buffer): Buffer | undefined {
+    const { frameSeq, fragIndex, fragCount, groupSize, frameSize } = header;
+    if (this.#lastDelivered !== undefined && !isNewer(frameSeq, this.#lastDelivered))
+      return undefined;
+    if (!fragCount || frameSize > fragCount * DATAGRAM_FRAGMENT_SIZE)
+      return undefined;
+
+    let frame = this.#pending.get(frameSeq);
+    if (!frame) {
+      frame = { count: fragCount, groupSize, size: frameSize, fragments: [], parity: [] };
+      this.#pending.set(frameSeq, frame);
+      this.#evict();
+      if (!this.#pending.has(frameSeq))
+        return undefined;
+    }
+    if (frame.count !== fragCount || frame.groupSize !== groupSize || frame.size !== frameSize)
+      return undefined;
+    if (fragIndex < fragCount)
+      frame.fragments[fragIndex] = fragment;
+    else if (groupSize && fragIndex - fragCount < Math.ceil(fragCount / groupSize))
+      frame.parity[fragIndex - fragCount] = fragment;
+    else
+      return undefined;
+
+    if (!this.#recover(frame))
+      return undefined;
+    this.#lastDelivered = frameSeq;
+    for (const seq of this.#pending.keys())
+      if (!isNewer(seq, frameSeq))
+        this.#pending.delete(seq);
+    return Buffer.concat(frame.fragments as Buffer[]).subarray(0, frame.size);
+  }
+
+  /** Fills in single losses per group from parity. @returns Whether all data fragments are there */
+  #recover(frame: PendingFrame) {
+    let received = 0;
+    for (let i = 0; i < frame.count; i++)
+      frame.fragments[i] && received++;
+    if (received === frame.count)
+      return true;
+    if (!frame.groupSize)
+      return false;
+    let available = received;
+    for (const parity of frame.parity)
+      parity && available++;
+    if (available < frame.count)
+      return false;
+
+    const missing: number[] = [];
+    for (let group = 0; group * frame.groupSize < frame.count; group++) {
+      const start = group * frame.groupSize;
+      const end = Math.min(start + frame.groupSize, frame.count);
+      const lost: number[] = [];
+      for (let i = start; i < end; i++)
+        !frame.fragments[i] && lost.push(i);
+      if (lost.length > 1 || (lost.length && !frame.parity[group]))
+        return false;
+      missing.push(...lost);
+    }
+    for (const index of missing) {
+      const group = Math.floor(index / frame.groupSize);
+      const restored = Buffer.from(frame.parity[group]!);
+      for (let i = group * frame.groupSize; i < Math.min((group + 1) * frame.groupSize, frame.count); i++)
+        if (i !== index)
+          for (let b = 0; b < DATAGRAM_FRAGMENT_SIZE; b++)
+            restored[b] ^= frame.fragments[i]![b];
+      frame.fragments[index] = restored;
+    }
+    return true;
+  }
+  #evict() {
+    while (this.#pending.size > MAX_PENDING_FRAMES) {
+      let oldest: number | undefined;
+      for (const seq of this.#pending.keys())
+        if (oldest === undefined || isNewer(oldest, seq))
+          oldest = seq;
+      this.#pending.delete(oldest!);
+    }
+  }
+}
+
+/** Bytes per second with a second's worth of burst; 0 lets everything through */
+export class RateLimiter {
+  #rate: number;
+  #tokens: number;
+  #refilledAt = Date.now();
+
+  constructor(bytesPerSec: number) {
+    this.#rate = Math.max(0, bytesPerSec);
+    this.#tokens = this.#rate;
+  }
+  /** @returns false if `bytes` would go over the rate: drop them */
+  take(bytes: number, now = Date.now()) {
+    if (!this.#rate)
+      return true;
+    this.#tokens = Math.min(this.#rate, this.#tokens + this.#rate * Math.max(0, now - this.#refilledAt) / 1000);
+    this.#refilledAt = now;
+    if (this.#tokens < bytes)
+      return false;
+    this.#tokens -= bytes;
+    return true;
+  }
+}
+
+interface Session {
+  key: Buffer;
+  assembler: FrameAssembler;
+  limiter: RateLimiter;
+  onFrame: (frame: Buffer) => void;
+}
+
+export class DatagramServer {
+  #socket?: dgram.Socket;
+  #sessions = new Map<string, Session>();
+  #rateLimit: number;
+
+  /** @param rateLimit Bytes/s per session, 0 = unlimited. Session ids are in the clear: it caps what a flood of one costs in decryption */
+  constructor(rateLimit = 0) {
+    this.#rateLimit = rateLimit;
+  }
+
+  get port() {
+    return this.#socket?.address().port;
+  }
+
+  async start(port: number) {
+    const socket = dgram.createSocket('udp4');
+    socket.on('message', packet => this.#onPacket(packet));
+    await new Promise<void>((resolve, reject) => {
+      socket.once('error', reject);
+      socket.bind(port, () => {
+        socket.off('error', reject);
+        resolve();
+      });
+    });
+    this.#socket = socket;
+  }
+  close() {
+    this.#socket?.close();
+    this.#socket = undefined;
+    this.#sessions.clear();
+  }
+
+  /**
+   * Derives the session's key and id from `socket` and routes its frames to `onFrame`
+   * @returns Unregister function, call it when the TLS connection goes away
+   */
+  register(socket: tls.TLSSocket, onFrame: (frame: Buffer) => void) {
+    const material = socket.exportKeyingMaterial(KEY_SIZE + SESSION_ID_SIZE, DATAGRAM_EXPORTER_LABEL);
+    const id = material.subarray(KEY_SIZE).toString('hex');
+    this.#sessions.set(id, { key: material.subarray(0, KEY_SIZE), assembler: new FrameAssembler(), limiter: new RateLimiter(this.#rateLimit), onFrame });
+    return () => this.#sessions.delete(id);
+  }
+
+  #onPacket(packet: Buffer) {
+    if (packet.length !== PACKET_SIZE)
+      return;
+    const header = parseHeader(packet);
+    const session = this.#sessions.get(header.sessionId.toString('hex'));
+    if (!session || !session.limiter.take(packet.length))
+      return;
+    const fragment = openPacket(session.key, packet);
+    if (!fragment)
+      return;
+    const frame = session.assembler.push(header, fragment);
+    if (frame)
+      session.onFrame(frame);
+  }
+}
@@ -0,0 +1,272 @@
+import crypto from 'node:crypto';
+
+/*
+ * rsync-style delta transfer, the server's side of the agent's Delta.cpp (same formats, byte for byte).
+ * The side with an old copy (the basis) sends its signature: [u32 block size][u64 basis size], then [u32 rolling checksum][16 bytes MD5]
+ * per block, the last one possibly short. The side with the new file (the target) slides a block-sized window over it one byte at a
+ * time; where the rolling checksum and then the MD5 match a block, it sends the block's index instead of its bytes.
+ * Delta: [u32 block size], then COPY [u8 1][u32 first block][u32 blocks] and LITERAL [u8 2][u32 size][bytes] instructions, then END:
+ * [u8 0][u64 target size][16 bytes MD5 of the target], which the patched file is checked against.
+ * Little-endian, like the rest of the protocol.
+ */
+
+/** Blocks are about the square root of the basis in size, between these */
+export const MIN_BLOCK_SIZE = 700;
+export const MAX_BLOCK_SIZE = 128 * 1024;
+const STRONG_SIZE = 16;
+const SIGNATURE_HEADER_SIZE = 4 + 8;
+const BLOCK_ENTRY_SIZE = 4 + STRONG_SIZE;
+/** Literal data goes in pieces of at most this (the agent never holds more of the target at once) */
+const MAX_LITERAL = 1024 * 1024;
+/** Bits of the table that turns most rolling checksums away before the blocks are looked up */
+const FILTER_BITS = 20;
+
+export enum Instruction { END, COPY, LITERAL }
+export interface DeltaStats {
+  /** Bytes of the target taken from the basis */
+  copied: number;
+  /** Bytes of the target sent as they are */
+  literal: number;
+}
+
+const md5 = (data: Buffer) => crypto.createHash('md5').update(data).digest();
+const slot = (rolling: number) => Math.imul(rolling, 2654435761) >>> (32 - FILTER_BITS);
+
+export const blockSizeFor = (basisSize: number) => basisSize <= MIN_BLOCK_SIZE * MIN_BLOCK_SIZE
+  ? MIN_BLOCK_SIZE
+  : Math.min((Math.floor(Math.sqrt(basisSize)) + 7) & ~7, MAX_BLOCK_SIZE);
+
+/** rsync's weak checksum: a = sum of the bytes, b = sum of a's running values, both mod 2^16, as a | b << 16 */
+export const rollingChecksum = (data: Buffer, start = 0, end = data.length) => {
+  let a = 0, b = 0;
+  for (let i = start; i < end; i++) {
+    a = (a + data[i]) & 0xffff;
+    b = (b + a) & 0xffff;
+  }
+  return (a | (b << 16)) >>> 0;
+};
+const roll = (rolling: number, out: number, into: number, blockSize: number) => {
+  const a = ((rolling & 0xffff) - out + into) & 0xffff;
+  const b = ((rolling >>> 16) - blockSize * out + a) & 0xffff;
+  return (a | (b << 16)) >>> 0;
+};
+
+/** Signature of the basis. An empty one is valid: everything will be literal */
+export const sign = (basis: Buffer, blockSize = blockSizeFor(basis.length)) => {
+  const blocks = Math.ceil(basis.length / blockSize);
+  const signature = Buffer.alloc(SIGNATURE_HEADER_SIZE + blocks * BLOCK_ENTRY_SIZE);
+  signature.writeUInt32LE(blockSize, 0);
+  signature.writeBigUInt64LE(BigInt(basis.length), 4);
+  for (let i = 0; i < blocks; i++) {
+    const block = basis.subarray(i * blockSize, Math.min(basis.length, (i + 1) * blockSize));
+    const offset = SIGNATURE_HEADER_SIZE + i * BLOCK_ENTRY_SIZE;
+    signature.writeUInt32LE(rollingChecksum(block), offset);
+    md5(block).copy(signature, offset + 4);
+  }
+  return signature;
+};
+
+class Signature {
+  readonly blockSize: number;
+  readonly blockCount: number;
+  /** Of the last block if it's short, 0 if they're all whole */
+  readonly shortSize: number;
+  readonly #data: Buffer;
+  readonly #blocks = new Map<number, number[]>();
+  readonly #filter = new Uint32Array((1 << FILTER_BITS) / 32);
+
+  constructor(data: Buffer) {
+    if (data.length < SIGNATURE_HEADER_SIZE)
+      throw new Error('Malformed signature');
+    this.blockSize = data.readUInt32LE(0);
+    const basisSize = Number(data.readBigUInt64LE(4));
+    if (!this.blockSize)
+      throw new Error('Malformed signature');
+    this.blockCount = Math.ceil(basisSize / this.blockSize);
+    if (data.length !== SIGNATURE_HEADER_SIZE + this.blockCount * BLOCK_ENTRY_SIZE)
+      throw new Error('Malformed signature');
+    this.shortSize = basisSize % this.blockSize;
+    this.#data = data.subarray(SIGNATURE_HEADER_SIZE);
+    // a short last block only ever matches the end of the target: it's looked for there, not in the table
+    const wholeBlocks = this.shortSize ? this.blockCount - 1 : this.blockCount;
+    for (let i = 0; i < wholeBlocks; i++) {
+      const rolling = this.#rollingOf(i);
+      const blocks = this.#blocks.get(rolling);
+      if (blocks)
+        blocks.push(i);
+      else
+        this.#blocks.set(rolling, [i]);
+      const s = slot(rolling);
+      this.#filter[s >>> 5] |= 1 << (s & 31);
+    }
+  }
+  /** Index of a whole block with these contents, `hint` first (the one after the last match keeps COPY runs going), -1 if there's none */
+  find(rolling: number, data: Buffer, hint: number) {
+    const s = slot(rolling);
+    if (!(this.#filter[s >>> 5] & (1 << (s & 31))))
+      return -1;
+    const blocks = this.#blocks.get(rolling);
+    if (!blocks)
+      return -1;
+    const digest = md5(data);
+    let found = -1;
+    for (const index of blocks)
+      if (digest.equals(this.#strongOf(index))) {
+        if (index === hint)
+          return hint;
+        if (found < 0)
+          found = index;
+      }
+    return found;
+  }
+  isShortBlock(data: Buffer) {
+    return !!this.shortSize && data.length === this.shortSize && rollingChecksum(data) === this.#rollingOf(this.blockCount - 1)
+      && md5(data).equals(this.#strongOf(this.blockCount - 1));
+  }
+  #rollingOf(index: number) {
+    return this.#data.readUInt32LE(index * BLOCK_ENTRY_SIZE);
+  }
+  #strongOf(index: number) {
+    const offset = index * BLOCK_ENTRY_SIZE + 4;
+    return this.#data.subarray(offset, offset + STRONG_SIZE);
+  }
+}
+
+/** Instructions that turn the basis `signature` describes into `target` */
+export const diff = (signatureData: Buffer, target: Buffer, stats?: DeltaStats) => {
+  const signature = new Signature(signatureData);
+  const { blockSize } = signature;
+  const parts: Buffer[] = [];
+  const header = Buffer.alloc(4);
+  header.writeUInt32LE(blockSize);
+  parts.push(header);
+  let copyFirst = 0, copyCount = 0;
+  const flushCopy = () => {
+    if (!copyCount)
+      return;
+    const instruction = Buffer.alloc(9);
+    instruction.writeUInt8(Instruction.COPY, 0);
+    instruction.writeUInt32LE(copyFirst, 1);
+    instruction.writeUInt32LE(copyCount, 5);
+    parts.push(instruction);
+    copyCount = 0;
+  };
+  const copy = (index: number, size: number) => {
+    if (copyCount && index === copyFirst + copyCount)
+      copyCount++;
+    else {
+      flushCopy();
+      copyFirst = index;
+      copyCount = 1;
+    }
+    if (stats)
+      stats.copied += size;
+  };
+  const literal = (start: number, end: number) => {
+    if (end <= start)
+      return;
+    flushCopy();
+    for (let offset = start; offset < end; offset += MAX_LITERAL) {
+      const piece = target.subarray(offset, Math.min(end, offset + MAX_LITERAL));
+      const instruction = Buffer.alloc(5);
+      instruction.writeUInt8(Instruction.LITERAL, 0);
+      instruction.writeUInt32LE(piece.length, 1);
+      parts.push(instruction, piece);
+    }
+    if (stats)
+      stats.literal += end - start;
+  };
+
+  // [literalStart, window) is yet to be sent as a literal, the window is the next block-sized piece to look up
+  let literalStart = 0, window = 0, rolling = 0, rollingValid = false, hint = 0;
+  while (target.length - window >= blockSize) {
+    if (!rollingValid) {
+      rolling = rollingChecksum(target, window, window + blockSize);
+      rollingValid = true;
+    }
+    const match = signature.find(rolling, target.subarray(window, window + blockSize), hint);
+    if (match >= 0) {
+      literal(literalStart, window);
+      copy(match, blockSize);
+      window += blockSize;
+      literalStart = window;
+      hint = match + 1;
+      rollingValid = false;
+      continue;
+    }
+    if (window - literalStart >= MAX_LITERAL) {
+      literal(literalStart, window);
+      literalStart = window;
+    }
+    // the target ends with this window: what's left is shorter than a block
+    if (window + blockSize === target.length) {
+      window++;
+      rollingValid = false;
+      continue;
+    }
+    rolling = roll(rolling, target[window], target[window + blockSize], blockSize);
+    window++;
+  }
+  if (window < target.length && signature.isShortBlock(target.subarray(window))) {
+    literal(literalStart, window);
+    copy(signature.blockCount - 1, target.length - window);
+    literalStart = target.length;
+  }
+  literal(literalStart, target.length);
+  flushCopy();
+  const end = Buffer.alloc(1 + 8);
+  end.writeUInt8(Instruction.END, 0);
+  end.writeBigUInt64LE(BigInt(target.length), 1);
+  parts.push(end, md5(target));
+  return Buffer.concat(parts);
+};
+
+/**
+ * Rebuilds the target from the basis and the delta
+ * @throws If the delta is malformed, or the result isn't the file it was made from (not the same basis)
+ */
+export const patch = (basis: Buffer, delta: Buffer) => {
+  if (delta.length < 4 + 1 + 8 + STRONG_SIZE)
+    throw new Error('Truncated delta');
+  const blockSize = delta.readUInt32LE(0);
+  if (!blockSize)
+    throw new Error('Malformed delta');
+  const parts: Buffer[] = [];
+  let offset = 4;
+  while (offset < delta.length) {
+    const instruction = delta.readUInt8(offset++);
+    switch (instruction) {
+      case Instruction.END: {
+        if (delta.length - offset !== 8 + STRONG_SIZE)
+          throw new Error('Malformed delta');
+        const result = Buffer.concat(parts);
+        if (BigInt(result.length) !== delta.readBigUInt64LE(offset) || !md5(result).equals(delta.subarray(offset + 8)))
+          throw new Error('The result doesn\'t match: the basis isn\'t the one the delta was made for');
+        return result;
+      }
+      case Instruction.COPY: {
+        if (delta.length - offset < 8)
+          throw new Error('Truncated delta');
+        const first = delta.readUInt32LE(offset), count = delta.readUInt32LE(offset + 4);
+        offset += 8;
+        // the last block of the basis may be short
+        parts.push(basis.subarray(Math.min(basis.length, first * blockSize), Math.min(basis.length, (first + count) * blockSize)));
+        break;
+      }
+      case Instruction.LITERAL: {
+        if (delta.length - offset < 4)
+          throw new Error('Truncated delta');
+        const size = delta.readUInt32LE(offset);
+        offset += 4;
+        if (delta.length - offset < size)
+          throw new Error('Truncated delta');
+        parts.push(delta.subarray(offset, offset + size));
+        offset += size;
+        break;
+      }
+      default:
+        throw new Error('Malformed delta');
+    }
+  }
+  throw new Error('Truncated delta');
+};
@@ -1,30 +1,51 @@
-import { Action } from '../common-types';
+import { Action, ACTION_COMPRESSED } from '../common-types';
 import { constants } from 'buffer';
 import * as fs from 'node:fs';
+import * as zlib from 'node:zlib';
 import type { Message } from './Message';
 import { BinaryMessage, FileMessage, ActionMessage } from './Message';
+import { parseRangeHeader, RANGE_HEADER_SIZE, type RangeHeader } from './Resume';
+
+/** A ranged FILE's header came: where in the file its range goes */
+export type OnFileRange = (header: RangeHeader) => number;
+/** @param range The ranged FILE's header, undefined if it came empty */
+export type OnFileWritten = (path: string, range?: RangeHeader) => unknown;
 
 export class MessageReader {
   #data: Buffer;
   #received?: bigint;
   #messageBodySize?: bigint;
   #outputFile?: string;
-  #fileExpectations: string[];
+  #onFileWritten?: OnFileWritten;
+  #onFileRange?: OnFileRange;
+  #rangeHeader = Buffer.alloc(0);
+  #range?: RangeHeader;
+  #fileExpectations: [string, OnFileWritten | undefined, OnFileRange | undefined][];
   #expectation: 'action' | 'binary';
   #action?: Action;
+  #compressed = false;
   #fileStream?: fs.WriteStream;
+  #onCorrupt?: (error: Error) => void;
+  #corrupt = false;
 
-  constructor() {
+  /** @param onCorrupt A message can't be made sense of: nothing after it can be either, the connection has to go */
+  constructor(onCorrupt?: (error: Error) => void) {
     this.#data = Buffer.alloc(0);
     this.#fileExpectations = [];
     this.#expectation = 'action';
+    this.#onCorrupt = onCorrupt;
   }
 
   isExpectingFile() {
     return !!this.#outputFile;
   }
-  expectFile(name: string) {
-    this.#fileExpectations.push(name);
+  /**
+   * @param onWritten Called once the file is complete and closed
+   * @param onRange Makes it a ranged FILE (protocol/Resume.ts): the body starts with a range header, and the rest is written where this
+   * says, over what's there from that point on. Unlike a plain one, a ranged file is kept if the connection drops
+   */
+  expectFile(name: string, onWritten?: OnFileWritten, onRange?: OnFileRange) {
+    this.#fileExpectations.push([name, onWritten, onRange]);
   }
   expectBinary() {
     this.#expectation = 'binary';
@@ -37,6 +58,9 @@ export class MessageReader {
       await new Promise((resolve, reject) => this.#fileStream?.end(resolve) || reject());
     this.#fileStream = undefined;
     this.#outputFile = undefined;
+    this.#onFileRange = undefined;
+    this.#rangeHeader = Buffer.alloc(0);
+    this.#range = undefined;
 
     let nextBytes = 0;
     if (data.length > borderLength) {
@@ -48,6 +72,7 @@ export class MessageReader {
     this.#received = undefined;
     this.#messageBodySize = undefined;
     this.#expectation = 'action';
+    this.#compressed = false;
 
     // console.log('message end', 'data.length', data.length, 'borderLength', borderLength, 'nextBytes', nextBytes);
     return nextBytes;
@@ -71,14 +96,20 @@ export class MessageReader {
 
       if (this.#data.length >= headerLength) {
         if (this.#fileExpectations.length)
-          [this.#outputFile] = this.#fileExpectations.splice(0, 1);
+          [[this.#outputFile, this.#onFileWritten, this.#onFileRange]] = this.#fileExpectations.splice(0, 1);
 
         const messageBodySize = this.#data.readBigUInt64LE() - BigInt(actionLength);
-        if (this.#expectation !== 'binary')
-          this.#action = Number(this.#data.at(lengthLength)) as Action;
+        if (this.#expectation !== 'binary') {
+          const actionByte = Number(this.#data.at(lengthLength));
+          this.#action = (actionByte & ~ACTION_COMPRESSED) as Action;
+          this.#compressed = !!(actionByte & ACTION_COMPRESSED);
+        }
         this.#data = this.#data.subarray(headerLength);
-        if (this.#outputFile)
-          this.#fileStream = fs.createWriteStream(this.#outputFile);
+        if (this.#outputFile) {
+          // a ranged one is opened once its header says where
+          if (!this.#onFileRange)
+            this.#fileStream = fs.createWriteStream(this.#outputFile);
+        }
         else if (this.#action === Action.FILE)
           throw new Error('Unexpected file (network stream aborted)');
         else if (messageBodySize > constants.MAX_LENGTH)
@@ -110,14 +141,30 @@ export class MessageReader {
     //   '#fileStream': !!this.#fileStream
     // });
 
-    if (this.#fileStream) {
-      await new Promise((resolve, reject) => this.#fileStream!.write(data.subarray(bodyStartsAt, bodyStartsAt + writeSize), err => err ? reject(err) : resolve(err)));
+    if (this.#outputFile) {
+      let body = data.subarray(bodyStartsAt, bodyStartsAt + writeSize);
+      if (this.#onFileRange && !this.#range) {
+        const headerPart = body.subarray(0, RANGE_HEADER_SIZE - this.#rangeHeader.length);
+        this.#rangeHeader = Buffer.concat([this.#rangeHeader, headerPart]);
+        body = body.subarray(headerPart.length);
+        if (this.#rangeHeader.length === RANGE_HEADER_SIZE) {
+          this.#range = parseRangeHeader(this.#rangeHeader);
+          this.#fileStream = MessageReader.#openAt(this.#outputFile, this.#onFileRange(this.#range));
+        }
+      }
+      if (body.length)
+        await new Promise((resolve, reject) => this.#fileStream!.write(body, err => err ? reject(err) : resolve(err)));
       this.#received += BigInt(writeSize);
 
       if (this.#received >= this.#messageBodySize) {
-        const result = new FileMessage(this.#outputFile as string);
+        const result = new FileMessage(this.#outputFile);
+        const onWritten = this.#onFileWritten;
+        const range = this.#range;
+        this.#onFileWritten = undefined;
         await onMessage(result);
-        return await this.#onMessageEnd(data, borderLength);
+        const nextBytes = await this.#onMessageEnd(data, borderLength);
+        await onWritten?.(result.path, range);
+        return nextBytes;
       }
     }
     else {
@@ -129,7 +176,17 @@ export class MessageReader {
         const resultBuf = this.#data.subarray(0, Number(this.#received));
         // console.log('before message end', this.#data.length, data?.length, this.#received, this.#messageBodySize);
         if (this.#expectation === 'action') {
-          await onMessage(new ActionMessage(resultBuf, this.#action as Exclude<Action, Action.FILE>));
+          let body = resultBuf;
+          if (this.#compressed)
+            try {
+              body = zlib.inflateSync(resultBuf, { maxOutputLength: constants.MAX_LENGTH });
+            }
+            catch (err) {
+              this.#corrupt = true;
+              this.#onCorrupt?.(new Error('Corrupt compressed message', { cause: err }));
+              return 0;
+            }
+          await onMessage(new ActionMessage(body, this.#action as Exclude<Action, Action.FILE>));
           return await this.#onMessageEnd(data, borderLength);
         }
         else if (this.#expectation === 'binary') {
@@ -150,6 +207,8 @@ export class MessageReader {
    */
   async read(data: Buffer, callback: (message: Message) => unknown | Promise<unknown>) {
     for (let i = 0; i < 100; i++) {
+      if (this.#corrupt)
+        return;
       const nextMessageBytes = await this._read(data, callback);
       if (!nextMessageBytes)
         return;
@@ -160,10 +219,18 @@ export class MessageReader {
     throw new Error('Infinite loop');
   }
 
+  /** Opens `path` for writing from `position` on, dropping what's there past it */
+  static #openAt(path: string, position: number) {
+    const fd = fs.openSync(path, fs.existsSync(path) ? 'r+' : 'w');
+    fs.ftruncateSync(fd, position);
+    return fs.createWriteStream(path, { fd, start: position });
+  }
+
   async cleanup() {
     if (this.#fileStream && !this.#fileStream.destroyed)
       await new Promise(resolve => this.#fileStream!.end(resolve));
-    if (this.#outputFile)
+    // what came of a ranged one is what a resumed transfer starts from
+    if (this.#outputFile && !this.#onFileRange)
       fs.unlinkSync(this.#outputFile);
   }
 }
\ No newline at end of file
@@ -0,0 +1,146 @@
+import fs from 'node:fs';
+import { pipeline } from 'node:stream/promises';
+
+/*
+ * Resumable and striped downloads, the server's side of the agent's net.SendFileRange and net.SendFileStripes. A range comes as a FILE
+ * behind a header: [u64 offset][u64 file size][i64 modified], the last two being the version of the file it's of. What's received is kept
+ * in `<target>.part` (`.part1`, `.part2`... for the other stripes), and `<target>.part.json` says of what: a download that broke off goes
+ * on from there, unless the agent's file has changed since. Stripes come over data connections of their own, which the agent opens and
+ * names with ATTACH: [32 bytes exported from the TLS session of its main connection][u32 transfer][u32 stripe].
+ */
+
+export const RANGE_HEADER_SIZE = 8 + 8 + 8;
+export const ATTACH_EXPORTER_LABEL = 'EXPORTER-mrut-attach';
+export const ATTACH_KEY_SIZE = 32;
+export const ATTACH_MESSAGE_SIZE = ATTACH_KEY_SIZE + 4 + 4;
+/** Smaller stripes aren't worth a connection */
+export const MIN_STRIPE_SIZE = 8 * 1024 * 1024;
+export const MAX_STRIPES = 16;
+
+export interface RangeHeader {
+  offset: number;
+  /** The file's, not the range's */
+  size: number;
+  /** The agent's modification time of the file: only compared with what it said before */
+  modified: number;
+}
+export interface Stripe {
+  offset: number;
+  length: number;
+}
+/** What `<target>.part.json` holds */
+interface ResumeState {
+  src: string;
+  size: number;
+  modified: number;
+  stripes: Stripe[];
+}
+
+export const parseRangeHeader = (data: Buffer): RangeHeader => ({
+  offset: Number(data.readBigUInt64LE(0)),
+  size: Number(data.readBigUInt64LE(8)),
+  modified: Number(data.readBigInt64LE(16)),
+});
+/** @returns undefined if it's not an ATTACH body */
+export const parseAttach = (data: Buffer) => data.length !== ATTACH_MESSAGE_SIZE ? undefined : {
+  key: Buffer.from(data.subarray(0, ATTACH_KEY_SIZE)),
+  transfer: data.readUInt32LE(ATTACH_KEY_SIZE),
+  stripe: data.readUInt32LE(ATTACH_KEY_SIZE + 4),
+};
+
+/** `size` bytes cut in up to `streams` equal stripes, none smaller than MIN_STRIPE_SIZE (a small file is one stripe) */
+export const planStripes = (size: number, streams: number): Stripe[] => {
+  const count = Math.max(1, Math.min(Math.floor(streams), MAX_STRIPES, Math.floor(size / MIN_STRIPE_SIZE)));
+  const length = Math.ceil(size / count);
+  return Array.from({ length: count }, (_, i) => ({ offset: i * length, length: Math.max(0, Math.min(length, size - i * length)) }));
+};
+
+/** A download into `target` that survives breaking off: what's received stays until it's all there */
+export class ResumableDownload {
+  #state?: ResumeState;
+
+  constructor(readonly target: string, readonly src: string) {
+    try {
+      const state: ResumeState = JSON.parse(fs.readFileSync(this.#statePath, 'utf-8'));
+      if (state.src === src && Array.isArray(state.stripes))
+        this.#state = state;
+    }
+    catch {
+      // nothing to resume
+    }
+  }
+  get #statePath() {
+    return `${this.target}.part.json`;
+  }
+  get stripes(): readonly Stripe[] {
+    return this.#state?.stripes ?? [];
+  }
+
+  partPath(stripe: number) {
+    return `${this.target}.part${stripe || ''}`;
+  }
+  /** Bytes of `stripe` here already */
+  received(stripe: number) {
+    const length = this.stripes[stripe]?.length ?? 0;
+    try {
+      return Math.min(fs.statSync(this.partPath(stripe)).size, length);
+    }
+    catch {
+      return 0;
+    }
+  }
+  /** What to ask for over a single connection: from where, and of which version of the file (0, 0: any) */
+  resumePoint(): RangeHeader {
+    if (this.#state?.stripes.length !== 1)
+      return { offset: 0, size: 0, modified: 0 };
+    return { offset: this.received(0), size: this.#state.size, modified: this.#state.modified };
+  }
+  /**
+   * The agent's file is of (`size`, `modified`): what's here is kept if it's of that version and cut the same way, else it starts over
+   * in up to `streams` stripes
+   */
+  plan(size: number, modified: number, streams: number) {
+    const stripes = planStripes(size, streams);
+    const state = this.#state;
+    if (state && state.size === size && state.modified === modified && state.stripes.length === stripes.length)
+      return state.stripes;
+    for (let i = 0; i < Math.max(state?.stripes.length ?? 0, stripes.length); i++)
+      fs.rmSync(this.partPath(i), { force: true });
+    this.#state = { src: this.src, size, modified, stripes };
+    fs.writeFileSync(this.#statePath, JSON.stringify(this.#state));
+    return stripes;
+  }
+  /** The ranges still to come, by stripe */
+  remaining() {
+    return this.stripes.map((stripe, i) => ({ stripe: i, offset: stripe.offset + this.received(i), length: stripe.length - this.received(i) }))
+      .filter(range => range.length > 0);
+  }
+  /** Where in its part the range `header` starts goes (what's past that there is dropped) */
+  position(stripe: number, header: RangeHeader) {
+    return Math.max(0, header.offset - (this.stripes[stripe]?.offset ?? 0));
+  }
+  isComplete() {
+    return !!this.#state && this.stripes.every((stripe, i) => this.received(i) === stripe.length);
+  }
+  /** The parts, put together, become `target` */
+  async finish() {
+    const stripes = this.stripes;
+    if (!fs.existsSync(this.partPath(0)))
+      fs.writeFileSync(this.partPath(0), '');
+    for (let i = 1; i < stripes.length; i++) {
+      await pipeline(fs.createReadStream(this.partPath(i)), fs.createWriteStream(this.partPath(0), { flags: 'r+', start: stripes[i].offset }));
+      fs.rmSync(this.partPath(i), { force: true });
+    }
+    fs.truncateSync(this.partPath(0), this.#state?.size ?? 0);
+    fs.renameSync(this.partPath(0), this.target);
+    fs.rmSync(this.#statePath, { force: true });
+    this.#state = undefined;
+  }
+}
+
+/** A download cut in stripes, waiting for their data connections */
+export interface StripedDownload {
+  download: ResumableDownload;
+  /** A stripe's FILE has all come; `header` is undefined if it came empty */
+  onStripe(stripe: number, header?: RangeHeader): unknown;
+}
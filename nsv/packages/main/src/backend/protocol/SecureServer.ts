@@ -4,26 +4,33 @@ import type { IUser, IUserHandshake } from '$types/Common';
 import { ActionMessage } from './Message';
 import * as commands from '../commands';
 import { ClientOneShot } from './ClientOneShot';
-import { Action } from '../common-types';
+import { Action, compressionCodecs } from '../common-types';
 import _ from 'lodash';
 import type { Logger } from '../Logger';
 import tls from 'node:tls';
+import crypto from 'node:crypto';
 import { Certificates } from '../Certififaces';
 import { en } from '../../../../../types/Locales';
+import { DATAGRAM_FEC_GROUP, DatagramServer } from './DatagramServer';
+import { ATTACH_EXPORTER_LABEL, ATTACH_KEY_SIZE, parseAttach } from './Resume';
+import type { Config } from '../Config';
 
 export class SecureServer {
   #bindClient: (client: Client) => void;
   #onModifyUser: (client: Client, update: Partial<IUser>) => void;
   #logger: Logger;
+  #config: Config;
   #server?: tls.Server;
+  #datagram?: DatagramServer;
 
-  constructor(logger: Logger, onModifyUser: (client: Client, update: Partial<IUser>) => void, bindClient: (client: Client) => void) {
+  constructor(logger: Logger, config: Config, onModifyUser: (client: Client, update: Partial<IUser>) => void, bindClient: (client: Client) => void) {
     this.#bindClient = bindClient;
     this.#logger = logger;
+    this.#config = config;
     this.#onModifyUser = onModifyUser;
   }
 
-  async performHandshake(client: Client, handshake: IUserHandshake) {
+  async performHandshake(client: Client, handshake: IUserHandshake, reply: object = {}) {
     try {
       client.public.hostname = handshake.hostname;
       client.public.startTimeMs = handshake.timestampMs;
@@ -49,7 +56,7 @@ export class SecureServer {
       }
 
       this.#onModifyUser(client, _.pick(client.public, updatedFields));
-      await client.sendMessage(JSON.stringify({}));
+      await client.sendMessage(JSON.stringify(reply));
       this.#logger.log({ type: 'system', text: en.serverLogs.clientConnected, targets: [client] });
     }
     catch (e) {
@@ -64,11 +71,21 @@ export class SecureServer {
   #handleConnection(socket: Socket) {
     // socket.setNoDelay(true);
     let client: Client;
+    let unregisterDatagram: (() => void) | undefined;
 
     const oneShot = new ClientOneShot(socket);
     oneShot.on('message', ActionMessage, async (message: ActionMessage) => {
       const [code, data] = [message.action, message.data];
 
+      if (code === Action.ATTACH) {
+        oneShot.dispose();
+        const attach = parseAttach(data);
+        // in constant time: how long a wrong key took to turn down says nothing about the right one
+        const owner = attach && commands.clients.find(v => v.public.online && v.attachKey && crypto.timingSafeEqual(v.attachKey, attach.key));
+        if (!attach || !owner)
+          return socket.destroy();
+        return owner.attach(socket, attach.transfer, attach.stripe);
+      }
       if (code !== Action.HANDSHAKE)
         throw new Error('Action before handshake: aborted');
       oneShot.dispose();
@@ -85,11 +102,25 @@ export class SecureServer {
       }
 
       this.#bindActualClient(client);
-      await this.performHandshake(client, handshake);
+      client.attachKey = (socket as tls.TLSSocket).exportKeyingMaterial(ATTACH_KEY_SIZE, ATTACH_EXPORTER_LABEL);
+      const reply: { datagram?: { port: number, fecGroup: number }, compression?: string, batch?: boolean, slices?: boolean } = {};
+      reply.compression = compressionCodecs.find(codec => handshake.compression?.includes(codec));
+      reply.batch = handshake.batch || undefined;
+      reply.slices = handshake.slices || undefined;
+      if (this.#datagram?.port !== undefined) {
+        const datagramClient = client;
+        unregisterDatagram?.();
+        unregisterDatagram = this.#datagram.register(socket as tls.TLSSocket, frame => datagramClient.dispatch(new ActionMessage(frame, Action.SCREENCAST)));
+        reply.datagram = { port: this.#datagram.port, fecGroup: DATAGRAM_FEC_GROUP };
+      }
+      await this.performHandshake(client, handshake, reply);
     });
 
     const setClientOffline = (e: Error | null) => {
-      if (!client.public.online)
+      unregisterDatagram?.();
+      unregisterDatagram = undefined;
+      // a data connection (ATTACH) has no client of its own
+      if (!client?.public.online)
         return;
       if (e)
         console.error(e);
@@ -122,18 +153,31 @@ export class SecureServer {
         ca: certificates.rootCrt,
         minVersion: 'TLSv1.3',
       }, socket => this.#handleConnection(socket));
-      this.#server.listen(1337);
+      this.#server.listen(this.#config.port);
       this.#logger.log({ text: en.serverLogs.serverStarted, type: 'system' });
     }
     catch (err) {
       this.#logger.log({ type: 'error', text: en.serverLogs.serverStartError, err });
     }
+    if (!this.#config.datagramPort)
+      return;
+    try {
+      // screencast side channel; agents keep streaming over TLS if it can't be bound
+      this.#datagram = new DatagramServer(this.#config.datagramRateLimit);
+      await this.#datagram.start(this.#config.datagramPort);
+    }
+    catch (err) {
+      this.#datagram = undefined;
+      this.#logger.log({ type: 'error', text: en.serverLogs.datagramStartError, err });
+    }
   }
   async restart() {
     if (this.#server) {
       this.#server.close();
       this.#server = undefined;
     }
+    this.#datagram?.close();
+    this.#datagram = undefined;
     this.start();
   }
 }
\ No newline at end of file
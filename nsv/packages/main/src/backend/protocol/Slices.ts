@@ -0,0 +1,88 @@
+/*
+ * Sliced messages, negotiated with `slices` in the handshake: the agent sends its BULK messages (files) in slices, so that whole
+ * messages of higher traffic classes (the poll, feedback, a screencast frame) go between them instead of waiting for all of the file.
+ * A sliced message's size has bit 63 set, and its body comes as slices of [u64 size | bit 62][that many bytes]; whole messages can come
+ * between two slices, another sliced message can't. Little-endian, like the rest of the protocol.
+ */
+
+export const SLICED_MESSAGE_FLAG = 1n << 63n;
+export const SLICE_FLAG = 1n << 62n;
+const SIZE_LENGTH = 8;
+
+export interface SlicedPiece {
+  /** Of a whole message that came between the slices of a sliced one */
+  interleaved: boolean;
+  data: Buffer;
+}
+
+/**
+ * Takes apart what comes between the slices of a sliced message from the sliced message itself, which comes out as a plain one (its
+ * size without the flag, then its body): each of the two goes to a reader of its own
+ */
+export class SliceSplitter {
+  #size = Buffer.alloc(0);
+  /** Of the frame being read (a whole message's body or a slice); undefined while its size is */
+  #frameLeft?: bigint;
+  #frameInterleaved = false;
+  /** Of the sliced message, once its size came; undefined if there's none */
+  #slicedLeft?: bigint;
+
+  write(data: Buffer): SlicedPiece[] {
+    const pieces: SlicedPiece[] = [];
+    let offset = 0;
+    while (offset < data.length) {
+      if (this.#frameLeft === undefined) {
+        const part = data.subarray(offset, offset + SIZE_LENGTH - this.#size.length);
+        this.#size = Buffer.concat([this.#size, part]);
+        offset += part.length;
+        if (this.#size.length < SIZE_LENGTH)
+          break;
+        this.#readSize(this.#size.readBigUInt64LE(), pieces);
+        this.#size = Buffer.alloc(0);
+      }
+      else {
+        const available = BigInt(data.length - offset);
+        const body = data.subarray(offset, offset + Number(this.#frameLeft < available ? this.#frameLeft : available));
+        pieces.push({ interleaved: this.#frameInterleaved, data: body });
+        offset += body.length;
+        this.#frameLeft -= BigInt(body.length);
+      }
+      if (this.#frameLeft === 0n)
+        this.#endFrame();
+    }
+    return pieces;
+  }
+  #readSize(size: bigint, pieces: SlicedPiece[]) {
+    if (size & SLICED_MESSAGE_FLAG) {
+      if (this.#slicedLeft !== undefined)
+        throw new Error('A sliced message within another');
+      this.#slicedLeft = size & ~SLICED_MESSAGE_FLAG;
+      pieces.push({ interleaved: false, data: SliceSplitter.#encodeSize(this.#slicedLeft) });
+      if (!this.#slicedLeft)
+        this.#slicedLeft = undefined;
+      return;
+    }
+    if (size & SLICE_FLAG) {
+      const length = size & ~SLICE_FLAG;
+      if (this.#slicedLeft === undefined || length > this.#slicedLeft)
+        throw new Error('A slice of no sliced message');
+      this.#slicedLeft -= length;
+      this.#frameLeft = length;
+      this.#frameInterleaved = false;
+      return;
+    }
+    this.#frameInterleaved = this.#slicedLeft !== undefined;
+    this.#frameLeft = size;
+    pieces.push({ interleaved: this.#frameInterleaved, data: SliceSplitter.#encodeSize(size) });
+  }
+  #endFrame() {
+    if (!this.#frameInterleaved && this.#slicedLeft === 0n)
+      this.#slicedLeft = undefined;
+    this.#frameLeft = undefined;
+  }
+  static #encodeSize(size: bigint) {
+    const data = Buffer.alloc(SIZE_LENGTH);
+    data.writeBigUInt64LE(size);
+    return data;
+  }
+}
@@ -0,0 +1,42 @@
+import type { IWatchEvent } from '$types/Common';
+import { StringDecoder } from 'node:string_decoder';
+
+/*
+ * Directory watching, the server's side of the agent's fs.Watch: the job's output is a JSON object per line, already folded over the
+ * agent's debounce window. The first is `{"event":"ready","token":N}`, which says which watch the job is, the way an archive's header
+ * does for downloaddir.
+ */
+
+const READY_PREFIX = Buffer.from('{"event":"ready","token":');
+
+/** @returns The token if `data` is the start of a watch's output */
+export const readWatchToken = (data: Buffer) => {
+  if (!data.subarray(0, READY_PREFIX.length).equals(READY_PREFIX))
+    return undefined;
+  const end = data.indexOf('}', READY_PREFIX.length);
+  const token = end < 0 ? NaN : Number(data.subarray(READY_PREFIX.length, end).toString('latin1'));
+  return Number.isInteger(token) ? token : undefined;
+};
+
+/** The events in a watch's output, as its pieces come: a piece can end within a line, or within a character */
+export class WatchEventReader {
+  #decoder = new StringDecoder('utf-8');
+  #rest = '';
+
+  write(data: Buffer): IWatchEvent[] {
+    const lines = (this.#rest + this.#decoder.write(data)).split('\n');
+    this.#rest = lines.pop()!;
+    const events: IWatchEvent[] = [];
+    for (const line of lines) {
+      try {
+        if (line)
+          events.push(JSON.parse(line));
+      }
+      catch {
+        // not an event: a broken line can only mean something was lost, which is what an overflow is
+        events.push({ event: 'overflow' });
+      }
+    }
+    return events;
+  }
+}
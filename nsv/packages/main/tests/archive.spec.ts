@@ -0,0 +1,112 @@
+import { expect, test, describe } from 'vitest';
+import { ArchiveExtractor, ArchiveRecord, BLOCK_SIZE, encodeArchive, isSafeArchivePath, readArchiveToken } from '../src/backend/protocol/Archive';
+import crypto from 'node:crypto';
+import fs from 'node:fs';
+import os from 'node:os';
+import path from 'node:path';
+
+const temporary = () => fs.mkdtempSync(path.join(os.tmpdir(), 'rut-archive-'));
+/** A few levels, an empty directory, small text files, an incompressible file bigger than a block, an empty file */
+const makeTree = () => {
+  const root = temporary();
+  fs.mkdirSync(path.join(root, 'a/b'), { recursive: true });
+  fs.mkdirSync(path.join(root, 'empty'));
+  for (let i = 0; i < 50; i++)
+    fs.writeFileSync(path.join(root, 'a/b', `small${i}.txt`), `file ${i}\n`.repeat(i * 10));
+  fs.writeFileSync(path.join(root, 'a/random.bin'), crypto.randomBytes(700 * 1024));
+  fs.writeFileSync(path.join(root, 'a/text.txt'), Array.from({ length: 100000 }, (_, i) => `line ${i}`).join('\n'));
+  fs.writeFileSync(path.join(root, 'zero'), '');
+  return root;
+};
+/** The pieces as they'd go out, one after another */
+const encode = async (...args: Parameters<typeof encodeArchive>) => Buffer.concat(await Array.fromAsync(encodeArchive(...args)));
+const listTree = (root: string): string[] => fs.readdirSync(root, { recursive: true, encoding: 'utf-8' }).sort();
+/** Feeds the archive in uneven pieces, as job output comes */
+const extract = (archive: Buffer, into: string) => {
+  const extractor = new ArchiveExtractor(into);
+  for (let offset = 0; offset < archive.length;) {
+    const size = 1 + crypto.randomInt(70000);
+    extractor.write(archive.subarray(offset, offset + size));
+    offset += size;
+  }
+  return extractor.end();
+};
+const pathRecord = (type: ArchiveRecord, relative: string) => {
+  const record = Buffer.alloc(3);
+  record.writeUInt8(type, 0);
+  record.writeUInt16LE(relative.length, 1);
+  return Buffer.concat([record, Buffer.from(relative)]);
+};
+
+describe('Round trip', () => {
+  const root = makeTree();
+  for (const compress of [true, false])
+    test(compress ? 'compressed' : 'stored', async () => {
+      const archive = await encode(root, { token: 7, compress });
+      expect(readArchiveToken(archive)).toBe(7);
+      const into = temporary();
+      const stats = extract(archive, into);
+      expect(stats.complete).toBe(true);
+      expect(stats.errors).toEqual([]);
+      expect(stats.files).toBe(53);
+      expect(stats.directories).toBe(3);
+      expect(listTree(into)).toEqual(listTree(root));
+      for (const file of ['a/random.bin', 'a/text.txt', 'a/b/small49.txt', 'zero'])
+        expect(fs.readFileSync(path.join(into, file)).equals(fs.readFileSync(path.join(root, file)))).toBe(true);
+      expect(Math.floor(fs.statSync(path.join(into, 'a/text.txt')).mtimeMs)).toBe(Math.floor(fs.statSync(path.join(root, 'a/text.txt')).mtimeMs));
+    });
+  test('text shrinks, random data doesn\'t grow', async () => {
+    const compressed = (await encode(root)).length, stored = (await encode(root, { compress: false })).length;
+    expect(compressed).toBeLessThan(stored - 500000);
+    expect(stored).toBeLessThan(fs.statSync(path.join(root, 'a/random.bin')).size + 1500000);
+  });
+  test('a single file', async () => {
+    const into = temporary();
+    const stats = extract(await encode(path.join(root, 'a/text.txt')), into);
+    expect(stats.files).toBe(1);
+    expect(fs.readFileSync(path.join(into, 'text.txt')).equals(fs.readFileSync(path.join(root, 'a/text.txt')))).toBe(true);
+  });
+  test('goes out in pieces of about a block', async () => {
+    const pieces = await Array.fromAsync(encodeArchive(root, { compress: false }));
+    expect(pieces.length).toBeGreaterThan(3);
+    // records held back for the next block, at most a block's worth and one path more, then the block itself
+    for (const piece of pieces)
+      expect(piece.length).toBeLessThanOrEqual(2 * BLOCK_SIZE + 0x10000 + 64);
+  });
+});
+
+describe('Damage', () => {
+  const root = makeTree();
+  test('cut off', async () => {
+    const archive = await encode(root);
+    const stats = extract(archive.subarray(0, archive.length >> 1), temporary());
+    expect(stats.complete).toBe(false);
+    expect(stats.failed).toBe(1);
+  });
+  test('not an archive', () => expect(extract(Buffer.from('definitely not an archive'), temporary()).complete).toBe(false));
+  test('paths out of the root are refused', async () => {
+    expect(['../x', '/x', 'a/../../x', 'C:x', 'a\\b', '', 'a//b', './a'].some(isSafeArchivePath)).toBe(false);
+    expect(isSafeArchivePath('a/b.c/d')).toBe(true);
+    const outer = temporary(), into = path.join(outer, 'into');
+    const archive = await encode(root);
+    const evil = Buffer.concat([archive.subarray(0, 8), pathRecord(ArchiveRecord.FILE, '../evil'), Buffer.alloc(8), Buffer.alloc(8),
+      pathRecord(ArchiveRecord.DIRECTORY, '../evildir'), Buffer.from([ArchiveRecord.END]), Buffer.alloc(16)]);
+    const stats = extract(evil, into);
+    expect(stats.failed).toBe(2);
+    expect(fs.readdirSync(outer)).toEqual(['into']);
+  });
+  test('a file the sender couldn\'t read is left out', async () => {
+    const archive = await encode(root);
+    const message = Buffer.from('read error');
+    const size = Buffer.alloc(2);
+    size.writeUInt16LE(message.length);
+    const partial = Buffer.concat([archive.subarray(0, 8), pathRecord(ArchiveRecord.FILE, 'partial'), Buffer.alloc(8),
+      Buffer.from([3, 0, 0, 0, 3, 0, 0, 0]), Buffer.from('abc'), Buffer.alloc(8), pathRecord(ArchiveRecord.ERROR, 'partial'), size, message,
+      Buffer.from([ArchiveRecord.END]), Buffer.alloc(16)]);
+    const into = temporary();
+    const stats = extract(partial, into);
+    expect(stats.files).toBe(0);
+    expect(stats.errors).toEqual(['partial: read error']);
+    expect(fs.existsSync(path.join(into, 'partial'))).toBe(false);
+  });
+});
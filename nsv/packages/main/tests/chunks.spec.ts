@@ -0,0 +1,72 @@
+import { expect, test, describe } from 'vitest';
+import { chunk, encodeManifest, encodeUpload, parseMissing, MAX_CHUNK_SIZE, MIN_CHUNK_SIZE } from '../src/backend/protocol/Chunks';
+import crypto from 'node:crypto';
+
+const hashes = (data: Buffer) => new Set(chunk(data).map(c => c.hash.toString('hex')));
+const shared = (a: Set<string>, b: Set<string>) => [...a].filter(h => b.has(h)).length;
+
+describe('Content-defined chunking', () => {
+  const data = crypto.randomBytes(4 * 1024 * 1024);
+  test('chunks cover the file, within the bounds', () => {
+    const chunks = chunk(data);
+    let offset = 0;
+    chunks.forEach((c, i) => {
+      expect(c.offset).toBe(offset);
+      expect(c.size).toBeLessThanOrEqual(MAX_CHUNK_SIZE);
+      if (i < chunks.length - 1)
+        expect(c.size).toBeGreaterThan(MIN_CHUNK_SIZE);
+      offset += c.size;
+    });
+    expect(offset).toBe(data.length);
+  });
+  test('same data, same chunks', () => expect(chunk(Buffer.from(data)).map(c => c.size)).toEqual(chunk(data).map(c => c.size)));
+  test('boundaries survive an insertion', () => {
+    const before = hashes(data);
+    const after = hashes(Buffer.concat([data.subarray(0, 1000000), crypto.randomBytes(100), data.subarray(1000000)]));
+    // only the chunk around the insertion changes (and maybe the next one, if its cut point was within reach)
+    expect(shared(before, after)).toBeGreaterThanOrEqual(before.size - 2);
+  });
+  test('boundaries survive a prefix', () => {
+    const before = hashes(data);
+    expect(shared(before, hashes(Buffer.concat([crypto.randomBytes(12345), data])))).toBeGreaterThanOrEqual(before.size - 2);
+  });
+  test('empty and small files', () => {
+    expect(chunk(Buffer.alloc(0))).toEqual([]);
+    expect(chunk(Buffer.alloc(100)).map(c => c.size)).toEqual([100]);
+  });
+});
+
+describe('Wire format', () => {
+  const data = crypto.randomBytes(1024 * 1024);
+  const chunks = chunk(data);
+  test('manifest', () => {
+    const manifest = encodeManifest(chunks);
+    expect(manifest.readUInt32LE(0)).toBe(chunks.length);
+    expect(manifest.length).toBe(4 + chunks.length * 36);
+    expect(manifest.readUInt32LE(4)).toBe(chunks[0].size);
+    expect(manifest.subarray(8, 40).equals(chunks[0].hash)).toBe(true);
+  });
+  test('the agent\'s answer', () => {
+    const answer = Buffer.alloc(8);
+    answer.writeUInt32LE(2, 0);
+    answer.writeUInt32LE(0, 4);
+    expect(parseMissing(answer)).toEqual([2, 0]);
+    expect(parseMissing(Buffer.alloc(0))).toEqual([]);
+  });
+  test('upload carries only the missing chunks, and says which', () => {
+    const upload = encodeUpload(data, chunks, [1]);
+    const manifestSize = 4 + chunks.length * 36;
+    expect(upload.subarray(0, manifestSize).equals(encodeManifest(chunks))).toBe(true);
+    expect(upload.readUInt32LE(manifestSize)).toBe(1);
+    expect(upload.readUInt32LE(manifestSize + 4)).toBe(1);
+    expect(upload.subarray(manifestSize + 8).equals(data.subarray(chunks[1].offset, chunks[1].offset + chunks[1].size))).toBe(true);
+    expect(encodeUpload(data, chunks, []).length).toBe(manifestSize + 4);
+  });
+  test('indices out of range or repeated are dropped, the rest sorted', () => {
+    const upload = encodeUpload(data, chunks, [2, chunks.length, 0, 2]);
+    const manifestSize = 4 + chunks.length * 36;
+    expect(upload.readUInt32LE(manifestSize)).toBe(2);
+    expect([upload.readUInt32LE(manifestSize + 4), upload.readUInt32LE(manifestSize + 8)]).toEqual([0, 2]);
+    expect(upload.length).toBe(manifestSize + 12 + chunks[0].size + chunks[2].size);
+  });
+});
@@ -0,0 +1,101 @@
+import { expect, test, describe } from 'vitest';
+import { blockSizeFor, diff, patch, rollingChecksum, sign, type DeltaStats } from '../src/backend/protocol/Delta';
+import crypto from 'node:crypto';
+
+const md5 = (data: Buffer) => crypto.createHash('md5').update(data).digest('hex');
+/** Deterministic bytes, so the agent's output for them can be pinned */
+const lcgBytes = (size: number) => {
+  const data = Buffer.alloc(size);
+  let x = 1;
+  for (let i = 0; i < size; i++) {
+    x = (Math.imul(x, 1103515245) + 12345) >>> 0;
+    data[i] = x >>> 24;
+  }
+  return data;
+};
+const roundTrip = (basis: Buffer, target: Buffer, blockSize?: number) => {
+  const stats: DeltaStats = { copied: 0, literal: 0 };
+  const delta = diff(sign(basis, blockSize), target, stats);
+  return { delta, stats, result: patch(basis, delta) };
+};
+
+describe('Rolling checksum', () => {
+  test('is rsync\'s', () => {
+    // a = 97 + 98 + 99, b = 97 + (97 + 98) + a
+    expect(rollingChecksum(Buffer.from('abc'))).toBe((294 | (586 << 16)) >>> 0);
+    expect(rollingChecksum(Buffer.from('xabcx'), 1, 4)).toBe(rollingChecksum(Buffer.from('abc')));
+  });
+  test('block size follows the square root', () => {
+    expect(blockSizeFor(0)).toBe(700);
+    expect(blockSizeFor(64 * 1024 * 1024)).toBe(8192);
+    expect(blockSizeFor(1e12)).toBe(128 * 1024);
+  });
+});
+
+describe('Edit patterns', () => {
+  const basis = crypto.randomBytes(3 * 1024 * 1024);
+  const half = basis.length / 2;
+  // around an edit, up to a block on each side goes as literal; so does the basis's short last block anywhere but at the end
+  const block = blockSizeFor(basis.length);
+  const patterns: [string, Buffer, number][] = [
+    // [name, target, at most this many literal bytes]
+    ['identical', basis, 0],
+    ['append', Buffer.concat([basis, crypto.randomBytes(10000)]), 10000 + block],
+    ['truncate', basis.subarray(0, 1000000), block],
+    ['insert at start', Buffer.concat([crypto.randomBytes(100), basis]), 100],
+    ['delete in the middle', Buffer.concat([basis.subarray(0, half), basis.subarray(half + 4096)]), 2 * block],
+    ['overwrite in place', Buffer.concat([basis.subarray(0, half), crypto.randomBytes(16), basis.subarray(half + 16)]), 2 * block],
+    ['reordered', Buffer.concat([basis.subarray(half), basis.subarray(0, half)]), 3 * block],
+  ];
+  for (const [name, target, maxLiteral] of patterns)
+    test(name, () => {
+      const { result, stats, delta } = roundTrip(basis, target);
+      expect(result.equals(target)).toBe(true);
+      expect(stats.literal).toBeLessThanOrEqual(maxLiteral);
+      expect(stats.copied + stats.literal).toBe(target.length);
+      expect(delta.length).toBeLessThan(maxLiteral + 4096);
+    });
+  test('unrelated data is all literal', () => {
+    const target = crypto.randomBytes(100000);
+    const { result, stats } = roundTrip(basis, target);
+    expect(result.equals(target)).toBe(true);
+    expect(stats.copied).toBe(0);
+  });
+});
+
+describe('Edge cases', () => {
+  test('no basis', () => {
+    const target = crypto.randomBytes(5000);
+    expect(roundTrip(Buffer.alloc(0), target).result.equals(target)).toBe(true);
+  });
+  test('empty target', () => expect(roundTrip(crypto.randomBytes(5000), Buffer.alloc(0)).result.length).toBe(0));
+  test('short last block is copied', () => {
+    const basis = crypto.randomBytes(10000), target = Buffer.concat([crypto.randomBytes(3), basis]);
+    const { result, stats } = roundTrip(basis, target);
+    expect(result.equals(target)).toBe(true);
+    expect(stats.literal).toBe(3);
+  });
+  test('small blocks', () => {
+    const basis = crypto.randomBytes(5000), target = Buffer.concat([basis.subarray(100, 2000), basis.subarray(3000)]);
+    expect(roundTrip(basis, target, 64).result.equals(target)).toBe(true);
+  });
+  test('a different basis is rejected', () => {
+    const basis = crypto.randomBytes(20000);
+    const delta = diff(sign(basis), basis);
+    basis[5] ^= 1;
+    expect(() => patch(basis, delta)).toThrow();
+  });
+  test('truncated delta is rejected', () => {
+    const basis = crypto.randomBytes(20000);
+    const delta = diff(sign(basis), Buffer.concat([basis, crypto.randomBytes(100)]));
+    expect(() => patch(basis, delta.subarray(0, delta.length - 1))).toThrow();
+  });
+  test('malformed signature is rejected', () => expect(() => diff(Buffer.alloc(5), Buffer.alloc(10))).toThrow());
+});
+
+describe('Same bytes as the agent (Delta.cpp)', () => {
+  const basis = lcgBytes(10000);
+  const target = Buffer.concat([basis.subarray(0, 3000), Buffer.from('inserted'), basis.subarray(3000, 7000), basis.subarray(7500)]);
+  test('signature', () => expect(md5(sign(basis))).toBe('b0bc970a7924408576f4df20c63c69c6'));
+  test('delta', () => expect(md5(diff(sign(basis), target))).toBe('e8da3cf3c947a1280ef8b222e7893875'));
+});
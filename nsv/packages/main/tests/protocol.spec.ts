@@ -1,8 +1,12 @@
 import { expect, test, describe } from 'vitest';
 import { MessageReader } from '../src/backend/protocol/MessageReader';
 import { type Message, FileMessage } from '../src/backend/protocol/Message';
-import { Action } from '../src/backend/common-types';
+import { Action, ACTION_COMPRESSED } from '../src/backend/common-types';
+import { FrameAssembler, openPacket, parseHeader, RateLimiter, sealFrame } from '../src/backend/protocol/DatagramServer';
+import { BATCH_NO_COMMAND, encodeArgs, encodeBatch, encodeBatchReply, encodeStream, parseArgs, parseBatch, parseBatchReply, parseStream, parseStreamMessage, PreparedCall, StreamKind } from '../src/backend/protocol/Batch';
 import fs from 'node:fs';
+import crypto from 'node:crypto';
+import zlib from 'node:zlib';
 
 const createMessage = (action: Action, data: Buffer) => {
   const actionByte = Buffer.from([action]); // 1-byte action
@@ -135,4 +139,130 @@ describe('Read file message and data', async () => {
   test('data matches', () => expect(exists && fs.readFileSync(testFilePath).toString('utf-8')).toBe(handshakeMessageText));
   test('action matches', () => expect(result[1].action).toEqual(Action.HANDSHAKE));
   test('content matches', () => expect(result[1].data?.toString('utf-8')).toEqual(handshakeMessageText));
-});
\ No newline at end of file
+});
+describe('Read compressed message', async () => {
+  const listing = Array.from({ length: 1000 }, (_, i) => JSON.stringify({ name: `file${i}.txt`, size: i, directory: false })).join('\n');
+  const compressed = zlib.deflateSync(Buffer.from(listing, 'utf-8'));
+  const reader = new MessageReader();
+  const result: Message[] = [];
+  await reader.read(Buffer.concat([createMessage(Action.FEEDBACK | ACTION_COMPRESSED, compressed), handshakeMessage]), msg => result.push(msg));
+  test('received 2 messages', () => expect(result.length).toBe(2));
+  test('flag stripped from action', () => expect(result[0]?.action).toBe(Action.FEEDBACK));
+  test('content inflated', () => expect(result[0]?.data?.toString('utf-8')).toEqual(listing));
+  test('next message not affected', () => expect(result[1]?.data?.toString('utf-8')).toEqual(handshakeMessageText));
+});
+
+describe('Read corrupt compressed message', async () => {
+  const errors: Error[] = [];
+  const reader = new MessageReader(error => errors.push(error));
+  const result: Message[] = [];
+  await reader.read(Buffer.concat([createMessage(Action.FEEDBACK | ACTION_COMPRESSED, Buffer.from('not deflate')), handshakeMessage]), msg => result.push(msg));
+  await reader.read(handshakeMessage, msg => result.push(msg));
+  test('reported, not thrown', () => expect(errors.length).toBe(1));
+  test('nothing read after it', () => expect(result.length).toBe(0));
+});
+
+const datagramKey = crypto.randomBytes(32);
+const datagramSession = crypto.randomBytes(8);
+const datagramFrame = crypto.randomBytes(20 * 1000);
+const assemble = (assembler: FrameAssembler, packets: Buffer[]) => {
+  const frames: Buffer[] = [];
+  for (const packet of packets) {
+    const fragment = openPacket(datagramKey, packet);
+    const frame = fragment && assembler.push(parseHeader(packet), fragment);
+    frame && frames.push(frame);
+  }
+  return frames;
+};
+
+describe('Reassemble datagram frame', () => {
+  const packets = sealFrame(datagramKey, datagramSession, 0, datagramFrame);
+  test('18 data + 3 parity fragments', () => expect(packets.length).toBe(21));
+  test('reordered', () => {
+    const frames = assemble(new FrameAssembler(), [...packets].reverse());
+    expect(frames.length).toBe(1);
+    expect(frames[0]?.equals(datagramFrame)).toBe(true);
+  });
+  test('one loss per group is recovered', () => {
+    const frames = assemble(new FrameAssembler(), packets.filter((_, i) => i !== 0 && i !== 10 && i !== 19));
+    expect(frames.length).toBe(1);
+    expect(frames[0]?.equals(datagramFrame)).toBe(true);
+  });
+  test('two losses in a group are not', () => expect(assemble(new FrameAssembler(), packets.filter((_, i) => i !== 0 && i !== 1)).length).toBe(0));
+  test('tampered packet is rejected', () => {
+    const tampered = Buffer.from(packets[0]!);
+    tampered[30] ^= 1;
+    expect(openPacket(datagramKey, tampered)).toBeUndefined();
+  });
+});
+
+describe('Datagram frames are never delivered out of order', () => {
+  const assembler = new FrameAssembler();
+  const older = sealFrame(datagramKey, datagramSession, 1, datagramFrame);
+  const newer = sealFrame(datagramKey, datagramSession, 2, datagramFrame.subarray(0, 5000));
+  const frames = assemble(assembler, [...older.slice(0, 5), ...newer, ...older.slice(5)]);
+  test('only the newer frame', () => expect(frames.length).toBe(1));
+  test('newer frame matches', () => expect(frames[0]?.equals(datagramFrame.subarray(0, 5000))).toBe(true));
+});
+
+describe('Datagram rate limit', () => {
+  test('a second\'s worth, then what the time since brings', () => {
+    const limiter = new RateLimiter(1000);
+    expect([limiter.take(600, 0), limiter.take(600, 0), limiter.take(600, 200), limiter.take(600, 300)]).toEqual([true, false, true, false]);
+  });
+  test('0 is unlimited', () => expect(new RateLimiter(0).take(1e9)).toBe(true));
+});
+describe('Batch envelope', async () => {
+  const frame = crypto.randomBytes(3000);
+  const envelope = encodeBatch([
+    { action: Action.FEEDBACK, commandId: 7, data: 'line 1\nline 2' },
+    { action: Action.FEEDBACK, commandId: 8, data: '' },
+    { action: Action.SCREENCAST, data: frame },
+    { action: Action.IDLE },
+  ]);
+  const reader = new MessageReader();
+  const result: Message[] = [];
+  await reader.read(createMessage(Action.BATCH, envelope), msg => result.push(msg));
+  const parts = parseBatch(result[0]!.data!);
+  test('read as one message', () => expect(result.length).toBe(1));
+  test('4 parts in order', () => expect(parts.map(part => part.action)).toEqual([Action.FEEDBACK, Action.FEEDBACK, Action.SCREENCAST, Action.IDLE]));
+  test('feedback keyed by command id', () => expect(parts.slice(0, 2).map(part => [part.commandId, part.data.toString('utf-8')])).toEqual([[7, 'line 1\nline 2'], [8, '']]));
+  test('binary part intact', () => expect(parts[2]?.data.equals(frame)).toBe(true));
+  test('no command id', () => expect(parts[3]?.commandId).toBe(BATCH_NO_COMMAND));
+  test('truncated envelope is rejected', () => expect(() => parseBatch(envelope.subarray(0, envelope.length - 1))).toThrow());
+});
+
+describe('Batch reply', () => {
+  const commands = [{ commandId: BATCH_NO_COMMAND, code: 'input.MouseMove(1, 2)' }, { commandId: 3, code: 'ListDirectory(\'Ж:/\')', concurrent: true }];
+  test('round trip', () => expect(parseBatchReply(encodeBatchReply(commands))).toEqual(commands));
+  test('empty reply', () => expect(parseBatchReply(Buffer.from([0]))).toEqual([]));
+  test('concurrent flag', () => expect(encodeBatchReply(commands).readUInt8(4 + 1 + 4 + 'input.MouseMove(1, 2)'.length + 4)).toBe(1));
+});
+
+describe('Prepared commands', () => {
+  const args = ['C:\\Users\\Ж\'s', 2.5, null, true, false];
+  const commands = [
+    { commandId: BATCH_NO_COMMAND, code: 'local source, destination = ...; Move({ source }, destination)', prepare: 0 },
+    { commandId: 9, code: '', invoke: 0, args },
+    { commandId: 10, code: '', invoke: 0, args: [], concurrent: true },
+  ];
+  test('round trip', () => expect(parseBatchReply(encodeBatchReply(commands))).toEqual(commands));
+  test('arguments round trip', () => expect(parseArgs(encodeArgs(args))).toEqual(args));
+  test('truncated argument is rejected', () => expect(() => parseArgs(encodeArgs(['abc']).subarray(0, 6))).toThrow());
+  test('source fallback escapes', () => expect(new PreparedCall('Rename(...)', ['a\\b\'c\n', null]).toSource()).toBe('(function(...) Rename(...) end)(\'a\\\\b\\\'c\\n\', nil)'));
+});
+
+describe('Stream chunks', () => {
+  const envelope = encodeBatch([
+    { action: Action.STREAM, commandId: 4, data: encodeStream({ kind: StreamKind.OUTPUT, data: 'Ж partial' }) },
+    { action: Action.STREAM, commandId: 4, data: encodeStream({ kind: StreamKind.EXIT, exitCode: -3 }) },
+    { action: Action.STREAM, commandId: 5, data: encodeStream({ kind: StreamKind.CANCELLED }) },
+  ]);
+  const chunks = parseBatch(envelope).map(part => parseStream(part.commandId, part.data));
+  test('output keyed by job id', () => expect([chunks[0]?.jobId, chunks[0]?.kind, chunks[0]?.data.toString('utf-8')]).toEqual([4, StreamKind.OUTPUT, 'Ж partial']));
+  test('signed exit code', () => expect([chunks[1]?.kind, chunks[1]?.exitCode]).toEqual([StreamKind.EXIT, -3]));
+  test('cancelled', () => expect([chunks[2]?.jobId, chunks[2]?.kind]).toEqual([5, StreamKind.CANCELLED]));
+  const standalone = Buffer.concat([Buffer.from([9, 0, 0, 0]), encodeStream({ kind: StreamKind.OUTPUT, data: 'line' })]);
+  test('standalone message carries the job id', () => expect(parseStreamMessage(standalone)).toMatchObject({ jobId: 9, kind: StreamKind.OUTPUT }));
+  test('empty chunk is rejected', () => expect(() => parseStream(1, Buffer.alloc(0))).toThrow());
+});
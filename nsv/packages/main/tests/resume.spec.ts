@@ -0,0 +1,131 @@
+import { expect, test, describe } from 'vitest';
+import { MessageReader } from '../src/backend/protocol/MessageReader';
+import { MIN_STRIPE_SIZE, type RangeHeader, ResumableDownload, parseAttach, planStripes } from '../src/backend/protocol/Resume';
+import { Action } from '../src/backend/common-types';
+import crypto from 'node:crypto';
+import fs from 'node:fs';
+import os from 'node:os';
+import path from 'node:path';
+
+const temporary = () => path.join(fs.mkdtempSync(path.join(os.tmpdir(), 'rut-resume-')), 'file.bin');
+/** A FILE message as net.SendFileRange sends it: the range header, then `length` bytes of `file` from `offset` */
+const rangeMessage = (file: Buffer, offset: number, length: number, modified = 1) => {
+  const body = file.subarray(offset, offset + length);
+  const header = Buffer.alloc(8 + 1 + 24);
+  header.writeBigUInt64LE(BigInt(1 + 24 + body.length), 0);
+  header.writeUInt8(Action.FILE, 8);
+  header.writeBigUInt64LE(BigInt(offset), 9);
+  header.writeBigUInt64LE(BigInt(file.length), 17);
+  header.writeBigInt64LE(BigInt(modified), 25);
+  return Buffer.concat([header, body]);
+};
+/** Receives a range the way the download command does over its single connection */
+const receive = async (download: ResumableDownload, message: Buffer, pieceSize = 10000) => {
+  const reader = new MessageReader();
+  let written: RangeHeader | undefined;
+  reader.expectFile(download.partPath(0), (_, range) => written = range, range => {
+    download.plan(range.size, range.modified, 1);
+    return download.position(0, range);
+  });
+  for (let offset = 0; offset < message.length; offset += pieceSize)
+    await reader.read(message.subarray(offset, offset + pieceSize), () => undefined);
+  await reader.cleanup();
+  return written;
+};
+
+describe('Stripes', () => {
+  test('a small file is one stripe', () => expect(planStripes(MIN_STRIPE_SIZE - 1, 8)).toEqual([{ offset: 0, length: MIN_STRIPE_SIZE - 1 }]));
+  test('an empty file too', () => expect(planStripes(0, 8)).toEqual([{ offset: 0, length: 0 }]));
+  test('stripes cover the file', () => {
+    const size = 5 * MIN_STRIPE_SIZE + 3;
+    const stripes = planStripes(size, 4);
+    expect(stripes.length).toBe(4);
+    expect(stripes.reduce((sum, stripe) => sum + stripe.length, 0)).toBe(size);
+    stripes.slice(1).forEach((stripe, i) => expect(stripe.offset).toBe(stripes[i].offset + stripes[i].length));
+  });
+  test('ATTACH', () => {
+    const body = Buffer.concat([crypto.randomBytes(32), Buffer.from([7, 0, 0, 0, 2, 0, 0, 0])]);
+    expect(parseAttach(body)).toEqual({ key: body.subarray(0, 32), transfer: 7, stripe: 2 });
+    expect(parseAttach(body.subarray(1))).toBe(undefined);
+  });
+});
+
+describe('Resume over one connection', async () => {
+  const file = crypto.randomBytes(300000);
+  const target = temporary();
+  // breaks off two thirds in: the part stays, unlike a plain FILE's
+  const first = new ResumableDownload(target, 'C:/file.bin');
+  expect(first.resumePoint()).toEqual({ offset: 0, size: 0, modified: 0 });
+  const cut = await receive(first, rangeMessage(file, 0, file.length).subarray(0, 200000));
+  const resumed = new ResumableDownload(target, 'C:/file.bin');
+  const from = resumed.resumePoint();
+  const written = await receive(resumed, rangeMessage(file, from.offset, file.length - from.offset));
+  const complete = resumed.isComplete();
+  await resumed.finish();
+
+  test('nothing reported for the cut one', () => expect(cut).toBe(undefined));
+  test('resumed where it broke off', () => expect(from).toEqual({ offset: 200000 - 8 - 1 - 24, size: file.length, modified: 1 }));
+  test('the second range is reported', () => expect(written?.offset).toBe(from.offset));
+  test('complete', () => expect(complete).toBe(true));
+  test('contents match', () => expect(fs.readFileSync(target).equals(file)).toBe(true));
+  test('no part left', () => expect(fs.readdirSync(path.dirname(target))).toEqual(['file.bin']));
+  test('another source starts over', () => expect(new ResumableDownload(target, 'C:/other.bin').resumePoint().offset).toBe(0));
+});
+
+describe('The file changed meanwhile', async () => {
+  const file = crypto.randomBytes(100000), changed = crypto.randomBytes(60000);
+  const target = temporary();
+  await receive(new ResumableDownload(target, 'a'), rangeMessage(file, 0, file.length).subarray(0, 80000));
+  // asked to go on from 80000 of version 1, the agent sends all of version 2 instead
+  const download = new ResumableDownload(target, 'a');
+  await receive(download, rangeMessage(changed, 0, changed.length, 2));
+  await download.finish();
+  test('the new version replaces the old part', () => expect(fs.readFileSync(target).equals(changed)).toBe(true));
+});
+
+describe('Striped', async () => {
+  const file = crypto.randomBytes(3 * MIN_STRIPE_SIZE + 12345);
+  const target = temporary();
+  const download = new ResumableDownload(target, 'big');
+  const stripes = download.plan(file.length, 5, 3);
+  // stripe 1 breaks off half way, the others come whole
+  const receiveStripe = async (stripe: number, message: Buffer) => {
+    const reader = new MessageReader();
+    reader.expectFile(download.partPath(stripe), undefined, range => download.position(stripe, range));
+    await reader.read(message, () => undefined);
+    await reader.cleanup();
+  };
+  await receiveStripe(0, rangeMessage(file, stripes[0].offset, stripes[0].length, 5));
+  await receiveStripe(1, rangeMessage(file, stripes[1].offset, stripes[1].length, 5).subarray(0, stripes[1].length / 2));
+  await receiveStripe(2, rangeMessage(file, stripes[2].offset, stripes[2].length, 5));
+  const again = new ResumableDownload(target, 'big');
+  const kept = again.plan(file.length, 5, 3);
+  const remaining = again.remaining();
+  for (const range of remaining)
+    await receiveStripe(range.stripe, rangeMessage(file, range.offset, range.length, 5));
+  const complete = again.isComplete();
+  await again.finish();
+
+  test('the same cut', () => expect(kept).toEqual(stripes));
+  test('only the rest of stripe 1 is asked for', () => {
+    expect(remaining.length).toBe(1);
+    expect(remaining[0].stripe).toBe(1);
+    expect(remaining[0].offset + remaining[0].length).toBe(stripes[1].offset + stripes[1].length);
+  });
+  test('complete', () => expect(complete).toBe(true));
+  test('put together', () => expect(fs.readFileSync(target).equals(file)).toBe(true));
+  test('no parts left', () => expect(fs.readdirSync(path.dirname(target))).toEqual(['file.bin']));
+});
+
+describe('An empty FILE', async () => {
+  const target = temporary();
+  const download = new ResumableDownload(target, 'missing');
+  const message = Buffer.alloc(9);
+  message.writeBigUInt64LE(1n);
+  message.writeUInt8(Action.FILE, 8);
+  const written = await receive(download, message);
+  test('no header, nothing written', () => {
+    expect(written).toBe(undefined);
+    expect(fs.existsSync(download.partPath(0))).toBe(false);
+  });
+});
@@ -0,0 +1,81 @@
+import { expect, test, describe } from 'vitest';
+import { SLICE_FLAG, SLICED_MESSAGE_FLAG, SliceSplitter } from '../src/backend/protocol/Slices';
+import { MessageReader } from '../src/backend/protocol/MessageReader';
+import { type Message, FileMessage } from '../src/backend/protocol/Message';
+import { Action } from '../src/backend/common-types';
+import fs from 'node:fs';
+
+const size = (value: bigint) => {
+  const data = Buffer.alloc(8);
+  data.writeBigUInt64LE(value);
+  return data;
+};
+const whole = (action: Action, text: string) => Buffer.concat([size(BigInt(text.length + 1)), Buffer.from([action]), Buffer.from(text)]);
+const file = Buffer.concat([Buffer.from([Action.FILE]), Buffer.from('0123456789'.repeat(10))]);
+// the file in three slices, the poll and a feedback between them
+const wire = Buffer.concat([
+  size(BigInt(file.length) | SLICED_MESSAGE_FLAG),
+  size(30n | SLICE_FLAG), file.subarray(0, 30),
+  whole(Action.IDLE, ''),
+  size(40n | SLICE_FLAG), file.subarray(30, 70),
+  whole(Action.FEEDBACK, 'done'),
+  size(BigInt(file.length - 70) | SLICE_FLAG), file.subarray(70),
+  whole(Action.FEEDBACK, 'after'),
+]);
+const split = (pieces: Buffer[]) => {
+  const splitter = new SliceSplitter();
+  const out = pieces.flatMap(piece => splitter.write(piece));
+  return {
+    sliced: Buffer.concat(out.filter(piece => !piece.interleaved).map(piece => piece.data)),
+    interleaved: Buffer.concat(out.filter(piece => piece.interleaved).map(piece => piece.data)),
+  };
+};
+
+describe('Splitting', () => {
+  test('the sliced message comes out plain, what was between its slices apart', () => {
+    const { sliced, interleaved } = split([wire]);
+    expect(sliced).toEqual(Buffer.concat([size(BigInt(file.length)), file, whole(Action.FEEDBACK, 'after')]));
+    expect(interleaved).toEqual(Buffer.concat([whole(Action.IDLE, ''), whole(Action.FEEDBACK, 'done')]));
+  });
+  test('cut anywhere', () => {
+    const expected = split([wire]);
+    for (let cut = 1; cut < wire.length; cut += 3) {
+      const { sliced, interleaved } = split([wire.subarray(0, cut), wire.subarray(cut, cut + 5), wire.subarray(cut + 5)]);
+      expect(sliced).toEqual(expected.sliced);
+      expect(interleaved).toEqual(expected.interleaved);
+    }
+  });
+  test('nothing sliced: all of it goes through', () => {
+    const plain = Buffer.concat([whole(Action.IDLE, ''), whole(Action.FEEDBACK, 'x')]);
+    expect(split([plain]).sliced).toEqual(plain);
+  });
+  test('a slice of nothing', () => {
+    let error: unknown;
+    try {
+      new SliceSplitter().write(size(4n | SLICE_FLAG));
+    }
+    catch (e) {
+      error = e;
+    }
+    expect(error instanceof Error).toBe(true);
+  });
+});
+
+describe('Read by two readers', async () => {
+  const path = 'slices-9845123.bin';
+  const reader = new MessageReader();
+  const interleavedReader = new MessageReader();
+  reader.expectFile(path);
+  const messages: Message[] = [];
+  const splitter = new SliceSplitter();
+  for (let offset = 0; offset < wire.length; offset += 7)
+    for (const piece of splitter.write(wire.subarray(offset, offset + 7)))
+      await (piece.interleaved ? interleavedReader : reader).read(piece.data, message => messages.push(message));
+  const written = fs.readFileSync(path);
+  fs.unlinkSync(path);
+  test('in the order they came', () => expect(messages.map(message => message.action)).toEqual([Action.IDLE, Action.FEEDBACK, Action.FILE, Action.FEEDBACK]));
+  test('the file is whole', () => {
+    expect(messages[2]).toBeInstanceOf(FileMessage);
+    expect(written).toEqual(file.subarray(1));
+  });
+});
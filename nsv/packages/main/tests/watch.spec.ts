@@ -0,0 +1,53 @@
+import { expect, test, describe } from 'vitest';
+import { WatchEventReader, readWatchToken } from '../src/backend/protocol/Watch';
+import { applyWatchEvents, type IFile, type IWatchEvent } from '../../../types/Common';
+
+const file = (name: string, size = 1): IWatchEvent => ({ name, path: `C:/dir/${name}`, type: 'file', size, dateModified: 1000 });
+const listing = (...names: string[]) => names.map(name => ({ name, path: `C:/dir/${name}`, type: 'file', size: 1, dateModified: new Date(1000) }) as IFile);
+
+describe('The output', () => {
+  test('the token', () => {
+    expect(readWatchToken(Buffer.from('{"event":"ready","token":42}\n{"event":"create"'))).toBe(42);
+    expect(readWatchToken(Buffer.from('{"event":"create","name":"x"}\n'))).toBe(undefined);
+    expect(readWatchToken(Buffer.from('{"event":"ready","token":'))).toBe(undefined);
+  });
+  test('lines and characters cut between pieces', () => {
+    const output = Buffer.from('{"event":"ready","token":1}\n{"event":"create","name":"файл","path":"C:/файл"}\n{"event":"delete","name":"x"}\n');
+    const reader = new WatchEventReader();
+    const cut = output.indexOf('л') + 1;
+    const events = [...reader.write(output.subarray(0, cut)), ...reader.write(output.subarray(cut, cut + 20)), ...reader.write(output.subarray(cut + 20))];
+    expect(events.map(event => event.event)).toEqual(['ready', 'create', 'delete']);
+    expect(events[1].name).toBe('файл');
+  });
+  test('a broken line is an overflow', () => expect(new WatchEventReader().write(Buffer.from('{"event":\n'))).toEqual([{ event: 'overflow' }]));
+});
+
+describe('Deltas', () => {
+  test('create, modify, delete', () => {
+    const files = applyWatchEvents(listing('a', 'b', 'c'), [
+      { event: 'create', ...file('d') },
+      { event: 'modify', ...file('a', 5) },
+      { event: 'delete', name: 'b', path: 'C:/dir/b' },
+    ]);
+    expect(files?.map(f => f.name)).toEqual(['a', 'c', 'd']);
+    expect(files?.[0].type === 'file' && files[0].size).toBe(5);
+    expect(files?.[2].dateModified).toEqual(new Date(1000));
+  });
+  test('a rename takes the old name\'s place away', () => {
+    const files = applyWatchEvents(listing('a', 'b'), [{ event: 'rename', oldName: 'a', oldPath: 'C:/dir/a', ...file('z') }]);
+    expect(files?.map(f => f.name)).toEqual(['b', 'z']);
+  });
+  test('renamed onto an entry: it\'s replaced', () => {
+    const files = applyWatchEvents(listing('a', 'b'), [{ event: 'rename', oldName: 'a', oldPath: 'C:/dir/a', ...file('b', 9) }]);
+    expect(files?.map(f => f.type === 'file' && [f.name, f.size])).toEqual([['b', 9]]);
+  });
+  test('the same name twice in one batch', () => {
+    const files = applyWatchEvents(listing('a'), [{ event: 'create', ...file('n') }, { event: 'delete', name: 'n' }, { event: 'create', ...file('n', 3) }]);
+    expect(files?.map(f => f.name)).toEqual(['a', 'n']);
+  });
+  test('nothing changes on ready', () => expect(applyWatchEvents(listing('a'), [{ event: 'ready', token: 1 }])?.length).toBe(1));
+  test('an overflow or the directory gone: list again', () => {
+    expect(applyWatchEvents(listing('a'), [{ event: 'create', ...file('b') }, { event: 'overflow' }])).toBe(undefined);
+    expect(applyWatchEvents(listing('a'), [{ event: 'gone' }])).toBe(undefined);
+  });
+});
@@ -65,4 +65,5 @@ exposeTyped<ExposedFrontend>('expose', {
 	modifyUser: handler => ipcRenderer.on('modifyUser', (_, ...args) => (handler as any)(...args)),
 	logCommand: handler => ipcRenderer.on('logCommand', (_, ...args) => (handler as any)(...args)),
 	screencast: handler => ipcRenderer.on('screencast', (_, ...args) => (handler as any)(...args)),
+	fsEvents: handler => ipcRenderer.on('fsEvents', (_, ...args) => (handler as any)(...args)),
 });
\ No newline at end of file
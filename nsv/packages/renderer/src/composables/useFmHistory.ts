@@ -1,5 +1,6 @@
 import { Commands, fileSchema, IFile } from '$types/Common';
 import { useGeneralStore } from '@/store/general';
+import { useFmWatch } from '@/composables/useFmWatch';
 import { computed, Ref, ref } from 'vue';
 import { z } from 'zod';
 
@@ -16,6 +17,7 @@ export const useFmHistory = ({ path, loading, files, selectedFiles }: FmCore) =>
 	let lastPathSet: string | undefined;
 
 	const store = useGeneralStore();
+	const watcher = useFmWatch(files, loading, () => refresh());
 
 	const checkPath = (p: string) => {
 		if (!p)
@@ -30,6 +32,7 @@ export const useFmHistory = ({ path, loading, files, selectedFiles }: FmCore) =>
 		path.value = p.replaceAll('\\', '/').replaceAll('//', '/');
 		lastPathSet = path.value;
 		selectedFiles.value = [];
+		watcher.start(target.id, path.value);
 		const json = (await window.backend.exec(`${'listdir' satisfies keyof Commands} "${path.value}"`, [target.id], true))[target.id];
 		files.value = fileSchema.or(z.literal(false)).array().parse(json.map(v => JSON.parse(v))).filter(v => !!v);
 
@@ -43,6 +46,13 @@ export const useFmHistory = ({ path, loading, files, selectedFiles }: FmCore) =>
 	const clear = () => {
 		historyPointer.value = -1;
 		history.value = [];
+		watcher.stop();
+	};
+	const refresh = async () => {
+		const target = store.targetUser;
+		if (!target || !lastPathSet)
+			return;
+		await gotoPath(target, lastPathSet);
 	};
 
 	return {
@@ -82,13 +92,10 @@ export const useFmHistory = ({ path, loading, files, selectedFiles }: FmCore) =>
 			lastPathSet = p;
 			await gotoPath(target, p);
 		},
-		refresh: async () => {
-			const target = store.targetUser;
-			if (!target || !lastPathSet)
-				return;
-			await gotoPath(target, lastPathSet);
-		},
+		refresh,
 		init: (path: string) => pushPath(path),
+		/** See useFmWatch() */
+		watch: (target: number, path: string) => watcher.start(target, path),
 		canGoBack: computed(() => historyPointer.value > 0 && history.value.length > 0),
 		canGoForward: computed(() => historyPointer.value < history.value.length - 1)
 	};
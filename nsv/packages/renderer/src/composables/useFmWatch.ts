@@ -0,0 +1,83 @@
+import { applyWatchEvents, Commands, IFile, IWatchEvent } from '$types/Common';
+import { useGeneralStore } from '@/store/general';
+import { onUnmounted, Ref, watch } from 'vue';
+
+/**
+ * Keeps the listing up to date while it's shown: the agent watches the directory and its changes are applied as they come, instead of
+ * listing it again. What comes while it's being listed waits for the listing; an overflow, or the directory gone, lists it again. The
+ * agent's watches end with its connection: once it's back the directory is listed (and so watched) again
+ */
+export const useFmWatch = (files: Ref<IFile[]>, loading: Ref<boolean>, relist: () => Promise<void>) => {
+	const store = useGeneralStore();
+	let watched: { target: number; path: string; job?: number } | undefined;
+	let held: IWatchEvent[] = [];
+	/** What was watched on a connection that dropped */
+	let lost: typeof watched;
+
+	const stop = () => {
+		if (watched?.job !== undefined)
+			window.backend.exec(`${'kill' satisfies keyof Commands} ${watched.job}`, [watched.target]);
+		watched = lost = undefined;
+		held = [];
+	};
+	const apply = (events: IWatchEvent[]) => {
+		const updated = applyWatchEvents(files.value, events);
+		if (updated) {
+			files.value = updated;
+			return;
+		}
+		// its job is over: listing again watches anew
+		if (events.some(event => event.event === 'gone'))
+			watched = undefined;
+		relist();
+	};
+
+	// sync: two batches in one tick are two deltas, neither can be skipped
+	watch(() => store.lastFsEvents, batch => {
+		if (!batch || !watched || batch.id !== watched.target || batch.path !== watched.path)
+			return;
+		if (loading.value)
+			held.push(...batch.events);
+		else
+			apply(batch.events);
+	}, { flush: 'sync' });
+	watch(loading, isLoading => {
+		if (isLoading || !held.length)
+			return;
+		const events = held;
+		held = [];
+		apply(events);
+	}, { flush: 'sync' });
+	watch(() => Object.values(store.users).filter(user => user.online).map(user => user.id), online => {
+		if (watched && !online.includes(watched.target)) {
+			// nothing to kill: the agent dropped it with the connection
+			lost = watched;
+			watched = undefined;
+			held = [];
+		}
+		else if (lost && online.includes(lost.target)) {
+			lost = undefined;
+			relist();
+		}
+	});
+	onUnmounted(stop);
+
+	return {
+		/** Watches `path` instead of what was watched (asked for before it's listed, so nothing between the two is missed) */
+		start: async (target: number, path: string) => {
+			if (watched?.target === target && watched.path === path)
+				return;
+			stop();
+			const current = watched = { target, path } as NonNullable<typeof watched>;
+			const feedback = (await window.backend.exec(`${'watch' satisfies keyof Commands} "${path}"`, [target], true))[target];
+			const job = Number(feedback?.find(line => line.startsWith('job '))?.slice('job '.length));
+			if (!Number.isInteger(job))
+				return;
+			if (watched === current)
+				current.job = job;
+			else
+				window.backend.exec(`${'kill' satisfies keyof Commands} ${job}`, [target]);
+		},
+		stop,
+	};
+};
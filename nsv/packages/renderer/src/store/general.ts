@@ -1,5 +1,5 @@
 import { defineStore } from 'pinia';
-import type { IUser, ICmdLog } from '$types/Common';
+import type { IUser, ICmdLog, IWatchEvent } from '$types/Common';
 
 export const useGeneralStore = defineStore('general', {
 	state: () => ({
@@ -7,6 +7,8 @@ export const useGeneralStore = defineStore('general', {
 		cmdLogs: [] as ICmdLog[],
 		_targetUser: null as null | IUser,
 		lastFrame: null as string | null,
+		/** The last changes a watched directory reported (a new object each time) */
+		lastFsEvents: null as { id: number; path: string; events: IWatchEvent[] } | null,
 	}),
 	getters: {
 		verifiedUsers(state) {
@@ -54,5 +56,8 @@ export const useGeneralStore = defineStore('general', {
 		acceptScreenshot(img: string) {
 			this.lastFrame = img;
 		},
+		acceptFsEvents(id: number, path: string, events: IWatchEvent[]) {
+			this.lastFsEvents = { id, path, events };
+		},
 	},
 });
\ No newline at end of file
@@ -11,6 +11,24 @@ export interface IUserMetadata {
 }
 export interface IUserHandshake extends Omit<IUserMetadata, 'startTimeMs'> {
 	timestampMs: number;
+	/** Codecs the client can compress with */
+	compression?: string[];
+	/** The client can send Action.BATCH and parse batched replies */
+	batch?: boolean;
+	/** The client can send its files in slices, with other messages between them (protocol/Slices.ts) */
+	slices?: boolean;
+}
+/** Client-side link estimate, see `TCPClient::LinkStats` */
+export interface ILinkStats {
+	rttMs: number;
+	rttVarMs: number;
+	sendBytesPerSec: number;
+	receiveBytesPerSec: number;
+	bytesSent: number;
+	bytesReceived: number;
+	messagesSent: number;
+	messagesReceived: number;
+	rttSamples: number;
 }
 export interface IUser extends Partial<IUserMetadata> {
 	[index: string]: any;
@@ -24,6 +42,7 @@ export interface IUser extends Partial<IUserMetadata> {
 	streaming: boolean;
 	verified?: boolean;
 	pendingVerification?: boolean;
+	linkStats?: ILinkStats;
 }
 export type { Log as ICmdLog } from '../packages/main/src/backend/Logger';
 
@@ -45,4 +64,48 @@ export type IFile = z.infer<typeof fileSchema>;
 export const deviceSchema = z.object({ path: z.string(), type: z.enum(['Unknown', 'Fixed', 'Removable', 'Network', 'CD-ROM', 'RAM Disk']), totalSpace: z.number(), freeSpace: z.number() });
 export type IDevice = z.infer<typeof deviceSchema>;
 export const placeSchema = z.object({ name: z.enum(['Home', 'Desktop', 'Downloads', 'Documents', 'Pictures', 'Videos']), path: z.string() });
-export type IPlace = z.infer<typeof placeSchema>;
\ No newline at end of file
+export type IPlace = z.infer<typeof placeSchema>;
+/**
+ * What `watch` reports (fs.Watch): `ready` once the agent watches, an entry that came, changed, went or was renamed (from `oldName`),
+ * in listdir's form; `overflow` if too much changed at once and `gone` if the directory itself went, both meaning it has to be listed again
+ */
+export interface IWatchEvent {
+	event: 'ready' | 'create' | 'modify' | 'delete' | 'rename' | 'overflow' | 'gone';
+	name?: string;
+	path?: string;
+	oldName?: string;
+	oldPath?: string;
+	type?: 'file' | 'dir';
+	size?: number;
+	dateModified?: number;
+	token?: number;
+}
+/** The listing after `events`: what came or changed put in (in its place, new ones at the end), what went taken out; undefined if it has to be read again */
+export const applyWatchEvents = (files: IFile[], events: IWatchEvent[]): IFile[] | undefined => {
+	const result: (IFile | undefined)[] = [...files];
+	const byName = new Map(files.map((file, i) => [file.name, i]));
+	const remove = (name?: string) => {
+		const i = name === undefined ? undefined : byName.get(name);
+		if (i !== undefined) {
+			result[i] = undefined;
+			byName.delete(name!);
+		}
+	};
+	for (const event of events) {
+		if (event.event === 'overflow' || event.event === 'gone')
+			return undefined;
+		if (event.event === 'delete' || event.event === 'rename')
+			remove(event.event === 'delete' ? event.name : event.oldName);
+		if (event.event !== 'create' && event.event !== 'modify' && event.event !== 'rename')
+			continue;
+		const parsed = fileSchema.safeParse(event);
+		if (!parsed.success)
+			continue;
+		const i = byName.get(parsed.data.name);
+		if (i !== undefined)
+			result[i] = parsed.data;
+		else
+			byName.set(parsed.data.name, result.push(parsed.data) - 1);
+	}
+	return result.filter((file): file is IFile => !!file);
+};
@@ -1,4 +1,4 @@
-import type { IUser, ICmdLog } from './Common';
+import type { IUser, ICmdLog, IWatchEvent } from './Common';
 import type { ConfigData } from '../packages/main/src/backend/Config';
 
 export type MouseButton = 'LEFT' | 'RIGHT' | 'MIDDLE';
@@ -31,6 +31,8 @@ export interface ExposedFrontend {
 	modifyUser: (handler: (id: number, data: Partial<IUser>) => void) => any;
 	logCommand: (handler: (log: ICmdLog) => void) => any;
 	screencast: (handler: (img: string) => void) => any;
+	/** Changes to a directory watched with `watch` on client `id` */
+	fsEvents: (handler: (id: number, path: string, events: IWatchEvent[]) => void) => any;
 }
 declare global {
 	interface Window {
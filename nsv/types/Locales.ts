@@ -157,6 +157,7 @@ export const en = {
     generateCertificatesError: 'Could not generate certificates',
     serverStarted: 'Server started',
     serverStartError: 'Failed to start server',
+    datagramStartError: 'Failed to open the UDP screencast port, streaming stays on TLS',
 
     failedToOpenFolder: 'Failed to open folder',
     dbCleared: 'DB cleared',
@@ -164,17 +165,39 @@ export const en = {
 
     runFileInvalidResult: 'Run from file: Invalid return type (expected array of string)',
     runFileError: 'Run from file: script error',
+    unknownTrafficClass: 'Unknown traffic class (expected control, input, screencast, bulk or link)',
+    job: 'job',
+    jobExited: 'exited with code',
+    jobCancelled: 'cancelled',
+    deltaTransfer: 'Delta transfer',
+    deltaTransferError: 'Delta transfer failed',
+    chunkedUpload: 'Chunked upload',
+    chunkedUploadError: 'Chunked upload failed',
+    archiveReceived: 'Folder received',
+    archiveError: 'Folder transfer failed',
+    downloadReceived: 'File received',
+    downloadResumed: 'Resuming download',
+    downloadStriped: 'Striped download',
+    downloadError: 'Download failed',
   },
   commands: {
-    download: 'Download remote file',
-    upload: 'Upload local file',
+    download: 'Download remote file; resumes where a broken one stopped (streams > 1: a big file comes over that many connections at once)',
+    upload: 'Upload local file (only the chunks the remote chunk store lacks are sent)',
+    syncup: 'Upload local file, sending only what the remote copy lacks (rsync-style delta)',
+    syncdown: 'Download remote file, receiving only what the local copy lacks (rsync-style delta)',
+    downloaddir: 'Download remote folder as one streamed archive ("store" as mode: no compression)',
+    uploaddir: 'Upload local folder as one streamed archive ("store" as mode: no compression)',
     frun: 'Execute Lua code from file on server (your computer)',
-    exec: 'Execute system command, as subprocess',
+    exec: 'Execute system command, as subprocess (!exec: in the background, its output streams back as it comes)',
+    kill: 'Stop a background command (!exec), search (find), watch or long copy/move/delete by the job id it printed',
     listdisks: 'List disks (Windows only)',
-    listdir: 'List directory',
+    listdir: 'List directory, optionally a page of it: offset, limit, sort by name, size, modified or type (-size for descending)',
     listplaces: 'List places (home, photos, etc.)',
     mkdir: 'Create directory',
     touch: 'Create file',
+    hash: 'Hash a file or every file of a directory tree (xxh64, blake2b or sha256): one { path, size, dateModified, hash } per file',
+    find: 'Search a directory tree by name pattern (* and ?), minimum size, modified after (ms or a date) and at most how many, in the background: matches stream back as the job\'s output',
+    watch: 'Watch a directory for changes until killed: they go to the file manager as they happen, gathered over debounceMs (200 by default)',
     delete: 'Delete file/directory, recursively',
     move: 'Move file/directory',
     copy: 'Copy file/directory',
@@ -182,6 +205,7 @@ export const en = {
     logs: 'Print logs',
     mouselock: 'Set mouse input lock',
     keyboardlock: 'Set keyboard input lock',
+    ratelimit: 'Limit client upload rate for a traffic class (control, input, screencast, bulk) or the whole link, KiB/s (0 = unlimited)',
     prompt: 'Request text input',
     alertconfirm: 'Set keyboard input lock',
     alertok: 'Set keyboard input lock',
@@ -345,6 +369,7 @@ const ru = {
     generateCertificatesError: 'Не удалось сгенерировать сертификаты',
     serverStarted: 'Сервер запущен',
     serverStartError: 'Не удалось запустить сервер',
+    datagramStartError: 'Не удалось открыть UDP-порт трансляции, трансляция идёт через TLS',
 
     failedToOpenFolder: 'Не удалось открыть папку',
     dbCleared: 'База данных очищена',
@@ -352,17 +377,39 @@ const ru = {
 
     runFileInvalidResult: 'Запуск из файла: Неправильный тип возвращаемого значения (ожидался массив строк)',
     runFileError: 'Запуск из файла: ошибка в коде',
+    unknownTrafficClass: 'Неизвестный класс трафика (ожидался control, input, screencast, bulk или link)',
+    job: 'задание',
+    jobExited: 'завершено с кодом',
+    jobCancelled: 'отменено',
+    deltaTransfer: 'Передача разницы',
+    deltaTransferError: 'Не удалось передать разницу',
+    chunkedUpload: 'Загрузка по частям',
+    chunkedUploadError: 'Не удалось загрузить по частям',
+    archiveReceived: 'Папка получена',
+    archiveError: 'Не удалось передать папку',
+    downloadReceived: 'Файл получен',
+    downloadResumed: 'Продолжение загрузки',
+    downloadStriped: 'Загрузка в несколько потоков',
+    downloadError: 'Не удалось скачать файл',
   },
   commands: {
-    download: 'Скачать файл с удаленного компьютера',
-    upload: 'Загрузить файл на удаленный компьютер',
+    download: 'Скачать файл с удаленного компьютера; прерванная загрузка продолжается с места обрыва (streams > 1: большой файл идет по стольким соединениям сразу)',
+    upload: 'Загрузить файл на удаленный компьютер (передаются только части, которых нет в его хранилище)',
+    syncup: 'Загрузить файл, передав только то, чего нет в удаленной копии (разница в стиле rsync)',
+    syncdown: 'Скачать файл, получив только то, чего нет в локальной копии (разница в стиле rsync)',
+    downloaddir: 'Скачать папку с удаленного компьютера одним потоковым архивом (режим "store": без сжатия)',
+    uploaddir: 'Загрузить папку на удаленный компьютер одним потоковым архивом (режим "store": без сжатия)',
     frun: 'Выполнить Lua-код на удаленном ПК из файла на сервере (с вашего компьютера)',
-    exec: 'Выполнить системную команду как подпроцесс',
+    exec: 'Выполнить системную команду как подпроцесс (!exec: в фоне, вывод приходит по мере появления)',
+    kill: 'Остановить фоновую команду (!exec), поиск (find), наблюдение (watch) или долгое копирование/перемещение/удаление по номеру задания, который они вывели',
     listdisks: 'Показать диски (только Windows)',
-    listdir: 'Показать содержимое каталога',
+    listdir: 'Показать содержимое каталога, по желанию страницу: смещение, число, сортировка по name, size, modified или type (-size по убыванию)',
     listplaces: 'Показать избранные места (домашняя папка, фото и т.д.)',
     mkdir: 'Создать каталог',
     touch: 'Создать файл',
+    hash: 'Хэш файла или всех файлов дерева каталогов (xxh64, blake2b или sha256): по { path, size, dateModified, hash } на файл',
+    find: 'Поиск в дереве каталогов по шаблону имени (* и ?), минимальному размеру, времени изменения (мс или дата) и наибольшему числу, в фоне: найденное приходит как вывод задания',
+    watch: 'Следить за изменениями в каталоге, пока не остановят: они приходят в файловый менеджер по мере появления, собранные за debounceMs (по умолчанию 200)',
     delete: 'Удалить файл/каталог (рекурсивно)',
     move: 'Переместить файл/каталог',
     copy: 'Копировать файл/каталог',
@@ -370,6 +417,7 @@ const ru = {
     logs: 'Вывести логи клиентов',
     mouselock: 'Заблокировать ввод мыши удаленного ПК',
     keyboardlock: 'Заблокировать ввод с клавиатуры удаленного ПК',
+    ratelimit: 'Ограничить скорость отправки клиента для класса трафика (control, input, screencast, bulk) или всего канала, КиБ/с (0 = без ограничений)',
     prompt: 'Запросить текстовый ввод',
     alertconfirm: 'Показать окно подтверждения',
     alertok: 'Показать окно уведомления',